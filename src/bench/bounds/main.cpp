@@ -0,0 +1,85 @@
+// Compares the SSE bounding box and bounding sphere kernels of utils/bounds.h with their scalar
+// versions on random positions.
+//
+// Usage: bounds_bench [num_positions] [num_iterations]
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "utils/bounds.h"
+
+namespace {
+
+// Returns the average time of |func| in milliseconds.
+template<typename Func>
+double TimeRuns(int num_iterations, Func func) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_iterations; ++i) {
+    func();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / num_iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  long num_positions = argc > 1 ? std::atol(argv[1]) : 1 << 22;
+  int num_iterations = argc > 2 ? std::atoi(argv[2]) : 20;
+  if (num_positions <= 0 || num_iterations <= 0) {
+    std::cerr << "The number of positions and iterations must be positive." << std::endl;
+    exit(1);
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(-100.f, 100.f);
+  std::vector<glm::vec3> positions(num_positions);
+  for (glm::vec3& pos : positions) {
+    pos = glm::vec3(dist(rng), dist(rng), dist(rng));
+  }
+
+  // Both versions must agree exactly, since min, max and the squared distances are computed the
+  // same way.
+  utils::Aabb aabb = utils::ComputeAabb(positions.data(), positions.size());
+  utils::Aabb scalar_aabb = utils::ComputeAabbScalar(positions.data(), positions.size());
+  glm::vec4 sphere = utils::ComputeBoundingSphere(positions.data(), positions.size(), aabb);
+  glm::vec4 scalar_sphere = 
+      utils::ComputeBoundingSphereScalar(positions.data(), positions.size(), aabb);
+  if (aabb.min != scalar_aabb.min || aabb.max != scalar_aabb.max || sphere != scalar_sphere) {
+    std::cerr << "The SSE and scalar bounds differ." << std::endl;
+    exit(1);
+  }
+
+  // Accumulates the results so that the compiler can't drop the calls.
+  float sink = 0.f;
+  double aabb_ms = TimeRuns(num_iterations, [&]() {
+    sink += utils::ComputeAabb(positions.data(), positions.size()).max.x;
+  });
+  double scalar_aabb_ms = TimeRuns(num_iterations, [&]() {
+    sink += utils::ComputeAabbScalar(positions.data(), positions.size()).max.x;
+  });
+  double sphere_ms = TimeRuns(num_iterations, [&]() {
+    sink += utils::ComputeBoundingSphere(positions.data(), positions.size(), aabb).w;
+  });
+  double scalar_sphere_ms = TimeRuns(num_iterations, [&]() {
+    sink += utils::ComputeBoundingSphereScalar(positions.data(), positions.size(), aabb).w;
+  });
+
+  double num_mverts = num_positions / 1e6;
+  std::cout << "Positions: " << num_positions << " (checksum " << sink << ")" << std::endl;
+  std::cout << "AABB scalar: " << scalar_aabb_ms << " ms (" << num_mverts / scalar_aabb_ms * 1e3 
+            << " Mvert/s)" << std::endl;
+  std::cout << "AABB SSE: " << aabb_ms << " ms (" << num_mverts / aabb_ms * 1e3 << " Mvert/s, " 
+            << scalar_aabb_ms / aabb_ms << "x)" << std::endl;
+  std::cout << "Sphere scalar: " << scalar_sphere_ms << " ms (" 
+            << num_mverts / scalar_sphere_ms * 1e3 << " Mvert/s)" << std::endl;
+  std::cout << "Sphere SSE: " << sphere_ms << " ms (" << num_mverts / sphere_ms * 1e3 
+            << " Mvert/s, " << scalar_sphere_ms / sphere_ms << "x)" << std::endl;
+
+  return 0;
+}
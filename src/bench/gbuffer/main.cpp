@@ -0,0 +1,351 @@
+// Compares the lighting pass of global_illum on the old G-buffer layout, with RGB16F position,
+// normal and albedo textures, and on the compact layout, with the position reconstructed from the
+// depth texture, an RG16_SNORM octahedral normal and an SRGB8_ALPHA8 albedo. Both layouts are
+// filled with the same synthetic surface, and lit with the same lights, at 1080p and 4K. Times are
+// measured on the GPU with timer queries.
+//
+// Usage: gbuffer_bench [num_iterations]
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/program.h"
+
+namespace {
+
+// Full-screen triangle, without any vertex buffer.
+const char kVertShaderSource[] =
+    "#version 430 core\n"
+    "out vec2 frag_texcoord;\n"
+    "void main() {\n"
+    "  frag_texcoord = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "  gl_Position = vec4(frag_texcoord * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}";
+
+// Wavy surface in front of the camera, shared by the fill shaders of both layouts.
+const char kSurfaceSource[] =
+    "uniform mat4 proj_mat;\n"
+    "uniform mat4 inv_proj_mat;\n"
+    "void GetSurface(vec2 texcoord, out vec3 pos, out vec3 normal, out vec3 albedo) {\n"
+    "  vec4 ray = inv_proj_mat * vec4(texcoord * 2.0 - 1.0, 1.0, 1.0);\n"
+    "  float z = -5.0 - 2.0 * sin(texcoord.x * 40.0) * cos(texcoord.y * 30.0);\n"
+    "  pos = ray.xyz / ray.z * z;\n"
+    "  normal = normalize(vec3(cos(texcoord.x * 40.0), sin(texcoord.y * 30.0), 2.0));\n"
+    "  albedo = vec3(fract(texcoord * 8.0), 0.5);\n"
+    "  vec4 clip_pos = proj_mat * vec4(pos, 1.0);\n"
+    "  gl_FragDepth = clip_pos.z / clip_pos.w * 0.5 + 0.5;\n"
+    "}\n";
+
+// Same lights for both layouts, so that only the G-buffer reads differ.
+const char kLightingSource[] =
+    "const int kNumLights = 16;\n"
+    "vec3 Shade(vec3 pos, vec3 normal, vec3 albedo) {\n"
+    "  vec3 color = 0.05 * albedo;\n"
+    "  for (int i = 0; i < kNumLights; ++i) {\n"
+    "    float a = float(i) * 0.3926991;\n"
+    "    vec3 light_v = vec3(4.0 * cos(a), 4.0 * sin(a), -3.0) - pos;\n"
+    "    float dist2 = dot(light_v, light_v);\n"
+    "    light_v *= inversesqrt(dist2);\n"
+    "    vec3 half_v = normalize(light_v - normalize(pos));\n"
+    "    float diffuse = max(dot(normal, light_v), 0.0);\n"
+    "    float specular = pow(max(dot(normal, half_v), 0.0), 32.0);\n"
+    "    color += (albedo * diffuse + specular) / (1.0 + dist2);\n"
+    "  }\n"
+    "  return color;\n"
+    "}\n";
+
+const char kOldFillFragShaderSource[] =
+    "in vec2 frag_texcoord;\n"
+    "layout(location = 0) out vec3 out_pos;\n"
+    "layout(location = 1) out vec3 out_normal;\n"
+    "layout(location = 2) out vec3 out_albedo;\n"
+    "void main() {\n"
+    "  GetSurface(frag_texcoord, out_pos, out_normal, out_albedo);\n"
+    "}";
+
+const char kOldLightFragShaderSource[] =
+    "in vec2 frag_texcoord;\n"
+    "out vec4 out_color;\n"
+    "uniform sampler2D pos_tex;\n"
+    "uniform sampler2D normal_tex;\n"
+    "uniform sampler2D albedo_tex;\n"
+    "void main() {\n"
+    "  vec3 pos = texture(pos_tex, frag_texcoord).xyz;\n"
+    "  vec3 normal = normalize(texture(normal_tex, frag_texcoord).xyz);\n"
+    "  vec3 albedo = texture(albedo_tex, frag_texcoord).rgb;\n"
+    "  out_color = vec4(Shade(pos, normal, albedo), 1.0);\n"
+    "}";
+
+// Must match EncodeOctahedral() in global_illum/geom_pass.frag.
+const char kCompactFillFragShaderSource[] =
+    "in vec2 frag_texcoord;\n"
+    "layout(location = 0) out vec2 out_normal;\n"
+    "layout(location = 1) out vec4 out_albedo;\n"
+    "vec2 EncodeOctahedral(vec3 n) {\n"
+    "  n /= abs(n.x) + abs(n.y) + abs(n.z);\n"
+    "  vec2 e = n.xy;\n"
+    "  if (n.z < 0.0) {\n"
+    "    e = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);\n"
+    "  }\n"
+    "  return e;\n"
+    "}\n"
+    "void main() {\n"
+    "  vec3 pos, normal, albedo;\n"
+    "  GetSurface(frag_texcoord, pos, normal, albedo);\n"
+    "  out_normal = EncodeOctahedral(normal);\n"
+    "  out_albedo = vec4(albedo, 1.0);\n"
+    "}";
+
+// Must match DecodeOctahedral() and ReconstructViewPos() in global_illum/light_pass.frag.
+const char kCompactLightFragShaderSource[] =
+    "in vec2 frag_texcoord;\n"
+    "out vec4 out_color;\n"
+    "uniform sampler2D normal_tex;\n"
+    "uniform sampler2D albedo_tex;\n"
+    "uniform sampler2D depth_tex;\n"
+    "uniform mat4 inv_proj_mat;\n"
+    "vec3 DecodeOctahedral(vec2 e) {\n"
+    "  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+    "  float t = max(-n.z, 0.0);\n"
+    "  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);\n"
+    "  return normalize(n);\n"
+    "}\n"
+    "vec3 ReconstructViewPos(vec2 texcoord, float depth) {\n"
+    "  vec4 pos = inv_proj_mat * vec4(vec3(texcoord, depth) * 2.0 - 1.0, 1.0);\n"
+    "  return pos.xyz / pos.w;\n"
+    "}\n"
+    "void main() {\n"
+    "  vec3 pos = ReconstructViewPos(frag_texcoord, texture(depth_tex, frag_texcoord).r);\n"
+    "  vec3 normal = DecodeOctahedral(texture(normal_tex, frag_texcoord).rg);\n"
+    "  vec3 albedo = texture(albedo_tex, frag_texcoord).rgb;\n"
+    "  out_color = vec4(Shade(pos, normal, albedo), 1.0);\n"
+    "}";
+
+struct Attachment {
+  GLenum internal_format;
+  GLenum format;
+  GLenum type;
+};
+
+struct GBufferLayout {
+  std::string name;
+  std::vector<Attachment> attachments;
+
+  // Names of the samplers of the color attachments in the light shader, in attachment order.
+  std::vector<std::string> sampler_names;
+
+  // Bytes per pixel that the light pass reads, including the depth if it reads it.
+  int read_bytes_per_pixel;
+  bool reads_depth;
+
+  const char* fill_frag_src;
+  const char* light_frag_src;
+};
+
+std::vector<GBufferLayout> GetLayouts() {
+  GBufferLayout old_layout;
+  old_layout.name = "old (RGB16F pos, normal, albedo)";
+  old_layout.attachments = { { GL_RGB16F, GL_RGB, GL_FLOAT }, { GL_RGB16F, GL_RGB, GL_FLOAT },
+                             { GL_RGB16F, GL_RGB, GL_FLOAT } };
+  old_layout.sampler_names = { "pos_tex", "normal_tex", "albedo_tex" };
+  old_layout.read_bytes_per_pixel = 18;
+  old_layout.reads_depth = false;
+  old_layout.fill_frag_src = kOldFillFragShaderSource;
+  old_layout.light_frag_src = kOldLightFragShaderSource;
+
+  GBufferLayout compact_layout;
+  compact_layout.name = "compact (depth, RG16_SNORM normal, SRGB8_ALPHA8 albedo)";
+  compact_layout.attachments = { { GL_RG16_SNORM, GL_RG, GL_SHORT },
+                                 { GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE } };
+  compact_layout.sampler_names = { "normal_tex", "albedo_tex" };
+  compact_layout.read_bytes_per_pixel = 12;
+  compact_layout.reads_depth = true;
+  compact_layout.fill_frag_src = kCompactFillFragShaderSource;
+  compact_layout.light_frag_src = kCompactLightFragShaderSource;
+
+  return { old_layout, compact_layout };
+}
+
+GLuint CreateTexture(GLenum internal_format, GLenum format, GLenum type, int width, int height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  return texture;
+}
+
+std::unique_ptr<utils::Program> CreateProgram(const std::string& frag_src) {
+  return utils::Program::Create({ { GL_VERTEX_SHADER, kVertShaderSource },
+                                  { GL_FRAGMENT_SHADER, "#version 430 core\n" + frag_src } });
+}
+
+// Returns the average time in milliseconds of the light pass of |layout| at |width|x|height|, or a
+// negative value on failure.
+double TimeLightPass(const GBufferLayout& layout, int width, int height, int num_iterations) {
+  glm::mat4 proj_mat = glm::perspective(glm::radians(75.f), static_cast<float>(width) / height,
+                                        0.1f, 1000.f);
+
+  std::unique_ptr<utils::Program> fill_program =
+      CreateProgram(std::string(kSurfaceSource) + layout.fill_frag_src);
+  std::unique_ptr<utils::Program> light_program =
+      CreateProgram(std::string(kLightingSource) + layout.light_frag_src);
+  if (fill_program == nullptr || light_program == nullptr) {
+    return -1.0;
+  }
+  fill_program->SetUniform(fill_program->FindUniform("proj_mat"), proj_mat);
+  fill_program->SetUniform(fill_program->FindUniform("inv_proj_mat"), glm::inverse(proj_mat));
+  light_program->SetUniform(light_program->FindUniform("inv_proj_mat"), glm::inverse(proj_mat));
+
+  GLuint gbuf_fbo;
+  glGenFramebuffers(1, &gbuf_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, gbuf_fbo);
+
+  std::vector<GLuint> gbuf_textures;
+  std::vector<GLenum> draw_buffers;
+  for (size_t i = 0; i < layout.attachments.size(); ++i) {
+    const Attachment& attachment = layout.attachments[i];
+    glActiveTexture(GL_TEXTURE0 + i);
+    gbuf_textures.push_back(CreateTexture(attachment.internal_format, attachment.format,
+                                          attachment.type, width, height));
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
+                           gbuf_textures.back(), 0);
+    draw_buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+    light_program->SetUniform(light_program->FindUniform(layout.sampler_names[i]),
+                              static_cast<int32_t>(i));
+  }
+  glDrawBuffers(draw_buffers.size(), draw_buffers.data());
+
+  const int depth_unit = static_cast<int>(layout.attachments.size());
+  glActiveTexture(GL_TEXTURE0 + depth_unit);
+  GLuint depth_tex = CreateTexture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, width,
+                                   height);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_tex, 0);
+  light_program->SetUniform(light_program->FindUniform("depth_tex"), depth_unit);
+
+  bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  // The light pass writes to an HDR target of the same size, like a lighting buffer would.
+  GLuint out_fbo;
+  glGenFramebuffers(1, &out_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+  glActiveTexture(GL_TEXTURE0 + depth_unit + 1);
+  GLuint out_tex = CreateTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT, width, height);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, out_tex, 0);
+  complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  double light_ms = -1.0;
+  if (complete) {
+    glViewport(0, 0, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuf_fbo);
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    fill_program->Use();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_FRAMEBUFFER_SRGB);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+    light_program->Use();
+
+    // Warms up the caches and the clocks before the timed passes.
+    for (int i = 0; i < 5; ++i) {
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for (int i = 0; i < num_iterations; ++i) {
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+    glDeleteQueries(1, &query);
+    light_ms = static_cast<double>(elapsed_ns) / 1e6 / num_iterations;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteTextures(1, &out_tex);
+  glDeleteFramebuffers(1, &out_fbo);
+  glDeleteTextures(1, &depth_tex);
+  glDeleteTextures(gbuf_textures.size(), gbuf_textures.data());
+  glDeleteFramebuffers(1, &gbuf_fbo);
+  return light_ms;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  int num_iterations = argc > 1 ? std::atoi(argv[1]) : 100;
+  if (num_iterations <= 0) {
+    std::cerr << "The number of iterations must be positive." << std::endl;
+    exit(1);
+  }
+
+  if (!glfwInit()) {
+    std::cerr << "Could not initialize GLFW." << std::endl;
+    exit(1);
+  }
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+  // Everything is drawn into framebuffers of their own, so the window is never shown.
+  GLFWwindow* glfw_window = glfwCreateWindow(64, 64, "gbuffer_bench", nullptr, nullptr);
+  if (glfw_window == nullptr) {
+    std::cerr << "Could not create GLFW window." << std::endl;
+    exit(1);
+  }
+  glfwMakeContextCurrent(glfw_window);
+
+  glewExperimental = true;
+  if (glewInit() != GLEW_OK) {
+    std::cerr << "Failed to initialize GLEW" << std::endl;
+    exit(1);
+  }
+
+  GLuint vao;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+
+  const int kSizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+  for (const GBufferLayout& layout : GetLayouts()) {
+    std::cout << layout.name << ", " << layout.read_bytes_per_pixel << " bytes per pixel read"
+              << (layout.reads_depth ? " (with depth)" : "") << std::endl;
+    for (const auto& size : kSizes) {
+      double light_ms = TimeLightPass(layout, size[0], size[1], num_iterations);
+      if (light_ms < 0.0) {
+        std::cerr << "Could not run the light pass of layout: " << layout.name << std::endl;
+        exit(1);
+      }
+      double num_mpix = static_cast<double>(size[0]) * size[1] / 1e6;
+      std::cout << "  " << size[0] << "x" << size[1] << ": " << light_ms << " ms per pass ("
+                << num_mpix / light_ms * 1e3 << " MPix/s)" << std::endl;
+    }
+  }
+
+  glDeleteVertexArrays(1, &vao);
+  glfwDestroyWindow(glfw_window);
+  glfwTerminate();
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+// Measures how long it takes to bake the lightmap of a model from scratch: unwrapping and packing
+// the charts, building the triangle BVH, path tracing the texels across all the worker threads,
+// and denoising them. The model is lit by the sun, the sky and a point light under the top of its
+// bounds, so that the cost is comparable between open scenes like Sponza and closed ones like the
+// Cornell box. The albedos are left at the default grey.
+//
+// Usage: lightmap_bake_bench [model_path] [material_dir] [atlas_size] [samples_per_texel]
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "utils/lightmap_baker.h"
+#include "utils/lightmap_uv.h"
+#include "utils/model.h"
+#include "utils/triangle_bvh.h"
+
+int main(int argc, char* argv[]) {
+  std::string path = argc > 1 ? argv[1] : "assets/cornell_box/cornell_box.obj";
+  std::string material_dir = argc > 2 ? argv[2] : "assets/cornell_box";
+  int atlas_size = argc > 3 ? std::atoi(argv[3]) : 512;
+  int samples_per_texel = argc > 4 ? std::atoi(argv[4]) : 128;
+  if (atlas_size <= 0 || samples_per_texel <= 0) {
+    std::cerr << "The atlas size and the number of samples must be positive." << std::endl;
+    exit(1);
+  }
+
+  std::shared_ptr<utils::Model> model = utils::Model::LoadModelFromFile(path, material_dir);
+  if (model == nullptr) {
+    std::cerr << "Could not load model: " << path << std::endl;
+    exit(1);
+  }
+
+  utils::LightmapUvOptions uv_options;
+  uv_options.atlas_size = static_cast<uint32_t>(atlas_size);
+  auto start = std::chrono::steady_clock::now();
+  utils::LightmapLayout layout = utils::UnwrapLightmap(*model, uv_options);
+  auto end = std::chrono::steady_clock::now();
+  double unwrap_ms = std::chrono::duration<double, std::milli>(end - start).count();
+  if (layout.width == 0) {
+    exit(1);
+  }
+
+  start = std::chrono::steady_clock::now();
+  utils::TriangleBvh bvh(*model);
+  end = std::chrono::steady_clock::now();
+  double build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+  // The light sits a fifth of the way down from the top of the bounds, and its intensity grows
+  // with the size of the model, so that the irradiance stays about the same.
+  const utils::Aabb& aabb = model->GetAabb();
+  const float diagonal = glm::length(aabb.GetSize());
+  utils::LightmapBakeOptions options;
+  options.sun_color = glm::vec3(3.f);
+  options.sky_color = glm::vec3(0.4f, 0.5f, 0.7f);
+  options.samples_per_texel = samples_per_texel;
+  options.point_lights.push_back({ glm::mix(aabb.GetCenter(), aabb.max, glm::vec3(0.f, 0.6f, 0.f)),
+                                   0.01f * diagonal, glm::vec3(0.5f * diagonal * diagonal) });
+
+  utils::LightmapBakeStats stats;
+  utils::BakeLightmap(*model, layout, bvh, options, &stats);
+  double mrays_per_sec = stats.num_rays / stats.trace_ms / 1e3;
+
+  std::cout << "Unwrap: " << layout.num_charts << " charts in a " << layout.width << "x" <<
+      layout.height << " atlas, " << unwrap_ms << " ms" << std::endl;
+  std::cout << "BVH: " << bvh.GetNumTriangles() << " triangles, " << build_ms << " ms" <<
+      std::endl;
+  std::cout << "Trace: " << stats.num_texels << " texels, " << stats.num_rays << " rays, " <<
+      stats.trace_ms << " ms (" << mrays_per_sec << " Mrays/s, " <<
+      mrays_per_sec / stats.num_threads << " Mrays/s per core on " << stats.num_threads <<
+      " threads)" << std::endl;
+  std::cout << "Denoise: " << stats.denoise_ms << " ms" << std::endl;
+
+  return 0;
+}
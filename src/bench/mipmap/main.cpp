@@ -0,0 +1,85 @@
+// Measures the throughput of utils::GenerateMips on one thread and across all the worker threads,
+// in millions of level 0 pixels per second.
+//
+// Usage: mipmap_bench [image_path] [num_iterations]
+//
+// Without an image path, a random 2048x2048 RGBA image is used.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils/image.h"
+#include "utils/parallel.h"
+
+namespace {
+
+std::shared_ptr<utils::Image> CreateRandomImage(uint32_t width, uint32_t height) {
+  auto img = std::make_shared<utils::Image>();
+  img->format = utils::ImageFormat::kRGBA;
+  img->width = width;
+  img->height = height;
+  img->data.resize(static_cast<size_t>(width) * height * 4);
+
+  std::mt19937 rng(1);
+  for (uint8_t& value : img->data) {
+    value = static_cast<uint8_t>(rng());
+  }
+  return img;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  int num_iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+  if (num_iterations <= 0) {
+    std::cerr << "The number of iterations must be positive." << std::endl;
+    exit(1);
+  }
+
+  std::shared_ptr<utils::Image> img;
+  if (argc > 1) {
+    img = utils::LoadImageFromFile(argv[1], false);
+    if (img == nullptr) {
+      std::cerr << "Could not load image: " << argv[1] << std::endl;
+      exit(1);
+    }
+  } else {
+    img = CreateRandomImage(2048, 2048);
+  }
+  double num_mpix = static_cast<double>(img->width) * img->height / 1e6;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_iterations; ++i) {
+    utils::GenerateMips(img.get());
+  }
+  auto end = std::chrono::steady_clock::now();
+  double single_ms = std::chrono::duration<double, std::milli>(end - start).count() / 
+                     num_iterations;
+
+  // Mips are generated per image, so the threads each take whole images, like the texture loader
+  // does.
+  size_t num_threads = utils::GetNumWorkerThreads();
+  std::vector<utils::Image> images(num_threads, *img);
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_iterations; ++i) {
+    utils::ParallelFor(images.size(), [&](size_t j) { utils::GenerateMips(&images[j]); });
+  }
+  end = std::chrono::steady_clock::now();
+  double batch_ms = std::chrono::duration<double, std::milli>(end - start).count() / 
+                    num_iterations;
+
+  std::cout << "Image: " << img->width << "x" << img->height << ", " 
+            << utils::GetNumChannels(img->format) << " channels, " << img->mips.size() + 1 
+            << " levels" << std::endl;
+  std::cout << "1 thread: " << single_ms << " ms per image (" << num_mpix / single_ms * 1e3 
+            << " MPix/s)" << std::endl;
+  std::cout << num_threads << " threads: " << batch_ms << " ms per " << num_threads 
+            << " images (" << num_mpix * num_threads / batch_ms * 1e3 << " MPix/s)" << std::endl;
+
+  return 0;
+}
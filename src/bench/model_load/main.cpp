@@ -0,0 +1,71 @@
+// Compares the startup cost of utils::Model::LoadModelFromFile on the cold path, which parses the
+// OBJ file, with the warm path, which reads the memory-mapped mesh cache.
+//
+// Usage: model_load_bench [model_path] [material_dir] [num_iterations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "utils/model.h"
+#include "utils/model_cache.h"
+
+namespace {
+
+// Returns the average load time in milliseconds, or a negative value if the model failed to load.
+double TimeLoads(const std::string& path, const std::string& material_dir, 
+                 const utils::ModelLoadOptions& options, int num_iterations) {
+  double total_ms = 0.0;
+  for (int i = 0; i < num_iterations; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<utils::Model> model = 
+        utils::Model::LoadModelFromFile(path, material_dir, options);
+    auto end = std::chrono::steady_clock::now();
+
+    if (model == nullptr) {
+      return -1.0;
+    }
+    total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+  }
+  return total_ms / num_iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::string path = argc > 1 ? argv[1] : "assets/sponza/sponza.obj";
+  std::string material_dir = argc > 2 ? argv[2] : "assets/sponza";
+  int num_iterations = argc > 3 ? std::atoi(argv[3]) : 5;
+  if (num_iterations <= 0) {
+    std::cerr << "The number of iterations must be positive." << std::endl;
+    exit(1);
+  }
+
+  utils::ModelLoadOptions cold_options;
+  cold_options.use_mesh_cache = false;
+
+  double cold_ms = TimeLoads(path, material_dir, cold_options, num_iterations);
+  if (cold_ms < 0.0) {
+    std::cerr << "Could not load model: " << path << std::endl;
+    exit(1);
+  }
+
+  // The first load with the cache enabled writes the cache, so it is excluded from the timing.
+  utils::ModelLoadOptions warm_options;
+  warm_options.use_mesh_cache = true;
+  if (utils::Model::LoadModelFromFile(path, material_dir, warm_options) == nullptr) {
+    std::cerr << "Could not write mesh cache: " << utils::GetMeshCachePath(path) << std::endl;
+    exit(1);
+  }
+
+  double warm_ms = TimeLoads(path, material_dir, warm_options, num_iterations);
+
+  std::cout << "Model: " << path << std::endl;
+  std::cout << "Cold (OBJ parse): " << cold_ms << " ms" << std::endl;
+  std::cout << "Warm (mmap cache): " << warm_ms << " ms" << std::endl;
+  std::cout << "Speedup: " << cold_ms / warm_ms << "x" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+// Measures how long it takes to rebake the irradiance probes of a model from scratch: building the
+// triangle BVH on one thread, then baking the probe grid across all the worker threads, with the
+// probe and ray counts that global_illum uses. The albedos are left at the default grey, which
+// doesn't change the cost.
+//
+// Usage: probe_bake_bench [model_path] [material_dir] [num_iterations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "utils/model.h"
+#include "utils/probe_grid.h"
+#include "utils/triangle_bvh.h"
+
+int main(int argc, char* argv[]) {
+  std::string path = argc > 1 ? argv[1] : "assets/sponza/sponza.obj";
+  std::string material_dir = argc > 2 ? argv[2] : "assets/sponza";
+  int num_iterations = argc > 3 ? std::atoi(argv[3]) : 3;
+  if (num_iterations <= 0) {
+    std::cerr << "The number of iterations must be positive." << std::endl;
+    exit(1);
+  }
+
+  std::shared_ptr<utils::Model> model = utils::Model::LoadModelFromFile(path, material_dir);
+  if (model == nullptr) {
+    std::cerr << "Could not load model: " << path << std::endl;
+    exit(1);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<utils::TriangleBvh> bvh;
+  for (int i = 0; i < num_iterations; ++i) {
+    bvh = std::make_unique<utils::TriangleBvh>(*model);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double build_ms = std::chrono::duration<double, std::milli>(end - start).count() /
+                    num_iterations;
+
+  // Same probe and ray counts as GetProbeBakeOptions() in global_illum.
+  utils::ProbeBakeOptions options;
+  options.max_probes_per_axis = 32;
+  options.rays_per_probe = 256;
+  options.num_bounces = 2;
+
+  utils::ProbeBakeStats stats;
+  double bake_ms = 0.0;
+  for (int i = 0; i < num_iterations; ++i) {
+    utils::BakeProbeGrid(*model, *bvh, options, &stats);
+    bake_ms += stats.bake_ms;
+  }
+  bake_ms /= num_iterations;
+  double mrays_per_sec = stats.num_rays / bake_ms / 1e3;
+
+  std::cout << "BVH: " << bvh->GetNumTriangles() << " triangles, " << bvh->GetNumNodes()
+            << " nodes, " << build_ms << " ms" << std::endl;
+  std::cout << "Bake: " << stats.num_probes << " probes, " << stats.num_rays << " rays, "
+            << bake_ms << " ms (" << mrays_per_sec << " Mrays/s, "
+            << mrays_per_sec / stats.num_threads << " Mrays/s per thread on "
+            << stats.num_threads << " threads)" << std::endl;
+
+  return 0;
+}
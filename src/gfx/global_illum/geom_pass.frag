@@ -1,28 +1,112 @@
 #version 430 core
 
-in vec3 frag_pos;
 in vec3 frag_normal;
 in vec2 frag_texcoord;
+in vec2 frag_lightmap_uv;
 flat in int frag_mtl_id;
 
-layout(location = 0) out vec3 out_pos;
-layout(location = 1) out vec3 out_normal;
-layout(location = 2) out vec3 out_ambient;
+// View-space normal in octahedral coordinates, and linear albedo, which the sRGB attachment
+// encodes. With the lightmap, also the irradiance of the surface.
+layout(location = 0) out vec2 out_normal;
+layout(location = 1) out vec4 out_albedo;
+layout(location = 2) out vec3 out_irradiance;
 
 struct Material {
-  vec3 Ka; // ambient color
-  vec3 Kd; // diffuse color
-  vec3 Ks; // specular color
-  float Ns; // specular exponent (i.e. shininess)
+  vec4 Ka; // ambient color
 
-  sampler2D tex_a; // ambient texture
+  vec2 tex_a_size; // size of the full ambient texture, before any resizing
+  int tex_a_array; // index in material_tex_arrays, -1 if there is no texture
+  int tex_a_layer; // layer in the texture array
+  int tex_a_stream_idx; // index in the texture streamer
 };
 
-uniform Material mtls[5];
+// Indexed by the material id of the vertices, so that draws don't have to set any material state.
+layout(std430, binding = 1) readonly buffer Materials {
+  Material mtls[];
+};
+
+// Must match kMaxTextureArrays.
+const int kMaxTextureArrays = 8;
+
+// Every material texture, packed into arrays of textures with the same format and size.
+uniform sampler2DArray material_tex_arrays[kMaxTextureArrays];
+
+// The lightmap texels hold the irradiance divided by lightmap_scale, and are decoded from sRGB by
+// the sampler.
+uniform bool use_lightmap;
+uniform sampler2D lightmap_tex;
+uniform float lightmap_scale;
+
+// Finest mip level needed of every streamed texture, written with atomicMin.
+layout(std430, binding = 0) buffer TextureFeedback {
+  uint tex_feedback[];
+};
+
+// Must match FrameUniforms in main.cpp.
+layout(std140, binding = 0) uniform FrameUniforms {
+  mat4 mv_mat;
+  mat4 mvp_mat;
+  mat4 normal_mat;
+  uint frame_index;
+  bool oct_normals;
+};
+
+// The array index comes from the material and can change within a draw. Sampler arrays can only
+// be indexed with dynamically uniform values, so every array gets its own branch, and the
+// gradients are computed beforehand in uniform control flow.
+vec4 SampleTextureArray(int array_idx, vec3 texcoord, vec2 dx, vec2 dy) {
+  switch (array_idx) {
+    case 0: return textureGrad(material_tex_arrays[0], texcoord, dx, dy);
+    case 1: return textureGrad(material_tex_arrays[1], texcoord, dx, dy);
+    case 2: return textureGrad(material_tex_arrays[2], texcoord, dx, dy);
+    case 3: return textureGrad(material_tex_arrays[3], texcoord, dx, dy);
+    case 4: return textureGrad(material_tex_arrays[4], texcoord, dx, dy);
+    case 5: return textureGrad(material_tex_arrays[5], texcoord, dx, dy);
+    case 6: return textureGrad(material_tex_arrays[6], texcoord, dx, dy);
+    case 7: return textureGrad(material_tex_arrays[7], texcoord, dx, dy);
+  }
+  return vec4(1.0);
+}
+
+// Only one pixel out of every 4x4 writes feedback in a given frame, in a pattern that cycles over
+// 16 frames, which keeps the atomics cheap. The level is relative to the full texture, which
+// the array may hold resized.
+void WriteTextureFeedback(int stream_idx, vec2 tex_size, vec2 dx, vec2 dy) {
+  float lod = log2(max(length(dx * tex_size), length(dy * tex_size)));
+  uvec2 pixel = uvec2(gl_FragCoord.xy) & 3u;
+  if (pixel.x + 4u * pixel.y == (frame_index & 15u)) {
+    atomicMin(tex_feedback[stream_idx], uint(max(lod, 0.0)));
+  }
+}
+
+vec2 EncodeOctahedral(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 e = n.xy;
+  if (n.z < 0.0) {
+    e = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return e;
+}
 
 void main() {
-  out_pos = frag_pos;
-  out_normal = frag_normal;
-  out_ambient = 
-      (vec4(mtls[frag_mtl_id].Ka, 1.0) * texture(mtls[frag_mtl_id].tex_a, frag_texcoord)).rgb;
-}
\ No newline at end of file
+  out_normal = EncodeOctahedral(normalize(frag_normal));
+
+  vec2 dx = dFdx(frag_texcoord);
+  vec2 dy = dFdy(frag_texcoord);
+
+  vec4 ambient_color = vec4(0.0);
+  if (frag_mtl_id >= 0) {
+    Material mtl = mtls[frag_mtl_id];
+    vec4 ambient_tex_color = vec4(1.0);
+    if (mtl.tex_a_array >= 0) {
+      ambient_tex_color = SampleTextureArray(mtl.tex_a_array,
+                                             vec3(frag_texcoord, float(mtl.tex_a_layer)), dx, dy);
+      WriteTextureFeedback(mtl.tex_a_stream_idx, mtl.tex_a_size, dx, dy);
+    }
+    // The texture arrays have sRGB formats, so the samples are already linear like the lighting.
+    ambient_color = mtl.Ka * ambient_tex_color;
+  }
+  out_albedo = vec4(ambient_color.rgb, 1.0);
+  out_irradiance = use_lightmap ? texture(lightmap_tex, frag_lightmap_uv).rgb * lightmap_scale :
+                                  vec3(0.0);
+}
@@ -5,20 +5,60 @@ layout(location = 1) in vec3 vert_normal;
 layout(location = 2) in vec2 vert_texcoord;
 layout(location = 3) in int vert_mtl_id;
 
-out vec3 frag_pos;
+// Index of the mesh being drawn. The attribute advances once per instance, and every draw command
+// starts at the instance of its mesh, so the value is the same for all of its vertices.
+layout(location = 4) in uint vert_mesh_idx;
+
+// Position in the lightmap atlas. Only set if the meshes were unwrapped for the lightmap.
+layout(location = 5) in vec2 vert_lightmap_uv;
+
 out vec3 frag_normal;
 out vec2 frag_texcoord;
+out vec2 frag_lightmap_uv;
 flat out int frag_mtl_id;
 
-uniform mat4 mv_mat;
-uniform mat4 mvp_mat;
-uniform mat3 normal_mat;
+// Must match FrameUniforms in main.cpp.
+layout(std140, binding = 0) uniform FrameUniforms {
+  mat4 mv_mat;
+  mat4 mvp_mat;
+  mat4 normal_mat;
+  uint frame_index;
+
+  // Packed vertex streams store the normal as two octahedral coordinates in vert_normal.xy and
+  // the position quantized to [0, 1] inside the mesh bounds. The full-float stream uses an offset
+  // of 0 and a scale of 1.
+  bool oct_normals;
+};
+
+// Must match utils::GpuMeshInfo.
+struct MeshInfo {
+  vec4 pos_offset;
+  vec4 pos_scale;
+  vec4 aabb_min;
+  vec4 aabb_max;
+  vec4 bounding_sphere;
+};
+
+layout(std430, binding = 2) readonly buffer Meshes {
+  MeshInfo meshes[];
+};
+
+vec3 DecodeOctahedral(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
 
 void main() {
-  frag_pos = (mv_mat * vec4(vert_pos, 1.0)).xyz;
-  frag_normal = normal_mat * vert_normal;
+  MeshInfo mesh = meshes[vert_mesh_idx];
+  vec3 pos = mesh.pos_offset.xyz + mesh.pos_scale.xyz * vert_pos;
+  vec3 normal = oct_normals ? DecodeOctahedral(vert_normal.xy) : vert_normal;
+
+  frag_normal = mat3(normal_mat) * normal;
   frag_texcoord = vert_texcoord;
+  frag_lightmap_uv = vert_lightmap_uv;
   frag_mtl_id = vert_mtl_id;
 
-  gl_Position = mvp_mat * vec4(vert_pos, 1.0);
+  gl_Position = mvp_mat * vec4(pos, 1.0);
 }
\ No newline at end of file
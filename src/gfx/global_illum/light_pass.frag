@@ -4,8 +4,232 @@ in vec2 frag_texcoord;
 
 out vec4 out_color;
 
-uniform sampler2D ambient_tex;
+uniform sampler2D normal_tex;
+uniform sampler2D albedo_tex;
+uniform sampler2D depth_tex;
+
+// Irradiance from the sun and the sky that the geometry pass sampled from the lightmap. Replaces
+// the probes if use_lightmap is set.
+uniform sampler2D irradiance_tex;
+uniform bool use_lightmap;
+
+// Takes the depth of a pixel back to view space, and view space back to world space, where the
+// probes are.
+uniform mat4 inv_proj_mat;
+uniform mat4 inv_view_mat;
+
+uniform float near_plane;
+uniform float far_plane;
+
+// Must match GBufferView in main.cpp.
+const int kGBufferViewLighting = 0;
+const int kGBufferViewAlbedo = 1;
+const int kGBufferViewNormal = 2;
+const int kGBufferViewPosition = 3;
+const int kGBufferViewLightCount = 4;
+uniform int gbuffer_view;
+
+// Must match the cluster constants of main.cpp.
+const uvec3 kClusterGrid = uvec3(16, 9, 24);
+const uint kMaxLightsPerCluster = 256;
+
+// Must match GpuPointLight in main.cpp. The positions are in view space.
+struct PointLight {
+  vec4 pos_radius;
+  vec4 color;
+};
+
+layout(std430, binding = 8) readonly buffer Lights {
+  PointLight lights[];
+};
+
+layout(std430, binding = 9) readonly buffer ClusterLightCounts {
+  uint cluster_light_counts[];
+};
+
+layout(std430, binding = 10) readonly buffer ClusterLightIndices {
+  uint cluster_light_indices[];
+};
+
+// Must match GpuProbe in main.cpp: the SH coefficients of the irradiance, then the distance
+// moments for +x and -x, +y and -y, and +z and -z.
+struct Probe {
+  vec4 irradiance[9];
+  vec4 distance_moments[3];
+};
+
+layout(std430, binding = 11) readonly buffer Probes {
+  Probe probes[];
+};
+
+// Probe (x, y, z) is at probe_grid_min + probe_grid_spacing * (x, y, z). The dims are 0 if there
+// are no probes.
+uniform vec3 probe_grid_min;
+uniform vec3 probe_grid_spacing;
+uniform ivec3 probe_grid_dims;
+
+// Must match utils/probe_grid.cpp.
+const float kProbeNormalBias = 0.25;
+const float kMinProbeWeight = 1e-4;
+
+const float kPi = 3.14159265;
+
+// Irradiance without probes.
+const float kAmbient = 0.05;
+const float kSpecular = 0.25;
+const float kShininess = 32.0;
+
+vec3 DecodeOctahedral(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
+vec3 ReconstructViewPos(vec2 texcoord, float depth) {
+  vec4 pos = inv_proj_mat * vec4(vec3(texcoord, depth) * 2.0 - 1.0, 1.0);
+  return pos.xyz / pos.w;
+}
+
+vec3 LinearToSrgb(vec3 color) {
+  return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055,
+             step(vec3(0.0031308), color));
+}
+
+// Same as utils::EvalShIrradiance().
+vec3 EvalShIrradiance(uint probe_idx, vec3 n) {
+  vec3 irradiance = probes[probe_idx].irradiance[0].rgb * 0.282095 +
+                    probes[probe_idx].irradiance[1].rgb * (0.488603 * n.y) +
+                    probes[probe_idx].irradiance[2].rgb * (0.488603 * n.z) +
+                    probes[probe_idx].irradiance[3].rgb * (0.488603 * n.x) +
+                    probes[probe_idx].irradiance[4].rgb * (1.092548 * n.x * n.y) +
+                    probes[probe_idx].irradiance[5].rgb * (1.092548 * n.y * n.z) +
+                    probes[probe_idx].irradiance[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0)) +
+                    probes[probe_idx].irradiance[7].rgb * (1.092548 * n.x * n.z) +
+                    probes[probe_idx].irradiance[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+  return max(irradiance, vec3(0.0));
+}
+
+vec2 GetDistanceMoments(uint probe_idx, vec3 dir) {
+  vec4 x = probes[probe_idx].distance_moments[0];
+  vec4 y = probes[probe_idx].distance_moments[1];
+  vec4 z = probes[probe_idx].distance_moments[2];
+  return dir.x * dir.x * (dir.x < 0.0 ? x.zw : x.xy) + dir.y * dir.y * (dir.y < 0.0 ? y.zw : y.xy) +
+         dir.z * dir.z * (dir.z < 0.0 ? z.zw : z.xy);
+}
+
+// Same as utils::ProbeGrid::SampleIrradiance(), with |pos| and |normal| in world space.
+vec3 SampleProbes(vec3 pos, vec3 normal) {
+  float bias = kProbeNormalBias * min(probe_grid_spacing.x, min(probe_grid_spacing.y, 
+                                                                probe_grid_spacing.z));
+  vec3 biased_pos = pos + normal * bias;
+  vec3 grid_pos = clamp((biased_pos - probe_grid_min) / probe_grid_spacing, vec3(0.0),
+                        vec3(probe_grid_dims - 1));
+  ivec3 base = min(ivec3(grid_pos), probe_grid_dims - 2);
+  vec3 alpha = grid_pos - vec3(base);
+
+  vec3 sum = vec3(0.0);
+  float weight_sum = 0.0;
+  for (int i = 0; i < 8; ++i) {
+    ivec3 offset = ivec3(i, i >> 1, i >> 2) & 1;
+    ivec3 coords = base + offset;
+    uint probe_idx = uint((coords.z * probe_grid_dims.y + coords.y) * probe_grid_dims.x + coords.x);
+
+    vec3 to_probe = probe_grid_min + probe_grid_spacing * vec3(coords) - biased_pos;
+    float distance = length(to_probe);
+    vec3 dir = distance > 0.0 ? to_probe / distance : normal;
+
+    float backface = (dot(dir, normal) + 1.0) * 0.5;
+    float weight = backface * backface + 0.2;
+
+    vec2 moments = GetDistanceMoments(probe_idx, -dir);
+    if (distance > moments.x) {
+      float variance = abs(moments.y - moments.x * moments.x);
+      float delta = distance - moments.x;
+      float visibility = variance / (variance + delta * delta);
+      weight *= visibility * visibility * visibility;
+    }
+    weight = max(weight, kMinProbeWeight);
+
+    vec3 trilinear = mix(1.0 - alpha, alpha, vec3(offset));
+    weight *= trilinear.x * trilinear.y * trilinear.z;
+
+    sum += weight * EvalShIrradiance(probe_idx, normal);
+    weight_sum += weight;
+  }
+  return weight_sum > 0.0 ? sum / weight_sum : vec3(0.0);
+}
+
+// Index of the cluster of the pixel at |texcoord|, with the view-space position |pos|. Inverts
+// GetSliceDistance() of cluster_lights.comp.
+uint GetClusterIndex(vec2 texcoord, vec3 pos) {
+  uvec2 tile = min(uvec2(texcoord * vec2(kClusterGrid.xy)), kClusterGrid.xy - 1u);
+  float slice = log(-pos.z / near_plane) / log(far_plane / near_plane) * float(kClusterGrid.z);
+  uint z = uint(clamp(slice, 0.0, float(kClusterGrid.z - 1u)));
+  return (z * kClusterGrid.y + tile.y) * kClusterGrid.x + tile.x;
+}
+
+// Blinn-Phong shading by the lights of cluster |cluster_idx|. The lights fade out smoothly to
+// nothing at their radius, so that the cut at the bounds of the clusters doesn't show.
+vec3 ShadeClusterLights(uint cluster_idx, vec3 pos, vec3 normal, vec3 albedo) {
+  vec3 view_v = normalize(-pos);
+  vec3 color = vec3(0.0);
+
+  uint count = cluster_light_counts[cluster_idx];
+  for (uint i = 0; i < count; ++i) {
+    PointLight light = lights[cluster_light_indices[cluster_idx * kMaxLightsPerCluster + i]];
+    vec3 light_v = light.pos_radius.xyz - pos;
+    float dist2 = dot(light_v, light_v);
+    float radius2 = light.pos_radius.w * light.pos_radius.w;
+    if (dist2 >= radius2) {
+      continue;
+    }
+    light_v *= inversesqrt(dist2);
+
+    float falloff = 1.0 - dist2 / radius2;
+    float n_dot_l = max(dot(normal, light_v), 0.0);
+    vec3 half_v = normalize(light_v + view_v);
+    float specular = kSpecular * pow(max(dot(normal, half_v), 0.0), kShininess);
+    color += light.color.rgb * (falloff * falloff * n_dot_l) * (albedo + specular);
+  }
+  return color;
+}
 
 void main() {
-  out_color = texture(ambient_tex, frag_texcoord);
+  vec3 albedo = texture(albedo_tex, frag_texcoord).rgb;
+  float depth = texture(depth_tex, frag_texcoord).r;
+  vec3 pos = ReconstructViewPos(frag_texcoord, depth);
+  if (gbuffer_view == kGBufferViewAlbedo) {
+    out_color = vec4(LinearToSrgb(albedo), 1.0);
+  } else if (gbuffer_view == kGBufferViewNormal) {
+    vec3 normal = DecodeOctahedral(texture(normal_tex, frag_texcoord).rg);
+    out_color = vec4(normal * 0.5 + 0.5, 1.0);
+  } else if (gbuffer_view == kGBufferViewPosition) {
+    out_color = vec4(fract(pos), 1.0);
+  } else if (depth == 1.0) {
+    // Nothing was drawn there.
+    out_color = vec4(0.0, 0.0, 0.0, 1.0);
+  } else if (gbuffer_view == kGBufferViewLightCount) {
+    // Goes from blue to red as the cluster fills up.
+    uint count = cluster_light_counts[GetClusterIndex(frag_texcoord, pos)];
+    vec3 heat = mix(vec3(0.0, 0.0, 1.0), vec3(1.0, 0.0, 0.0),
+                    float(count) / float(kMaxLightsPerCluster));
+    out_color = vec4(count == 0 ? vec3(0.0) : heat, 1.0);
+  } else {
+    vec3 normal = DecodeOctahedral(texture(normal_tex, frag_texcoord).rg);
+    vec3 color = ShadeClusterLights(GetClusterIndex(frag_texcoord, pos), pos, normal, albedo);
+
+    // A diffuse surface reflects albedo / pi of its irradiance. The lightmap also holds the direct
+    // light of the sun, which the probes only pass on through the surfaces it lights.
+    vec3 indirect = vec3(kAmbient);
+    if (use_lightmap) {
+      indirect = texture(irradiance_tex, frag_texcoord).rgb / kPi;
+    } else if (probe_grid_dims.x > 0) {
+      vec3 world_pos = (inv_view_mat * vec4(pos, 1.0)).xyz;
+      vec3 world_normal = normalize(mat3(inv_view_mat) * normal);
+      indirect = SampleProbes(world_pos, world_normal) / kPi;
+    }
+    color += indirect * albedo;
+    out_color = vec4(LinearToSrgb(color), 1.0);
+  }
 }
\ No newline at end of file
@@ -7,46 +7,262 @@
 #include <glm/glm.hpp>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <string>
 #include <utility>
-#include <unordered_map>
+#include <vector>
 #include "utils/camera.h"
 #include "utils/image.h"
+#include "utils/lightmap_baker.h"
+#include "utils/lightmap_uv.h"
+#include "utils/mesh_bvh.h"
+#include "utils/mesh_simplifier.h"
 #include "utils/model.h"
-#include "utils/shader.h"
+#include "utils/probe_grid.h"
 #include "utils/program.h"
+#include "utils/scene_buffers.h"
+#include "utils/texture_cache.h"
+#include "utils/texture_compression.h"
+#include "utils/texture_streamer.h"
+#include "utils/triangle_bvh.h"
+#include "utils/vertex_packing.h"
 
 constexpr int kWindowWidth = 1920;
 constexpr int kWindowHeight = 1080;
 const char* kWindowTitle = "Global Illum";
 
+const char* kModelPath = "assets/sponza/sponza.obj";
+const char* kMaterialDir = "assets/sponza";
+
 constexpr float kAspectRatio = static_cast<float>(kWindowWidth) / static_cast<float>(kWindowHeight);
 
+// Vertex stream that gets uploaded to the GPU. The packed formats use a single interleaved VBO for
+// the scene instead of one VBO per attribute.
+constexpr utils::VertexFormat kVertexFormat = utils::VertexFormat::kPackedQuantized;
+
+const float kFovY = glm::radians(75.f);
+constexpr float kNearPlane = 0.1f;
+constexpr float kFarPlane = 1000.f;
+
+// Meshes are drawn with the least detailed LOD whose simplification error stays below this many
+// pixels on screen.
+constexpr float kMaxLodPixelError = 1.f;
+
+// Must match the size of material_tex_arrays in geom_pass.frag.
+constexpr size_t kMaxTextureArrays = 8;
+
+// First texture unit of the material texture arrays, after the G-buffer textures.
+constexpr int kMaterialTexUnit = 10;
+
+// Uniform block binding of the per-frame uniforms of the geometry pass.
+constexpr GLuint kFrameUniformsBinding = 0;
+
+// Shader storage bindings of the geometry pass.
+constexpr GLuint kTextureFeedbackBinding = 0;
+constexpr GLuint kMaterialsBinding = 1;
+constexpr GLuint kMeshesBinding = 2;
+
+// Shader storage bindings of the culling pass, which shares kMeshesBinding.
+constexpr GLuint kCullInCommandsBinding = 3;
+constexpr GLuint kCullOutCommandsBinding = 4;
+constexpr GLuint kCullDrawCountBinding = 5;
+constexpr GLuint kCullMeshVisibilityBinding = 6;
+constexpr GLuint kCullStatsBinding = 7;
+
+// Shader storage bindings of the light clustering pass and of the light pass.
+constexpr GLuint kLightsBinding = 8;
+constexpr GLuint kClusterLightCountsBinding = 9;
+constexpr GLuint kClusterLightIndicesBinding = 10;
+constexpr GLuint kProbesBinding = 11;
+
+// Texture units of the G-buffer textures, of the depth pyramid and of the lightmap.
+constexpr int kNormalTexUnit = 1;
+constexpr int kAlbedoTexUnit = 2;
+constexpr int kDepthTexUnit = 3;
+constexpr int kDepthPyramidTexUnit = 4;
+constexpr int kIrradianceTexUnit = 5;
+constexpr int kLightmapTexUnit = 6;
+
+// What the light pass shows: the lit scene, a G-buffer channel, or the number of lights of the
+// cluster of every pixel. Must match light_pass.frag.
+enum class GBufferView { kLighting = 0, kAlbedo = 1, kNormal = 2, kPosition = 3, kLightCount = 4 };
+constexpr GBufferView kGBufferView = GBufferView::kLighting;
+
+// Lights the model with a lightmap baked from the sun and the sky of the probe grid, instead of the
+// probes. The probes only get the sun through the surfaces it lights, and blur it over the grid
+// spacing, while the lightmap holds the direct sun, with its shadows, and its bounces at every
+// texel. The geometry pass samples it into the G-buffer. The point lights are added either way.
+// Off by default: the charts are packed over the whole model, so the meshes can't be uploaded
+// while the model file is still being parsed, and a first run spends minutes on the bake. If the
+// charts don't fit in the atlas, the probes are used instead.
+constexpr bool kUseLightmap = false;
+
+// Size in texels of the lightmap atlas, and the paths traced from every texel.
+constexpr uint32_t kLightmapSize = 1024;
+constexpr int kLightmapSamplesPerTexel = 64;
+
+// Must match the work group sizes of cull.comp, depth_pyramid.comp and cluster_lights.comp.
+constexpr GLuint kCullGroupSize = 64;
+constexpr GLuint kDepthPyramidGroupSize = 8;
+constexpr GLuint kClusterGroupSize = 128;
+
+// The view frustum is split into 16x9 screen tiles and 24 depth slices, spaced logarithmically
+// between the near and the far planes. cluster_lights.comp lists the lights that touch each of
+// these clusters, and the light pass only shades a pixel with the lights of its cluster. Must
+// match cluster_lights.comp and light_pass.frag.
+constexpr GLuint kClusterGridX = 16;
+constexpr GLuint kClusterGridY = 9;
+constexpr GLuint kClusterGridZ = 24;
+constexpr GLuint kNumClusters = kClusterGridX * kClusterGridY * kClusterGridZ;
+constexpr GLuint kMaxLightsPerCluster = 256;
+
+// Point lights scattered through the model. Their radius is a fraction of the diagonal of the
+// model bounds, and they bob up and down by up to a radius.
+constexpr size_t kNumLights = 4096;
+constexpr float kLightRadiusScale = 0.04f;
+
+// The culling counts are read back at most once every this many frames, and shown in the title of
+// the window.
+constexpr int kCullStatsInterval = 30;
+
+// Textures without alpha use BC1 (0.5 bytes per pixel) and alpha-tested ones use BC7, which keeps
+// the alpha edges sharper than BC3 at the same size. Only the levels up to 64x64 are loaded at
+// startup; finer levels are streamed in as the camera gets close.
+utils::TextureStreamerOptions GetTextureStreamerOptions() {
+  utils::TextureStreamerOptions options;
+  options.load_options.rgb_format = utils::BlockFormat::kBC1;
+  options.load_options.rgba_format = utils::BlockFormat::kBC7;
+  options.resident_size = 64;
+  options.vram_budget = size_t(128) << 20;
+  options.max_size = 2048;
+  options.max_arrays = kMaxTextureArrays;
+  return options;
+}
+
+// Uniforms that change at most once per frame, laid out like the FrameUniforms block of the
+// geometry pass (std140). The normal matrix is stored as a mat4, whose columns have the same
+// stride as those of a std140 mat3.
+struct FrameUniforms {
+  glm::mat4 mv_mat;
+  glm::mat4 mvp_mat;
+  glm::mat4 normal_mat;
+  uint32_t frame_index;
+  int32_t oct_normals;
+  int32_t padding[2];
+};
+
+// Material as laid out in the Materials buffer of geom_pass.frag (std430).
+struct GpuMaterial {
+  glm::vec4 ambient_color;
+  glm::vec2 tex_a_size;
+  int32_t tex_a_array;
+  int32_t tex_a_layer;
+  int32_t tex_a_stream_idx;
+  int32_t padding[3];
+};
+static_assert(sizeof(GpuMaterial) == 48, "GpuMaterial must match the std430 layout");
+
+struct PointLight {
+  glm::vec3 pos;
+  float radius;
+  glm::vec3 color;
+  float phase;
+};
+
+// Point light as laid out in the Lights buffer of cluster_lights.comp and light_pass.frag (std430),
+// with the position in view space.
+struct GpuPointLight {
+  glm::vec4 pos_radius;
+  glm::vec4 color;
+};
+
+// Irradiance probe as laid out in the Probes buffer of light_pass.frag (std430): the SH
+// coefficients of utils::ShIrradiance, then the distance moments of utils::ProbeDistances, two
+// directions per vec4.
+struct GpuProbe {
+  glm::vec4 irradiance[utils::kNumShCoeffs];
+  glm::vec4 distance_moments[3];
+};
+
+// Culling counts of a frame, laid out like the CullStats buffer of cull.comp, followed by the
+// number of commands drawn in each phase.
+struct CullStats {
+  uint32_t frustum_culled;
+  uint32_t occlusion_culled;
+  uint32_t phase_draws[2];
+};
+
 std::unique_ptr<utils::Camera> camera;
 
-GLuint gl_geom_pass_program;
-GLuint gl_geom_pass_vao;
+std::unique_ptr<utils::Program> geom_pass_program;
+std::unique_ptr<utils::UniformBuffer<FrameUniforms>> frame_uniform_buffer;
 GLuint gl_gbuf_fbo;
-GLuint gl_gbuf_pos_tex;
 GLuint gl_gbuf_normal_tex;
-GLuint gl_gbuf_ambient_tex;
-GLuint gl_gbuf_depth_rbo;
+GLuint gl_gbuf_albedo_tex;
+GLuint gl_gbuf_irradiance_tex;
+GLuint gl_gbuf_depth_tex;
 
 std::shared_ptr<utils::Model> model;
-std::vector<GLuint> gl_pos_vbos;
-std::vector<GLuint> gl_normal_vbos;
-std::vector<GLuint> gl_texcoord_vbos;
-std::vector<GLuint> gl_mtl_id_vbos;
-
-std::unordered_map<std::string, std::shared_ptr<utils::Image>> tex_images;
-std::unordered_map<std::string, GLuint> texname_to_gl_texture;
-std::unordered_map<std::string, int> texname_to_tex_unit;
-
-GLuint gl_light_pass_program;
+std::unique_ptr<utils::SceneBuffers> scene_buffers;
+std::vector<utils::DrawElementsIndirectCommand> draw_commands;
+std::unique_ptr<utils::MeshBvh> mesh_bvh;
+
+std::unique_ptr<utils::TextureStreamer> texture_streamer;
+GLuint gl_materials_ssbo;
+
+// Albedo of every material as the geometry pass writes it, which the baked light bounces off.
+std::vector<glm::vec3> material_albedos;
+
+// The G-buffer pass is drawn in two phases that cull.comp fills: the meshes visible in the last
+// frame, and then the ones that the depth pyramid built from the first phase finds newly visible.
+std::unique_ptr<utils::Program> cull_program;
+int cull_num_commands_id;
+int cull_view_proj_mat_id;
+int cull_second_phase_id;
+std::unique_ptr<utils::Program> depth_pyramid_program;
+int depth_pyramid_copy_depth_id;
+GLuint gl_depth_pyramid_tex;
+int depth_pyramid_levels;
+GLuint gl_culled_command_buffers[2];
+GLuint gl_draw_count_buffers[2];
+GLuint gl_mesh_visibility_buffer;
+GLuint gl_cull_stats_buffer;
+
+// The counts are copied into the readback buffer, and read once |cull_stats_fence| has passed, so
+// that reading them never waits for the GPU.
+GLuint gl_cull_stats_readback_buffer;
+GLsync cull_stats_fence = nullptr;
+int frames_since_cull_stats = 0;
+size_t cull_stats_num_commands;
+CullStats cull_stats = {};
+GLFWwindow* glfw_window;
+
+std::vector<PointLight> lights;
+std::vector<GpuPointLight> gpu_lights;
+std::unique_ptr<utils::Program> cluster_lights_program;
+int cluster_lights_num_lights_id;
+GLuint gl_lights_ssbo;
+GLuint gl_cluster_light_counts_ssbo;
+GLuint gl_cluster_light_indices_ssbo;
+
+// Indirect light from the sun and the sky, baked into a grid of probes over the model, or all the
+// light from them, baked into a lightmap. |use_lightmap| starts as kUseLightmap, and is cleared if
+// the model can't be unwrapped.
+GLuint gl_probes_ssbo;
+GLuint gl_lightmap_tex;
+bool use_lightmap = kUseLightmap;
+
+std::unique_ptr<utils::Program> light_pass_program;
+int light_pass_inv_view_mat_id;
 GLuint gl_light_pass_vao;
 GLuint gl_light_pass_pos_vbo;
 GLuint gl_light_pass_texcoord_vbo;
@@ -56,7 +272,51 @@ glm::mat4 proj_mat;
 
 // Forward declarations.
 void InitGeomPass();
+void InitCullPass();
+void InitLights();
 void InitLightPass();
+void InitProbes();
+void InitLightmap(const utils::LightmapLayout& layout);
+
+// Picks the LOD of a mesh for a perspective view from |eye_pos|. |proj_scale| is the size in pixels
+// of one unit at a distance of one, i.e. viewport_height / (2 * tan(fov_y / 2)).
+size_t SelectMeshLod(size_t mesh_idx, const glm::vec3& eye_pos, float proj_scale) {
+  const glm::vec4& sphere = model->GetMeshByIndex(mesh_idx).bounding_sphere;
+  float distance = std::max(glm::length(glm::vec3(sphere) - eye_pos) - sphere.w, kNearPlane);
+  return utils::SelectLod(model->GetMeshByIndex(mesh_idx), proj_scale / distance,
+                          kMaxLodPixelError);
+}
+
+// Writes a mesh to the GL buffers of the scene as soon as the model loader hands it over, in
+// between parsing the windows of the model file.
+void UploadMesh(const utils::Mesh& mesh, int /* mesh_idx */) {
+  scene_buffers->AddMesh(mesh);
+}
+
+// Average color of a texture, in linear space. The mips of the texture are built in linear space,
+// so that is the color of its 1x1 level, which is decoded from the mapped file instead of loading
+// the whole image.
+glm::vec3 GetAverageColor(const utils::TextureFile& file) {
+  const utils::TextureLevel& level = file.GetLevel(file.GetNumLevels() - 1);
+  const utils::TextureFormat format = file.GetInfo().format;
+  std::vector<uint8_t> texel;
+  if (utils::IsBlockCompressed(format)) {
+    utils::CompressedLevel compressed;
+    compressed.width = level.width;
+    compressed.height = level.height;
+    compressed.data.assign(level.data, level.data + level.size);
+    utils::DecompressLevel(utils::ToBlockFormat(format), compressed, 3, &texel);
+  } else {
+    texel.assign(level.data, level.data + 3);
+  }
+
+  glm::vec3 color;
+  for (int c = 0; c < 3; ++c) {
+    float srgb = texel[c] / 255.f;
+    color[c] = srgb <= 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+  }
+  return color;
+}
 
 void Initialize() {
   glEnable(GL_TEXTURE_2D);
@@ -64,207 +324,312 @@ void Initialize() {
   glClearColor(0.f, 0.f, 0.f, 1.f);
 
   InitGeomPass();
+  InitCullPass();
+  InitLights();
   InitLightPass();
+  if (!use_lightmap) {
+    InitProbes();
+  }
 }
 
 void InitGeomPass() {
-  gl_geom_pass_program = glCreateProgram();
-  if (!gl_geom_pass_program) {
-    std::cerr << "Could not create gl_geom_pass_program." << std::endl;
+  geom_pass_program = utils::Program::LoadFromFiles({
+      { GL_VERTEX_SHADER, "geom_pass.vert" }, { GL_FRAGMENT_SHADER, "geom_pass.frag" } });
+  if (geom_pass_program == nullptr) {
+    std::cerr << "Could not create geom_pass_program." << std::endl;
     exit(1);
   }
-
-  GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
-  if (auto src_opt = utils::LoadShaderSource("geom_pass.vert")) {
-    if (!utils::CompileShader(vert_shader, src_opt.value())) {
-      std::cerr << "Could not compile vertex shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file." << std::endl;
-    exit(1);
-  }
-
-  GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  if (auto src_opt = utils::LoadShaderSource("geom_pass.frag")) {
-    if (!utils::CompileShader(frag_shader, src_opt.value())) {
-      std::cerr << "Could not compile fragment shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file." << std::endl;
-    exit(1);
-  }
-
-  glAttachShader(gl_geom_pass_program, vert_shader);
-  glAttachShader(gl_geom_pass_program, frag_shader);
-
-  glLinkProgram(gl_geom_pass_program);
-  if (!utils::CheckProgramLinkStatus(gl_geom_pass_program)) {
-    exit(1);
-  }
-  
-  glDeleteShader(frag_shader);
-  glDeleteShader(vert_shader);
-
-  glGenVertexArrays(1, &gl_geom_pass_vao);
+  frame_uniform_buffer = std::make_unique<utils::UniformBuffer<FrameUniforms>>();
 
   glGenFramebuffers(1, &gl_gbuf_fbo);
   glBindFramebuffer(GL_FRAMEBUFFER, gl_gbuf_fbo);
 
-  glGenTextures(1, &gl_gbuf_pos_tex);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, gl_gbuf_pos_tex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, kWindowWidth, kWindowHeight, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_gbuf_pos_tex, 0);
-
+  // The G-buffer takes 12 bytes per pixel: the view-space normal in octahedral coordinates, the
+  // albedo in sRGB, and the depth, from which the light pass reconstructs the position. The
+  // irradiance sampled from the lightmap takes 4 more (see InitLightmap()).
   glGenTextures(1, &gl_gbuf_normal_tex);
-  glActiveTexture(GL_TEXTURE1);
+  glActiveTexture(GL_TEXTURE0 + kNormalTexUnit);
   glBindTexture(GL_TEXTURE_2D, gl_gbuf_normal_tex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, kWindowWidth, kWindowHeight, 0, GL_RGB, GL_FLOAT, NULL);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16_SNORM, kWindowWidth, kWindowHeight, 0, GL_RG, GL_SHORT, 
+               NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gl_gbuf_normal_tex, 
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_gbuf_normal_tex, 
                          0);
 
-  glGenTextures(1, &gl_gbuf_ambient_tex);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, gl_gbuf_ambient_tex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, kWindowWidth, kWindowHeight, 0, GL_RGB, GL_FLOAT, NULL);
+  glGenTextures(1, &gl_gbuf_albedo_tex);
+  glActiveTexture(GL_TEXTURE0 + kAlbedoTexUnit);
+  glBindTexture(GL_TEXTURE_2D, gl_gbuf_albedo_tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, kWindowWidth, kWindowHeight, 0, GL_RGBA, 
+               GL_UNSIGNED_BYTE, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gl_gbuf_ambient_tex, 
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gl_gbuf_albedo_tex, 
                          0);
 
-  GLuint gbuf_attachments[] = { 
-    GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2
-  };
-  glDrawBuffers(3, gbuf_attachments);
+  GLuint gbuf_attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+  glDrawBuffers(2, gbuf_attachments);
 
-  glGenRenderbuffers(1, &gl_gbuf_depth_rbo);
-  glBindRenderbuffer(GL_RENDERBUFFER, gl_gbuf_depth_rbo);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, kWindowWidth, kWindowHeight);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
-                            gl_gbuf_depth_rbo);
+  // The depth buffer is a texture, so that the depth pyramid and the positions can be built from
+  // it.
+  glGenTextures(1, &gl_gbuf_depth_tex);
+  glActiveTexture(GL_TEXTURE0 + kDepthTexUnit);
+  glBindTexture(GL_TEXTURE_2D, gl_gbuf_depth_tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, kWindowWidth, kWindowHeight, 0, 
+               GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gl_gbuf_depth_tex, 0);
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
     std::cerr << "Could not create framebuffer." << std::endl;
     exit(1);
   }
 
-  glUseProgram(gl_geom_pass_program);
-  
-  proj_mat = glm::perspective(glm::radians(75.f), kAspectRatio, 0.1f, 1000.f);
+  proj_mat = glm::perspective(kFovY, kAspectRatio, kNearPlane, kFarPlane);
+
+  utils::ModelLoadOptions load_options;
+  load_options.vertex_format = kVertexFormat;
+  load_options.build_lods = true;
+  scene_buffers = std::make_unique<utils::SceneBuffers>(kVertexFormat);
 
-  model = utils::Model::LoadModelFromFile("assets/sponza/sponza.obj", "assets/sponza");
+  // The charts of the lightmap can't share vertices along their seams, so with the lightmap the
+  // meshes are uploaded with the vertices of the unwrapped ones, once the lightmap is baked.
+  model = utils::Model::LoadModelFromFile(kModelPath, kMaterialDir, load_options, 
+                                          use_lightmap ? utils::MeshLoadedCallback() : UploadMesh);
   if (model == nullptr) {
     std::cerr << "Could not load model." << std::endl;
     exit(1);
   }
-
-  for (const utils::Mesh& mesh : model->GetMeshes() ) {
-    for (const utils::Material& mtl : mesh.materials) {
-      const std::string& texname = mtl.ambient_texname;
-      // Loads the image file if it hasn't been loaded in before.
-      if (!texname.empty() && tex_images.find(texname) == tex_images.end()) {
-        std::shared_ptr<utils::Image> img =
-            utils::LoadImageFromFile("assets/sponza/" + texname, true);
-        if (img != nullptr) {
-          tex_images[texname] = std::move(img);
-        } else {
-          std::cerr << "Could not find image file: " << texname << std::endl;
-        }
+  utils::LightmapLayout lightmap_layout;
+  if (use_lightmap) {
+    utils::LightmapUvOptions uv_options;
+    uv_options.atlas_size = kLightmapSize;
+    lightmap_layout = utils::UnwrapLightmap(*model, uv_options);
+    if (lightmap_layout.width == 0) {
+      std::cerr << "Could not unwrap the lightmap, using the probes instead." << std::endl;
+      use_lightmap = false;
+      for (int i = 0; i < model->GetNumMeshes(); ++i) {
+        scene_buffers->AddMesh(model->GetMeshByIndex(i));
       }
     }
   }
-
-  for (const auto& [texname, img] : tex_images) {
-    GLuint texture;
-    int tex_unit = 10 + texname_to_tex_unit.size();
-    glGenTextures(1, &texture);
-    glActiveTexture(GL_TEXTURE0 + tex_unit);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, img->width, img->height, 0, GL_RGB, GL_UNSIGNED_BYTE, 
-                 img->data.data());
-    texname_to_gl_texture[texname] = texture;
-    texname_to_tex_unit[texname] = tex_unit;
+  if (!use_lightmap) {
+    scene_buffers->Upload();
   }
+  mesh_bvh = std::make_unique<utils::MeshBvh>(*model);
+
+  // Starts in the middle of the model.
+  camera->SetCameraPos(model->GetAabb().GetCenter());
+
+  const utils::MaterialTable& mtl_table = model->GetMaterialTable();
+
+  // Index in |texture_streamer| of every texture id of the material table, or -1 for textures
+  // that aren't used as ambient textures.
+  std::vector<int> tex_stream_indices(mtl_table.texture_names.size(), -1);
 
-  gl_pos_vbos.resize(model->GetNumMeshes());
-  glGenBuffers(gl_pos_vbos.size(), &gl_pos_vbos[0]);
-  for (size_t i = 0; i < gl_pos_vbos.size(); ++i) {
-    glBindBuffer(GL_ARRAY_BUFFER, gl_pos_vbos[i]);
-    glBufferData(GL_ARRAY_BUFFER, model->GetMeshByIndex(i).positions.size() * sizeof(glm::vec3), 
-                 glm::value_ptr(model->GetMeshByIndex(i).positions[0]), GL_STATIC_DRAW);
+  std::vector<int> tex_ids_to_load;
+  for (const utils::Material& mtl : mtl_table.materials) {
+    int tex_id = mtl.ambient_tex_id;
+    if (tex_id != -1 && 
+        std::find(tex_ids_to_load.begin(), tex_ids_to_load.end(), tex_id) == 
+        tex_ids_to_load.end()) {
+      tex_ids_to_load.push_back(tex_id);
+    }
   }
 
-  gl_normal_vbos.resize(model->GetNumMeshes());
-  glGenBuffers(gl_normal_vbos.size(), &gl_normal_vbos[0]);
-  for (size_t i = 0; i < gl_normal_vbos.size(); ++i) {
-    glBindBuffer(GL_ARRAY_BUFFER, gl_normal_vbos[i]);
-    glBufferData(GL_ARRAY_BUFFER, model->GetMeshByIndex(i).normals.size() * sizeof(glm::vec3), 
-                 glm::value_ptr(model->GetMeshByIndex(i).normals[0]), GL_STATIC_DRAW);
+  std::vector<std::string> tex_paths;
+  for (int tex_id : tex_ids_to_load) {
+    tex_stream_indices[tex_id] = static_cast<int>(tex_paths.size());
+    tex_paths.push_back(std::string(kMaterialDir) + "/" + mtl_table.texture_names[tex_id]);
   }
 
-  gl_texcoord_vbos.resize(model->GetNumMeshes());
-  glGenBuffers(gl_texcoord_vbos.size(), &gl_texcoord_vbos[0]);
-  for (size_t i = 0; i < gl_texcoord_vbos.size(); ++i) {
-    glBindBuffer(GL_ARRAY_BUFFER, gl_texcoord_vbos[i]);
-    glBufferData(GL_ARRAY_BUFFER, model->GetMeshByIndex(i).texcoords.size() * sizeof(glm::vec2), 
-                 glm::value_ptr(model->GetMeshByIndex(i).texcoords[0]), GL_STATIC_DRAW);
+  // The textures are block-compressed once and cached next to the images. Later runs map the
+  // cached files and upload the levels straight from the mapping.
+  texture_streamer = std::make_unique<utils::TextureStreamer>(tex_paths, 
+                                                              GetTextureStreamerOptions());
+  for (size_t i = 0; i < tex_paths.size(); ++i) {
+    if (!texture_streamer->IsLoaded(i)) {
+      std::cerr << "Could not load texture: " << tex_paths[i] << std::endl;
+    }
   }
 
-  gl_mtl_id_vbos.resize(model->GetNumMeshes());
-  glGenBuffers(gl_mtl_id_vbos.size(), &gl_mtl_id_vbos[0]);
-  for (size_t i = 0; i < gl_mtl_id_vbos.size(); ++i) {
-    glBindBuffer(GL_ARRAY_BUFFER, gl_mtl_id_vbos[i]);
-    glBufferData(GL_ARRAY_BUFFER, model->GetMeshByIndex(i).material_ids.size() * sizeof(int),
-                 &model->GetMeshByIndex(i).material_ids[0], GL_STATIC_DRAW);
+  // Every material goes into one buffer that the fragment shader indexes with the material id of
+  // the vertices, and every texture into one of the texture arrays.
+  std::vector<GpuMaterial> gpu_mtls;
+  for (const utils::Material& mtl : mtl_table.materials) {
+    GpuMaterial gpu_mtl = {};
+    gpu_mtl.ambient_color = glm::vec4(mtl.ambient_color, 1.f);
+    gpu_mtl.tex_a_array = -1;
+    glm::vec3 tex_color = glm::vec3(1.f);
+    int stream_idx = mtl.ambient_tex_id != -1 ? tex_stream_indices[mtl.ambient_tex_id] : -1;
+    if (stream_idx != -1 && texture_streamer->IsLoaded(stream_idx)) {
+      gpu_mtl.tex_a_size = glm::vec2(texture_streamer->GetWidth(stream_idx),
+                                     texture_streamer->GetHeight(stream_idx));
+      gpu_mtl.tex_a_array = static_cast<int32_t>(texture_streamer->GetArrayIndex(stream_idx));
+      gpu_mtl.tex_a_layer = static_cast<int32_t>(texture_streamer->GetLayer(stream_idx));
+      gpu_mtl.tex_a_stream_idx = stream_idx;
+      tex_color = GetAverageColor(texture_streamer->GetFile(stream_idx));
+    }
+    gpu_mtls.push_back(gpu_mtl);
+    material_albedos.push_back(mtl.ambient_color * tex_color);
+  }
+  glGenBuffers(1, &gl_materials_ssbo);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_materials_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, gpu_mtls.size()) * sizeof(GpuMaterial),
+               gpu_mtls.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  int32_t tex_units[kMaxTextureArrays];
+  for (size_t i = 0; i < kMaxTextureArrays; ++i) {
+    tex_units[i] = kMaterialTexUnit + static_cast<int32_t>(i);
+  }
+  geom_pass_program->SetUniformArray(geom_pass_program->FindUniform("material_tex_arrays"),
+                                     tex_units, kMaxTextureArrays);
+  geom_pass_program->SetUniform(geom_pass_program->FindUniform("lightmap_tex"), kLightmapTexUnit);
+  geom_pass_program->SetUniform(geom_pass_program->FindUniform("use_lightmap"), 
+                                static_cast<int32_t>(use_lightmap));
+  geom_pass_program->SetUniform(geom_pass_program->FindUniform("lightmap_scale"), 
+                                utils::kLightmapMaxIrradiance);
+
+  // The lightmap bounces the light off the albedos above. It is baked over the vertices that the
+  // model was loaded with, so only then are the meshes moved onto the vertices of the charts, in
+  // place, since the model isn't needed as it was loaded anymore.
+  if (use_lightmap) {
+    InitLightmap(lightmap_layout);
+    for (int i = 0; i < model->GetNumMeshes(); ++i) {
+      utils::Mesh* mesh = model->GetMutableMeshByIndex(i);
+      utils::ApplyLightmapUvs(lightmap_layout.meshes[i], mesh);
+      scene_buffers->AddMesh(*mesh);
+    }
+    scene_buffers->Upload();
   }
 }
 
-void InitLightPass() {
-  gl_light_pass_program = glCreateProgram();
-  if (!gl_light_pass_program) {
-    std::cerr << "Could not create gl_light_pass_program." << std::endl;
+void InitCullPass() {
+  cull_program = utils::Program::LoadFromFiles({ { GL_COMPUTE_SHADER, "cull.comp" } });
+  if (cull_program == nullptr) {
+    std::cerr << "Could not create cull_program." << std::endl;
     exit(1);
   }
-
-  GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
-  if (auto src_opt = utils::LoadShaderSource("light_pass.vert")) {
-    if (!utils::CompileShader(vert_shader, src_opt.value())) {
-      std::cerr << "Could not compile vertex shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file." << std::endl;
+  cull_num_commands_id = cull_program->FindUniform("num_commands");
+  cull_view_proj_mat_id = cull_program->FindUniform("view_proj_mat");
+  cull_second_phase_id = cull_program->FindUniform("second_phase");
+  depth_pyramid_program = 
+      utils::Program::LoadFromFiles({ { GL_COMPUTE_SHADER, "depth_pyramid.comp" } });
+  if (depth_pyramid_program == nullptr) {
+    std::cerr << "Could not create depth_pyramid_program." << std::endl;
     exit(1);
   }
+  depth_pyramid_copy_depth_id = depth_pyramid_program->FindUniform("copy_depth");
 
-  GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  if (auto src_opt = utils::LoadShaderSource("light_pass.frag")) {
-    if (!utils::CompileShader(frag_shader, src_opt.value())) {
-      std::cerr << "Could not compile fragment shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file." << std::endl;
-    exit(1);
+  // Level 0 has the size of the depth buffer, and every level halves it, rounded down.
+  depth_pyramid_levels = 1;
+  while ((std::max(kWindowWidth, kWindowHeight) >> depth_pyramid_levels) > 0) {
+    ++depth_pyramid_levels;
+  }
+  glGenTextures(1, &gl_depth_pyramid_tex);
+  glActiveTexture(GL_TEXTURE0 + kDepthPyramidTexUnit);
+  glBindTexture(GL_TEXTURE_2D, gl_depth_pyramid_tex);
+  glTexStorage2D(GL_TEXTURE_2D, depth_pyramid_levels, GL_R32F, kWindowWidth, kWindowHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  // Room for a command per mesh in each phase, which is the most that can pass.
+  const size_t num_meshes = std::max<size_t>(1, scene_buffers->GetNumMeshes());
+  glGenBuffers(2, gl_culled_command_buffers);
+  glGenBuffers(2, gl_draw_count_buffers);
+  for (int phase = 0; phase < 2; ++phase) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_culled_command_buffers[phase]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, num_meshes * sizeof(utils::DrawElementsIndirectCommand),
+                 nullptr, GL_DYNAMIC_COPY);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_draw_count_buffers[phase]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
   }
 
-  glAttachShader(gl_light_pass_program, vert_shader);
-  glAttachShader(gl_light_pass_program, frag_shader);
+  // No mesh is visible before the first frame, so its first phase draws nothing, and its second
+  // phase tests every mesh against an empty depth buffer.
+  std::vector<uint32_t> mesh_visibility(num_meshes, 0);
+  glGenBuffers(1, &gl_mesh_visibility_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_mesh_visibility_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, mesh_visibility.size() * sizeof(uint32_t), 
+               mesh_visibility.data(), GL_DYNAMIC_COPY);
+
+  glGenBuffers(1, &gl_cull_stats_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_cull_stats_buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+
+  glGenBuffers(1, &gl_cull_stats_readback_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, gl_cull_stats_readback_buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, sizeof(CullStats), nullptr, GL_STREAM_READ);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  cull_program->SetUniform(cull_program->FindUniform("depth_pyramid_tex"), kDepthPyramidTexUnit);
+  depth_pyramid_program->SetUniform(depth_pyramid_program->FindUniform("depth_tex"), 
+                                    kDepthTexUnit);
+}
 
-  glLinkProgram(gl_light_pass_program);
-  if (!utils::CheckProgramLinkStatus(gl_light_pass_program)) {
+void InitLights() {
+  cluster_lights_program = 
+      utils::Program::LoadFromFiles({ { GL_COMPUTE_SHADER, "cluster_lights.comp" } });
+  if (cluster_lights_program == nullptr) {
+    std::cerr << "Could not create cluster_lights_program." << std::endl;
     exit(1);
   }
-  
-  glDeleteShader(frag_shader);
-  glDeleteShader(vert_shader);
+  cluster_lights_num_lights_id = cluster_lights_program->FindUniform("num_lights");
+
+  // The lights are placed at random, but the same way on every run.
+  const utils::Aabb& aabb = model->GetAabb();
+  const float radius = kLightRadiusScale * glm::length(aabb.GetSize());
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> unit_dist(0.f, 1.f);
+  for (size_t i = 0; i < kNumLights; ++i) {
+    PointLight light;
+    light.pos = aabb.min + 
+        aabb.GetSize() * glm::vec3(unit_dist(rng), unit_dist(rng), unit_dist(rng));
+    light.radius = radius;
+    light.color = glm::vec3(unit_dist(rng), unit_dist(rng), unit_dist(rng));
+    light.color /= std::max(light.color.r, std::max(light.color.g, light.color.b));
+    light.phase = glm::radians(360.f) * unit_dist(rng);
+    lights.push_back(light);
+  }
+  gpu_lights.resize(lights.size());
+
+  glGenBuffers(1, &gl_lights_ssbo);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_lights_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, lights.size()) * sizeof(GpuPointLight),
+               nullptr, GL_STREAM_DRAW);
+
+  glGenBuffers(1, &gl_cluster_light_counts_ssbo);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_cluster_light_counts_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, kNumClusters * sizeof(uint32_t), nullptr, 
+               GL_DYNAMIC_COPY);
+
+  // Every cluster has room for kMaxLightsPerCluster indices, so that the clusters can be filled
+  // independently, without a shared counter.
+  glGenBuffers(1, &gl_cluster_light_indices_ssbo);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_cluster_light_indices_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, 
+               size_t(kNumClusters) * kMaxLightsPerCluster * sizeof(uint32_t), nullptr, 
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  cluster_lights_program->SetUniform(cluster_lights_program->FindUniform("inv_proj_mat"), 
+                                     glm::inverse(proj_mat));
+  cluster_lights_program->SetUniform(cluster_lights_program->FindUniform("near_plane"), 
+                                     kNearPlane);
+  cluster_lights_program->SetUniform(cluster_lights_program->FindUniform("far_plane"), kFarPlane);
+}
+
+void InitLightPass() {
+  light_pass_program = utils::Program::LoadFromFiles({
+      { GL_VERTEX_SHADER, "light_pass.vert" }, { GL_FRAGMENT_SHADER, "light_pass.frag" } });
+  if (light_pass_program == nullptr) {
+    std::cerr << "Could not create light_pass_program." << std::endl;
+    exit(1);
+  }
+  light_pass_inv_view_mat_id = light_pass_program->FindUniform("inv_view_mat");
 
   glCreateVertexArrays(1, &gl_light_pass_vao);
 
@@ -282,72 +647,358 @@ void InitLightPass() {
   glBufferData(GL_ARRAY_BUFFER, sizeof(texcoord_verts), glm::value_ptr(texcoord_verts[0]), 
                GL_STATIC_DRAW);
 
-  glUseProgram(gl_light_pass_program);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("normal_tex"), kNormalTexUnit);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("albedo_tex"), kAlbedoTexUnit);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("depth_tex"), kDepthTexUnit);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("inv_proj_mat"), 
+                                 glm::inverse(proj_mat));
+  light_pass_program->SetUniform(light_pass_program->FindUniform("near_plane"), kNearPlane);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("far_plane"), kFarPlane);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("gbuffer_view"), 
+                                 static_cast<int32_t>(kGBufferView));
+  light_pass_program->SetUniform(light_pass_program->FindUniform("irradiance_tex"), 
+                                 kIrradianceTexUnit);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("use_lightmap"), 
+                                 static_cast<int32_t>(use_lightmap));
+}
 
-  GLint ambient_tex_loc = glGetUniformLocation(gl_light_pass_program, "ambient_tex");
-  glUniform1i(ambient_tex_loc, 2);
+// The sun and the sky that the probes are baked with. The sun comes in steeply, through the open
+// roof of the atrium. The albedos are part of the key of the probe file, so that editing the
+// materials rebakes the probes.
+utils::ProbeBakeOptions GetProbeBakeOptions() {
+  utils::ProbeBakeOptions options;
+  options.max_probes_per_axis = 32;
+  options.rays_per_probe = 256;
+  options.num_bounces = 2;
+  options.sun_dir = glm::vec3(0.2f, 1.f, 0.3f);
+  options.sun_color = glm::vec3(4.f, 3.8f, 3.4f);
+  options.sky_color = glm::vec3(0.4f, 0.5f, 0.7f);
+  options.material_albedos = material_albedos;
+  return options;
 }
 
-void RenderPass() {
+// Loads the probe grid of the model, or bakes it and saves it next to the model if the file is
+// missing or stale, and uploads it for the light pass.
+void InitProbes() {
+  utils::ProbeBakeOptions options = GetProbeBakeOptions();
+  utils::ProbeGrid probe_grid;
+  if (!utils::ReadProbeGrid(kModelPath, options, &probe_grid)) {
+    utils::TriangleBvh bvh(*model);
+    utils::ProbeBakeStats stats;
+    probe_grid = utils::BakeProbeGrid(*model, bvh, options, &stats);
+    std::cout << "Baked " << stats.num_probes << " probes in " << stats.bake_ms << " ms ("
+              << stats.num_rays / stats.bake_ms / 1e3 << " Mrays/s on " << stats.num_threads
+              << " threads)" << std::endl;
+    if (!utils::WriteProbeGrid(kModelPath, options, probe_grid)) {
+      std::cerr << "Could not write probe grid: " << utils::GetProbeGridPath(kModelPath) 
+                << std::endl;
+    }
+  }
+
+  std::vector<GpuProbe> gpu_probes(probe_grid.GetNumProbes());
+  for (size_t i = 0; i < gpu_probes.size(); ++i) {
+    for (int j = 0; j < utils::kNumShCoeffs; ++j) {
+      gpu_probes[i].irradiance[j] = glm::vec4(probe_grid.irradiance[i].coeffs[j], 0.f);
+    }
+    const glm::vec2* moments = probe_grid.distances[i].moments;
+    for (int axis = 0; axis < 3; ++axis) {
+      gpu_probes[i].distance_moments[axis] = 
+          glm::vec4(moments[2 * axis].x, moments[2 * axis].y, 
+                    moments[2 * axis + 1].x, moments[2 * axis + 1].y);
+    }
+  }
+  glGenBuffers(1, &gl_probes_ssbo);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_probes_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, gpu_probes.size()) * sizeof(GpuProbe),
+               gpu_probes.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  // An empty grid has dims of 0, and the light pass falls back to a constant ambient term.
+  light_pass_program->SetUniform(light_pass_program->FindUniform("probe_grid_min"), 
+                                 probe_grid.bounds.min);
+  light_pass_program->SetUniform(light_pass_program->FindUniform("probe_grid_spacing"), 
+                                 probe_grid.GetNumProbes() > 0 ? probe_grid.GetSpacing() :
+                                                                 glm::vec3(1.f));
+  light_pass_program->SetUniform(light_pass_program->FindUniform("probe_grid_dims"), 
+                                 probe_grid.dims);
+}
+
+// The lightmap is lit by the same sun and sky as the probes, and bounces the light as many times.
+utils::LightmapBakeOptions GetLightmapBakeOptions() {
+  const utils::ProbeBakeOptions probe_options = GetProbeBakeOptions();
+  utils::LightmapBakeOptions options;
+  options.sun_dir = probe_options.sun_dir;
+  options.sun_color = probe_options.sun_color;
+  options.sky_color = probe_options.sky_color;
+  options.samples_per_texel = kLightmapSamplesPerTexel;
+  options.max_bounces = probe_options.num_bounces;
+  options.material_albedos = material_albedos;
+  return options;
+}
+
+// Loads the lightmap of the model, or bakes it and saves it next to the model if the file is
+// missing or stale, and uploads it for the geometry pass, which samples it into an extra
+// attachment of the G-buffer.
+void InitLightmap(const utils::LightmapLayout& layout) {
+  const utils::LightmapBakeOptions options = GetLightmapBakeOptions();
+  std::unique_ptr<utils::TextureFile> lightmap_file = 
+      utils::ReadLightmap(kModelPath, layout, options);
+  if (lightmap_file == nullptr) {
+    utils::TriangleBvh bvh(*model);
+    utils::LightmapBakeStats stats;
+    utils::Lightmap lightmap = utils::BakeLightmap(*model, layout, bvh, options, &stats);
+    double mrays_per_sec = stats.num_rays / stats.trace_ms / 1e3;
+    std::cout << "Baked " << stats.num_texels << " lightmap texels in " << stats.trace_ms
+              << " ms (" << mrays_per_sec / stats.num_threads << " Mrays/s per core on "
+              << stats.num_threads << " threads), denoised in " << stats.denoise_ms << " ms"
+              << std::endl;
+    lightmap_file = utils::WriteLightmap(kModelPath, layout, options, lightmap);
+  }
+
+  // The texels are sRGB-encoded, so they are decoded before they are filtered. The rows are
+  // tightly packed.
+  const utils::TextureLevel& level = lightmap_file->GetLevel(0);
+  glGenTextures(1, &gl_lightmap_tex);
+  glActiveTexture(GL_TEXTURE0 + kLightmapTexUnit);
+  glBindTexture(GL_TEXTURE_2D, gl_lightmap_tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, level.width, level.height, 0, GL_RGB,
+               GL_UNSIGNED_BYTE, level.data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenTextures(1, &gl_gbuf_irradiance_tex);
+  glActiveTexture(GL_TEXTURE0 + kIrradianceTexUnit);
+  glBindTexture(GL_TEXTURE_2D, gl_gbuf_irradiance_tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, kWindowWidth, kWindowHeight, 0, GL_RGB, 
+               GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glActiveTexture(GL_TEXTURE0);
+
   glBindFramebuffer(GL_FRAMEBUFFER, gl_gbuf_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, 
+                         gl_gbuf_irradiance_tex, 0);
+  GLuint gbuf_attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+  glDrawBuffers(3, gbuf_attachments);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-  glViewport(0, 0, kWindowWidth, kWindowHeight);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Zeroes the outputs of both culling phases. The commands that don't pass are left at 0, for
+// drivers that draw all of them.
+void ClearCullBuffers() {
+  const uint32_t zero = 0;
+  for (int phase = 0; phase < 2; ++phase) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_culled_command_buffers[phase]);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_draw_count_buffers[phase]);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_cull_stats_buffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
 
-  glUseProgram(gl_geom_pass_program);
-  glBindVertexArray(gl_geom_pass_vao);
+// Runs phase |phase| of cull.comp over the |num_commands| commands of the scene buffers, seen with
+// |view_proj_mat|. The commands that pass go to |gl_culled_command_buffers[phase]|, and their
+// number to |gl_draw_count_buffers[phase]|.
+void CullPass(int phase, const glm::mat4& view_proj_mat, size_t num_commands) {
+  cull_program->Use();
+  cull_program->SetUniform(cull_num_commands_id, static_cast<uint32_t>(num_commands));
+  cull_program->SetUniform(cull_view_proj_mat_id, view_proj_mat);
+  cull_program->SetUniform(cull_second_phase_id, static_cast<int32_t>(phase == 1));
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMeshesBinding, scene_buffers->GetMeshInfoBuffer());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullInCommandsBinding, 
+                   scene_buffers->GetDrawCommandBuffer());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullOutCommandsBinding, 
+                   gl_culled_command_buffers[phase]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullDrawCountBinding, gl_draw_count_buffers[phase]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullMeshVisibilityBinding, 
+                   gl_mesh_visibility_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCullStatsBinding, gl_cull_stats_buffer);
+
+  glDispatchCompute((num_commands + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-  for (size_t i = 0; i < model->GetNumMeshes(); ++i) {
-    const utils::Mesh& mesh = model->GetMeshByIndex(i);
-    const utils::Material& mtl = mesh.materials[0];
+// Copies the culling counts of this frame to the readback buffer if the last copy has been read,
+// and reads the last copy if the GPU is done with it. Shows the latest counts in the window title.
+void UpdateCullStats(size_t num_commands) {
+  if (cull_stats_fence != nullptr) {
+    if (glClientWaitSync(cull_stats_fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      return;
+    }
+    glDeleteSync(cull_stats_fence);
+    cull_stats_fence = nullptr;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, gl_cull_stats_readback_buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(CullStats), &cull_stats);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    std::string title = std::string(kWindowTitle) + 
+        " | meshes: " + std::to_string(scene_buffers->GetNumMeshes()) + 
+        ", in BVH frustum: " + std::to_string(cull_stats_num_commands) + 
+        ", frustum culled: " + std::to_string(cull_stats.frustum_culled) + 
+        ", occlusion culled: " + std::to_string(cull_stats.occlusion_culled) + 
+        ", drawn: " + std::to_string(cull_stats.phase_draws[0]) + " + " + 
+        std::to_string(cull_stats.phase_draws[1]);
+    glfwSetWindowTitle(glfw_window, title.c_str());
+  }
 
-    glm::mat4 model_mat = glm::mat4(1.f);
-    view_mat = camera->GetViewMatrix();
+  if (++frames_since_cull_stats < kCullStatsInterval) {
+    return;
+  }
+  frames_since_cull_stats = 0;
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, gl_cull_stats_readback_buffer);
+  glBindBuffer(GL_COPY_READ_BUFFER, gl_cull_stats_buffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 
+                      offsetof(CullStats, frustum_culled), 2 * sizeof(uint32_t));
+  for (int phase = 0; phase < 2; ++phase) {
+    glBindBuffer(GL_COPY_READ_BUFFER, gl_draw_count_buffers[phase]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 
+                        offsetof(CullStats, phase_draws) + phase * sizeof(uint32_t), 
+                        sizeof(uint32_t));
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-    glm::mat4 mv_mat = view_mat * model_mat;
-    glm::mat4 mvp_mat = proj_mat * view_mat * model_mat;
+  cull_stats_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  cull_stats_num_commands = num_commands;
+}
+
+// Reduces the depth buffer of the first phase of the G-buffer pass into the depth pyramid that the
+// second phase is culled against.
+void BuildDepthPyramid() {
+  depth_pyramid_program->Use();
+
+  for (int level = 0; level < depth_pyramid_levels; ++level) {
+    int width = std::max(kWindowWidth >> level, 1);
+    int height = std::max(kWindowHeight >> level, 1);
+
+    depth_pyramid_program->SetUniform(depth_pyramid_copy_depth_id, 
+                                      static_cast<int32_t>(level == 0));
+    glBindImageTexture(0, gl_depth_pyramid_tex, std::max(level - 1, 0), GL_FALSE, 0, 
+                       GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, gl_depth_pyramid_tex, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((width + kDepthPyramidGroupSize - 1) / kDepthPyramidGroupSize,
+                      (height + kDepthPyramidGroupSize - 1) / kDepthPyramidGroupSize, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+// Moves the lights for |time| seconds since the start, uploads them in view space, and lists the
+// lights of every cluster of the view frustum.
+void ClusterLights(double time) {
+  for (size_t i = 0; i < lights.size(); ++i) {
+    const PointLight& light = lights[i];
+    glm::vec3 pos = light.pos;
+    pos.y += light.radius * static_cast<float>(std::sin(time + light.phase));
+    gpu_lights[i].pos_radius = glm::vec4(glm::vec3(view_mat * glm::vec4(pos, 1.f)), light.radius);
+    gpu_lights[i].color = glm::vec4(light.color, 1.f);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_lights_ssbo);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpu_lights.size() * sizeof(GpuPointLight), 
+                  gpu_lights.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  cluster_lights_program->Use();
+  cluster_lights_program->SetUniform(cluster_lights_num_lights_id, 
+                                     static_cast<uint32_t>(gpu_lights.size()));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kLightsBinding, gl_lights_ssbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kClusterLightCountsBinding, 
+                   gl_cluster_light_counts_ssbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kClusterLightIndicesBinding, 
+                   gl_cluster_light_indices_ssbo);
+
+  glDispatchCompute((kNumClusters + kClusterGroupSize - 1) / kClusterGroupSize, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-    GLint mv_mat_loc = glGetUniformLocation(gl_geom_pass_program, "mv_mat");
-    glUniformMatrix4fv(mv_mat_loc, 1, GL_FALSE, glm::value_ptr(mv_mat));
-      
-    GLint mvp_mat_loc = glGetUniformLocation(gl_geom_pass_program, "mvp_mat");
-    glUniformMatrix4fv(mvp_mat_loc, 1, GL_FALSE, glm::value_ptr(mvp_mat));
+void RenderPass() {
+  glBindFramebuffer(GL_FRAMEBUFFER, gl_gbuf_fbo);
 
-    glm::mat3 normal_mat = glm::transpose(glm::inverse(glm::mat3(mv_mat)));
-    GLint normal_mat_loc = glGetUniformLocation(gl_geom_pass_program, "normal_mat");
-    glUniformMatrix3fv(normal_mat_loc, 1, GL_FALSE, glm::value_ptr(normal_mat)); 
+  // The albedo is written in linear space, and encoded into the sRGB attachment on the way.
+  glEnable(GL_FRAMEBUFFER_SRGB);
 
-    GLuint ambient_color_loc = glGetUniformLocation(gl_geom_pass_program, "mtls[0].Ka");
-    glUniform3fv(ambient_color_loc, 1, glm::value_ptr(mtl.ambient_color));
+  glViewport(0, 0, kWindowWidth, kWindowHeight);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    GLuint ambient_tex_loc = glGetUniformLocation(gl_geom_pass_program, "mtls[0].tex_a");
-    glUniform1i(ambient_tex_loc, texname_to_tex_unit[mtl.ambient_texname]);
+  texture_streamer->BeginFrame(kTextureFeedbackBinding);
 
-    glBindBuffer(GL_ARRAY_BUFFER, gl_pos_vbos[i]);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialsBinding, gl_materials_ssbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMeshesBinding, scene_buffers->GetMeshInfoBuffer());
 
-    glBindBuffer(GL_ARRAY_BUFFER, gl_normal_vbos[i]);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  // The GL textures change as levels are streamed in and out, so they are bound every frame.
+  for (size_t i = 0; i < kMaxTextureArrays; ++i) {
+    glActiveTexture(GL_TEXTURE0 + kMaterialTexUnit + i);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 
+                  i < texture_streamer->GetNumArrays() ? texture_streamer->GetGlArray(i) : 0);
+  }
 
-    glBindBuffer(GL_ARRAY_BUFFER, gl_texcoord_vbos[i]);
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  // All the meshes are in world space, so the matrices are the same for every draw.
+  glm::mat4 model_mat = glm::mat4(1.f);
+  view_mat = camera->GetViewMatrix();
+
+  FrameUniforms frame_uniforms = {};
+  frame_uniforms.mv_mat = view_mat * model_mat;
+  frame_uniforms.mvp_mat = proj_mat * view_mat * model_mat;
+  frame_uniforms.normal_mat = 
+      glm::mat4(glm::transpose(glm::inverse(glm::mat3(frame_uniforms.mv_mat))));
+  frame_uniforms.frame_index = texture_streamer->GetFrameIndex();
+  frame_uniforms.oct_normals = kVertexFormat != utils::VertexFormat::kSeparate;
+  frame_uniform_buffer->Set(0, frame_uniforms);
+  frame_uniform_buffer->Upload();
+  frame_uniform_buffer->BindElement(kFrameUniformsBinding, 0);
+
+  const float proj_scale = kWindowHeight / (2.f * std::tan(kFovY * 0.5f));
+
+  // Materials and mesh bounds come from the storage buffers and all the meshes share the vertex
+  // buffers, so the whole pass is a single multi-draw with a command per mesh that passes culling.
+  // The BVH drops the meshes outside the frustum before any command is written, and the GPU then
+  // culls the remaining ones in two phases around the depth pyramid.
+  draw_commands.clear();
+  for (uint32_t mesh_idx : mesh_bvh->Cull(camera->GetFrustum(proj_mat))) {
+    draw_commands.push_back(scene_buffers->GetDrawCommand(
+        mesh_idx, SelectMeshLod(mesh_idx, camera->GetCameraPos(), proj_scale)));
+  }
+  scene_buffers->SetDrawCommands(draw_commands);
+  ClearCullBuffers();
 
-    glBindBuffer(GL_ARRAY_BUFFER, gl_mtl_id_vbos[i]);
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 1, GL_INT, GL_FALSE, 0, 0);
+  for (int phase = 0; phase < 2; ++phase) {
+    if (phase == 1) {
+      BuildDepthPyramid();
+    }
+    CullPass(phase, proj_mat * view_mat, draw_commands.size());
 
-    glDrawArrays(GL_TRIANGLES, 0, mesh.num_verts);
+    geom_pass_program->Use();
+    scene_buffers->DrawIndirect(gl_culled_command_buffers[phase], gl_draw_count_buffers[phase], 
+                                draw_commands.size());
   }
+  UpdateCullStats(draw_commands.size());
+
+  texture_streamer->EndFrame();
 
+  glDisable(GL_FRAMEBUFFER_SRGB);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+  // Binning only needs the lights and the view, so it runs after the G-buffer pass has been
+  // submitted rather than in front of it.
+  ClusterLights(glfwGetTime());
+
   glViewport(0, 0, kWindowWidth, kWindowHeight);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  glUseProgram(gl_light_pass_program);
+  light_pass_program->Use();
+  light_pass_program->SetUniform(light_pass_inv_view_mat_id, glm::inverse(view_mat));
+  if (!use_lightmap) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kProbesBinding, gl_probes_ssbo);
+  }
   glBindVertexArray(gl_light_pass_vao);
 
   glBindBuffer(GL_ARRAY_BUFFER, gl_light_pass_pos_vbo);
@@ -365,24 +1016,46 @@ void Cleanup() {
   glDeleteBuffers(1, &gl_light_pass_texcoord_vbo);
   glDeleteBuffers(1, &gl_light_pass_pos_vbo);
   glDeleteVertexArrays(1, &gl_light_pass_vao);
-  glDeleteProgram(gl_light_pass_program);
+  light_pass_program.reset();
 
-  glDeleteBuffers(gl_mtl_id_vbos.size(), &gl_mtl_id_vbos[0]);
-  glDeleteBuffers(gl_texcoord_vbos.size(), &gl_texcoord_vbos[0]);
-  glDeleteBuffers(gl_normal_vbos.size(), &gl_normal_vbos[0]);
-  glDeleteBuffers(gl_pos_vbos.size(), &gl_pos_vbos[0]);
-  
-  for (const auto& [texname, texture] : texname_to_gl_texture) {
-    glDeleteTextures(1, &texture);
+  if (use_lightmap) {
+    glDeleteTextures(1, &gl_lightmap_tex);
+  } else {
+    glDeleteBuffers(1, &gl_probes_ssbo);
   }
 
-  glDeleteRenderbuffers(1, &gl_gbuf_depth_rbo);
-  glDeleteTextures(1, &gl_gbuf_ambient_tex);
+  glDeleteBuffers(1, &gl_cluster_light_indices_ssbo);
+  glDeleteBuffers(1, &gl_cluster_light_counts_ssbo);
+  glDeleteBuffers(1, &gl_lights_ssbo);
+  cluster_lights_program.reset();
+
+  if (cull_stats_fence != nullptr) {
+    glDeleteSync(cull_stats_fence);
+  }
+  glDeleteBuffers(1, &gl_cull_stats_readback_buffer);
+  glDeleteBuffers(1, &gl_cull_stats_buffer);
+  glDeleteBuffers(1, &gl_mesh_visibility_buffer);
+  glDeleteBuffers(2, gl_draw_count_buffers);
+  glDeleteBuffers(2, gl_culled_command_buffers);
+  glDeleteTextures(1, &gl_depth_pyramid_tex);
+  depth_pyramid_program.reset();
+  cull_program.reset();
+
+  mesh_bvh.reset();
+  scene_buffers.reset();
+
+  glDeleteBuffers(1, &gl_materials_ssbo);
+  texture_streamer.reset();
+
+  glDeleteTextures(1, &gl_gbuf_depth_tex);
+  if (use_lightmap) {
+    glDeleteTextures(1, &gl_gbuf_irradiance_tex);
+  }
+  glDeleteTextures(1, &gl_gbuf_albedo_tex);
   glDeleteTextures(1, &gl_gbuf_normal_tex);
-  glDeleteTextures(1, &gl_gbuf_pos_tex);
   glDeleteFramebuffers(1, &gl_gbuf_fbo);
-  glDeleteVertexArrays(1, &gl_geom_pass_vao);
-  glDeleteProgram(gl_geom_pass_program);
+  frame_uniform_buffer.reset();
+  geom_pass_program.reset();
 }
 
 void WindowErrorCallback(int error, const char* desc) {
@@ -399,8 +1072,7 @@ int main() {
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   
-  GLFWwindow* glfw_window = glfwCreateWindow(kWindowWidth, kWindowHeight, kWindowTitle, nullptr, 
-                                             nullptr);
+  glfw_window = glfwCreateWindow(kWindowWidth, kWindowHeight, kWindowTitle, nullptr, nullptr);
   if (glfw_window == nullptr) {
     std::cerr << "Could not create GLFW window." << std::endl;
     exit(1);
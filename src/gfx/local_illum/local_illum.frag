@@ -2,34 +2,70 @@
 
 in vec3 frag_pos;
 in vec3 frag_normal;
+flat in int frag_mtl_id;
+in vec2 frag_lightmap_uv;
 
 out vec4 out_color;
 
-uniform vec3 camera_pos;
-uniform float far_plane;
+// Must match FrameUniforms in main.cpp.
+layout(std140, binding = 0) uniform FrameUniforms {
+  vec3 light_pos;
+  float far_plane;
+  vec3 ambient_I;
+  vec3 diffuse_I;
+  vec3 specular_I;
+  vec3 camera_pos;
+};
 
-uniform vec3 light_pos;
-uniform vec3 ambient_I;
-uniform vec3 diffuse_I;
-uniform vec3 specular_I;
-uniform float shininess;
+// Must match GpuMaterial in main.cpp.
+struct Material {
+  vec3 ambient_color;
+  float shininess;
+  vec3 specular_color;
+  vec3 diffuse_color;
+};
 
-uniform vec3 ambient_color;
-uniform vec3 specular_color;
+layout(std430, binding = 0) readonly buffer Materials {
+  Material materials[];
+};
 
 uniform samplerCube shadow_tex;
 
+// Baked irradiance, divided by lightmap_scale. Must match kUseLightmap in main.cpp and
+// kLightmapMaxIrradiance in lightmap_baker.h.
+uniform sampler2D lightmap_tex;
+uniform bool use_lightmap;
+uniform float lightmap_scale;
+
+const float kPi = 3.14159265;
+
+vec3 LinearToSrgb(vec3 color) {
+  return mix(color * 12.92, 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055,
+             step(vec3(0.0031308), color));
+}
+
 void main() {
+  // Vertices without a material use the first one.
+  Material mtl = materials[max(frag_mtl_id, 0)];
+
+  // The lightmap holds the direct and indirect irradiance of the texel, which a diffuse surface
+  // reflects as albedo / pi of it.
+  if (use_lightmap) {
+    vec3 irradiance = texture(lightmap_tex, frag_lightmap_uv).rgb * lightmap_scale;
+    out_color = vec4(LinearToSrgb(mtl.diffuse_color * irradiance / kPi), 1.0);
+    return;
+  }
+
   vec3 light_v = normalize(light_pos - frag_pos);
   vec3 view_v = normalize(camera_pos - frag_pos);
 
   vec3 half_v = normalize((light_v + view_v) / 2.0);
   vec3 normal_v = normalize(frag_normal);
 
-  vec3 ambient = ambient_I * ambient_color;
+  vec3 ambient = ambient_I * mtl.ambient_color;
   vec3 diffuse = diffuse_I * clamp(dot(light_v, normal_v), 0.0, 1.0);
-  vec3 specular = specular_I * pow(clamp(dot(half_v, normal_v), 0.0, 1.0), shininess) * 
-      specular_color;
+  vec3 specular = specular_I * pow(clamp(dot(half_v, normal_v), 0.0, 1.0), mtl.shininess) * 
+      mtl.specular_color;
 
   float shadow_tex_val = texture(shadow_tex, -light_v).r;
   float shadow_occlude = 
@@ -2,17 +2,26 @@
 
 layout(location = 0) in vec3 vert_pos;
 layout(location = 1) in vec3 vert_normal;
+layout(location = 3) in int vert_mtl_id;
+// Must match kSceneLightmapUvAttrib in scene_buffers.h.
+layout(location = 5) in vec2 vert_lightmap_uv;
 
 out vec3 frag_pos;
 out vec3 frag_normal;
+flat out int frag_mtl_id;
+out vec2 frag_lightmap_uv;
 
-uniform mat4 model_mat;
-uniform mat4 mvp_mat;
-uniform mat3 normal_mat;
+// Must match ViewUniforms in main.cpp.
+layout(std140, binding = 1) uniform ViewUniforms {
+  mat4 model_mat;
+  mat4 mvp_mat;
+};
 
 void main() {
   frag_pos = (model_mat * vec4(vert_pos, 1.0)).xyz;
   frag_normal = mat3(model_mat) * vert_normal;
+  frag_mtl_id = vert_mtl_id;
+  frag_lightmap_uv = vert_lightmap_uv;
   
   gl_Position = mvp_mat * vec4(vert_pos, 1.0);
 }
\ No newline at end of file
@@ -7,125 +7,282 @@
 #include <glm/gtx/string_cast.hpp>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "utils/camera.h"
 #include "utils/image.h"
+#include "utils/lightmap_baker.h"
+#include "utils/lightmap_uv.h"
+#include "utils/mesh_bvh.h"
+#include "utils/mesh_simplifier.h"
 #include "utils/model.h"
 #include "utils/program.h"
-#include "utils/shader.h"
+#include "utils/scene_buffers.h"
+#include "utils/texture_file.h"
+#include "utils/triangle_bvh.h"
 #include "utils/wireframe_drawer.h"
 
 constexpr int kWindowWidth = 1920;
 constexpr int kWindowHeight = 1080;
 const char* kWindowTitle = "Local Illum";
 
+const char* kModelPath = "assets/cornell_box/cornell_box.obj";
+const char* kMaterialDir = "assets/cornell_box";
+
 constexpr float kAspectRatio = static_cast<float>(kWindowWidth) / static_cast<float>(kWindowHeight);
 
 constexpr int kShadowTexWidth = 1024;
 constexpr int kShadowTexHeight = 1024;
 constexpr float kShadowNearPlane = 0.5f;
-constexpr float kShadowFarPlane = 20.f;
+
+const float kFovY = glm::radians(75.f);
+constexpr float kNearPlane = 0.1f;
+
+constexpr float kModelScale = 5.f;
+
+// Lights the meshes with a lightmap baked for the light, stored next to the model, instead of the
+// shadow cube map and the Phong terms. The model is static, so the diffuse lighting, its shadows
+// and its indirect bounces come down to one texture fetch, and the shadow pass is not created.
+constexpr bool kUseLightmap = true;
+
+// Size in texels of the lightmap atlas.
+constexpr uint32_t kLightmapSize = 256;
+
+// Texture unit of the lightmap, after the shadow cube map.
+constexpr int kLightmapTexUnit = 2;
+
+// Light of the lightmap, in world units: a surface facing it at a distance d receives an
+// irradiance of kLightIntensity / d^2. Its radius, that of the box drawn around it, softens the
+// shadows.
+constexpr float kLightIntensity = 200.f;
+constexpr float kLightRadius = 0.5f;
+
+// Meshes are drawn with the least detailed LOD whose simplification error stays below this many
+// pixels in the render target.
+constexpr float kMaxLodPixelError = 1.f;
+
+// Uniform block bindings shared by the shadow pass and the light pass.
+constexpr GLuint kFrameUniformsBinding = 0;
+constexpr GLuint kViewUniformsBinding = 1;
+
+// Shader storage binding of the materials of the light pass.
+constexpr GLuint kMaterialsBinding = 0;
+
+// Elements of the view uniform buffer: one per shadow cube face, then the camera.
+constexpr size_t kNumShadowFaces = 6;
+constexpr size_t kCameraViewIdx = kNumShadowFaces;
+
+// Uniforms that change at most once per frame, laid out like the FrameUniforms block (std140).
+struct FrameUniforms {
+  glm::vec3 light_pos;
+  float far_plane;
+  glm::vec3 ambient_I;
+  float padding0;
+  glm::vec3 diffuse_I;
+  float padding1;
+  glm::vec3 specular_I;
+  float padding2;
+  glm::vec3 camera_pos;
+  float padding3;
+};
+
+// Uniforms of a view, laid out like the ViewUniforms block (std140). All the meshes of a pass are
+// drawn with the same matrices.
+struct ViewUniforms {
+  glm::mat4 model_mat;
+  glm::mat4 mvp_mat;
+};
+
+// Material as laid out in the Materials buffer of local_illum.frag (std430).
+struct GpuMaterial {
+  glm::vec3 ambient_color;
+  float shininess;
+  glm::vec3 specular_color;
+  float padding0;
+  glm::vec3 diffuse_color;
+  float padding1;
+};
+static_assert(sizeof(GpuMaterial) == 48, "GpuMaterial must match the std430 layout");
 
 std::unique_ptr<utils::Camera> camera;
 std::unique_ptr<utils::WireframeDrawer> wireframe_drawer;
 
-GLuint gl_program;
-GLuint gl_vao;
-std::vector<GLuint> gl_pos_vbos;
-std::vector<GLuint> gl_normal_vbos;
+std::unique_ptr<utils::Program> program;
 std::shared_ptr<utils::Model> model;
+std::unique_ptr<utils::SceneBuffers> scene_buffers;
+std::vector<utils::DrawElementsIndirectCommand> draw_commands;
+std::unique_ptr<utils::MeshBvh> mesh_bvh;
 
-GLuint gl_shadow_program;
-GLuint gl_shadow_vao;
+// Meshes inside the frustum of every view that is drawn, culled once per frame: the shadow cube
+// faces, unless the lightmap is used, and then the camera, always last.
+std::vector<std::vector<uint32_t>> view_visible_meshes;
+GLuint gl_materials_ssbo;
+GLuint gl_lightmap_tex;
+
+std::unique_ptr<utils::Program> shadow_program;
 GLuint gl_shadow_fbo;
 GLuint gl_shadow_tex;
 GLuint gl_shadow_rbo;
 
 glm::vec3 light_pos;
+float shadow_far_plane;
 glm::mat4 shadow_view_mats[6];
 glm::mat4 shadow_proj_mat;
 
+FrameUniforms frame_uniforms;
+std::unique_ptr<utils::UniformBuffer<FrameUniforms>> frame_uniform_buffer;
+
+std::unique_ptr<utils::UniformBuffer<ViewUniforms>> view_uniform_buffer;
+
+// Picks the LOD of a mesh for a perspective view from |eye_pos|. |proj_scale| is the size in pixels
+// of one unit at a distance of one, i.e. viewport_height / (2 * tan(fov_y / 2)).
+size_t SelectMeshLod(size_t mesh_idx, const glm::vec3& eye_pos, float proj_scale) {
+  const glm::vec4& sphere = model->GetMeshByIndex(mesh_idx).bounding_sphere;
+  float distance = std::max(glm::length(glm::vec3(sphere) * kModelScale - eye_pos) - 
+                            sphere.w * kModelScale, kNearPlane);
+  return utils::SelectLod(model->GetMeshByIndex(mesh_idx), proj_scale * kModelScale / distance,
+                          kMaxLodPixelError);
+}
+
+utils::LightmapUvOptions GetLightmapUvOptions() {
+  utils::LightmapUvOptions options;
+  options.atlas_size = kLightmapSize;
+  return options;
+}
+
+// The lightmap is baked in model space, so the light is scaled down with the model. The albedos
+// are the diffuse colors of the materials.
+utils::LightmapBakeOptions GetLightmapBakeOptions() {
+  utils::LightmapBakeOptions options;
+  options.point_lights.push_back({ light_pos / kModelScale, kLightRadius / kModelScale,
+                                   glm::vec3(kLightIntensity / (kModelScale * kModelScale)) });
+  for (const utils::Material& mtl : model->GetMaterialTable().materials) {
+    options.material_albedos.push_back(mtl.diffuse_color);
+  }
+  return options;
+}
+
+// Loads the lightmap of the model, or bakes it and saves it next to the model if the file is
+// missing or stale, and uploads it for the light pass.
+void InitLightmap(const utils::LightmapLayout& layout) {
+  const utils::LightmapBakeOptions options = GetLightmapBakeOptions();
+  std::unique_ptr<utils::TextureFile> lightmap_file = 
+      utils::ReadLightmap(kModelPath, layout, options);
+  if (lightmap_file == nullptr) {
+    utils::TriangleBvh bvh(*model);
+    utils::LightmapBakeStats stats;
+    utils::Lightmap lightmap = utils::BakeLightmap(*model, layout, bvh, options, &stats);
+    double mrays_per_sec = stats.num_rays / stats.trace_ms / 1e3;
+    std::cout << "Baked " << stats.num_texels << " lightmap texels in " << stats.trace_ms
+              << " ms (" << mrays_per_sec / stats.num_threads << " Mrays/s per core on "
+              << stats.num_threads << " threads), denoised in " << stats.denoise_ms << " ms"
+              << std::endl;
+    lightmap_file = utils::WriteLightmap(kModelPath, layout, options, lightmap);
+  }
+
+  // The texels are sRGB-encoded, so they are decoded before they are filtered. The rows are
+  // tightly packed.
+  const utils::TextureLevel& level = lightmap_file->GetLevel(0);
+  glGenTextures(1, &gl_lightmap_tex);
+  glActiveTexture(GL_TEXTURE0 + kLightmapTexUnit);
+  glBindTexture(GL_TEXTURE_2D, gl_lightmap_tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, level.width, level.height, 0, GL_RGB,
+               GL_UNSIGNED_BYTE, level.data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glActiveTexture(GL_TEXTURE0);
+}
+
 void Initialize() {
   glEnable(GL_DEPTH_TEST);
   glClearColor(0.f, 0.f, 0.f, 1.f);
 
-  model = utils::Model::LoadModelFromFile("assets/cornell_box/cornell_box.obj", 
-                                          "assets/cornell_box");
+  utils::ModelLoadOptions load_options;
+  load_options.build_lods = true;
+  model = utils::Model::LoadModelFromFile(kModelPath, kMaterialDir, load_options);
   if (model == nullptr) {
     std::cerr << "Could not load model." << std::endl;
     exit(1);
   }
 
-  gl_pos_vbos.resize(model->GetNumMeshes());
-  glGenBuffers(gl_pos_vbos.size(), &gl_pos_vbos[0]);
-  for (size_t i = 0; i < gl_pos_vbos.size(); ++i) {
-    glBindBuffer(GL_ARRAY_BUFFER, gl_pos_vbos[i]);
-    glBufferData(GL_ARRAY_BUFFER, model->GetMeshByIndex(i).positions.size() * sizeof(glm::vec3), 
-                 glm::value_ptr(model->GetMeshByIndex(i).positions[0]), GL_STATIC_DRAW);
+  // The charts of the lightmap can't share vertices along their seams, so the meshes are uploaded
+  // with the vertices of the unwrapped ones, once the lightmap is baked.
+  utils::LightmapLayout lightmap_layout;
+  if (kUseLightmap) {
+    lightmap_layout = utils::UnwrapLightmap(*model, GetLightmapUvOptions());
+    if (lightmap_layout.width == 0) {
+      std::cerr << "Could not unwrap the lightmap." << std::endl;
+      exit(1);
+    }
   }
 
-  gl_normal_vbos.resize(model->GetNumMeshes());
-  glGenBuffers(gl_normal_vbos.size(), &gl_normal_vbos[0]);
-  for (size_t i = 0; i < gl_normal_vbos.size(); ++i) {
-    glBindBuffer(GL_ARRAY_BUFFER, gl_normal_vbos[i]);
-    glBufferData(GL_ARRAY_BUFFER, model->GetMeshByIndex(i).normals.size() * sizeof(glm::vec3), 
-                 glm::value_ptr(model->GetMeshByIndex(i).normals[0]), GL_STATIC_DRAW);
+  mesh_bvh = std::make_unique<utils::MeshBvh>(*model);
+
+  // The light pass reads the material of every vertex from this buffer.
+  std::vector<GpuMaterial> gpu_mtls;
+  for (const utils::Material& mtl : model->GetMaterialTable().materials) {
+    gpu_mtls.push_back({ mtl.ambient_color, mtl.shininess, mtl.specular_color, 0.f,
+                         mtl.diffuse_color, 0.f });
   }
+  glGenBuffers(1, &gl_materials_ssbo);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, gl_materials_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, gpu_mtls.size()) * sizeof(GpuMaterial),
+               gpu_mtls.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
   light_pos = glm::vec3(0.f, 8.0f, 0.f);
 
+  // Fits the far plane of the shadow cube map to the farthest point of the scaled model.
+  const glm::vec4& model_sphere = model->GetBoundingSphere();
+  shadow_far_plane = std::max(
+      glm::length(glm::vec3(model_sphere) * kModelScale - light_pos) + model_sphere.w * kModelScale,
+      2.f * kShadowNearPlane);
+
+  frame_uniforms.light_pos = light_pos;
+  frame_uniforms.far_plane = shadow_far_plane;
+  frame_uniform_buffer = std::make_unique<utils::UniformBuffer<FrameUniforms>>();
+  view_uniform_buffer = 
+      std::make_unique<utils::UniformBuffer<ViewUniforms>>(kNumShadowFaces + 1);
+
   wireframe_drawer = std::make_unique<utils::WireframeDrawer>();
 
   wireframe_drawer->AddRectangle(glm::vec3(0.f, 8.f, 0.f), 1.f, 1.f, 1.f);
-}
-
-void CreateShadowPass() {
-  gl_shadow_program = glCreateProgram();
-  if (!gl_shadow_program) {
-    std::cerr << "Could not create program." << std::endl;
-    exit(1);
-  }
 
-  GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
-  if (std::optional<std::string> src_opt = utils::LoadShaderSource("shadow_pass.vert")) {
-    if (!utils::CompileShader(vert_shader, src_opt.value())) {
-      std::cerr << "Could not compile vertex shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file triangle.vert." << std::endl;
-    exit(1);
+  if (kUseLightmap) {
+    InitLightmap(lightmap_layout);
   }
 
-  GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  if (std::optional<std::string> src_opt = utils::LoadShaderSource("shadow_pass.frag")) {
-    if (!utils::CompileShader(frag_shader, src_opt.value())) {
-      std::cerr << "Could not compile fragment shader." << std::endl;
-      exit(1);
+  // All the meshes share one vertex and index buffer, so that a pass is a single multi-draw. The
+  // lightmap is baked over the vertices that the model was loaded with, so the meshes are only
+  // moved onto the vertices of the charts now, in place.
+  scene_buffers = std::make_unique<utils::SceneBuffers>(load_options.vertex_format);
+  for (int i = 0; i < model->GetNumMeshes(); ++i) {
+    if (kUseLightmap) {
+      utils::ApplyLightmapUvs(lightmap_layout.meshes[i], model->GetMutableMeshByIndex(i));
     }
-  } else {
-    std:: cerr << "Could not load shader from file triangle.frag." << std::endl;
-    exit(1);
+    scene_buffers->AddMesh(model->GetMeshByIndex(i));
   }
+  scene_buffers->Upload();
+}
 
-  glAttachShader(gl_shadow_program, vert_shader);
-  glAttachShader(gl_shadow_program, frag_shader);
-
-  glLinkProgram(gl_shadow_program);
-  if (!utils::CheckProgramLinkStatus(gl_shadow_program)) {
+void CreateShadowPass() {
+  shadow_program = utils::Program::LoadFromFiles({ { GL_VERTEX_SHADER, "shadow_pass.vert" },
+                                                    { GL_FRAGMENT_SHADER, "shadow_pass.frag" } });
+  if (shadow_program == nullptr) {
+    std::cerr << "Could not create shadow program." << std::endl;
     exit(1);
   }
-  
-  glDeleteShader(frag_shader);
-  glDeleteShader(vert_shader);
-
-  glUseProgram(gl_shadow_program);
-
-  glGenVertexArrays(1, &gl_shadow_vao);
 
   glGenTextures(1, &gl_shadow_tex);
 
@@ -164,114 +321,98 @@ void CreateShadowPass() {
                             gl_shadow_rbo);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
       
-  shadow_proj_mat = glm::perspective(glm::radians(90.f), 1.f, kShadowNearPlane, kShadowFarPlane);
-
-  GLint far_plane_loc = glGetUniformLocation(gl_shadow_program, "far_plane");
-  glUniform1f(far_plane_loc, kShadowFarPlane);                                   
-
-  GLint light_pos_loc = glGetUniformLocation(gl_shadow_program, "light_pos");
-  glUniform3fv(light_pos_loc, 1, glm::value_ptr(light_pos));
+  shadow_proj_mat = glm::perspective(glm::radians(90.f), 1.f, kShadowNearPlane, shadow_far_plane);
 }
 
 void CreateLightPass() {
-  gl_program = glCreateProgram();
-  if (!gl_program) {
-    std::cerr << "Could not create gl_program." << std::endl;
-    exit(1);
-  }
-
-  GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
-  if (std::optional<std::string> src_opt = utils::LoadShaderSource("local_illum.vert")) {
-    if (!utils::CompileShader(vert_shader, src_opt.value())) {
-      std::cerr << "Could not compile vertex shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file triangle.vert." << std::endl;
-    exit(1);
-  }
-
-  GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  if (std::optional<std::string> src_opt = utils::LoadShaderSource("local_illum.frag")) {
-    if (!utils::CompileShader(frag_shader, src_opt.value())) {
-      std::cerr << "Could not compile fragment shader." << std::endl;
-      exit(1);
-    }
-  } else {
-    std:: cerr << "Could not load shader from file triangle.frag." << std::endl;
-    exit(1);
-  }
-
-  glAttachShader(gl_program, vert_shader);
-  glAttachShader(gl_program, frag_shader);
-
-  glLinkProgram(gl_program);
-  if (!utils::CheckProgramLinkStatus(gl_program)) {
+  program = utils::Program::LoadFromFiles({ { GL_VERTEX_SHADER, "local_illum.vert" },
+                                             { GL_FRAGMENT_SHADER, "local_illum.frag" } });
+  if (program == nullptr) {
+    std::cerr << "Could not create program." << std::endl;
     exit(1);
   }
-  
-  glDeleteShader(frag_shader);
-  glDeleteShader(vert_shader);
 
-  glGenVertexArrays(1, &gl_vao);
-
-  glUseProgram(gl_program);
-
-  glm::vec3 ambient_I = glm::vec3(0.8f, 0.8f, 0.8f);
-  glm::vec3 diffuse_I = glm::vec3(0.3f, 0.3f, 0.3f);
-  glm::vec3 specular_I = glm::vec3(1.f, 1.f, 1.f);
-  float shininess = 8.f;
+  frame_uniforms.ambient_I = glm::vec3(0.8f, 0.8f, 0.8f);
+  frame_uniforms.diffuse_I = glm::vec3(0.3f, 0.3f, 0.3f);
+  frame_uniforms.specular_I = glm::vec3(1.f, 1.f, 1.f);
 
   camera->SetCameraPos(glm::vec3(0.f, 7.f, 12.5f));
 
-  GLint far_plane_loc = glGetUniformLocation(gl_program, "far_plane");
-  glUniform1f(far_plane_loc, kShadowFarPlane);      
-
-  GLint light_pos_loc = glGetUniformLocation(gl_program, "light_pos");
-  glUniform3fv(light_pos_loc, 1, glm::value_ptr(light_pos));
+  program->SetUniform(program->FindUniform("shadow_tex"), 1);
+  program->SetUniform(program->FindUniform("lightmap_tex"), kLightmapTexUnit);
+  program->SetUniform(program->FindUniform("use_lightmap"), static_cast<int32_t>(kUseLightmap));
+  program->SetUniform(program->FindUniform("lightmap_scale"), utils::kLightmapMaxIrradiance);
+}
 
-  GLint ambient_loc = glGetUniformLocation(gl_program, "ambient_I");
-  glUniform3fv(ambient_loc, 1, glm::value_ptr(ambient_I));
+// Uploads the uniforms of the frame, which both passes read, and the matrices of the six shadow
+// cube faces, unless the lightmap is used, and of the camera. Also culls the meshes against the
+// frusta of all these views.
+void UpdateFrameUniforms() {
+  frame_uniforms.camera_pos = camera->GetCameraPos();
+  frame_uniform_buffer->Set(0, frame_uniforms);
+  frame_uniform_buffer->Upload();
+  frame_uniform_buffer->BindElement(kFrameUniformsBinding, 0);
+
+  // The frusta come from the model-view-projection matrices, so they are in the model space of
+  // the BVH.
+  std::vector<utils::Frustum> view_frusta;
+  glm::mat4 model_mat = glm::scale(glm::mat4(1.f), glm::vec3(kModelScale));
+  if (!kUseLightmap) {
+    for (size_t i = 0; i < kNumShadowFaces; ++i) {
+      ViewUniforms view;
+      view.model_mat = model_mat;
+      view.mvp_mat = shadow_proj_mat * shadow_view_mats[i] * model_mat;
+      view_uniform_buffer->Set(i, view);
+      view_frusta.push_back(utils::ExtractFrustum(view.mvp_mat));
+    }
+  }
 
-  GLint diffuse_loc = glGetUniformLocation(gl_program, "diffuse_I");
-  glUniform3fv(diffuse_loc, 1, glm::value_ptr(diffuse_I));
+  glm::mat4 proj_mat = glm::perspective(kFovY, kAspectRatio, kNearPlane, 1000.f);
+  ViewUniforms camera_view;
+  camera_view.model_mat = model_mat;
+  camera_view.mvp_mat = proj_mat * camera->GetViewMatrix() * model_mat;
+  view_uniform_buffer->Set(kCameraViewIdx, camera_view);
+  view_frusta.push_back(utils::ExtractFrustum(camera_view.mvp_mat));
+  view_uniform_buffer->Upload();
 
-  GLint specular_loc = glGetUniformLocation(gl_program, "specular_I");
-  glUniform3fv(specular_loc, 1, glm::value_ptr(specular_I));
+  view_visible_meshes = mesh_bvh->Cull(view_frusta);
 }
 
 void ShadowPass() {
   glBindFramebuffer(GL_FRAMEBUFFER, gl_shadow_fbo);
 
-  for (size_t i = 0; i < 6; ++i) {
+  // All six faces see the meshes from the same distance, so the LODs are picked once. The
+  // commands of every face only cover the meshes in its frustum, and go one face after the other
+  // into the command buffer.
+  const float shadow_proj_scale = kShadowTexHeight / (2.f * std::tan(glm::radians(45.f)));
+  std::vector<size_t> mesh_lods(scene_buffers->GetNumMeshes());
+  for (size_t i = 0; i < mesh_lods.size(); ++i) {
+    mesh_lods[i] = SelectMeshLod(i, light_pos, shadow_proj_scale);
+  }
+
+  draw_commands.clear();
+  size_t face_first_commands[kNumShadowFaces + 1];
+  for (size_t i = 0; i < kNumShadowFaces; ++i) {
+    face_first_commands[i] = draw_commands.size();
+    for (uint32_t mesh_idx : view_visible_meshes[i]) {
+      draw_commands.push_back(scene_buffers->GetDrawCommand(mesh_idx, mesh_lods[mesh_idx]));
+    }
+  }
+  face_first_commands[kNumShadowFaces] = draw_commands.size();
+  scene_buffers->SetDrawCommands(draw_commands);
+
+  shadow_program->Use();
+
+  for (size_t i = 0; i < kNumShadowFaces; ++i) {
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
                            gl_shadow_tex, 0);
 
     glViewport(0, 0, kShadowTexWidth, kShadowTexHeight);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glUseProgram(gl_shadow_program);
-
-    for (size_t j = 0; j < model->GetNumMeshes(); ++j) {
-      const utils::Mesh& mesh = model->GetMeshByIndex(j);
-
-      glm::mat4 model_mat = glm::scale(glm::mat4(1.f), glm::vec3(5.f, 5.f, 5.f));
-      glm::mat4 mvp_mat = shadow_proj_mat * shadow_view_mats[i] * model_mat;
-
-      GLint model_mat_loc = glGetUniformLocation(gl_shadow_program, "model_mat");
-      glUniformMatrix4fv(model_mat_loc, 1, GL_FALSE, glm::value_ptr(model_mat));
-      
-      GLint mvp_mat_loc = glGetUniformLocation(gl_shadow_program, "mvp_mat");
-      glUniformMatrix4fv(mvp_mat_loc, 1, GL_FALSE, glm::value_ptr(mvp_mat));
-
-      glBindVertexArray(gl_shadow_vao);
-
-      glBindBuffer(GL_ARRAY_BUFFER, gl_pos_vbos[j]);
-      glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-      glDrawArrays(GL_TRIANGLES, 0, mesh.num_verts);
-    }
+    view_uniform_buffer->BindElement(kViewUniformsBinding, i);
+    scene_buffers->Draw(face_first_commands[i], 
+                        face_first_commands[i + 1] - face_first_commands[i]);
   }
 
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -282,70 +423,41 @@ void LightPass() {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   glm::mat4 view_mat = camera->GetViewMatrix();
-  glm::mat4 proj_mat = glm::perspective(glm::radians(75.f), kAspectRatio, 0.1f, 1000.f);
-
-  glUseProgram(gl_program);
-
-  for (size_t i = 0; i < model->GetNumMeshes(); ++i) {
-    const utils::Mesh& mesh = model->GetMeshByIndex(i);
-
-    glm::mat4 model_mat = glm::scale(glm::mat4(1.f), glm::vec3(5.f, 5.f, 5.f));
-
-    glm::mat4 mv_mat = view_mat * model_mat;
-    glm::mat4 mvp_mat = proj_mat * mv_mat;
-
-    GLint model_mat_loc = glGetUniformLocation(gl_program, "model_mat");
-    glUniformMatrix4fv(model_mat_loc, 1, GL_FALSE, glm::value_ptr(model_mat));
-      
-    GLint mvp_mat_loc = glGetUniformLocation(gl_program, "mvp_mat");
-    glUniformMatrix4fv(mvp_mat_loc, 1, GL_FALSE, glm::value_ptr(mvp_mat));
-
-    glm::mat3 normal_mat = glm::transpose(glm::inverse(glm::mat3(mv_mat)));
-    GLint normal_mat_loc = glGetUniformLocation(gl_program, "normal_mat");
-    glUniformMatrix3fv(normal_mat_loc, 1, GL_FALSE, glm::value_ptr(normal_mat)); 
+  glm::mat4 proj_mat = glm::perspective(kFovY, kAspectRatio, kNearPlane, 1000.f);
 
-    GLint camera_pos_loc = glGetUniformLocation(gl_program, "camera_pos");
-    glUniform3fv(camera_pos_loc, 1, glm::value_ptr(camera->GetCameraPos()));
-
-    GLint ambient_color_loc = glGetUniformLocation(gl_program, "ambient_color");
-    glUniform3fv(ambient_color_loc, 1, glm::value_ptr(mesh.materials[0].ambient_color));
-
-    GLint specular_color_loc = glGetUniformLocation(gl_program, "specular_color");
-    glUniform3fv(specular_color_loc, 1, glm::value_ptr(mesh.materials[0].specular_color));
-
-    GLint shininess_loc = glGetUniformLocation(gl_program, "shininess");
-    glUniform1f(shininess_loc, mesh.materials[0].shininess);
-
-    GLint shadow_tex_loc = glGetUniformLocation(gl_program, "shadow_tex");
-    glUniform1i(shadow_tex_loc, 1);
-
-    glBindVertexArray(gl_vao);
-
-    glBindBuffer(GL_ARRAY_BUFFER, gl_pos_vbos[i]);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  const float proj_scale = kWindowHeight / (2.f * std::tan(kFovY * 0.5f));
+  draw_commands.clear();
+  for (uint32_t mesh_idx : view_visible_meshes.back()) {
+    draw_commands.push_back(scene_buffers->GetDrawCommand(
+        mesh_idx, SelectMeshLod(mesh_idx, camera->GetCameraPos(), proj_scale)));
+  }
+  scene_buffers->SetDrawCommands(draw_commands);
 
-    glBindBuffer(GL_ARRAY_BUFFER, gl_normal_vbos[i]);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  program->Use();
+  view_uniform_buffer->BindElement(kViewUniformsBinding, kCameraViewIdx);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialsBinding, gl_materials_ssbo);
 
-    glDrawArrays(GL_TRIANGLES, 0, mesh.num_verts);
-  }
+  scene_buffers->Draw(0, draw_commands.size());
 
   wireframe_drawer->Draw(proj_mat * view_mat);
 }
 
 void Cleanup() {
-  glDeleteRenderbuffers(1, &gl_shadow_rbo);
-  glDeleteFramebuffers(1, &gl_shadow_fbo);
-  glDeleteTextures(1, &gl_shadow_tex);
-  glDeleteVertexArrays(1, &gl_shadow_vao);
-  glDeleteProgram(gl_shadow_program);
+  if (kUseLightmap) {
+    glDeleteTextures(1, &gl_lightmap_tex);
+  } else {
+    glDeleteRenderbuffers(1, &gl_shadow_rbo);
+    glDeleteFramebuffers(1, &gl_shadow_fbo);
+    glDeleteTextures(1, &gl_shadow_tex);
+    shadow_program.reset();
+  }
+  glDeleteBuffers(1, &gl_materials_ssbo);
+  mesh_bvh.reset();
+  scene_buffers.reset();
+  program.reset();
 
-  glDeleteBuffers(gl_normal_vbos.size(), &gl_normal_vbos[0]);
-  glDeleteBuffers(gl_pos_vbos.size(), &gl_pos_vbos[0]);
-  glDeleteVertexArrays(1, &gl_vao);
-  glDeleteProgram(gl_program);
+  view_uniform_buffer.reset();
+  frame_uniform_buffer.reset();
 
   wireframe_drawer.reset();
 }
@@ -382,14 +494,19 @@ int main() {
   camera = std::make_unique<utils::Camera>(glfw_window);
 
   Initialize();
-  CreateShadowPass();
+  if (!kUseLightmap) {
+    CreateShadowPass();
+  }
   CreateLightPass();
 
   while (!glfwWindowShouldClose(glfw_window)) {
     glfwPollEvents();
     camera->Tick();
 
-    ShadowPass();
+    UpdateFrameUniforms();
+    if (!kUseLightmap) {
+      ShadowPass();
+    }
     LightPass();
 
     glfwSwapBuffers(glfw_window);
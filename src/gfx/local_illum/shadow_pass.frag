@@ -4,8 +4,15 @@ in vec3 frag_pos;
 
 out float out_color;
 
-uniform vec3 light_pos;
-uniform float far_plane;
+// Must match FrameUniforms in main.cpp.
+layout(std140, binding = 0) uniform FrameUniforms {
+  vec3 light_pos;
+  float far_plane;
+  vec3 ambient_I;
+  vec3 diffuse_I;
+  vec3 specular_I;
+  vec3 camera_pos;
+};
 
 void main() {
   out_color = length(frag_pos - light_pos) / far_plane;
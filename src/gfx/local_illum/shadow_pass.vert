@@ -4,8 +4,11 @@ layout(location = 0) in vec3 vert_pos;
 
 out vec3 frag_pos;
 
-uniform mat4 mvp_mat;
-uniform mat4 model_mat;
+// Must match ViewUniforms in main.cpp.
+layout(std140, binding = 1) uniform ViewUniforms {
+  mat4 model_mat;
+  mat4 mvp_mat;
+};
 
 void main() {
   frag_pos = (model_mat * vec4(vert_pos, 1.0)).xyz;
@@ -0,0 +1,159 @@
+#include "utils/bounds.h"
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILS_BOUNDS_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+namespace utils {
+
+namespace {
+
+// The kernels read the positions as a flat array of floats.
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float));
+
+#ifdef UTILS_BOUNDS_USE_SSE
+
+// Four positions are loaded as three registers holding x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3.
+// Transposes them into x0 x1 x2 x3 | y0 y1 y2 y3 | z0 z1 z2 z3.
+inline void TransposeToSoa(__m128 a, __m128 b, __m128 c, __m128* x, __m128* y, __m128* z) {
+  __m128 b2_c1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+  *x = _mm_shuffle_ps(a, b2_c1, _MM_SHUFFLE(2, 0, 3, 0));
+
+  __m128 a1_b0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+  __m128 b3_c2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+  *y = _mm_shuffle_ps(a1_b0, b3_c2, _MM_SHUFFLE(2, 0, 2, 0));
+
+  __m128 a2_b1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+  __m128 c0_c3 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+  *z = _mm_shuffle_ps(a2_b1, c0_c3, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+inline float GetLane(__m128 v, int lane) {
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, v);
+  return lanes[lane];
+}
+
+#endif // UTILS_BOUNDS_USE_SSE
+
+} // namespace
+
+Aabb ComputeAabbScalar(const glm::vec3* positions, size_t count) {
+  Aabb aabb;
+  for (size_t i = 0; i < count; ++i) {
+    aabb.min = glm::min(aabb.min, positions[i]);
+    aabb.max = glm::max(aabb.max, positions[i]);
+  }
+  return aabb;
+}
+
+glm::vec4 ComputeBoundingSphereScalar(const glm::vec3* positions, size_t count,
+                                      const Aabb& aabb) {
+  if (count == 0) {
+    return glm::vec4(0.f);
+  }
+  glm::vec3 center = aabb.GetCenter();
+  float max_dist_sq = 0.f;
+  for (size_t i = 0; i < count; ++i) {
+    glm::vec3 d = positions[i] - center;
+    max_dist_sq = std::max(max_dist_sq, d.x * d.x + d.y * d.y + d.z * d.z);
+  }
+  return glm::vec4(center, std::sqrt(max_dist_sq));
+}
+
+#ifdef UTILS_BOUNDS_USE_SSE
+
+Aabb ComputeAabb(const glm::vec3* positions, size_t count) {
+  const float* data = reinterpret_cast<const float*>(positions);
+  size_t num_blocks = count / 4;
+
+  // The three registers of a block hold the components in a rotating order, so each register
+  // accumulates its own mix of x, y and z. The lanes are sorted out after the loop.
+  __m128 min_a = _mm_set1_ps(std::numeric_limits<float>::max());
+  __m128 min_b = min_a;
+  __m128 min_c = min_a;
+  __m128 max_a = _mm_set1_ps(-std::numeric_limits<float>::max());
+  __m128 max_b = max_a;
+  __m128 max_c = max_a;
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const float* block = data + i * 12;
+    __m128 a = _mm_loadu_ps(block);
+    __m128 b = _mm_loadu_ps(block + 4);
+    __m128 c = _mm_loadu_ps(block + 8);
+    min_a = _mm_min_ps(min_a, a);
+    min_b = _mm_min_ps(min_b, b);
+    min_c = _mm_min_ps(min_c, c);
+    max_a = _mm_max_ps(max_a, a);
+    max_b = _mm_max_ps(max_b, b);
+    max_c = _mm_max_ps(max_c, c);
+  }
+
+  __m128 min_x, min_y, min_z, max_x, max_y, max_z;
+  TransposeToSoa(min_a, min_b, min_c, &min_x, &min_y, &min_z);
+  TransposeToSoa(max_a, max_b, max_c, &max_x, &max_y, &max_z);
+
+  Aabb aabb = ComputeAabbScalar(positions + num_blocks * 4, count - num_blocks * 4);
+  for (int lane = 0; lane < 4; ++lane) {
+    aabb.min = glm::min(aabb.min, glm::vec3(GetLane(min_x, lane), GetLane(min_y, lane),
+                                            GetLane(min_z, lane)));
+    aabb.max = glm::max(aabb.max, glm::vec3(GetLane(max_x, lane), GetLane(max_y, lane),
+                                            GetLane(max_z, lane)));
+  }
+  return aabb;
+}
+
+glm::vec4 ComputeBoundingSphere(const glm::vec3* positions, size_t count, const Aabb& aabb) {
+  if (count == 0) {
+    return glm::vec4(0.f);
+  }
+  glm::vec3 center = aabb.GetCenter();
+  const float* data = reinterpret_cast<const float*>(positions);
+  size_t num_blocks = count / 4;
+
+  __m128 center_x = _mm_set1_ps(center.x);
+  __m128 center_y = _mm_set1_ps(center.y);
+  __m128 center_z = _mm_set1_ps(center.z);
+  __m128 max_dist_sq = _mm_setzero_ps();
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const float* block = data + i * 12;
+    __m128 x, y, z;
+    TransposeToSoa(_mm_loadu_ps(block), _mm_loadu_ps(block + 4), _mm_loadu_ps(block + 8),
+                   &x, &y, &z);
+    __m128 dx = _mm_sub_ps(x, center_x);
+    __m128 dy = _mm_sub_ps(y, center_y);
+    __m128 dz = _mm_sub_ps(z, center_z);
+    __m128 dist_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                _mm_mul_ps(dz, dz));
+    max_dist_sq = _mm_max_ps(max_dist_sq, dist_sq);
+  }
+
+  // The tail reuses the scalar kernel, whose radius is the distance to the farthest position.
+  float radius =
+      ComputeBoundingSphereScalar(positions + num_blocks * 4, count - num_blocks * 4, aabb).w;
+  float max_lane_dist_sq =
+      std::max(std::max(GetLane(max_dist_sq, 0), GetLane(max_dist_sq, 1)),
+               std::max(GetLane(max_dist_sq, 2), GetLane(max_dist_sq, 3)));
+  return glm::vec4(center, std::max(radius, std::sqrt(max_lane_dist_sq)));
+}
+
+#else
+
+Aabb ComputeAabb(const glm::vec3* positions, size_t count) {
+  return ComputeAabbScalar(positions, count);
+}
+
+glm::vec4 ComputeBoundingSphere(const glm::vec3* positions, size_t count, const Aabb& aabb) {
+  return ComputeBoundingSphereScalar(positions, count, aabb);
+}
+
+#endif // UTILS_BOUNDS_USE_SSE
+
+} // namespace utils
@@ -0,0 +1,45 @@
+#ifndef UTILS_BOUNDS_H_
+#define UTILS_BOUNDS_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <limits>
+
+namespace utils {
+
+// Axis-aligned bounding box. The default box is empty, with min > max, so that merging anything
+// into it gives the bounds of that thing.
+struct Aabb {
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+  bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+  glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+  glm::vec3 GetSize() const { return max - min; }
+
+  void Merge(const Aabb& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+};
+
+// Returns the bounding box of |count| positions, or an empty box if |count| is 0. Runs four
+// positions at a time with SSE where it is available.
+Aabb ComputeAabb(const glm::vec3* positions, size_t count);
+
+// Returns a sphere (xyz center, w radius) around |count| positions. The sphere is centered on the
+// center of |aabb|, which must be the bounding box of the positions, and its radius is the distance
+// to the farthest position. This is never larger than half the diagonal of the box, and is usually
+// much tighter for rounded meshes. Returns a zero sphere if |count| is 0.
+glm::vec4 ComputeBoundingSphere(const glm::vec3* positions, size_t count, const Aabb& aabb);
+
+// Plain loop versions of the functions above, as a reference for the SSE kernels.
+Aabb ComputeAabbScalar(const glm::vec3* positions, size_t count);
+glm::vec4 ComputeBoundingSphereScalar(const glm::vec3* positions, size_t count,
+                                      const Aabb& aabb);
+
+} // namespace utils
+
+#endif // UTILS_BOUNDS_H_
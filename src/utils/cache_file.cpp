@@ -0,0 +1,60 @@
+#include "utils/cache_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace utils {
+
+bool GetSourceStamp(const std::string& path, uint64_t* size, int64_t* mtime) {
+  std::error_code err;
+  auto file_size = std::filesystem::file_size(path, err);
+  if (err) {
+    return false;
+  }
+  auto file_time = std::filesystem::last_write_time(path, err);
+  if (err) {
+    return false;
+  }
+  *size = static_cast<uint64_t>(file_size);
+  *mtime = static_cast<int64_t>(file_time.time_since_epoch().count());
+  return true;
+}
+
+uint32_t Fnv1a(const void* data, size_t size, uint32_t hash) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+bool WriteFileAtomically(const std::string& path, const std::vector<uint8_t>& bytes) {
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return false;
+    }
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    if (!file.good()) {
+      file.close();
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  std::error_code err;
+  std::filesystem::rename(tmp_path, path, err);
+  if (err) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+} // namespace utils
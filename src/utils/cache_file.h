@@ -0,0 +1,30 @@
+#ifndef UTILS_CACHE_FILE_H_
+#define UTILS_CACHE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+
+// Helpers for the files that are built from a source file and stored next to it, like the mesh
+// cache, the texture cache and the baked lighting. Such a file records the stamp of its source and
+// a hash of the options it was built with, and it is rebuilt when either of them changes.
+
+// Size and modification time of the file at |path|. Returns false if the file can't be found.
+bool GetSourceStamp(const std::string& path, uint64_t* size, int64_t* mtime);
+
+constexpr uint32_t kFnv1aBasis = 2166136261u;
+
+// 32-bit FNV-1a hash of |size| bytes at |data|. Passing the hash of some earlier data as |hash|
+// gives the hash of both, one after the other.
+uint32_t Fnv1a(const void* data, size_t size, uint32_t hash = kFnv1aBasis);
+
+// Writes |bytes| under a temporary name next to |path| and then renames the file to |path|, so
+// that readers never see a partially written file.
+bool WriteFileAtomically(const std::string& path, const std::vector<uint8_t>& bytes);
+
+} // namespace utils
+
+#endif // UTILS_CACHE_FILE_H_
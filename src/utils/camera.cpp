@@ -27,6 +27,50 @@ static void MouseCallbackWrapper(GLFWwindow *window, double x, double y) {
 
 } // internal
 
+bool Frustum::IsOutside(const Aabb& aabb) const {
+  for (const glm::vec4& plane : planes) {
+    // Corner of the box farthest along the plane normal.
+    glm::vec3 corner(plane.x > 0.f ? aabb.max.x : aabb.min.x,
+                     plane.y > 0.f ? aabb.max.y : aabb.min.y,
+                     plane.z > 0.f ? aabb.max.z : aabb.min.z);
+    if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Frustum::Contains(const Aabb& aabb) const {
+  for (const glm::vec4& plane : planes) {
+    // Corner of the box farthest against the plane normal.
+    glm::vec3 corner(plane.x > 0.f ? aabb.min.x : aabb.max.x,
+                     plane.y > 0.f ? aabb.min.y : aabb.max.y,
+                     plane.z > 0.f ? aabb.min.z : aabb.max.z);
+    if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Frustum ExtractFrustum(const glm::mat4& view_proj_mat) {
+  // Every plane is the sum or difference of the last row of the matrix and one of the others
+  // (Gribb and Hartmann). GLM matrices are column-major, so rows are read across the columns.
+  glm::mat4 rows = glm::transpose(view_proj_mat);
+
+  Frustum frustum;
+  frustum.planes[0] = rows[3] + rows[0];
+  frustum.planes[1] = rows[3] - rows[0];
+  frustum.planes[2] = rows[3] + rows[1];
+  frustum.planes[3] = rows[3] - rows[1];
+  frustum.planes[4] = rows[3] + rows[2];
+  frustum.planes[5] = rows[3] - rows[2];
+  for (glm::vec4& plane : frustum.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
+
 Camera::Camera(GLFWwindow* window) 
     : glfw_window_(window), view_mat_(1.f), camera_rotation_(1.f, 0.f, 0.f, 0.f),
       camera_pos_(0.f, 0.f, 0.f) {
@@ -7,8 +7,28 @@
 
 #include <limits>
 
+#include "utils/bounds.h"
+
 namespace utils {
 
+// View frustum as six planes, whose normals (xyz) point inside: a point p is inside a plane if
+// dot(plane.xyz, p) + plane.w >= 0.
+struct Frustum {
+  // Left, right, bottom, top, near, far.
+  glm::vec4 planes[6];
+
+  // True if |aabb| is entirely outside one of the planes. Boxes near the corners of the frustum
+  // can be outside of it without being outside of any single plane, so this is conservative.
+  bool IsOutside(const Aabb& aabb) const;
+
+  // True if |aabb| is entirely inside all the planes.
+  bool Contains(const Aabb& aabb) const;
+};
+
+// Extracts the planes of the frustum of |view_proj_mat|, in the space that the matrix transforms
+// from. With a model-view-projection matrix, the planes are in model space.
+Frustum ExtractFrustum(const glm::mat4& view_proj_mat);
+
 class Camera {
 public:
   Camera(GLFWwindow* window);
@@ -23,6 +43,11 @@ public:
   const glm::mat4& GetViewMatrix() const { return view_mat_; }
   const glm::vec3& GetCameraPos() const { return camera_pos_; }
 
+  // Frustum of the camera in world space, for the projection |proj_mat|.
+  Frustum GetFrustum(const glm::mat4& proj_mat) const {
+    return ExtractFrustum(proj_mat * view_mat_);
+  }
+
   void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
   void MouseCallback(GLFWwindow* window, double x, double y);
 
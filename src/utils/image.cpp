@@ -3,17 +3,167 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILS_IMAGE_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace utils {
 
+namespace {
+
+void FlipRows(uint8_t* pixels, size_t row_size, size_t num_rows) {
+  for (size_t top = 0; top < num_rows / 2; ++top) {
+    size_t bottom = num_rows - 1 - top;
+    std::swap_ranges(pixels + top * row_size, pixels + (top + 1) * row_size, 
+                     pixels + bottom * row_size);
+  }
+}
+
+// Linear values are encoded to sRGB by looking up the nearest of this many evenly spaced values.
+// The steps are fine enough to round the dark end, where sRGB is steepest, to the right byte.
+constexpr int kSrgbEncodeTableSize = 1 << 13;
+
+struct SrgbTables {
+  float decode[256];                        // sRGB byte to linear [0, 1]
+  uint8_t encode[kSrgbEncodeTableSize];     // linear * (kSrgbEncodeTableSize - 1) to sRGB byte
+};
+
+const SrgbTables& GetSrgbTables() {
+  static const SrgbTables tables = []() {
+    SrgbTables tables;
+    for (int i = 0; i < 256; ++i) {
+      float c = i / 255.f;
+      tables.decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < kSrgbEncodeTableSize; ++i) {
+      float c = static_cast<float>(i) / (kSrgbEncodeTableSize - 1);
+      float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+      tables.encode[i] = static_cast<uint8_t>(std::lround(std::clamp(srgb, 0.f, 1.f) * 255.f));
+    }
+    return tables;
+  }();
+  return tables;
+}
+
+// Converts a row of pixels to linear RGBA floats. Images without alpha get an alpha of 1.
+void DecodeRow(const uint8_t* src, uint32_t width, uint32_t num_channels, 
+               const SrgbTables& tables, float* dst) {
+  for (uint32_t x = 0; x < width; ++x) {
+    const uint8_t* pixel = src + x * num_channels;
+    dst[4 * x + 0] = tables.decode[pixel[0]];
+    dst[4 * x + 1] = tables.decode[pixel[1]];
+    dst[4 * x + 2] = tables.decode[pixel[2]];
+    dst[4 * x + 3] = num_channels == 4 ? pixel[3] * (1.f / 255.f) : 1.f;
+  }
+}
+
+// Averages the 2x2 block of linear pixels at |x0| and |x1| of two decoded rows and writes it
+// back as an sRGB pixel.
+inline void AverageQuad(const float* row0, const float* row1, uint32_t x0, uint32_t x1,
+                        uint32_t num_channels, const SrgbTables& tables, uint8_t* dst) {
+#ifdef UTILS_IMAGE_USE_SSE
+  // Each pixel is one register, so the four channels are averaged together.
+  __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + 4 * x0), _mm_loadu_ps(row0 + 4 * x1)),
+                          _mm_add_ps(_mm_loadu_ps(row1 + 4 * x0), _mm_loadu_ps(row1 + 4 * x1)));
+  const __m128 scale = _mm_setr_ps(0.25f * (kSrgbEncodeTableSize - 1), 
+                                   0.25f * (kSrgbEncodeTableSize - 1),
+                                   0.25f * (kSrgbEncodeTableSize - 1), 0.25f * 255.f);
+  alignas(16) int32_t idx[4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(idx), _mm_cvtps_epi32(_mm_mul_ps(sum, scale)));
+#else
+  int32_t idx[4];
+  for (int c = 0; c < 4; ++c) {
+    float sum = row0[4 * x0 + c] + row0[4 * x1 + c] + row1[4 * x0 + c] + row1[4 * x1 + c];
+    float scale = c < 3 ? 0.25f * (kSrgbEncodeTableSize - 1) : 0.25f * 255.f;
+    idx[c] = static_cast<int32_t>(std::lround(sum * scale));
+  }
+#endif
+  dst[0] = tables.encode[idx[0]];
+  dst[1] = tables.encode[idx[1]];
+  dst[2] = tables.encode[idx[2]];
+  if (num_channels == 4) {
+    dst[3] = static_cast<uint8_t>(idx[3]);
+  }
+}
+
+void DownsampleLevel(const uint8_t* src, uint32_t src_width, uint32_t src_height, 
+                     uint32_t num_channels, ImageMipLevel* dst) {
+  const SrgbTables& tables = GetSrgbTables();
+
+  dst->width = std::max(1u, src_width / 2);
+  dst->height = std::max(1u, src_height / 2);
+  dst->data.resize(static_cast<size_t>(dst->width) * dst->height * num_channels);
+
+  std::vector<float> row0(4 * src_width);
+  std::vector<float> row1(4 * src_width);
+  size_t src_row_size = static_cast<size_t>(src_width) * num_channels;
+  for (uint32_t y = 0; y < dst->height; ++y) {
+    // A source that is a single pixel high or wide uses that pixel twice.
+    uint32_t src_y0 = std::min(2 * y, src_height - 1);
+    uint32_t src_y1 = std::min(2 * y + 1, src_height - 1);
+    DecodeRow(src + src_y0 * src_row_size, src_width, num_channels, tables, row0.data());
+    DecodeRow(src + src_y1 * src_row_size, src_width, num_channels, tables, row1.data());
+
+    uint8_t* dst_row = dst->data.data() + static_cast<size_t>(y) * dst->width * num_channels;
+    for (uint32_t x = 0; x < dst->width; ++x) {
+      uint32_t src_x0 = std::min(2 * x, src_width - 1);
+      uint32_t src_x1 = std::min(2 * x + 1, src_width - 1);
+      AverageQuad(row0.data(), row1.data(), src_x0, src_x1, num_channels, tables, 
+                  dst_row + x * num_channels);
+    }
+  }
+}
+
+} // namespace
+
+uint32_t GetNumChannels(ImageFormat format) {
+  switch (format) {
+    case ImageFormat::kRGB:
+      return 3;
+    case ImageFormat::kRGBA:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+void GenerateMips(Image* img) {
+  img->mips.clear();
+  uint32_t num_channels = GetNumChannels(img->format);
+  if (num_channels == 0) {
+    return;
+  }
+
+  const uint8_t* src = img->data.data();
+  uint32_t src_width = img->width;
+  uint32_t src_height = img->height;
+  while (src_width > 1 || src_height > 1) {
+    ImageMipLevel level;
+    DownsampleLevel(src, src_width, src_height, num_channels, &level);
+    img->mips.push_back(std::move(level));
+
+    src = img->mips.back().data.data();
+    src_width = img->mips.back().width;
+    src_height = img->mips.back().height;
+  }
+}
+
 std::shared_ptr<Image> LoadImageFromFile(const std::string& path, bool flip) {
   int load_width = -1;
   int load_height = -1;
   int load_channels = -1;
 
-  stbi_set_flip_vertically_on_load(flip);
+  // stb_image's flip setting is global, so the rows are flipped here instead to keep concurrent
+  // loads independent.
   stbi_uc *pixels = stbi_load(path.c_str(), &load_width, &load_height, 
                               &load_channels, 0);
   if (pixels == nullptr) {
@@ -32,13 +182,19 @@ std::shared_ptr<Image> LoadImageFromFile(const std::string& path, bool flip) {
       img->format = ImageFormat::kRGBA;
       break;
     default:
+      stbi_image_free(pixels);
       return nullptr;
   }
 
-  uint32_t load_size = load_width * load_height * load_channels;
-  img->data = std::vector<uint8_t>(pixels, pixels + load_size);
+  size_t row_size = static_cast<size_t>(load_width) * load_channels;
+  if (flip) {
+    FlipRows(pixels, row_size, load_height);
+  }
+
+  img->data = std::vector<uint8_t>(pixels, pixels + row_size * load_height);
+  stbi_image_free(pixels);
 
   return img;
 }
 
-} // namespace utils
\ No newline at end of file
+} // namespace utils
@@ -1,9 +1,9 @@
 #ifndef UTILS_IMAGE_H_
-#define UTILS_TEXTURE_H_
+#define UTILS_IMAGE_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <optional>
 #include <string>
 #include <vector>
 
@@ -15,6 +15,13 @@ enum class ImageFormat {
   kRGBA
 };
 
+struct ImageMipLevel {
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  std::vector<uint8_t> data;
+};
+
 struct Image {
   ImageFormat format = ImageFormat::kInvalid;
 
@@ -22,12 +29,23 @@ struct Image {
   uint32_t height = 0;
 
   std::vector<uint8_t> data;
+
+  // Mip levels 1 and up, down to 1x1. Level 0 is |data|. Empty unless GenerateMips() was called.
+  std::vector<ImageMipLevel> mips;
 };
 
+uint32_t GetNumChannels(ImageFormat format);
+
+// Safe to call from several threads at once.
 std::shared_ptr<Image> LoadImageFromFile(const std::string& path, bool flip);
 
+// Fills in |img->mips| with a 2x2 box filter. The color channels are treated as sRGB and averaged
+// in linear space, so that minified textures keep their brightness; alpha is averaged as is.
+// Levels with an odd size drop their last row or column.
+void GenerateMips(Image* img);
+
 // std::optional<std::vector<Image>> LoadImagesFromDir(const std::string& dir);
 
 } // namespace utils
 
-#endif // UTILS_IMAGE_H_
\ No newline at end of file
+#endif // UTILS_IMAGE_H_
@@ -0,0 +1,557 @@
+#include "utils/lightmap_baker.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/cache_file.h"
+#include "utils/lightmap_uv.h"
+#include "utils/model.h"
+#include "utils/parallel.h"
+#include "utils/texture_file.h"
+#include "utils/triangle_bvh.h"
+
+namespace utils {
+
+namespace {
+
+constexpr float kPi = 3.14159265358979f;
+
+// Rays leave a surface this fraction of the diagonal of the model bounds above it, so that they
+// don't hit it again.
+constexpr float kSurfaceOffsetScale = 1e-4f;
+
+// Texel centers this close outside a triangle, in barycentric units, still count as covered, so
+// that the texels on shared edges aren't lost to rounding.
+constexpr float kCoverageEpsilon = 1e-5f;
+
+// Weights of the taps of the filter at offsets 0, 1 and 2 along each axis (a B3 spline).
+constexpr float kFilterTaps[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+// The indirect light is filtered with steps of 1, 2, 4, 8 and 16 texels. The direct light is much
+// less noisy and only gets the first pass, which keeps its shadow edges sharp.
+constexpr int kNumIndirectFilterPasses = 5;
+constexpr int kNumDirectFilterPasses = 1;
+
+// Neighbors are weighted by the cosine between the normals to this power, and by a Gaussian of
+// their distance, whose deviation is this many texels times the step of the pass.
+constexpr float kFilterNormalPower = 32.f;
+constexpr float kFilterPositionSigma = 2.f;
+
+// Every pass grows the charts by a texel into the padding around them.
+constexpr int kNumDilationPasses = 4;
+
+// Must be incremented whenever the contents of the file change for the same options.
+constexpr uint32_t kFileVersion = 1;
+
+// Surface at the center of every texel of the atlas.
+struct TexelSurfaces {
+  std::vector<glm::vec3> positions;
+
+  // Interpolated vertex normal, which is the side that the texel is lit on, and the normal of the
+  // triangle turned to the same side.
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec3> face_normals;
+
+  std::vector<uint8_t> covered;
+};
+
+// Everything that the paths read. Tiles only read it, so any number of them can be traced at once.
+struct BakeContext {
+  const Model& model;
+  const TriangleBvh& bvh;
+  const LightmapBakeOptions& options;
+  glm::vec3 sun_dir;
+  float surface_offset;
+};
+
+// Hashes the layout and the bake options that change the contents of the lightmap.
+uint32_t GetOptionsKey(const LightmapLayout& layout, const LightmapBakeOptions& options) {
+  std::vector<float> values = {
+      static_cast<float>(kFileVersion),
+      static_cast<float>(layout.width), static_cast<float>(layout.height), layout.texel_size,
+      options.sun_dir.x, options.sun_dir.y, options.sun_dir.z,
+      options.sun_color.x, options.sun_color.y, options.sun_color.z,
+      options.sky_color.x, options.sky_color.y, options.sky_color.z,
+      static_cast<float>(options.samples_per_texel), static_cast<float>(options.max_bounces),
+      static_cast<float>(options.tile_size), options.denoise ? 1.f : 0.f };
+  for (const LightmapPointLight& light : options.point_lights) {
+    values.insert(values.end(), { light.position.x, light.position.y, light.position.z,
+                                  light.radius,
+                                  light.intensity.x, light.intensity.y, light.intensity.z });
+  }
+  uint32_t key = Fnv1a(values.data(), values.size() * sizeof(float));
+  key = Fnv1a(options.material_albedos.data(),
+              options.material_albedos.size() * sizeof(glm::vec3), key);
+
+  // The source vertices and the indices follow the welding and the order of the vertices of the
+  // model, which the stamp of the model file doesn't cover.
+  for (const LightmapMesh& mesh : layout.meshes) {
+    key = Fnv1a(mesh.source_vertices.data(), mesh.source_vertices.size() * sizeof(uint32_t), key);
+    key = Fnv1a(mesh.uvs.data(), mesh.uvs.size() * sizeof(glm::vec2), key);
+    key = Fnv1a(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), key);
+  }
+  return key;
+}
+
+// Albedo of the material of the first vertex of triangle |triangle_idx| of |mesh|.
+glm::vec3 GetAlbedo(const Mesh& mesh, uint32_t triangle_idx, const LightmapBakeOptions& options) {
+  int mtl_id = mesh.material_ids[mesh.indices[3 * triangle_idx]];
+  if (mtl_id < 0 || static_cast<size_t>(mtl_id) >= options.material_albedos.size()) {
+    return glm::vec3(0.5f);
+  }
+  return options.material_albedos[mtl_id];
+}
+
+float Cross2(const glm::vec2& a, const glm::vec2& b) {
+  return a.x * b.y - a.y * b.x;
+}
+
+glm::vec3 SampleSphere(float u1, float u2) {
+  float z = 1.f - 2.f * u1;
+  float r = std::sqrt(std::max(0.f, 1.f - z * z));
+  float phi = 2.f * kPi * u2;
+  return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Direction around the unit normal |n|, with a density proportional to its cosine with |n|.
+glm::vec3 SampleCosine(const glm::vec3& n, float u1, float u2) {
+  // Orthonormal basis around |n| (Duff et al.).
+  float sign = n.z >= 0.f ? 1.f : -1.f;
+  float a = -1.f / (sign + n.z);
+  float b = n.x * n.y * a;
+  glm::vec3 t(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+  glm::vec3 s(b, sign + n.y * n.y * a, -n.y);
+
+  float r = std::sqrt(u1);
+  float phi = 2.f * kPi * u2;
+  return r * std::cos(phi) * t + r * std::sin(phi) * s + std::sqrt(std::max(0.f, 1.f - u1)) * n;
+}
+
+// Finds the surface at the center of every texel that a triangle covers. Triangles too thin to
+// cover any texel center still get the texel under their centroid, if no other triangle has it.
+TexelSurfaces RasterizeTexels(const Model& model, const LightmapLayout& layout) {
+  const size_t num_texels = static_cast<size_t>(layout.width) * layout.height;
+  TexelSurfaces surfaces;
+  surfaces.positions.resize(num_texels, glm::vec3(0.f));
+  surfaces.normals.resize(num_texels, glm::vec3(0.f));
+  surfaces.face_normals.resize(num_texels, glm::vec3(0.f));
+  surfaces.covered.resize(num_texels, 0);
+
+  const glm::vec2 atlas_size(layout.width, layout.height);
+  for (int mesh_idx = 0; mesh_idx < model.GetNumMeshes(); ++mesh_idx) {
+    const Mesh& mesh = model.GetMeshByIndex(mesh_idx);
+    const LightmapMesh& lightmap_mesh = layout.meshes[mesh_idx];
+    for (size_t i = 0; i + 2 < lightmap_mesh.indices.size(); i += 3) {
+      uint32_t verts[3];
+      glm::vec2 uvs[3];
+      for (int j = 0; j < 3; ++j) {
+        verts[j] = lightmap_mesh.source_vertices[lightmap_mesh.indices[i + j]];
+        uvs[j] = lightmap_mesh.uvs[lightmap_mesh.indices[i + j]] * atlas_size;
+      }
+      const glm::vec3& p0 = mesh.positions[verts[0]];
+      const glm::vec3& p1 = mesh.positions[verts[1]];
+      const glm::vec3& p2 = mesh.positions[verts[2]];
+      glm::vec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+      float face_normal_length = glm::length(face_normal);
+      if (!(face_normal_length > 0.f)) {
+        continue;
+      }
+      face_normal /= face_normal_length;
+
+      auto write_texel = [&](size_t texel, const glm::vec3& bary) {
+        glm::vec3 normal = face_normal;
+        if (!mesh.normals.empty()) {
+          glm::vec3 vertex_normal = bary.x * mesh.normals[verts[0]] +
+                                    bary.y * mesh.normals[verts[1]] +
+                                    bary.z * mesh.normals[verts[2]];
+          if (glm::dot(vertex_normal, vertex_normal) > 0.f) {
+            normal = glm::normalize(vertex_normal);
+          }
+        }
+        surfaces.positions[texel] = bary.x * p0 + bary.y * p1 + bary.z * p2;
+        surfaces.normals[texel] = normal;
+        surfaces.face_normals[texel] = glm::dot(face_normal, normal) < 0.f ? -face_normal :
+                                                                             face_normal;
+        surfaces.covered[texel] = 1;
+      };
+
+      bool covers_texel = false;
+      float area = Cross2(uvs[1] - uvs[0], uvs[2] - uvs[0]);
+      if (area != 0.f) {
+        // Texels whose centers are within the bounds of the triangle.
+        glm::vec2 uv_min = glm::min(uvs[0], glm::min(uvs[1], uvs[2]));
+        glm::vec2 uv_max = glm::max(uvs[0], glm::max(uvs[1], uvs[2]));
+        int x_begin = std::max(static_cast<int>(std::ceil(uv_min.x - 0.5f)), 0);
+        int y_begin = std::max(static_cast<int>(std::ceil(uv_min.y - 0.5f)), 0);
+        int x_end = std::min(static_cast<int>(std::floor(uv_max.x - 0.5f)) + 1,
+                             static_cast<int>(layout.width));
+        int y_end = std::min(static_cast<int>(std::floor(uv_max.y - 0.5f)) + 1,
+                             static_cast<int>(layout.height));
+        for (int y = y_begin; y < y_end; ++y) {
+          for (int x = x_begin; x < x_end; ++x) {
+            glm::vec2 center(x + 0.5f, y + 0.5f);
+            float b0 = Cross2(uvs[1] - center, uvs[2] - center) / area;
+            float b1 = Cross2(uvs[2] - center, uvs[0] - center) / area;
+            float b2 = 1.f - b0 - b1;
+            if (b0 < -kCoverageEpsilon || b1 < -kCoverageEpsilon || b2 < -kCoverageEpsilon) {
+              continue;
+            }
+            covers_texel = true;
+            size_t texel = static_cast<size_t>(y) * layout.width + x;
+            if (!surfaces.covered[texel]) {
+              write_texel(texel, glm::vec3(b0, b1, b2));
+            }
+          }
+        }
+      }
+      if (!covers_texel) {
+        glm::vec2 centroid = (uvs[0] + uvs[1] + uvs[2]) / 3.f;
+        int x = std::clamp(static_cast<int>(centroid.x), 0, static_cast<int>(layout.width) - 1);
+        int y = std::clamp(static_cast<int>(centroid.y), 0, static_cast<int>(layout.height) - 1);
+        size_t texel = static_cast<size_t>(y) * layout.width + x;
+        if (!surfaces.covered[texel]) {
+          write_texel(texel, glm::vec3(1.f / 3.f));
+        }
+      }
+    }
+  }
+  return surfaces;
+}
+
+// Irradiance at |origin|, which is already off the surface, from the sun.
+glm::vec3 SampleSunLight(const BakeContext& ctx, const glm::vec3& origin, const glm::vec3& normal,
+                         size_t* num_rays) {
+  const glm::vec3& sun_color = ctx.options.sun_color;
+  float n_dot_l = glm::dot(normal, ctx.sun_dir);
+  if (sun_color == glm::vec3(0.f) || n_dot_l <= 0.f) {
+    return glm::vec3(0.f);
+  }
+  ++*num_rays;
+  return ctx.bvh.IsOccluded({ origin, ctx.sun_dir }) ? glm::vec3(0.f) : sun_color * n_dot_l;
+}
+
+// Irradiance at |origin|, which is already off the surface, from the point lights, each seen from
+// a random point of its sphere.
+glm::vec3 SamplePointLights(const BakeContext& ctx, const glm::vec3& origin,
+                            const glm::vec3& normal, std::mt19937* rng, size_t* num_rays) {
+  std::uniform_real_distribution<float> unit_dist(0.f, 1.f);
+  glm::vec3 irradiance(0.f);
+  for (const LightmapPointLight& light : ctx.options.point_lights) {
+    glm::vec3 light_pos = light.position +
+                          light.radius * SampleSphere(unit_dist(*rng), unit_dist(*rng));
+    glm::vec3 to_light = light_pos - origin;
+    float distance_sq = glm::dot(to_light, to_light);
+    if (!(distance_sq > 0.f)) {
+      continue;
+    }
+    float n_dot_l = glm::dot(normal, to_light) / std::sqrt(distance_sq);
+    if (n_dot_l <= 0.f) {
+      continue;
+    }
+    // The direction isn't normalized, so the light is at t = 1.
+    ++*num_rays;
+    if (!ctx.bvh.IsOccluded({ origin, to_light, 0.f, 1.f - 1e-4f })) {
+      irradiance += light.intensity * (n_dot_l / distance_sq);
+    }
+  }
+  return irradiance;
+}
+
+// Radiance arriving at |origin| from |dir|, gathered along a path of up to max_bounces surfaces.
+glm::vec3 TracePath(const BakeContext& ctx, glm::vec3 origin, glm::vec3 dir, std::mt19937* rng,
+                    size_t* num_rays) {
+  std::uniform_real_distribution<float> unit_dist(0.f, 1.f);
+  glm::vec3 radiance(0.f);
+  glm::vec3 throughput(1.f);
+  for (int bounce = 0; bounce < std::max(ctx.options.max_bounces, 1); ++bounce) {
+    ++*num_rays;
+    std::optional<RayHit> hit = ctx.bvh.Intersect({ origin, dir });
+    if (!hit.has_value()) {
+      radiance += throughput * ctx.options.sky_color;
+      break;
+    }
+
+    const Mesh& mesh = ctx.model.GetMeshByIndex(hit->mesh_idx);
+    const uint32_t* tri = &mesh.indices[3 * hit->triangle_idx];
+    const glm::vec3& p0 = mesh.positions[tri[0]];
+    glm::vec3 normal = glm::normalize(glm::cross(mesh.positions[tri[1]] - p0,
+                                                 mesh.positions[tri[2]] - p0));
+    if (glm::dot(normal, dir) > 0.f) {
+      normal = -normal;
+    }
+    origin += dir * hit->t + normal * ctx.surface_offset;
+
+    // The surface reflects albedo / pi of its irradiance. The next direction is cosine-weighted,
+    // which cancels the pi for the light that it brings.
+    throughput *= GetAlbedo(mesh, hit->triangle_idx, ctx.options);
+    radiance += throughput / kPi * (SampleSunLight(ctx, origin, normal, num_rays) +
+                                    SamplePointLights(ctx, origin, normal, rng, num_rays));
+    dir = SampleCosine(normal, unit_dist(*rng), unit_dist(*rng));
+  }
+  return radiance;
+}
+
+// One pass of the edge-avoiding a-trous wavelet filter (Dammertz et al.): a 5x5 B3 spline kernel
+// with |step| texels between its taps, over the covered texels only.
+void FilterPass(const TexelSurfaces& surfaces, const LightmapLayout& layout, int step,
+                const std::vector<glm::vec3>& in, std::vector<glm::vec3>* out) {
+  const float sigma = kFilterPositionSigma * step * layout.texel_size;
+  const float inv_two_sigma_sq = sigma > 0.f ? 1.f / (2.f * sigma * sigma) : 0.f;
+  const int width = static_cast<int>(layout.width);
+  const int height = static_cast<int>(layout.height);
+  ParallelFor(layout.height, [&](size_t row) {
+    const int y = static_cast<int>(row);
+    for (int x = 0; x < width; ++x) {
+      const size_t texel = static_cast<size_t>(y) * width + x;
+      if (!surfaces.covered[texel]) {
+        (*out)[texel] = in[texel];
+        continue;
+      }
+
+      glm::vec3 sum(0.f);
+      float weight_sum = 0.f;
+      for (int dy = -2; dy <= 2; ++dy) {
+        int ny = y + dy * step;
+        if (ny < 0 || ny >= height) {
+          continue;
+        }
+        for (int dx = -2; dx <= 2; ++dx) {
+          int nx = x + dx * step;
+          size_t neighbor = static_cast<size_t>(ny) * width + nx;
+          if (nx < 0 || nx >= width || !surfaces.covered[neighbor]) {
+            continue;
+          }
+          float n_dot = glm::dot(surfaces.normals[texel], surfaces.normals[neighbor]);
+          if (n_dot <= 0.f) {
+            continue;
+          }
+          glm::vec3 offset = surfaces.positions[neighbor] - surfaces.positions[texel];
+          float weight = kFilterTaps[std::abs(dx)] * kFilterTaps[std::abs(dy)] *
+                         std::pow(n_dot, kFilterNormalPower) *
+                         std::exp(-glm::dot(offset, offset) * inv_two_sigma_sq);
+          sum += weight * in[neighbor];
+          weight_sum += weight;
+        }
+      }
+      // The texel itself always has a weight.
+      (*out)[texel] = sum / weight_sum;
+    }
+  });
+}
+
+std::vector<glm::vec3> Denoise(const TexelSurfaces& surfaces, const LightmapLayout& layout,
+                               int num_passes, std::vector<glm::vec3> values) {
+  std::vector<glm::vec3> filtered(values.size());
+  for (int pass = 0; pass < num_passes; ++pass) {
+    FilterPass(surfaces, layout, 1 << pass, values, &filtered);
+    values.swap(filtered);
+  }
+  return values;
+}
+
+// Gives the empty texels next to the charts the mean of their non-empty neighbors.
+void Dilate(const TexelSurfaces& surfaces, const LightmapLayout& layout,
+            std::vector<glm::vec3>* irradiance) {
+  const int width = static_cast<int>(layout.width);
+  const int height = static_cast<int>(layout.height);
+  std::vector<uint8_t> filled = surfaces.covered;
+  for (int pass = 0; pass < kNumDilationPasses; ++pass) {
+    // Only reads the texels filled by the previous passes, whose values don't change in this one.
+    std::vector<uint8_t> next_filled = filled;
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const size_t texel = static_cast<size_t>(y) * width + x;
+        if (filled[texel]) {
+          continue;
+        }
+        glm::vec3 sum(0.f);
+        int count = 0;
+        for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ++ny) {
+          for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx) {
+            size_t neighbor = static_cast<size_t>(ny) * width + nx;
+            if (filled[neighbor]) {
+              sum += (*irradiance)[neighbor];
+              ++count;
+            }
+          }
+        }
+        if (count > 0) {
+          (*irradiance)[texel] = sum / static_cast<float>(count);
+          next_filled[texel] = 1;
+        }
+      }
+    }
+    filled.swap(next_filled);
+  }
+}
+
+uint8_t EncodeSrgb(float value) {
+  value = std::clamp(value, 0.f, 1.f);
+  float srgb = value <= 0.0031308f ? 12.92f * value : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(srgb * 255.f + 0.5f);
+}
+
+} // namespace
+
+Lightmap BakeLightmap(const Model& model, const LightmapLayout& layout, const TriangleBvh& bvh,
+                      const LightmapBakeOptions& options, LightmapBakeStats* stats) {
+  auto start = std::chrono::steady_clock::now();
+
+  Lightmap lightmap;
+  if (layout.width == 0 || layout.height == 0 ||
+      layout.meshes.size() != static_cast<size_t>(model.GetNumMeshes())) {
+    return lightmap;
+  }
+  lightmap.width = layout.width;
+  lightmap.height = layout.height;
+  const size_t num_texels = static_cast<size_t>(layout.width) * layout.height;
+  const TexelSurfaces surfaces = RasterizeTexels(model, layout);
+
+  const BakeContext ctx = {
+      model, bvh, options, glm::normalize(options.sun_dir),
+      kSurfaceOffsetScale * glm::length(model.GetAabb().GetSize()) };
+  const uint32_t tile_size = std::max(options.tile_size, 1u);
+  const uint32_t tiles_x = (layout.width + tile_size - 1) / tile_size;
+  const uint32_t tiles_y = (layout.height + tile_size - 1) / tile_size;
+  const int num_samples = std::max(options.samples_per_texel, 1);
+
+  std::vector<glm::vec3> direct(num_texels, glm::vec3(0.f));
+  std::vector<glm::vec3> indirect(num_texels, glm::vec3(0.f));
+  std::atomic<size_t> num_rays(0);
+  ParallelFor(static_cast<size_t>(tiles_x) * tiles_y, [&](size_t tile_idx) {
+    // Seeded by tile, so that the result doesn't depend on which thread traces what.
+    std::mt19937 rng(static_cast<uint32_t>(tile_idx));
+    std::uniform_real_distribution<float> unit_dist(0.f, 1.f);
+    size_t tile_rays = 0;
+
+    const uint32_t x_begin = static_cast<uint32_t>(tile_idx % tiles_x) * tile_size;
+    const uint32_t y_begin = static_cast<uint32_t>(tile_idx / tiles_x) * tile_size;
+    const uint32_t x_end = std::min(x_begin + tile_size, layout.width);
+    const uint32_t y_end = std::min(y_begin + tile_size, layout.height);
+    for (uint32_t y = y_begin; y < y_end; ++y) {
+      for (uint32_t x = x_begin; x < x_end; ++x) {
+        const size_t texel = static_cast<size_t>(y) * layout.width + x;
+        if (!surfaces.covered[texel]) {
+          continue;
+        }
+        const glm::vec3& normal = surfaces.normals[texel];
+        const glm::vec3& face_normal = surfaces.face_normals[texel];
+        const glm::vec3 origin = surfaces.positions[texel] + face_normal * ctx.surface_offset;
+
+        glm::vec3 point_light_sum(0.f);
+        glm::vec3 path_sum(0.f);
+        for (int sample = 0; sample < num_samples; ++sample) {
+          point_light_sum += SamplePointLights(ctx, origin, normal, &rng, &tile_rays);
+
+          // Directions under the triangle would start the path inside the surface.
+          glm::vec3 dir = SampleCosine(normal, unit_dist(rng), unit_dist(rng));
+          if (glm::dot(dir, face_normal) > 0.f) {
+            path_sum += TracePath(ctx, origin, dir, &rng, &tile_rays);
+          }
+        }
+        // The sun is a single direction, so one shadow ray settles it. With cosine-weighted
+        // directions, the irradiance is pi times the mean radiance of the paths.
+        direct[texel] = SampleSunLight(ctx, origin, normal, &tile_rays) +
+                        point_light_sum / static_cast<float>(num_samples);
+        indirect[texel] = kPi * path_sum / static_cast<float>(num_samples);
+      }
+    }
+    num_rays += tile_rays;
+  });
+  auto trace_end = std::chrono::steady_clock::now();
+
+  if (options.denoise) {
+    direct = Denoise(surfaces, layout, kNumDirectFilterPasses, std::move(direct));
+    indirect = Denoise(surfaces, layout, kNumIndirectFilterPasses, std::move(indirect));
+  }
+  lightmap.irradiance.resize(num_texels);
+  for (size_t texel = 0; texel < num_texels; ++texel) {
+    lightmap.irradiance[texel] = direct[texel] + indirect[texel];
+  }
+  Dilate(surfaces, layout, &lightmap.irradiance);
+  auto end = std::chrono::steady_clock::now();
+
+  if (stats != nullptr) {
+    stats->num_texels = static_cast<size_t>(
+        std::count(surfaces.covered.begin(), surfaces.covered.end(), 1));
+    stats->num_rays = num_rays;
+    stats->num_threads = GetNumWorkerThreads();
+    stats->trace_ms = std::chrono::duration<double, std::milli>(trace_end - start).count();
+    stats->denoise_ms = std::chrono::duration<double, std::milli>(end - trace_end).count();
+  }
+  return lightmap;
+}
+
+std::string GetLightmapPath(const std::string& model_path) {
+  return model_path + ".lightmap.robintex";
+}
+
+std::unique_ptr<TextureFile> ReadLightmap(const std::string& model_path,
+                                          const LightmapLayout& layout,
+                                          const LightmapBakeOptions& options) {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!GetSourceStamp(model_path, &source_size, &source_mtime)) {
+    return nullptr;
+  }
+
+  std::unique_ptr<TextureFile> file = TextureFile::Open(GetLightmapPath(model_path));
+  if (file == nullptr) {
+    return nullptr;
+  }
+  const TextureFileInfo& info = file->GetInfo();
+  if (info.format != TextureFormat::kRGB8 ||
+      info.options_key != GetOptionsKey(layout, options) ||
+      info.source_size != source_size ||
+      info.source_mtime != source_mtime ||
+      file->GetNumLevels() != 1 ||
+      file->GetLevel(0).width != layout.width ||
+      file->GetLevel(0).height != layout.height) {
+    return nullptr;
+  }
+  return file;
+}
+
+std::unique_ptr<TextureFile> WriteLightmap(const std::string& model_path,
+                                           const LightmapLayout& layout,
+                                           const LightmapBakeOptions& options,
+                                           const Lightmap& lightmap) {
+  std::vector<uint8_t> texels(3 * lightmap.irradiance.size());
+  for (size_t i = 0; i < lightmap.irradiance.size(); ++i) {
+    for (int c = 0; c < 3; ++c) {
+      texels[3 * i + c] = EncodeSrgb(lightmap.irradiance[i][c] / kLightmapMaxIrradiance);
+    }
+  }
+
+  TextureFileInfo info;
+  info.format = TextureFormat::kRGB8;
+  info.options_key = GetOptionsKey(layout, options);
+  bool write_file = GetSourceStamp(model_path, &info.source_size, &info.source_mtime);
+
+  TextureLevel level;
+  level.width = lightmap.width;
+  level.height = lightmap.height;
+  level.data = texels.data();
+  level.size = texels.size();
+  std::vector<uint8_t> buffer = SerializeTextureFile(info, { level });
+
+  if (!write_file || !WriteTextureFile(GetLightmapPath(model_path), buffer)) {
+    std::cerr << "Could not write lightmap: " << GetLightmapPath(model_path) << std::endl;
+  }
+  return TextureFile::FromBuffer(std::move(buffer));
+}
+
+} // namespace utils
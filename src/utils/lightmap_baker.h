@@ -0,0 +1,114 @@
+#ifndef UTILS_LIGHTMAP_BAKER_H_
+#define UTILS_LIGHTMAP_BAKER_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/lightmap_uv.h"
+#include "utils/texture_file.h"
+
+namespace utils {
+
+class Model;
+class TriangleBvh;
+
+// Lightmap files store the irradiance divided by this, sRGB-encoded, so brighter texels clip to
+// white. Shaders multiply the decoded texture color by it.
+constexpr float kLightmapMaxIrradiance = 16.f;
+
+// Spherical light. Its radius only softens the shadows that it casts.
+struct LightmapPointLight {
+  glm::vec3 position = glm::vec3(0.f);
+  float radius = 0.f;
+
+  // A surface facing the light at a distance d receives an irradiance of intensity / d^2.
+  glm::vec3 intensity = glm::vec3(0.f);
+};
+
+struct LightmapBakeOptions {
+  std::vector<LightmapPointLight> point_lights;
+
+  // Direction towards the sun, and the irradiance of a surface that faces it. A black sun is left
+  // out.
+  glm::vec3 sun_dir = glm::vec3(0.2f, 1.f, 0.3f);
+  glm::vec3 sun_color = glm::vec3(0.f);
+
+  // Radiance of the rays that leave the model.
+  glm::vec3 sky_color = glm::vec3(0.f);
+
+  // Paths traced from every texel. Every path also samples each point light once from the texel.
+  int samples_per_texel = 128;
+
+  // Surfaces that a path bounces off at most. Each one is lit by the sun and the point lights.
+  int max_bounces = 3;
+
+  // The atlas is traced in square tiles of this many texels, which are handed out to the worker
+  // threads one at a time, so that threads which get empty tiles move on to others.
+  uint32_t tile_size = 16;
+
+  // Smooths out the noise with an edge-aware filter over the surface positions and normals of the
+  // texels. Far cheaper than tracing enough paths for the noise to average out.
+  bool denoise = true;
+
+  // Diffuse albedo of every material of the model, indexed like MaterialTable::materials.
+  // Surfaces without a material, or with one past the end, are 50% grey.
+  std::vector<glm::vec3> material_albedos;
+};
+
+struct LightmapBakeStats {
+  // Texels that some triangle covers.
+  size_t num_texels = 0;
+
+  // Path rays and shadow rays.
+  size_t num_rays = 0;
+
+  size_t num_threads = 0;
+  double trace_ms = 0.0;
+  double denoise_ms = 0.0;
+};
+
+// Linear irradiance at every texel of a lightmap atlas, row by row from v = 0.
+struct Lightmap {
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  std::vector<glm::vec3> irradiance;
+};
+
+// Path traces the direct and indirect irradiance at the center of every texel of |layout|. The
+// layout must have been unwrapped from |model|, and |bvh| built from it. Texels are lit on the side
+// that the vertex normals face, while the surfaces that paths hit are lit on both sides, as for the
+// probe grid. Empty texels next to the charts get the irradiance of their neighbors, so that the
+// charts don't darken at their edges when the lightmap is filtered.
+Lightmap BakeLightmap(const Model& model, const LightmapLayout& layout, const TriangleBvh& bvh,
+                      const LightmapBakeOptions& options, LightmapBakeStats* stats = nullptr);
+
+// Lightmap file of a model, stored next to the model file (e.g. cornell_box.obj.lightmap.robintex)
+// as a texture file with a single RGB8 level (see kLightmapMaxIrradiance). It records the size and
+// modification time of the model file and a hash of the layout and of the bake options, albedos
+// included, and it is ignored if any of them have changed. The layout stands in for everything
+// that places the texels on the model: the unwrap options, and the load options that weld and
+// reorder the vertices.
+
+std::string GetLightmapPath(const std::string& model_path);
+
+// Returns nullptr if there is no valid lightmap file for the model file and options.
+std::unique_ptr<TextureFile> ReadLightmap(const std::string& model_path,
+                                          const LightmapLayout& layout,
+                                          const LightmapBakeOptions& options);
+
+// Encodes |lightmap| into a texture file and writes it next to the model file. Returns the
+// texture file, even if it couldn't be written.
+std::unique_ptr<TextureFile> WriteLightmap(const std::string& model_path,
+                                           const LightmapLayout& layout,
+                                           const LightmapBakeOptions& options,
+                                           const Lightmap& lightmap);
+
+} // namespace utils
+
+#endif // UTILS_LIGHTMAP_BAKER_H_
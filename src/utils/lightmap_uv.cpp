@@ -0,0 +1,330 @@
+#include "utils/lightmap_uv.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils/meshlet.h"
+#include "utils/model.h"
+#include "utils/vertex_packing.h"
+
+namespace utils {
+
+namespace {
+
+// The texel size starts at the size that would fill the atlas exactly, and grows by this factor
+// until all the charts fit.
+constexpr float kTexelSizeGrowth = 1.05f;
+constexpr int kMaxPackAttempts = 200;
+
+struct PositionHash {
+  size_t operator()(const glm::vec3& pos) const {
+    uint32_t words[3];
+    std::memcpy(words, &pos, sizeof(words));
+    size_t hash = 0;
+    for (uint32_t word : words) {
+      hash ^= std::hash<uint32_t>()(word) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+  }
+};
+
+struct Chart {
+  // Axis direction that all the triangles of the chart lean towards, 0 to 5 for +x, -x, +y, -y,
+  // +z and -z.
+  int direction;
+
+  // Bounds of the triangles projected along the axis, in model units.
+  glm::vec2 min = glm::vec2(std::numeric_limits<float>::max());
+  glm::vec2 max = glm::vec2(std::numeric_limits<float>::lowest());
+
+  // Rectangle of the chart in the atlas, padding included, in texels.
+  uint32_t x = 0;
+  uint32_t y = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+glm::vec3 GetFaceNormal(const Mesh& mesh, const uint32_t* tri) {
+  const glm::vec3& p0 = mesh.positions[tri[0]];
+  return glm::cross(mesh.positions[tri[1]] - p0, mesh.positions[tri[2]] - p0);
+}
+
+// Degenerate triangles, with a zero normal, face +x.
+int GetChartDirection(const glm::vec3& normal) {
+  glm::vec3 a = glm::abs(normal);
+  int axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+  return 2 * axis + (normal[axis] < 0.f ? 1 : 0);
+}
+
+glm::vec2 Project(const glm::vec3& pos, int direction) {
+  int axis = direction / 2;
+  return glm::vec2(pos[(axis + 1) % 3], pos[(axis + 2) % 3]);
+}
+
+uint32_t FindRoot(std::vector<uint32_t>* parents, uint32_t i) {
+  while ((*parents)[i] != i) {
+    (*parents)[i] = (*parents)[(*parents)[i]];
+    i = (*parents)[i];
+  }
+  return i;
+}
+
+// Groups the triangles of |mesh| that share an edge and a chart direction into charts, which are
+// appended to |charts|. Returns the index in |charts| of the chart of every triangle.
+std::vector<uint32_t> BuildCharts(const Mesh& mesh, std::vector<Chart>* charts) {
+  const uint32_t num_triangles = static_cast<uint32_t>(mesh.indices.size() / 3);
+
+  // Vertices that only differ by their normal or texcoord are the same point of the surface.
+  std::vector<uint32_t> pos_reps(mesh.positions.size());
+  {
+    std::unordered_map<glm::vec3, uint32_t, PositionHash> pos_to_rep;
+    pos_to_rep.reserve(mesh.positions.size());
+    for (uint32_t vert = 0; vert < mesh.positions.size(); ++vert) {
+      pos_reps[vert] = pos_to_rep.try_emplace(mesh.positions[vert], vert).first->second;
+    }
+  }
+
+  std::vector<int> directions(num_triangles);
+  std::vector<std::pair<uint64_t, uint32_t>> edges;
+  edges.reserve(3 * num_triangles);
+  for (uint32_t tri = 0; tri < num_triangles; ++tri) {
+    const uint32_t* corners = &mesh.indices[3 * tri];
+    directions[tri] = GetChartDirection(GetFaceNormal(mesh, corners));
+    for (int i = 0; i < 3; ++i) {
+      uint32_t a = pos_reps[corners[i]];
+      uint32_t b = pos_reps[corners[(i + 1) % 3]];
+      if (a != b) {
+        edges.push_back({ static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b), tri });
+      }
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+
+  // Joins the triangles around every edge with the first one of the same direction.
+  std::vector<uint32_t> parents(num_triangles);
+  std::iota(parents.begin(), parents.end(), 0);
+  for (size_t begin = 0; begin < edges.size();) {
+    size_t end = begin;
+    uint32_t first_of_direction[6];
+    std::fill(std::begin(first_of_direction), std::end(first_of_direction), num_triangles);
+    for (; end < edges.size() && edges[end].first == edges[begin].first; ++end) {
+      uint32_t tri = edges[end].second;
+      uint32_t& first = first_of_direction[directions[tri]];
+      if (first == num_triangles) {
+        first = tri;
+      } else {
+        parents[FindRoot(&parents, tri)] = FindRoot(&parents, first);
+      }
+    }
+    begin = end;
+  }
+
+  std::vector<uint32_t> triangle_charts(num_triangles);
+  std::unordered_map<uint32_t, uint32_t> root_charts;
+  for (uint32_t tri = 0; tri < num_triangles; ++tri) {
+    auto [it, inserted] = root_charts.try_emplace(FindRoot(&parents, tri),
+                                                  static_cast<uint32_t>(charts->size()));
+    if (inserted) {
+      charts->push_back({ directions[tri] });
+    }
+    Chart& chart = (*charts)[it->second];
+    for (int i = 0; i < 3; ++i) {
+      glm::vec2 uv = Project(mesh.positions[mesh.indices[3 * tri + i]], chart.direction);
+      chart.min = glm::min(chart.min, uv);
+      chart.max = glm::max(chart.max, uv);
+    }
+    triangle_charts[tri] = it->second;
+  }
+  return triangle_charts;
+}
+
+// Places the charts on shelves, tallest first, at the size they have with |texel_size|. Returns
+// false if they don't fit in the atlas.
+bool PackCharts(float texel_size, const LightmapUvOptions& options, std::vector<Chart>* charts) {
+  // A chart covers every texel center within its bounds, plus one, so that vertices on its edges
+  // land on texel centers.
+  for (Chart& chart : *charts) {
+    glm::vec2 size = (chart.max - chart.min) / texel_size;
+    chart.width = static_cast<uint32_t>(std::ceil(size.x)) + 1 + 2 * options.padding;
+    chart.height = static_cast<uint32_t>(std::ceil(size.y)) + 1 + 2 * options.padding;
+    if (chart.width > options.atlas_size || chart.height > options.atlas_size) {
+      return false;
+    }
+  }
+
+  std::vector<uint32_t> order(charts->size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return (*charts)[a].height > (*charts)[b].height;
+  });
+
+  uint32_t shelf_x = 0;
+  uint32_t shelf_y = 0;
+  uint32_t shelf_height = 0;
+  for (uint32_t chart_idx : order) {
+    Chart& chart = (*charts)[chart_idx];
+    if (shelf_x + chart.width > options.atlas_size) {
+      shelf_x = 0;
+      shelf_y += shelf_height;
+      shelf_height = 0;
+    }
+    if (shelf_y + chart.height > options.atlas_size) {
+      return false;
+    }
+    chart.x = shelf_x;
+    chart.y = shelf_y;
+    shelf_x += chart.width;
+    shelf_height = std::max(shelf_height, chart.height);
+  }
+  return true;
+}
+
+} // namespace
+
+LightmapLayout UnwrapLightmap(const Model& model, const LightmapUvOptions& options) {
+  LightmapLayout layout;
+  std::vector<Chart> charts;
+  std::vector<std::vector<uint32_t>> triangle_charts;
+  for (int mesh_idx = 0; mesh_idx < model.GetNumMeshes(); ++mesh_idx) {
+    triangle_charts.push_back(BuildCharts(model.GetMeshByIndex(mesh_idx), &charts));
+  }
+
+  double chart_area = 0.0;
+  for (const Chart& chart : charts) {
+    glm::vec2 size = chart.max - chart.min;
+    chart_area += static_cast<double>(size.x) * size.y;
+  }
+  float texel_size = static_cast<float>(std::sqrt(chart_area) / options.atlas_size);
+  if (!(texel_size > 0.f)) {
+    texel_size = 1.f;
+  }
+  int attempt = 0;
+  for (; attempt < kMaxPackAttempts && !PackCharts(texel_size, options, &charts); ++attempt) {
+    texel_size *= kTexelSizeGrowth;
+  }
+  if (attempt == kMaxPackAttempts) {
+    std::cerr << "Could not pack " << charts.size() << " lightmap charts into a " <<
+        options.atlas_size << "x" << options.atlas_size << " atlas." << std::endl;
+    return layout;
+  }
+
+  layout.width = options.atlas_size;
+  layout.height = options.atlas_size;
+  layout.texel_size = texel_size;
+  layout.num_charts = charts.size();
+
+  const glm::vec2 atlas_size(layout.width, layout.height);
+  for (int mesh_idx = 0; mesh_idx < model.GetNumMeshes(); ++mesh_idx) {
+    const Mesh& mesh = model.GetMeshByIndex(mesh_idx);
+    LightmapMesh lightmap_mesh;
+    lightmap_mesh.indices.reserve(mesh.indices.size());
+
+    // Every vertex gets one copy per chart that it is in, in the order of first use.
+    std::unordered_map<uint64_t, uint32_t> chart_vertices;
+    for (size_t i = 0; i < mesh.indices.size(); ++i) {
+      uint32_t source_vert = mesh.indices[i];
+      uint32_t chart_idx = triangle_charts[mesh_idx][i / 3];
+      auto [it, inserted] = chart_vertices.try_emplace(
+          static_cast<uint64_t>(chart_idx) << 32 | source_vert,
+          static_cast<uint32_t>(lightmap_mesh.source_vertices.size()));
+      if (inserted) {
+        const Chart& chart = charts[chart_idx];
+        glm::vec2 texel = (Project(mesh.positions[source_vert], chart.direction) - chart.min) /
+                          texel_size;
+        texel += glm::vec2(chart.x, chart.y) + static_cast<float>(options.padding) + 0.5f;
+        lightmap_mesh.source_vertices.push_back(source_vert);
+        lightmap_mesh.uvs.push_back(texel / atlas_size);
+      }
+      lightmap_mesh.indices.push_back(it->second);
+    }
+    layout.meshes.push_back(std::move(lightmap_mesh));
+  }
+  return layout;
+}
+
+void ApplyLightmapUvs(const LightmapMesh& lightmap_mesh, Mesh* mesh) {
+  std::vector<uint32_t> source_vertices = lightmap_mesh.source_vertices;
+  std::vector<glm::vec2> uvs = lightmap_mesh.uvs;
+
+  // All the triangles of a chart face the same way, so every copy of a vertex has the direction of
+  // its chart.
+  std::vector<int> directions(source_vertices.size(), 0);
+  for (size_t i = 0; i + 2 < lightmap_mesh.indices.size(); i += 3) {
+    int direction = GetChartDirection(GetFaceNormal(*mesh, &mesh->indices[i]));
+    for (int j = 0; j < 3; ++j) {
+      directions[lightmap_mesh.indices[i + j]] = direction;
+    }
+  }
+  std::vector<std::vector<uint32_t>> copies(mesh->positions.size());
+  for (uint32_t vert = 0; vert < source_vertices.size(); ++vert) {
+    copies[source_vertices[vert]].push_back(vert);
+  }
+
+  // Vertices that the LODs use but the full mesh doesn't get a copy at the corner of the atlas.
+  auto get_copy = [&](uint32_t source_vert, int direction) {
+    std::vector<uint32_t>& vert_copies = copies[source_vert];
+    if (vert_copies.empty()) {
+      vert_copies.push_back(static_cast<uint32_t>(source_vertices.size()));
+      source_vertices.push_back(source_vert);
+      uvs.push_back(glm::vec2(0.f));
+      directions.push_back(direction);
+    }
+    for (uint32_t vert : vert_copies) {
+      if (directions[vert] == direction) {
+        return vert;
+      }
+    }
+    return vert_copies.front();
+  };
+  for (MeshLod& lod : mesh->lods) {
+    for (size_t i = 0; i + 2 < lod.indices.size(); i += 3) {
+      int direction = GetChartDirection(GetFaceNormal(*mesh, &lod.indices[i]));
+      for (int j = 0; j < 3; ++j) {
+        lod.indices[i + j] = get_copy(lod.indices[i + j], direction);
+      }
+    }
+  }
+
+  auto remap = [&](auto* values) {
+    if (values->empty()) {
+      return;
+    }
+    std::remove_reference_t<decltype(*values)> remapped;
+    remapped.reserve(source_vertices.size());
+    for (uint32_t source_vert : source_vertices) {
+      remapped.push_back((*values)[source_vert]);
+    }
+    *values = std::move(remapped);
+  };
+  remap(&mesh->positions);
+  remap(&mesh->normals);
+  remap(&mesh->texcoords);
+  remap(&mesh->material_ids);
+  mesh->num_verts = static_cast<uint32_t>(source_vertices.size());
+  mesh->indices = lightmap_mesh.indices;
+  mesh->lightmap_uvs = std::move(uvs);
+
+  if (mesh->packed_format != VertexFormat::kSeparate) {
+    PackVertices(mesh->packed_format, mesh);
+  }
+  if (!mesh->meshlet_data.meshlets.empty()) {
+    MeshletData meshlet_data;
+    BuildMeshlets(*mesh, &meshlet_data);
+    mesh->meshlet_data = std::move(meshlet_data);
+  }
+}
+
+} // namespace utils
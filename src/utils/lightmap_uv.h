@@ -0,0 +1,66 @@
+#ifndef UTILS_LIGHTMAP_UV_H_
+#define UTILS_LIGHTMAP_UV_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+
+class Model;
+struct Mesh;
+
+struct LightmapUvOptions {
+  // Size in texels of the square atlas that the charts of all the meshes are packed into. The
+  // texel size is the smallest one that lets them all fit.
+  uint32_t atlas_size = 1024;
+
+  // Empty texels left around every chart, so that bilinear filtering and the dilation of the
+  // baked lightmap never mix two charts.
+  uint32_t padding = 2;
+};
+
+// Lightmap texcoords of one mesh. Charts can't share vertices along their seams, so the unwrapped
+// mesh has its own vertices: vertex i is a copy of vertex |source_vertices[i]| of the mesh.
+struct LightmapMesh {
+  std::vector<uint32_t> source_vertices;
+
+  // Position in the atlas of every vertex, in [0, 1].
+  std::vector<glm::vec2> uvs;
+
+  // Same triangles as Mesh::indices, in the same order, over the vertices above.
+  std::vector<uint32_t> indices;
+};
+
+// Charts of all the meshes of a model, packed into one atlas.
+struct LightmapLayout {
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  // Size of a texel in model units.
+  float texel_size = 0.f;
+
+  size_t num_charts = 0;
+
+  // Indexed like the meshes of the model.
+  std::vector<LightmapMesh> meshes;
+};
+
+// Splits the triangles of every mesh of |model| into charts and packs them into an atlas. A chart
+// is a set of connected triangles whose normals lean the most towards the same one of the six
+// axis directions, and it is projected along that axis, so the texels of flat walls and floors
+// are squares. The result only depends on the model and the options, so it can be recomputed
+// instead of stored next to a baked lightmap.
+LightmapLayout UnwrapLightmap(const Model& model, const LightmapUvOptions& options);
+
+// Rebuilds the vertex arrays of |mesh| over the vertices of |lightmap_mesh|, which must come from
+// the same mesh, and fills in Mesh::lightmap_uvs. The LODs are remapped onto the new vertices,
+// each triangle using the copies of its vertices in the charts that face its way, and the packed
+// vertices and meshlets are rebuilt if the mesh had them.
+void ApplyLightmapUvs(const LightmapMesh& lightmap_mesh, Mesh* mesh);
+
+} // namespace utils
+
+#endif // UTILS_LIGHTMAP_UV_H_
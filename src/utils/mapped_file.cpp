@@ -0,0 +1,134 @@
+#include "utils/mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+
+namespace utils {
+
+#ifdef _WIN32
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_handle_ != nullptr) {
+    CloseHandle(mapping_handle_);
+  }
+  if (file_handle_ != nullptr) {
+    CloseHandle(file_handle_);
+  }
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+  auto file = std::make_unique<MappedFile>();
+
+  HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, 
+                                   OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  file->file_handle_ = file_handle;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_handle, &size)) {
+    return nullptr;
+  }
+  file->size_ = static_cast<size_t>(size.QuadPart);
+
+  // Empty files can't be mapped, but they are still valid files.
+  if (file->size_ == 0) {
+    return file;
+  }
+
+  HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_handle == nullptr) {
+    return nullptr;
+  }
+  file->mapping_handle_ = mapping_handle;
+
+  void* data = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+  if (data == nullptr) {
+    return nullptr;
+  }
+  file->data_ = static_cast<const uint8_t*>(data);
+
+  return file;
+}
+
+void MappedFile::DiscardPages(size_t offset, size_t size) const {
+  if (data_ == nullptr || size == 0) {
+    return;
+  }
+  // Unlocking pages that aren't locked removes them from the working set.
+  VirtualUnlock(const_cast<uint8_t*>(data_ + offset), size);
+}
+
+#else
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path) {
+  auto file = std::make_unique<MappedFile>();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return nullptr;
+  }
+  file->fd_ = fd;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    return nullptr;
+  }
+  file->size_ = static_cast<size_t>(file_stat.st_size);
+
+  // Empty files can't be mapped, but they are still valid files.
+  if (file->size_ == 0) {
+    return file;
+  }
+
+  void* data = mmap(nullptr, file->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  file->data_ = static_cast<const uint8_t*>(data);
+
+  madvise(data, file->size_, MADV_SEQUENTIAL);
+
+  return file;
+}
+
+void MappedFile::DiscardPages(size_t offset, size_t size) const {
+  if (data_ == nullptr || size == 0) {
+    return;
+  }
+  // Only whole pages inside the range are discarded.
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t begin = (offset + page_size - 1) / page_size * page_size;
+  size_t end = std::min(offset + size, size_) / page_size * page_size;
+  if (begin < end) {
+    madvise(const_cast<uint8_t*>(data_ + begin), end - begin, MADV_DONTNEED);
+  }
+}
+
+#endif
+
+} // namespace utils
@@ -0,0 +1,44 @@
+#ifndef UTILS_MAPPED_FILE_H_
+#define UTILS_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace utils {
+
+// Read-only memory mapping of a whole file. The mapping stays valid for the lifetime of the
+// object.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* GetData() const { return data_; }
+  size_t GetSize() const { return size_; }
+
+  // Tells the OS that the given range won't be read again soon, so its pages can be dropped from
+  // memory. The data stays valid and is read back from the file if it is accessed again.
+  void DiscardPages(size_t offset, size_t size) const;
+
+  static std::unique_ptr<MappedFile> Open(const std::string& path);
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+
+#ifdef _WIN32
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+} // namespace utils
+
+#endif // UTILS_MAPPED_FILE_H_
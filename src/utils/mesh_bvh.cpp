@@ -0,0 +1,225 @@
+#include "utils/mesh_bvh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "utils/bounds.h"
+#include "utils/camera.h"
+#include "utils/model.h"
+#include "utils/parallel.h"
+
+namespace utils {
+
+namespace {
+
+// Nodes with this many meshes or fewer become leaves.
+constexpr uint32_t kMaxLeafMeshes = 4;
+
+// Number of buckets along the split axis in which the split positions are evaluated.
+constexpr int kNumSahBins = 16;
+
+// The tree is split into about this many subtrees per worker thread, so that the threads stay
+// busy when some subtrees are culled early.
+constexpr size_t kTasksPerThread = 4;
+
+float GetSurfaceArea(const Aabb& aabb) {
+  if (aabb.IsEmpty()) {
+    return 0.f;
+  }
+  glm::vec3 size = aabb.GetSize();
+  return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+std::vector<Aabb> GetMeshBounds(const Model& model) {
+  std::vector<Aabb> mesh_bounds;
+  for (int i = 0; i < model.GetNumMeshes(); ++i) {
+    mesh_bounds.push_back(model.GetMeshByIndex(i).aabb);
+  }
+  return mesh_bounds;
+}
+
+} // namespace
+
+MeshBvh::MeshBvh(const std::vector<Aabb>& mesh_bounds) {
+  // Meshes without any vertices have nothing to draw, so they are left out.
+  for (uint32_t i = 0; i < mesh_bounds.size(); ++i) {
+    if (!mesh_bounds[i].IsEmpty()) {
+      mesh_indices_.push_back(i);
+    }
+  }
+  if (mesh_indices_.empty()) {
+    return;
+  }
+  nodes_.reserve(2 * mesh_indices_.size());
+  BuildNode(mesh_bounds, 0, static_cast<uint32_t>(mesh_indices_.size()));
+
+  leaf_mesh_bounds_.reserve(mesh_indices_.size());
+  for (uint32_t mesh_idx : mesh_indices_) {
+    leaf_mesh_bounds_.push_back(mesh_bounds[mesh_idx]);
+  }
+
+  // Every subtree that is small enough, or a leaf, becomes a task, but none of its descendants.
+  size_t max_task_meshes = std::max<size_t>(
+      kMaxLeafMeshes, mesh_indices_.size() / (kTasksPerThread * pool_.GetNumThreads()));
+  std::vector<uint32_t> stack = { 0 };
+  while (!stack.empty()) {
+    uint32_t node_idx = stack.back();
+    stack.pop_back();
+
+    const Node& node = nodes_[node_idx];
+    if (node.right_child == 0 || node.count <= max_task_meshes) {
+      task_roots_.push_back(node_idx);
+    } else {
+      stack.push_back(node.right_child);
+      stack.push_back(node_idx + 1);
+    }
+  }
+}
+
+MeshBvh::MeshBvh(const Model& model) : MeshBvh(GetMeshBounds(model)) {}
+
+uint32_t MeshBvh::BuildNode(const std::vector<Aabb>& mesh_bounds, uint32_t first,
+                            uint32_t count) {
+  uint32_t node_idx = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back({ Aabb(), first, count, 0 });
+
+  Aabb bounds;
+  Aabb centroid_bounds;
+  for (uint32_t i = first; i < first + count; ++i) {
+    const Aabb& mesh_aabb = mesh_bounds[mesh_indices_[i]];
+    bounds.Merge(mesh_aabb);
+    glm::vec3 center = mesh_aabb.GetCenter();
+    centroid_bounds.Merge({ center, center });
+  }
+  nodes_[node_idx].bounds = bounds;
+  if (count <= kMaxLeafMeshes) {
+    return node_idx;
+  }
+
+  // Splits along the longest axis of the mesh centers.
+  glm::vec3 extent = centroid_bounds.GetSize();
+  int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+  if (!(extent[axis] > 0.f)) {
+    return node_idx;
+  }
+  auto get_bin = [&](uint32_t mesh_idx) {
+    float t = (mesh_bounds[mesh_idx].GetCenter()[axis] - centroid_bounds.min[axis]) / extent[axis];
+    return std::min(static_cast<int>(t * kNumSahBins), kNumSahBins - 1);
+  };
+
+  Aabb bin_bounds[kNumSahBins];
+  uint32_t bin_counts[kNumSahBins] = {};
+  for (uint32_t i = first; i < first + count; ++i) {
+    int bin = get_bin(mesh_indices_[i]);
+    bin_bounds[bin].Merge(mesh_bounds[mesh_indices_[i]]);
+    ++bin_counts[bin];
+  }
+
+  // Cost of splitting after each bin, as the area-weighted number of meshes on both sides.
+  float left_costs[kNumSahBins - 1];
+  Aabb left_bounds;
+  uint32_t left_count = 0;
+  for (int bin = 0; bin < kNumSahBins - 1; ++bin) {
+    left_bounds.Merge(bin_bounds[bin]);
+    left_count += bin_counts[bin];
+    left_costs[bin] = GetSurfaceArea(left_bounds) * left_count;
+  }
+  int best_split = -1;
+  float best_cost = GetSurfaceArea(bounds) * count;
+  Aabb right_bounds;
+  uint32_t right_count = 0;
+  for (int bin = kNumSahBins - 1; bin > 0; --bin) {
+    right_bounds.Merge(bin_bounds[bin]);
+    right_count += bin_counts[bin];
+    float cost = left_costs[bin - 1] + GetSurfaceArea(right_bounds) * right_count;
+    if (right_count < count && cost < best_cost) {
+      best_cost = cost;
+      best_split = bin;
+    }
+  }
+
+  // Falls back to halving the meshes along the axis when no split beats a single leaf.
+  uint32_t* begin = mesh_indices_.data() + first;
+  uint32_t* end = begin + count;
+  uint32_t* middle;
+  if (best_split != -1) {
+    middle = std::partition(begin, end, [&](uint32_t mesh_idx) {
+      return get_bin(mesh_idx) < best_split;
+    });
+  } else {
+    middle = begin + count / 2;
+    std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+      return mesh_bounds[a].GetCenter()[axis] < mesh_bounds[b].GetCenter()[axis];
+    });
+  }
+  uint32_t left_size = static_cast<uint32_t>(middle - begin);
+  if (left_size == 0 || left_size == count) {
+    return node_idx;
+  }
+
+  BuildNode(mesh_bounds, first, left_size);
+  uint32_t right_child = BuildNode(mesh_bounds, first + left_size, count - left_size);
+  nodes_[node_idx].right_child = right_child;
+  return node_idx;
+}
+
+void MeshBvh::CullSubtree(const Frustum& frustum, uint32_t root,
+                          std::vector<uint32_t>* visible) const {
+  std::vector<uint32_t> stack = { root };
+  while (!stack.empty()) {
+    uint32_t node_idx = stack.back();
+    stack.pop_back();
+
+    const Node& node = nodes_[node_idx];
+    if (frustum.IsOutside(node.bounds)) {
+      continue;
+    }
+
+    // Subtrees entirely inside the frustum keep all their meshes without testing them.
+    if (frustum.Contains(node.bounds)) {
+      visible->insert(visible->end(), mesh_indices_.begin() + node.first,
+                      mesh_indices_.begin() + node.first + node.count);
+      continue;
+    }
+    if (node.right_child == 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        if (!frustum.IsOutside(leaf_mesh_bounds_[i])) {
+          visible->push_back(mesh_indices_[i]);
+        }
+      }
+      continue;
+    }
+    stack.push_back(node.right_child);
+    stack.push_back(node_idx + 1);
+  }
+}
+
+std::vector<uint32_t> MeshBvh::Cull(const Frustum& frustum) {
+  return std::move(Cull(std::vector<Frustum>{ frustum })[0]);
+}
+
+std::vector<std::vector<uint32_t>> MeshBvh::Cull(const std::vector<Frustum>& frusta) {
+  // One task per frustum and subtree, each with its own output.
+  const size_t num_roots = task_roots_.size();
+  std::vector<std::vector<uint32_t>> task_visible(frusta.size() * num_roots);
+  ParallelFor(pool_, task_visible.size(), [&](size_t task) {
+    CullSubtree(frusta[task / num_roots], task_roots_[task % num_roots], &task_visible[task]);
+  });
+
+  std::vector<std::vector<uint32_t>> visible(frusta.size());
+  for (size_t i = 0; i < frusta.size(); ++i) {
+    for (size_t j = 0; j < num_roots; ++j) {
+      const std::vector<uint32_t>& task = task_visible[i * num_roots + j];
+      visible[i].insert(visible[i].end(), task.begin(), task.end());
+    }
+    std::sort(visible[i].begin(), visible[i].end());
+  }
+  return visible;
+}
+
+} // namespace utils
@@ -0,0 +1,68 @@
+#ifndef UTILS_MESH_BVH_H_
+#define UTILS_MESH_BVH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils/bounds.h"
+#include "utils/camera.h"
+#include "utils/parallel.h"
+
+namespace utils {
+
+class Model;
+
+// Bounding volume hierarchy over the bounding boxes of the meshes of a model, for culling them on
+// the CPU every frame.
+//
+// The tree is built once with the surface area heuristic. Culling splits it into subtrees that are
+// traversed in parallel on a pool owned by the BVH, and several frusta, e.g. the six faces of a
+// shadow cube map, are culled in the same pass.
+class MeshBvh {
+ public:
+  explicit MeshBvh(const std::vector<Aabb>& mesh_bounds);
+  explicit MeshBvh(const Model& model);
+
+  MeshBvh(const MeshBvh&) = delete;
+  MeshBvh& operator=(const MeshBvh&) = delete;
+
+  // Meshes with an empty bounding box are left out of the tree, and are never visible.
+  size_t GetNumMeshes() const { return mesh_indices_.size(); }
+  size_t GetNumNodes() const { return nodes_.size(); }
+
+  // Returns the indices of the meshes whose bounding box isn't outside |frustum|, in increasing
+  // order.
+  std::vector<uint32_t> Cull(const Frustum& frustum);
+
+  // Same as Cull() for every frustum of |frusta|.
+  std::vector<std::vector<uint32_t>> Cull(const std::vector<Frustum>& frusta);
+
+ private:
+  // Interior nodes have their left child right after them, and cover the same range of
+  // |mesh_indices_| as their two children together.
+  struct Node {
+    Aabb bounds;
+    uint32_t first;
+    uint32_t count;
+    uint32_t right_child; // 0 for leaves
+  };
+
+  uint32_t BuildNode(const std::vector<Aabb>& mesh_bounds, uint32_t first, uint32_t count);
+  void CullSubtree(const Frustum& frustum, uint32_t root, std::vector<uint32_t>* visible) const;
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> mesh_indices_;
+
+  // Bounds of the meshes, in the order of |mesh_indices_|.
+  std::vector<Aabb> leaf_mesh_bounds_;
+
+  // Roots of the subtrees that are culled as separate tasks.
+  std::vector<uint32_t> task_roots_;
+
+  ThreadPool pool_;
+};
+
+} // namespace utils
+
+#endif // UTILS_MESH_BVH_H_
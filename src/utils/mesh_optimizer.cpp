@@ -0,0 +1,365 @@
+#include "utils/mesh_optimizer.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+
+#include "utils/vertex_packing.h"
+
+namespace utils {
+
+namespace {
+
+constexpr uint32_t kInvalidVertex = std::numeric_limits<uint32_t>::max();
+
+// FIFO cache simulation. A vertex is in the cache if fewer than cache_size misses happened since
+// it was last transformed.
+class VertexCache {
+ public:
+  VertexCache(uint32_t num_verts, uint32_t cache_size) 
+      : cache_size_(cache_size), time_(cache_size + 1), timestamps_(num_verts, 0) {}
+
+  bool Contains(uint32_t vert) const { return time_ - timestamps_[vert] <= cache_size_; }
+
+  // Returns the number of vertices transformed for the triangle.
+  uint32_t AddTriangle(const uint32_t* tri) {
+    uint32_t num_misses = 0;
+    for (int i = 0; i < 3; ++i) {
+      if (!Contains(tri[i])) {
+        timestamps_[tri[i]] = time_++;
+        ++num_misses;
+      }
+    }
+    return num_misses;
+  }
+
+  // Age of the vertex in cache entries.
+  uint32_t GetAge(uint32_t vert) const { return time_ - timestamps_[vert]; }
+
+  void Flush() { time_ += cache_size_ + 1; }
+
+ private:
+  uint32_t cache_size_;
+  uint32_t time_;
+  std::vector<uint32_t> timestamps_;
+};
+
+// Number of transformed vertices when drawing triangles [begin, end) with a cold cache.
+uint32_t CountCacheMisses(const std::vector<uint32_t>& indices, size_t begin, size_t end,
+                          VertexCache* cache) {
+  cache->Flush();
+  uint32_t num_misses = 0;
+  for (size_t tri = begin; tri < end; ++tri) {
+    num_misses += cache->AddTriangle(&indices[tri * 3]);
+  }
+  return num_misses;
+}
+
+} // namespace
+
+double VertexCacheStats::GetAcmr() const {
+  return num_triangles > 0 ? static_cast<double>(num_transformed) / num_triangles : 0.0;
+}
+
+double VertexCacheStats::GetAtvr() const {
+  return num_vertices > 0 ? static_cast<double>(num_transformed) / num_vertices : 0.0;
+}
+
+VertexCacheStats& VertexCacheStats::operator+=(const VertexCacheStats& other) {
+  num_triangles += other.num_triangles;
+  num_vertices += other.num_vertices;
+  num_transformed += other.num_transformed;
+  return *this;
+}
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t num_verts,
+                                    uint32_t cache_size) {
+  VertexCache cache(num_verts, cache_size);
+
+  VertexCacheStats stats;
+  stats.num_triangles = indices.size() / 3;
+  stats.num_vertices = num_verts;
+  for (size_t tri = 0; tri < stats.num_triangles; ++tri) {
+    stats.num_transformed += cache.AddTriangle(&indices[tri * 3]);
+  }
+  return stats;
+}
+
+void OptimizeVertexCache(Mesh* mesh, std::vector<uint32_t>* clusters, uint32_t cache_size) {
+  OptimizeVertexCache(&mesh->indices, mesh->num_verts, clusters, cache_size);
+}
+
+void OptimizeVertexCache(std::vector<uint32_t>* in_indices, uint32_t num_verts,
+                         std::vector<uint32_t>* clusters, uint32_t cache_size) {
+  const std::vector<uint32_t>& indices = *in_indices;
+  const size_t num_tris = indices.size() / 3;
+
+  if (clusters != nullptr) {
+    clusters->clear();
+  }
+  if (num_tris == 0) {
+    return;
+  }
+
+  // Vertex-triangle adjacency, and the number of triangles per vertex that have yet to be emitted.
+  std::vector<uint32_t> num_live_tris(num_verts, 0);
+  for (uint32_t vert : indices) {
+    ++num_live_tris[vert];
+  }
+
+  std::vector<uint32_t> adj_offsets(num_verts + 1, 0);
+  std::partial_sum(num_live_tris.begin(), num_live_tris.end(), adj_offsets.begin() + 1);
+
+  std::vector<uint32_t> adj_tris(indices.size());
+  {
+    std::vector<uint32_t> fill_pos(adj_offsets.begin(), adj_offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      adj_tris[fill_pos[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<uint32_t> out_indices;
+  out_indices.reserve(indices.size());
+
+  std::vector<char> emitted(num_tris, false);
+  std::vector<uint32_t> dead_end_stack;
+  std::vector<uint32_t> candidates;
+  VertexCache cache(num_verts, cache_size);
+  uint32_t cursor = 0;
+
+  // Picks a vertex that still has triangles left once the fanning vertex has none of its
+  // neighbours left to continue with. Recently used vertices come first, the input order second.
+  auto skip_dead_end = [&]() {
+    while (!dead_end_stack.empty()) {
+      uint32_t vert = dead_end_stack.back();
+      dead_end_stack.pop_back();
+      if (num_live_tris[vert] > 0) {
+        return vert;
+      }
+    }
+    for (; cursor < num_verts; ++cursor) {
+      if (num_live_tris[cursor] > 0) {
+        return cursor;
+      }
+    }
+    return kInvalidVertex;
+  };
+
+  uint32_t fan_vert = skip_dead_end();
+  while (fan_vert != kInvalidVertex) {
+    // A fanning vertex that fell out of the cache restarts cold, so the triangles up to here can
+    // be reordered freely with the ones after.
+    if (clusters != nullptr && !cache.Contains(fan_vert)) {
+      clusters->push_back(static_cast<uint32_t>(out_indices.size() / 3));
+    }
+
+    candidates.clear();
+    for (uint32_t i = adj_offsets[fan_vert]; i < adj_offsets[fan_vert + 1]; ++i) {
+      uint32_t tri = adj_tris[i];
+      if (emitted[tri]) {
+        continue;
+      }
+      for (int j = 0; j < 3; ++j) {
+        uint32_t vert = indices[tri * 3 + j];
+        out_indices.push_back(vert);
+        dead_end_stack.push_back(vert);
+        candidates.push_back(vert);
+        --num_live_tris[vert];
+      }
+      cache.AddTriangle(&indices[tri * 3]);
+      emitted[tri] = true;
+    }
+
+    // Continues with the candidate that has been in the cache the longest while still being in it
+    // after its remaining triangles are emitted.
+    uint32_t next_vert = kInvalidVertex;
+    int64_t best_priority = -1;
+    for (uint32_t vert : candidates) {
+      if (num_live_tris[vert] == 0) {
+        continue;
+      }
+      int64_t priority = 0;
+      if (cache.GetAge(vert) + 2 * num_live_tris[vert] <= cache_size) {
+        priority = cache.GetAge(vert);
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        next_vert = vert;
+      }
+    }
+
+    fan_vert = next_vert != kInvalidVertex ? next_vert : skip_dead_end();
+  }
+
+  assert(out_indices.size() == indices.size());
+  *in_indices = std::move(out_indices);
+}
+
+void OptimizeOverdraw(Mesh* mesh, const std::vector<uint32_t>& clusters, float threshold,
+                      uint32_t cache_size) {
+  const std::vector<uint32_t>& indices = mesh->indices;
+  const size_t num_tris = indices.size() / 3;
+  if (num_tris == 0 || clusters.empty()) {
+    return;
+  }
+
+  // Splits the hard clusters into smaller ones wherever the ACMR of the triangles so far, drawn on
+  // their own, is already close to the ACMR of the whole cluster.
+  std::vector<uint32_t> soft_clusters;
+  VertexCache cache(mesh->num_verts, cache_size);
+  for (size_t i = 0; i < clusters.size(); ++i) {
+    size_t begin = clusters[i];
+    size_t end = i + 1 < clusters.size() ? clusters[i + 1] : num_tris;
+    if (begin >= end) {
+      continue;
+    }
+
+    double cluster_acmr = 
+        static_cast<double>(CountCacheMisses(indices, begin, end, &cache)) / (end - begin);
+
+    soft_clusters.push_back(static_cast<uint32_t>(begin));
+    cache.Flush();
+    uint32_t num_misses = 0;
+    size_t soft_begin = begin;
+    for (size_t tri = begin; tri < end; ++tri) {
+      num_misses += cache.AddTriangle(&indices[tri * 3]);
+      double acmr = static_cast<double>(num_misses) / (tri + 1 - soft_begin);
+      if (tri + 1 < end && acmr <= threshold * cluster_acmr) {
+        soft_begin = tri + 1;
+        soft_clusters.push_back(static_cast<uint32_t>(soft_begin));
+        cache.Flush();
+        num_misses = 0;
+      }
+    }
+  }
+
+  // Area-weighted centroids and normals of the clusters and of the whole mesh.
+  const size_t num_clusters = soft_clusters.size();
+  std::vector<glm::vec3> centroids(num_clusters, glm::vec3(0.f));
+  std::vector<glm::vec3> normals(num_clusters, glm::vec3(0.f));
+  glm::vec3 mesh_centroid(0.f);
+  float mesh_area = 0.f;
+
+  for (size_t i = 0; i < num_clusters; ++i) {
+    size_t begin = soft_clusters[i];
+    size_t end = i + 1 < num_clusters ? soft_clusters[i + 1] : num_tris;
+
+    float cluster_area = 0.f;
+    for (size_t tri = begin; tri < end; ++tri) {
+      const glm::vec3& p0 = mesh->positions[indices[tri * 3 + 0]];
+      const glm::vec3& p1 = mesh->positions[indices[tri * 3 + 1]];
+      const glm::vec3& p2 = mesh->positions[indices[tri * 3 + 2]];
+
+      glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+      float area = glm::length(normal);
+
+      centroids[i] += (p0 + p1 + p2) * (area / 3.f);
+      normals[i] += normal;
+      cluster_area += area;
+    }
+
+    mesh_centroid += centroids[i];
+    mesh_area += cluster_area;
+    if (cluster_area > 0.f) {
+      centroids[i] /= cluster_area;
+    }
+  }
+  if (mesh_area > 0.f) {
+    mesh_centroid /= mesh_area;
+  }
+
+  std::vector<float> sort_keys(num_clusters, 0.f);
+  for (size_t i = 0; i < num_clusters; ++i) {
+    float normal_len = glm::length(normals[i]);
+    if (normal_len > 0.f) {
+      sort_keys[i] = glm::dot(centroids[i] - mesh_centroid, normals[i] / normal_len);
+    }
+  }
+
+  std::vector<uint32_t> order(num_clusters);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  std::vector<uint32_t> out_indices;
+  out_indices.reserve(indices.size());
+  for (uint32_t cluster : order) {
+    size_t begin = soft_clusters[cluster];
+    size_t end = cluster + 1 < num_clusters ? soft_clusters[cluster + 1] : num_tris;
+    out_indices.insert(out_indices.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+  }
+
+  mesh->indices = std::move(out_indices);
+}
+
+void OptimizeVertexFetch(Mesh* mesh) {
+  std::vector<uint32_t> remap(mesh->num_verts, kInvalidVertex);
+  std::vector<uint32_t> new_to_old;
+  new_to_old.reserve(mesh->num_verts);
+
+  for (uint32_t& index : mesh->indices) {
+    if (remap[index] == kInvalidVertex) {
+      remap[index] = static_cast<uint32_t>(new_to_old.size());
+      new_to_old.push_back(index);
+    }
+    index = remap[index];
+  }
+
+  // LODs only use vertices of the full mesh.
+  for (MeshLod& lod : mesh->lods) {
+    for (uint32_t& index : lod.indices) {
+      index = remap[index];
+    }
+  }
+
+  auto reorder = [&](auto* attribs) {
+    if (attribs->empty()) {
+      return;
+    }
+    std::remove_reference_t<decltype(*attribs)> reordered(new_to_old.size());
+    for (size_t i = 0; i < new_to_old.size(); ++i) {
+      reordered[i] = (*attribs)[new_to_old[i]];
+    }
+    *attribs = std::move(reordered);
+  };
+
+  reorder(&mesh->positions);
+  reorder(&mesh->normals);
+  reorder(&mesh->texcoords);
+  reorder(&mesh->material_ids);
+
+  if (!mesh->packed_vertices.empty()) {
+    const size_t vert_size = GetPackedVertexSize(mesh->packed_format);
+    std::vector<uint8_t> reordered(new_to_old.size() * vert_size);
+    for (size_t i = 0; i < new_to_old.size(); ++i) {
+      std::memcpy(&reordered[i * vert_size], &mesh->packed_vertices[new_to_old[i] * vert_size],
+                  vert_size);
+    }
+    mesh->packed_vertices = std::move(reordered);
+  }
+
+  mesh->num_verts = static_cast<uint32_t>(new_to_old.size());
+}
+
+void OptimizeMesh(Mesh* mesh, VertexCacheStats* before, VertexCacheStats* after) {
+  if (before != nullptr) {
+    *before = AnalyzeVertexCache(mesh->indices, mesh->num_verts);
+  }
+
+  std::vector<uint32_t> clusters;
+  OptimizeVertexCache(mesh, &clusters);
+  OptimizeOverdraw(mesh, clusters);
+  OptimizeVertexFetch(mesh);
+
+  if (after != nullptr) {
+    *after = AnalyzeVertexCache(mesh->indices, mesh->num_verts);
+  }
+}
+
+} // namespace utils
@@ -0,0 +1,59 @@
+#ifndef UTILS_MESH_OPTIMIZER_H_
+#define UTILS_MESH_OPTIMIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils/model.h"
+
+namespace utils {
+
+// Size of the simulated post-transform vertex cache (FIFO). Close to what current GPUs reuse
+// within a batch.
+constexpr uint32_t kVertexCacheSize = 16;
+
+struct VertexCacheStats {
+  size_t num_triangles = 0;
+  size_t num_vertices = 0;
+  size_t num_transformed = 0;
+
+  // Average cache miss ratio: transformed vertices per triangle, in [0.5, 3].
+  double GetAcmr() const;
+  // Average transform to vertex ratio: transformed vertices per vertex, 1 is optimal.
+  double GetAtvr() const;
+
+  VertexCacheStats& operator+=(const VertexCacheStats& other);
+};
+
+// Simulates a FIFO vertex cache of |cache_size| entries over the triangle list |indices|.
+VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t num_verts,
+                                    uint32_t cache_size = kVertexCacheSize);
+
+// Reorders the triangles of |mesh| for vertex cache locality using Tipsify (Sander et al. 2007).
+// If |clusters| isn't null, it receives the first triangle of every run of triangles that starts
+// with a cold cache, which makes those runs free to reorder afterwards.
+void OptimizeVertexCache(Mesh* mesh, std::vector<uint32_t>* clusters = nullptr,
+                         uint32_t cache_size = kVertexCacheSize);
+void OptimizeVertexCache(std::vector<uint32_t>* indices, uint32_t num_verts,
+                         std::vector<uint32_t>* clusters = nullptr,
+                         uint32_t cache_size = kVertexCacheSize);
+
+// Splits the |clusters| from OptimizeVertexCache further wherever that keeps the ACMR within
+// |threshold| of the unsplit cluster, then sorts the clusters so that those facing away from the
+// mesh center are drawn first. This reduces overdraw from any viewpoint.
+void OptimizeOverdraw(Mesh* mesh, const std::vector<uint32_t>& clusters, float threshold = 1.05f,
+                      uint32_t cache_size = kVertexCacheSize);
+
+// Reorders the vertices of |mesh| in the order the indices first reference them, and drops
+// unreferenced vertices. The LOD indices are remapped to match.
+void OptimizeVertexFetch(Mesh* mesh);
+
+// Runs all of the above. If |before| and |after| aren't null, they receive the vertex cache
+// statistics of the mesh before and after optimizing.
+void OptimizeMesh(Mesh* mesh, VertexCacheStats* before = nullptr, 
+                  VertexCacheStats* after = nullptr);
+
+} // namespace utils
+
+#endif // UTILS_MESH_OPTIMIZER_H_
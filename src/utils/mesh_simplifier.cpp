@@ -0,0 +1,433 @@
+#include "utils/mesh_simplifier.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "utils/mesh_optimizer.h"
+
+namespace utils {
+
+namespace {
+
+constexpr uint32_t kInvalidVertex = std::numeric_limits<uint32_t>::max();
+
+// Planes through border edges, perpendicular to their triangle, get this much more weight than
+// the triangle planes so that the outline of open meshes holds its shape.
+constexpr float kBorderWeight = 10.f;
+
+// A collapse is rejected if it turns a triangle normal by more than ~75 degrees.
+constexpr float kMinFlipCos = 0.25f;
+
+constexpr size_t kMaxLods = 8;
+constexpr size_t kMinLodTriangles = 32;
+
+// LODs are only kept if they remove at least this fraction of the previous level's triangles.
+constexpr float kMinLodReduction = 0.15f;
+
+enum class VertexKind : uint8_t {
+  kManifold,
+  kBorder,
+  kLocked
+};
+
+// Sum of squared distances to a set of weighted planes.
+struct Quadric {
+  double a00 = 0.0, a11 = 0.0, a22 = 0.0;
+  double a10 = 0.0, a20 = 0.0, a21 = 0.0;
+  double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+  double c = 0.0;
+  double weight = 0.0;
+
+  // Adds the plane dot(normal, p) + d = 0, where |normal| is unit length.
+  void AddPlane(const glm::vec3& normal, float d, float plane_weight) {
+    double x = normal.x, y = normal.y, z = normal.z, w = plane_weight;
+    a00 += w * x * x;
+    a11 += w * y * y;
+    a22 += w * z * z;
+    a10 += w * y * x;
+    a20 += w * z * x;
+    a21 += w * z * y;
+    b0 += w * x * d;
+    b1 += w * y * d;
+    b2 += w * z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  Quadric& operator+=(const Quadric& other) {
+    a00 += other.a00;
+    a11 += other.a11;
+    a22 += other.a22;
+    a10 += other.a10;
+    a20 += other.a20;
+    a21 += other.a21;
+    b0 += other.b0;
+    b1 += other.b1;
+    b2 += other.b2;
+    c += other.c;
+    weight += other.weight;
+    return *this;
+  }
+
+  // Returns the weighted mean squared distance of |p| to the planes.
+  double Evaluate(const glm::vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double rx = a00 * x + a10 * y + a20 * z;
+    double ry = a10 * x + a11 * y + a21 * z;
+    double rz = a20 * x + a21 * y + a22 * z;
+    double error = rx * x + ry * y + rz * z + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0.0 ? std::abs(error) / weight : 0.0;
+  }
+};
+
+struct PositionHash {
+  size_t operator()(const glm::vec3& pos) const {
+    uint32_t words[3];
+    std::memcpy(words, &pos, sizeof(words));
+    size_t hash = 0;
+    for (uint32_t word : words) {
+      hash ^= std::hash<uint32_t>()(word) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+  }
+};
+
+uint64_t GetEdgeKey(uint32_t from, uint32_t to) {
+  return (static_cast<uint64_t>(from) << 32) | to;
+}
+
+// Directed edges of a triangle list, in terms of position representatives. An edge is a border
+// edge if the opposite edge doesn't exist.
+class EdgeSet {
+ public:
+  EdgeSet(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& pos_reps) {
+    edge_counts_.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      for (int j = 0; j < 3; ++j) {
+        uint32_t from = pos_reps[indices[i + j]];
+        uint32_t to = pos_reps[indices[i + (j + 1) % 3]];
+        if (from != to) {
+          ++edge_counts_[GetEdgeKey(from, to)];
+        }
+      }
+    }
+  }
+
+  uint32_t GetCount(uint32_t from, uint32_t to) const {
+    auto it = edge_counts_.find(GetEdgeKey(from, to));
+    return it != edge_counts_.end() ? it->second : 0;
+  }
+
+  bool IsBorder(uint32_t from, uint32_t to) const {
+    return (GetCount(from, to) > 0) != (GetCount(to, from) > 0);
+  }
+
+  template <typename Func>
+  void ForEach(Func func) const {
+    for (const auto& [key, count] : edge_counts_) {
+      func(static_cast<uint32_t>(key >> 32), static_cast<uint32_t>(key), count);
+    }
+  }
+
+ private:
+  std::unordered_map<uint64_t, uint32_t> edge_counts_;
+};
+
+std::vector<VertexKind> ClassifyVertices(const Mesh& mesh, const std::vector<uint32_t>& indices,
+                                         const std::vector<uint32_t>& pos_reps) {
+  std::vector<uint32_t> num_wedges(mesh.num_verts, 0);
+  for (uint32_t vert = 0; vert < mesh.num_verts; ++vert) {
+    ++num_wedges[pos_reps[vert]];
+  }
+
+  std::vector<uint32_t> num_border_edges(mesh.num_verts, 0);
+  std::vector<char> non_manifold(mesh.num_verts, false);
+
+  EdgeSet edges(indices, pos_reps);
+  edges.ForEach([&](uint32_t from, uint32_t to, uint32_t count) {
+    if (count > 1) {
+      non_manifold[from] = non_manifold[to] = true;
+    }
+    if (edges.GetCount(to, from) == 0) {
+      ++num_border_edges[from];
+      ++num_border_edges[to];
+    }
+  });
+
+  std::vector<VertexKind> kinds(mesh.num_verts);
+  for (uint32_t vert = 0; vert < mesh.num_verts; ++vert) {
+    uint32_t rep = pos_reps[vert];
+    if (num_wedges[rep] > 1 || non_manifold[rep] || num_border_edges[rep] > 2) {
+      kinds[vert] = VertexKind::kLocked;
+    } else if (num_border_edges[rep] > 0) {
+      kinds[vert] = VertexKind::kBorder;
+    } else {
+      kinds[vert] = VertexKind::kManifold;
+    }
+  }
+  return kinds;
+}
+
+void ComputeQuadrics(const Mesh& mesh, const std::vector<uint32_t>& indices,
+                     const std::vector<uint32_t>& pos_reps, std::vector<Quadric>* quadrics) {
+  quadrics->assign(mesh.num_verts, Quadric());
+
+  EdgeSet edges(indices, pos_reps);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    const glm::vec3& p0 = mesh.positions[indices[i + 0]];
+    const glm::vec3& p1 = mesh.positions[indices[i + 1]];
+    const glm::vec3& p2 = mesh.positions[indices[i + 2]];
+
+    glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+    float double_area = glm::length(normal);
+    if (double_area == 0.f) {
+      continue;
+    }
+    normal /= double_area;
+
+    Quadric tri_quadric;
+    tri_quadric.AddPlane(normal, -glm::dot(normal, p0), double_area * 0.5f);
+    for (int j = 0; j < 3; ++j) {
+      (*quadrics)[indices[i + j]] += tri_quadric;
+    }
+
+    for (int j = 0; j < 3; ++j) {
+      uint32_t from = indices[i + j];
+      uint32_t to = indices[i + (j + 1) % 3];
+      if (!edges.IsBorder(pos_reps[from], pos_reps[to])) {
+        continue;
+      }
+
+      glm::vec3 edge = mesh.positions[to] - mesh.positions[from];
+      float edge_length = glm::length(edge);
+      if (edge_length == 0.f) {
+        continue;
+      }
+      glm::vec3 border_normal = glm::normalize(glm::cross(edge, normal));
+
+      Quadric border_quadric;
+      border_quadric.AddPlane(border_normal, -glm::dot(border_normal, mesh.positions[from]),
+                              edge_length * edge_length * kBorderWeight);
+      (*quadrics)[from] += border_quadric;
+      (*quadrics)[to] += border_quadric;
+    }
+  }
+}
+
+// Returns true if moving |from| onto |to| flips or squashes any triangle around |from| that
+// survives the collapse.
+bool CollapseFlipsTriangle(const Mesh& mesh, const std::vector<uint32_t>& indices,
+                           const std::vector<uint32_t>& adj_offsets,
+                           const std::vector<uint32_t>& adj_tris, uint32_t from, uint32_t to) {
+  const glm::vec3& new_pos = mesh.positions[to];
+  for (uint32_t i = adj_offsets[from]; i < adj_offsets[from + 1]; ++i) {
+    const uint32_t* tri = &indices[adj_tris[i] * 3];
+    if (tri[0] == to || tri[1] == to || tri[2] == to) {
+      continue;
+    }
+
+    // Rotates the triangle so that |from| comes first.
+    int k = tri[0] == from ? 0 : (tri[1] == from ? 1 : 2);
+    const glm::vec3& p1 = mesh.positions[tri[(k + 1) % 3]];
+    const glm::vec3& p2 = mesh.positions[tri[(k + 2) % 3]];
+
+    glm::vec3 old_normal = glm::cross(p1 - mesh.positions[from], p2 - mesh.positions[from]);
+    glm::vec3 new_normal = glm::cross(p1 - new_pos, p2 - new_pos);
+    if (glm::dot(old_normal, new_normal) <= 
+        kMinFlipCos * glm::length(old_normal) * glm::length(new_normal)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+std::vector<uint32_t> SimplifyMesh(const Mesh& mesh, const std::vector<uint32_t>& indices,
+                                   size_t target_index_count, float* error) {
+  *error = 0.f;
+  std::vector<uint32_t> result = indices;
+  if (result.size() <= target_index_count) {
+    return result;
+  }
+
+  // Vertices that share a position are tracked through the first vertex at that position.
+  std::vector<uint32_t> pos_reps(mesh.num_verts);
+  {
+    std::unordered_map<glm::vec3, uint32_t, PositionHash> pos_to_rep;
+    pos_to_rep.reserve(mesh.num_verts);
+    for (uint32_t vert = 0; vert < mesh.num_verts; ++vert) {
+      pos_reps[vert] = pos_to_rep.try_emplace(mesh.positions[vert], vert).first->second;
+    }
+  }
+
+  std::vector<VertexKind> kinds = ClassifyVertices(mesh, result, pos_reps);
+  std::vector<Quadric> quadrics;
+  ComputeQuadrics(mesh, result, pos_reps, &quadrics);
+
+  double max_error = 0.0;
+
+  std::vector<uint32_t> adj_offsets(mesh.num_verts + 1);
+  std::vector<uint32_t> adj_tris;
+  std::vector<uint32_t> best_target(mesh.num_verts);
+  std::vector<double> best_cost(mesh.num_verts);
+  std::vector<uint32_t> collapse_order;
+  std::vector<uint32_t> remap(mesh.num_verts);
+  std::vector<char> vert_locked(mesh.num_verts);
+
+  while (result.size() > target_index_count) {
+    const size_t num_tris = result.size() / 3;
+
+    std::fill(adj_offsets.begin(), adj_offsets.end(), 0);
+    for (uint32_t vert : result) {
+      ++adj_offsets[vert + 1];
+    }
+    std::partial_sum(adj_offsets.begin(), adj_offsets.end(), adj_offsets.begin());
+    adj_tris.resize(result.size());
+    {
+      std::vector<uint32_t> fill_pos(adj_offsets.begin(), adj_offsets.end() - 1);
+      for (size_t i = 0; i < result.size(); ++i) {
+        adj_tris[fill_pos[result[i]]++] = static_cast<uint32_t>(i / 3);
+      }
+    }
+
+    // Finds the cheapest allowed collapse for every vertex.
+    EdgeSet edges(result, pos_reps);
+    std::fill(best_target.begin(), best_target.end(), kInvalidVertex);
+    std::fill(best_cost.begin(), best_cost.end(), std::numeric_limits<double>::max());
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int j = 0; j < 6; ++j) {
+        uint32_t from = result[i + j % 3];
+        uint32_t to = result[i + (j / 3 == 0 ? (j + 1) % 3 : (j + 2) % 3)];
+        if (from == to || kinds[from] == VertexKind::kLocked) {
+          continue;
+        }
+        if (kinds[from] == VertexKind::kBorder && 
+            (kinds[to] == VertexKind::kManifold || !edges.IsBorder(pos_reps[from], pos_reps[to]))) {
+          continue;
+        }
+
+        Quadric merged = quadrics[from];
+        merged += quadrics[to];
+        double cost = merged.Evaluate(mesh.positions[to]);
+        if (cost < best_cost[from]) {
+          best_cost[from] = cost;
+          best_target[from] = to;
+        }
+      }
+    }
+
+    collapse_order.clear();
+    for (uint32_t vert = 0; vert < mesh.num_verts; ++vert) {
+      if (best_target[vert] != kInvalidVertex) {
+        collapse_order.push_back(vert);
+      }
+    }
+    std::sort(collapse_order.begin(), collapse_order.end(), [&](uint32_t a, uint32_t b) {
+      return best_cost[a] < best_cost[b];
+    });
+
+    // Collapses as many independent edges as possible in order of cost. The vertices around a
+    // collapse are locked for the rest of the pass, since their costs are stale afterwards.
+    std::iota(remap.begin(), remap.end(), 0);
+    std::fill(vert_locked.begin(), vert_locked.end(), false);
+    const size_t num_tris_to_remove = num_tris - target_index_count / 3;
+    size_t num_tris_removed = 0;
+    size_t num_collapses = 0;
+
+    for (uint32_t from : collapse_order) {
+      uint32_t to = best_target[from];
+      if (vert_locked[from] || vert_locked[to] ||
+          CollapseFlipsTriangle(mesh, result, adj_offsets, adj_tris, from, to)) {
+        continue;
+      }
+
+      remap[from] = to;
+      quadrics[to] += quadrics[from];
+      max_error = std::max(max_error, best_cost[from]);
+      ++num_collapses;
+
+      for (uint32_t i = adj_offsets[from]; i < adj_offsets[from + 1]; ++i) {
+        const uint32_t* tri = &result[adj_tris[i] * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) {
+          ++num_tris_removed;
+        }
+        vert_locked[tri[0]] = vert_locked[tri[1]] = vert_locked[tri[2]] = true;
+      }
+
+      if (num_tris_removed >= num_tris_to_remove) {
+        break;
+      }
+    }
+
+    if (num_collapses == 0) {
+      break;
+    }
+
+    size_t write_pos = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t v0 = remap[result[i + 0]];
+      uint32_t v1 = remap[result[i + 1]];
+      uint32_t v2 = remap[result[i + 2]];
+      if (v0 != v1 && v1 != v2 && v2 != v0) {
+        result[write_pos++] = v0;
+        result[write_pos++] = v1;
+        result[write_pos++] = v2;
+      }
+    }
+    result.resize(write_pos);
+  }
+
+  *error = static_cast<float>(std::sqrt(max_error));
+  return result;
+}
+
+void BuildLodChain(Mesh* mesh) {
+  mesh->lods.clear();
+
+  const std::vector<uint32_t>* prev_indices = &mesh->indices;
+  float prev_error = 0.f;
+  while (mesh->lods.size() < kMaxLods) {
+    size_t target_index_count = prev_indices->size() / 6 * 3;
+    if (target_index_count < kMinLodTriangles * 3) {
+      break;
+    }
+
+    float error;
+    std::vector<uint32_t> lod_indices = 
+        SimplifyMesh(*mesh, *prev_indices, target_index_count, &error);
+    if (lod_indices.size() > prev_indices->size() * (1.f - kMinLodReduction)) {
+      break;
+    }
+    OptimizeVertexCache(&lod_indices, mesh->num_verts);
+
+    // Each level is simplified from the previous one, so the errors add up.
+    MeshLod lod;
+    lod.indices = std::move(lod_indices);
+    lod.error = prev_error + error;
+    prev_error = lod.error;
+
+    mesh->lods.push_back(std::move(lod));
+    prev_indices = &mesh->lods.back().indices;
+  }
+}
+
+size_t SelectLod(const Mesh& mesh, float pixels_per_unit, float max_pixel_error) {
+  size_t level = 0;
+  for (size_t i = 0; i < mesh.lods.size(); ++i) {
+    if (mesh.lods[i].error * pixels_per_unit > max_pixel_error) {
+      break;
+    }
+    level = i + 1;
+  }
+  return level;
+}
+
+} // namespace utils
@@ -0,0 +1,36 @@
+#ifndef UTILS_MESH_SIMPLIFIER_H_
+#define UTILS_MESH_SIMPLIFIER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils/model.h"
+
+namespace utils {
+
+// Simplifies the triangle list |indices|, which indexes into the vertices of |mesh|, down to at
+// most |target_index_count| indices if possible. Uses quadric error metrics with edge collapses
+// onto existing vertices, so the result references a subset of the same vertices.
+//
+// Vertices on UV, normal or material seams (several vertices at the same position) never move,
+// and border vertices only move along the border, so material boundaries, seams and outlines are
+// preserved. |error| receives the object-space distance the surface moved by.
+std::vector<uint32_t> SimplifyMesh(const Mesh& mesh, const std::vector<uint32_t>& indices,
+                                   size_t target_index_count, float* error);
+
+// Fills in |mesh->lods| with successive halvings of the triangle count, until the simplifier
+// stalls or the mesh gets too small to bother.
+void BuildLodChain(Mesh* mesh);
+
+// Returns the least detailed LOD level whose error covers at most |max_pixel_error| pixels on
+// screen. Level 0 is |mesh.indices|, level i > 0 is |mesh.lods[i - 1]|.
+//
+// |pixels_per_unit| is the size in pixels of one object-space unit at the mesh, i.e.
+//
+//   viewport_height / (2 * tan(fov_y / 2)) * model_scale / distance
+size_t SelectLod(const Mesh& mesh, float pixels_per_unit, float max_pixel_error);
+
+} // namespace utils
+
+#endif // UTILS_MESH_SIMPLIFIER_H_
@@ -0,0 +1,266 @@
+#include "utils/meshlet.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "utils/model.h"
+
+namespace utils {
+
+namespace {
+
+constexpr uint32_t kInvalidIndex = std::numeric_limits<uint32_t>::max();
+
+// Number of unused triangles, in index order, that are searched for the one closest to the current
+// meshlet once it has no connected triangles left.
+constexpr uint32_t kNumNearbySearchTris = 128;
+
+// Minimum cosine between the cone axis and any triangle normal for the normal cone to be usable.
+constexpr float kMinConeCos = 0.1f;
+
+glm::vec4 ComputeBoundingSphere(const std::vector<glm::vec3>& points) {
+  // Ritter's algorithm: starts with the sphere through two far apart points, then grows it to
+  // include all the points.
+  auto farthest_from = [&](const glm::vec3& from) {
+    size_t farthest = 0;
+    float max_dist_sq = -1.f;
+    for (size_t i = 0; i < points.size(); ++i) {
+      glm::vec3 diff = points[i] - from;
+      float dist_sq = glm::dot(diff, diff);
+      if (dist_sq > max_dist_sq) {
+        max_dist_sq = dist_sq;
+        farthest = i;
+      }
+    }
+    return points[farthest];
+  };
+
+  glm::vec3 a = farthest_from(points[0]);
+  glm::vec3 b = farthest_from(a);
+
+  glm::vec3 center = (a + b) * 0.5f;
+  float radius = glm::length(b - a) * 0.5f;
+  for (const glm::vec3& point : points) {
+    float dist = glm::length(point - center);
+    if (dist > radius) {
+      float new_radius = (radius + dist) * 0.5f;
+      center += (point - center) * ((new_radius - radius) / dist);
+      radius = new_radius;
+    }
+  }
+
+  return glm::vec4(center, radius);
+}
+
+void ComputeMeshletBounds(const Mesh& mesh, const MeshletData& data, const Meshlet& meshlet,
+                          MeshletBounds* bounds) {
+  std::vector<glm::vec3> points(meshlet.vertex_count);
+  for (uint32_t i = 0; i < meshlet.vertex_count; ++i) {
+    points[i] = mesh.positions[data.vertices[meshlet.vertex_offset + i]];
+  }
+  bounds->sphere = ComputeBoundingSphere(points);
+  glm::vec3 center(bounds->sphere);
+
+  std::vector<glm::vec3> tri_points(meshlet.triangle_count * 3);
+  std::vector<glm::vec3> tri_normals;
+  tri_normals.reserve(meshlet.triangle_count);
+  glm::vec3 normal_sum(0.f);
+  for (uint32_t i = 0; i < meshlet.triangle_count; ++i) {
+    uint32_t packed = data.triangles[meshlet.triangle_offset + i];
+    glm::vec3 p0 = points[packed & 0xff];
+    glm::vec3 p1 = points[(packed >> 8) & 0xff];
+    glm::vec3 p2 = points[(packed >> 16) & 0xff];
+
+    glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(normal);
+    if (length > 0.f) {
+      tri_points[tri_normals.size()] = p0;
+      tri_normals.push_back(normal / length);
+      normal_sum += tri_normals.back();
+    }
+  }
+
+  // Falls back to a cone that never culls for meshlets whose triangles face too many directions.
+  bounds->cone_axis = glm::vec4(0.f, 0.f, 0.f, 1.f);
+  bounds->cone_apex = glm::vec4(center, 0.f);
+
+  float normal_sum_length = glm::length(normal_sum);
+  if (normal_sum_length == 0.f) {
+    return;
+  }
+  glm::vec3 axis = normal_sum / normal_sum_length;
+
+  float min_cos = 1.f;
+  for (const glm::vec3& normal : tri_normals) {
+    min_cos = std::min(min_cos, glm::dot(axis, normal));
+  }
+  if (min_cos <= kMinConeCos) {
+    return;
+  }
+
+  // Moves the apex back along the axis until it is behind the planes of all the triangles.
+  float max_t = 0.f;
+  for (size_t i = 0; i < tri_normals.size(); ++i) {
+    float t = glm::dot(center - tri_points[i], tri_normals[i]) / glm::dot(axis, tri_normals[i]);
+    max_t = std::max(max_t, t);
+  }
+
+  bounds->cone_axis = glm::vec4(axis, std::sqrt(1.f - min_cos * min_cos));
+  bounds->cone_apex = glm::vec4(center - axis * max_t, 0.f);
+}
+
+} // namespace
+
+void BuildMeshlets(const Mesh& mesh, MeshletData* data) {
+  *data = MeshletData();
+
+  const std::vector<uint32_t>& indices = mesh.indices;
+  const size_t num_tris = indices.size() / 3;
+  if (num_tris == 0) {
+    return;
+  }
+
+  // Vertex-triangle adjacency.
+  std::vector<uint32_t> adj_offsets(mesh.num_verts + 1, 0);
+  for (uint32_t vert : indices) {
+    ++adj_offsets[vert + 1];
+  }
+  std::partial_sum(adj_offsets.begin(), adj_offsets.end(), adj_offsets.begin());
+
+  std::vector<uint32_t> adj_tris(indices.size());
+  {
+    std::vector<uint32_t> fill_pos(adj_offsets.begin(), adj_offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      adj_tris[fill_pos[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<glm::vec3> tri_centroids(num_tris);
+  for (size_t tri = 0; tri < num_tris; ++tri) {
+    tri_centroids[tri] = (mesh.positions[indices[tri * 3 + 0]] + 
+                          mesh.positions[indices[tri * 3 + 1]] + 
+                          mesh.positions[indices[tri * 3 + 2]]) / 3.f;
+  }
+
+  std::vector<char> tri_used(num_tris, false);
+  std::vector<uint32_t> vert_to_local(mesh.num_verts, kInvalidIndex);
+  size_t cursor = 0;
+
+  Meshlet meshlet = {};
+  glm::vec3 centroid_sum(0.f);
+
+  auto count_new_verts = [&](size_t tri) {
+    uint32_t count = 0;
+    for (int i = 0; i < 3; ++i) {
+      count += vert_to_local[indices[tri * 3 + i]] == kInvalidIndex ? 1 : 0;
+    }
+    return count;
+  };
+
+  auto flush_meshlet = [&]() {
+    if (meshlet.triangle_count == 0) {
+      return;
+    }
+    for (uint32_t i = 0; i < meshlet.vertex_count; ++i) {
+      vert_to_local[data->vertices[meshlet.vertex_offset + i]] = kInvalidIndex;
+    }
+
+    MeshletBounds bounds;
+    ComputeMeshletBounds(mesh, *data, meshlet, &bounds);
+    data->meshlets.push_back(meshlet);
+    data->bounds.push_back(bounds);
+
+    meshlet = {};
+    meshlet.vertex_offset = static_cast<uint32_t>(data->vertices.size());
+    meshlet.triangle_offset = static_cast<uint32_t>(data->triangles.size());
+    centroid_sum = glm::vec3(0.f);
+  };
+
+  // Prefers the connected triangle that adds the fewest new vertices, then the earliest one, which
+  // keeps the vertex cache order from OptimizeVertexCache().
+  auto find_connected_tri = [&]() {
+    uint32_t best_tri = kInvalidIndex;
+    uint32_t best_new_verts = 4;
+    for (uint32_t i = 0; i < meshlet.vertex_count; ++i) {
+      uint32_t vert = data->vertices[meshlet.vertex_offset + i];
+      for (uint32_t j = adj_offsets[vert]; j < adj_offsets[vert + 1]; ++j) {
+        uint32_t tri = adj_tris[j];
+        if (tri_used[tri]) {
+          continue;
+        }
+        uint32_t new_verts = count_new_verts(tri);
+        if (meshlet.vertex_count + new_verts > kMaxMeshletVertices) {
+          continue;
+        }
+        if (new_verts < best_new_verts || (new_verts == best_new_verts && tri < best_tri)) {
+          best_tri = tri;
+          best_new_verts = new_verts;
+        }
+      }
+    }
+    return best_tri;
+  };
+
+  // Returns the unused triangle closest to the meshlet out of the next few in index order.
+  auto find_nearby_tri = [&]() {
+    while (cursor < num_tris && tri_used[cursor]) {
+      ++cursor;
+    }
+    if (cursor == num_tris || meshlet.triangle_count == 0) {
+      return cursor < num_tris ? static_cast<uint32_t>(cursor) : kInvalidIndex;
+    }
+
+    glm::vec3 center = centroid_sum / static_cast<float>(meshlet.triangle_count);
+    uint32_t best_tri = kInvalidIndex;
+    float best_dist_sq = std::numeric_limits<float>::max();
+    uint32_t num_searched = 0;
+    for (size_t tri = cursor; tri < num_tris && num_searched < kNumNearbySearchTris; ++tri) {
+      if (tri_used[tri]) {
+        continue;
+      }
+      ++num_searched;
+      glm::vec3 diff = tri_centroids[tri] - center;
+      float dist_sq = glm::dot(diff, diff);
+      if (dist_sq < best_dist_sq) {
+        best_dist_sq = dist_sq;
+        best_tri = static_cast<uint32_t>(tri);
+      }
+    }
+    return best_tri;
+  };
+
+  for (size_t num_added = 0; num_added < num_tris; ++num_added) {
+    uint32_t tri = find_connected_tri();
+    if (tri == kInvalidIndex) {
+      tri = find_nearby_tri();
+      if (meshlet.vertex_count + count_new_verts(tri) > kMaxMeshletVertices) {
+        flush_meshlet();
+      }
+    }
+
+    uint32_t packed = 0;
+    for (int i = 0; i < 3; ++i) {
+      uint32_t vert = indices[tri * 3 + i];
+      if (vert_to_local[vert] == kInvalidIndex) {
+        vert_to_local[vert] = meshlet.vertex_count++;
+        data->vertices.push_back(vert);
+      }
+      packed |= vert_to_local[vert] << (8 * i);
+    }
+    data->triangles.push_back(packed);
+    ++meshlet.triangle_count;
+    centroid_sum += tri_centroids[tri];
+    tri_used[tri] = true;
+
+    if (meshlet.triangle_count == kMaxMeshletTriangles) {
+      flush_meshlet();
+    }
+  }
+  flush_meshlet();
+}
+
+} // namespace utils
@@ -0,0 +1,56 @@
+#ifndef UTILS_MESHLET_H_
+#define UTILS_MESHLET_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+
+struct Mesh;
+
+constexpr uint32_t kMaxMeshletVertices = 64;
+constexpr uint32_t kMaxMeshletTriangles = 124;
+
+// The meshlet types only use 32-bit scalars and vec4s, so arrays of them can be uploaded as-is to
+// std430 shader storage buffers.
+struct Meshlet {
+  uint32_t vertex_offset;   // first entry in MeshletData::vertices
+  uint32_t triangle_offset; // first entry in MeshletData::triangles
+  uint32_t vertex_count;
+  uint32_t triangle_count;
+};
+
+struct MeshletBounds {
+  // xyz is the center and w the radius of a sphere around all the meshlet vertices.
+  glm::vec4 sphere;
+
+  // Normal cone. xyz is the axis and w the sine of the cone half-angle, or 1 if the triangles face
+  // too many directions to ever cull the meshlet. The meshlet faces away from a camera at |eye| if
+  //
+  //   dot(normalize(cone_apex.xyz - eye), cone_axis.xyz) >= cone_axis.w
+  glm::vec4 cone_axis;
+  glm::vec4 cone_apex; // w is unused
+};
+
+struct MeshletData {
+  std::vector<Meshlet> meshlets;
+  std::vector<MeshletBounds> bounds; // one per meshlet
+
+  // Mesh vertex indices referenced by the meshlets.
+  std::vector<uint32_t> vertices;
+
+  // One entry per triangle, holding three 8-bit indices into the meshlet's vertices in bits 0-7,
+  // 8-15 and 16-23.
+  std::vector<uint32_t> triangles;
+};
+
+// Splits the triangles of |mesh| into meshlets of at most kMaxMeshletVertices vertices and
+// kMaxMeshletTriangles triangles. Meshlets are grown over connected triangles so that their bounds
+// and normal cones stay tight.
+void BuildMeshlets(const Mesh& mesh, MeshletData* meshlet_data);
+
+} // namespace utils
+
+#endif // UTILS_MESHLET_H_
@@ -1,37 +1,48 @@
 #include "utils/model.h"
 
 #include <glm/glm.hpp>
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tinyobjloader/tiny_obj_loader.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <numeric>
 #include <unordered_map>
 #include <utility>
 
+#include "utils/bounds.h"
+#include "utils/mesh_optimizer.h"
+#include "utils/mesh_simplifier.h"
+#include "utils/meshlet.h"
+#include "utils/model_cache.h"
+#include "utils/obj_parser.h"
+#include "utils/parallel.h"
+#include "utils/vertex_packing.h"
+
 namespace utils {
 
 namespace {
 
-bool LoadVertexDataForMesh(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs,
-                           Mesh* mesh) {
+bool LoadVertexDataForMesh(const ObjShape& shape, const ObjData& obj, Mesh* mesh) {
   assert(mesh->positions.empty());
   assert(mesh->normals.empty());
   assert(mesh->texcoords.empty());
 
-  // IMPT: Only correct because we assume that all faces are triangles.
-  mesh->num_verts = shape.mesh.num_face_vertices.size() * 3; 
+  // The parser triangulates all the faces.
+  mesh->num_verts = shape.indices.size(); 
 
   bool use_pos_data = true;
   bool use_normal_data = true;
   bool use_texcoord_data = true;
 
   // We won't load in data for a certain vertex type (e.g. normal, texcoord) if there's at least
-  // one -1 value in the tinyobjloader data (i.e. at least one vertex that doesn't have data for 
-  // that type).
+  // one -1 value in the parsed data (i.e. at least one vertex that doesn't have data for that 
+  // type).
   // If this happens for normals, we will generate them ourselves using the position data.
-  for (const tinyobj::index_t& vert_indices : shape.mesh.indices) {
+  for (const ObjIndex& vert_indices : shape.indices) {
     if (vert_indices.vertex_index == -1) {
       use_pos_data = false;
     }
@@ -58,40 +69,28 @@ bool LoadVertexDataForMesh(const tinyobj::shape_t& shape, const tinyobj::attrib_
     mesh->texcoords.resize(mesh->num_verts);
   }
   
-  // Code adapted from vulkan-tutorial.com
-  // Triangle faces only - for now.
-  size_t vert_idx = 0;
-  size_t indices_idx = 0;
-  for (unsigned int num_verts : shape.mesh.num_face_vertices) {
-    if (num_verts != 3) {
-      std::cerr << "Face is not a triangle. Failing." << std::endl;
-      return false;
+  for (size_t vert_idx = 0; vert_idx < mesh->num_verts; ++vert_idx) {
+    const ObjIndex& vert_indices = shape.indices[vert_idx];
+
+    if (use_pos_data) {
+      assert(vert_indices.vertex_index != -1);
+      size_t base_idx = vert_indices.vertex_index * 3;
+      mesh->positions[vert_idx].x = obj.positions[base_idx + 0];
+      mesh->positions[vert_idx].y = obj.positions[base_idx + 1];
+      mesh->positions[vert_idx].z = obj.positions[base_idx + 2];
     }
-
-    for (size_t i = 0; i < num_verts; ++i) {
-      auto vert_indices = shape.mesh.indices[vert_idx];
-      
-      if (use_pos_data) {
-        assert(vert_indices.vertex_index != -1);
-        size_t base_idx = vert_indices.vertex_index * 3;
-        mesh->positions[vert_idx].x = attribs.vertices[base_idx + 0];
-        mesh->positions[vert_idx].y = attribs.vertices[base_idx + 1];
-        mesh->positions[vert_idx].z = attribs.vertices[base_idx + 2];
-      }
-      if (use_normal_data) {
-        assert(vert_indices.normal_index != -1);
-        size_t base_idx = vert_indices.normal_index * 3;
-        mesh->normals[vert_idx].x = attribs.normals[base_idx + 0];
-        mesh->normals[vert_idx].y = attribs.normals[base_idx + 1];
-        mesh->normals[vert_idx].z = attribs.normals[base_idx + 2];
-      }
-      if (use_texcoord_data) {
-        assert(vert_indices.texcoord_index != -1);
-        size_t base_idx = vert_indices.texcoord_index * 2;
-        mesh->texcoords[vert_idx].s = attribs.texcoords[base_idx + 0];
-        mesh->texcoords[vert_idx].t = attribs.texcoords[base_idx + 1];
-      }
-      ++vert_idx;
+    if (use_normal_data) {
+      assert(vert_indices.normal_index != -1);
+      size_t base_idx = vert_indices.normal_index * 3;
+      mesh->normals[vert_idx].x = obj.normals[base_idx + 0];
+      mesh->normals[vert_idx].y = obj.normals[base_idx + 1];
+      mesh->normals[vert_idx].z = obj.normals[base_idx + 2];
+    }
+    if (use_texcoord_data) {
+      assert(vert_indices.texcoord_index != -1);
+      size_t base_idx = vert_indices.texcoord_index * 2;
+      mesh->texcoords[vert_idx].s = obj.texcoords[base_idx + 0];
+      mesh->texcoords[vert_idx].t = obj.texcoords[base_idx + 1];
     }
   }
 
@@ -112,73 +111,77 @@ bool LoadVertexDataForMesh(const tinyobj::shape_t& shape, const tinyobj::attrib_
   return true;
 }
 
-Material CreateMaterialFromLoaderData(const tinyobj::material_t& loader_mtl) {
-  Material mtl;
-
-  mtl.ambient_color  = glm::vec3(loader_mtl.ambient[0],
-                                loader_mtl.ambient[1],
-                                loader_mtl.ambient[2]);
-  mtl.diffuse_color  = glm::vec3(loader_mtl.diffuse[0],
-                                loader_mtl.diffuse[1],
-                                loader_mtl.diffuse[2]);
-  mtl.specular_color = glm::vec3(loader_mtl.specular[0],
-                                loader_mtl.specular[1],
-                                loader_mtl.specular[2]);
-  mtl.emission_color = glm::vec3(loader_mtl.emission[0],
-                                loader_mtl.emission[1],
-                                loader_mtl.emission[2]);
-  mtl.shininess = loader_mtl.shininess;
-
-  switch (loader_mtl.illum) {
-    case 0:
-      mtl.illum = IllumModel::kColorOnly;
-      break;
-    case 1:
-      mtl.illum = IllumModel::kAmbientOnly;
-      break;
-    case 2:
-      mtl.illum = IllumModel::kHighlight;
-      break;
-    default:
-      mtl.illum = IllumModel::kInvalid;
-      break;
-  }
-
-  if (!loader_mtl.ambient_texname.empty()) {
-    mtl.ambient_texname = loader_mtl.ambient_texname;
-  }
-  if (!loader_mtl.diffuse_texname.empty()) {
-    mtl.diffuse_texname = loader_mtl.diffuse_texname;
-  }
-  if (!loader_mtl.specular_texname.empty()) {
-    mtl.specular_texname = loader_mtl.specular_texname;
-  }
-
-  return mtl;
-}
+// Adds the materials of an OBJ file to a MaterialTable, reusing identical materials and texture
+// names that are already in the table.
+class MaterialInterner {
+ public:
+  explicit MaterialInterner(MaterialTable* table) : table_(table) {}
+
+  int InternMaterial(const ObjMaterial& obj_mtl) {
+    Material mtl = obj_mtl.material;
+    mtl.ambient_tex_id = InternTexture(obj_mtl.ambient_texname);
+    mtl.diffuse_tex_id = InternTexture(obj_mtl.diffuse_texname);
+    mtl.specular_tex_id = InternTexture(obj_mtl.specular_texname);
+
+    MaterialKey key = {
+      mtl.ambient_color.x, mtl.ambient_color.y, mtl.ambient_color.z,
+      mtl.diffuse_color.x, mtl.diffuse_color.y, mtl.diffuse_color.z,
+      mtl.specular_color.x, mtl.specular_color.y, mtl.specular_color.z,
+      mtl.emission_color.x, mtl.emission_color.y, mtl.emission_color.z,
+      mtl.shininess, static_cast<float>(mtl.illum), 
+      static_cast<float>(mtl.ambient_tex_id), static_cast<float>(mtl.diffuse_tex_id), 
+      static_cast<float>(mtl.specular_tex_id)
+    };
+    auto [it, inserted] = 
+        material_ids_.try_emplace(key, static_cast<int>(table_->materials.size()));
+    if (inserted) {
+      table_->materials.push_back(mtl);
+    }
+    return it->second;
+  }
 
-bool LoadMaterialDataForMesh(const tinyobj::shape_t& shape, 
-                             const std::vector<tinyobj::material_t>& loader_mtls, Mesh* mesh) {
-  mesh->material_ids.resize(mesh->num_verts);
+ private:
+  using MaterialKey = std::array<float, 17>;
 
-  std::unordered_map<int, int> loader_id_to_mtl_id;
+  int InternTexture(const std::string& name) {
+    if (name.empty()) {
+      return -1;
+    }
+    auto [it, inserted] = 
+        texture_ids_.try_emplace(name, static_cast<int>(table_->texture_names.size()));
+    if (inserted) {
+      table_->texture_names.push_back(name);
+    }
+    return it->second;
+  }
+
+  MaterialTable* table_;
+  std::map<MaterialKey, int> material_ids_;
+  std::unordered_map<std::string, int> texture_ids_;
+};
+
+// |obj_to_model_mtl_ids| maps the material ids of the OBJ file to ids in the model's material
+// table.
+bool LoadMaterialDataForMesh(const ObjShape& shape, const std::vector<int>& obj_to_model_mtl_ids,
+                             Mesh* mesh) {
+  mesh->material_ids.resize(mesh->num_verts);
 
   size_t vert_idx = 0;
-  for (size_t i = 0; i < shape.mesh.num_face_vertices.size(); ++i) {
+  for (size_t i = 0; i < shape.material_ids.size(); ++i) {
     int mtl_id = -1;
 
-    int loader_id = shape.mesh.material_ids[i];
+    int loader_id = shape.material_ids[i];
     if (loader_id != -1) {
-      // If the material is new, creates a new material id in the conversion table.
-      if (loader_id_to_mtl_id.find(loader_id) == loader_id_to_mtl_id.end()) {
-        loader_id_to_mtl_id[loader_id] = static_cast<int>(mesh->materials.size());
-        mesh->materials.push_back(CreateMaterialFromLoaderData(loader_mtls[loader_id]));
-      }
+      mtl_id = obj_to_model_mtl_ids[loader_id];
 
-      mtl_id = loader_id_to_mtl_id[loader_id];
+      // Meshes rarely use more than a few materials, so a linear search is enough.
+      if (std::find(mesh->used_material_ids.begin(), mesh->used_material_ids.end(), mtl_id) ==
+          mesh->used_material_ids.end()) {
+        mesh->used_material_ids.push_back(mtl_id);
+      }
     }
 
-    for (size_t j = 0; j < shape.mesh.num_face_vertices[i]; ++j) {
+    for (size_t j = 0; j < 3; ++j) {
       mesh->material_ids[vert_idx] = mtl_id;
       ++vert_idx;
     }
@@ -186,12 +189,240 @@ bool LoadMaterialDataForMesh(const tinyobj::shape_t& shape,
   return true;
 }
 
+// All the attributes of a single vertex. Two vertices are welded together only if their keys are
+// bitwise identical.
+struct VertexKey {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 texcoord;
+  int material_id;
+
+  bool operator==(const VertexKey& other) const {
+    return std::memcmp(this, &other, sizeof(VertexKey)) == 0;
+  }
+};
+
+static_assert(sizeof(VertexKey) == 9 * sizeof(float), "VertexKey must not contain padding.");
+
+struct VertexKeyHash {
+  size_t operator()(const VertexKey& key) const {
+    uint32_t words[sizeof(VertexKey) / sizeof(uint32_t)];
+    std::memcpy(words, &key, sizeof(VertexKey));
+
+    size_t hash = 0;
+    for (uint32_t word : words) {
+      hash ^= std::hash<uint32_t>()(word) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+  }
+};
+
+// Replaces the per-corner vertex data of |mesh| with the unique vertices and an index list that
+// references them.
+void WeldVertices(Mesh* mesh) {
+  const bool has_texcoords = !mesh->texcoords.empty();
+
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec2> texcoords;
+  std::vector<int> material_ids;
+
+  std::unordered_map<VertexKey, uint32_t, VertexKeyHash> key_to_vert_idx;
+  key_to_vert_idx.reserve(mesh->num_verts);
+
+  mesh->indices.resize(mesh->num_verts);
+
+  for (size_t i = 0; i < mesh->num_verts; ++i) {
+    VertexKey key;
+    key.position = mesh->positions[i];
+    key.normal = mesh->normals[i];
+    key.texcoord = has_texcoords ? mesh->texcoords[i] : glm::vec2(0.f);
+    key.material_id = mesh->material_ids[i];
+
+    auto [it, inserted] = 
+        key_to_vert_idx.try_emplace(key, static_cast<uint32_t>(positions.size()));
+    if (inserted) {
+      positions.push_back(mesh->positions[i]);
+      normals.push_back(mesh->normals[i]);
+      if (has_texcoords) {
+        texcoords.push_back(mesh->texcoords[i]);
+      }
+      material_ids.push_back(mesh->material_ids[i]);
+    }
+    mesh->indices[i] = it->second;
+  }
+
+  mesh->positions = std::move(positions);
+  mesh->normals = std::move(normals);
+  mesh->texcoords = std::move(texcoords);
+  mesh->material_ids = std::move(material_ids);
+  mesh->num_verts = static_cast<uint32_t>(mesh->positions.size());
+}
+
+// Welding and vertex cache statistics, summed over all the meshes loaded from the model file.
+struct ObjLoadStats {
+  size_t num_corner_verts = 0;
+  size_t num_unique_verts = 0;
+  VertexCacheStats cache_before;
+  VertexCacheStats cache_after;
+};
+
+// Turns a batch of parsed shapes into meshes.
+bool LoadMeshesFromObjShapes(const std::vector<ObjShape>& shapes, const ObjData& obj,
+                             const std::vector<int>& obj_to_model_mtl_ids,
+                             const ModelLoadOptions& options, std::vector<Mesh>* meshes,
+                             ObjLoadStats* stats) {
+  meshes->resize(shapes.size());
+
+  std::vector<size_t> num_corner_verts_per_mesh(shapes.size());
+  std::vector<char> mesh_loaded(shapes.size());
+  std::vector<VertexCacheStats> stats_before(shapes.size());
+  std::vector<VertexCacheStats> stats_after(shapes.size());
+
+  ParallelFor(shapes.size(), [&](size_t i) {
+    const ObjShape& shape = shapes[i];
+    Mesh& mesh = (*meshes)[i];
+
+    mesh.name = shape.name;
+
+    if (!LoadVertexDataForMesh(shape, obj, &mesh) ||
+        !LoadMaterialDataForMesh(shape, obj_to_model_mtl_ids, &mesh)) {
+      return;
+    }
+
+    num_corner_verts_per_mesh[i] = mesh.num_verts;
+
+    if (options.weld_vertices) {
+      WeldVertices(&mesh);
+    } else {
+      mesh.indices.resize(mesh.num_verts);
+      std::iota(mesh.indices.begin(), mesh.indices.end(), 0);
+    }
+
+    if (options.optimize_meshes) {
+      OptimizeMesh(&mesh, &stats_before[i], &stats_after[i]);
+    }
+
+    if (options.build_lods) {
+      BuildLodChain(&mesh);
+    }
+
+    mesh_loaded[i] = true;
+  });
+
+  for (size_t i = 0; i < meshes->size(); ++i) {
+    if (!mesh_loaded[i]) {
+      return false;
+    }
+    stats->num_corner_verts += num_corner_verts_per_mesh[i];
+    stats->num_unique_verts += (*meshes)[i].num_verts;
+    stats->cache_before += stats_before[i];
+    stats->cache_after += stats_after[i];
+  }
+  return true;
+}
+
+void PrintObjLoadStats(const ModelLoadOptions& options, const ObjLoadStats& stats,
+                       const std::vector<Mesh>& meshes) {
+  if (options.weld_vertices && stats.num_corner_verts > 0) {
+    std::cout << "Welded " << stats.num_corner_verts << " face vertices into " 
+              << stats.num_unique_verts << " unique vertices (" 
+              << 100.0 * (stats.num_corner_verts - stats.num_unique_verts) / 
+                 stats.num_corner_verts 
+              << "% reduction)." << std::endl;
+  }
+
+  if (options.optimize_meshes) {
+    std::cout << "Optimized meshes for a " << kVertexCacheSize << "-entry vertex cache: ACMR " 
+              << stats.cache_before.GetAcmr() << " -> " << stats.cache_after.GetAcmr() 
+              << ", ATVR " << stats.cache_before.GetAtvr() << " -> " 
+              << stats.cache_after.GetAtvr() << "." << std::endl;
+  }
+
+  if (options.build_lods) {
+    size_t num_levels = 1;
+    for (const Mesh& mesh : meshes) {
+      num_levels = std::max(num_levels, mesh.lods.size() + 1);
+    }
+
+    // Meshes that run out of levels count with their least detailed one.
+    std::vector<size_t> num_tris_per_level(num_levels, 0);
+    for (const Mesh& mesh : meshes) {
+      for (size_t level = 0; level < num_levels; ++level) {
+        size_t mesh_level = std::min(level, mesh.lods.size());
+        const std::vector<uint32_t>& indices = 
+            mesh_level == 0 ? mesh.indices : mesh.lods[mesh_level - 1].indices;
+        num_tris_per_level[level] += indices.size() / 3;
+      }
+    }
+    std::cout << "Built LOD chains. Triangles per level:";
+    for (size_t num_tris : num_tris_per_level) {
+      std::cout << " " << num_tris;
+    }
+    std::cout << std::endl;
+  }
+}
+
+// Builds the data that isn't stored in the mesh cache.
+void FinishMeshes(const ModelLoadOptions& options, std::vector<Mesh>* meshes) {
+  ParallelFor(meshes->size(), [&](size_t i) {
+    Mesh& mesh = (*meshes)[i];
+    mesh.aabb = ComputeAabb(mesh.positions.data(), mesh.positions.size());
+    mesh.bounding_sphere = 
+        ComputeBoundingSphere(mesh.positions.data(), mesh.positions.size(), mesh.aabb);
+    if (options.vertex_format != VertexFormat::kSeparate) {
+      PackVertices(options.vertex_format, &mesh);
+    }
+    if (options.build_meshlets) {
+      BuildMeshlets(mesh, &mesh.meshlet_data);
+    }
+  });
+}
+
+void PrintFinishStats(const ModelLoadOptions& options, const std::vector<Mesh>& meshes) {
+  if (options.vertex_format != VertexFormat::kSeparate) {
+    size_t separate_bytes = 0;
+    size_t packed_bytes = 0;
+    for (const Mesh& mesh : meshes) {
+      separate_bytes += mesh.positions.size() * sizeof(glm::vec3) + 
+                        mesh.normals.size() * sizeof(glm::vec3) +
+                        mesh.texcoords.size() * sizeof(glm::vec2) +
+                        mesh.material_ids.size() * sizeof(int);
+      packed_bytes += mesh.packed_vertices.size();
+    }
+    if (separate_bytes > 0) {
+      std::cout << "Packed vertex data from " << separate_bytes / 1024 << " KB into " 
+                << packed_bytes / 1024 << " KB (" 
+                << 100.0 * (separate_bytes - packed_bytes) / separate_bytes 
+                << "% reduction)." << std::endl;
+    }
+  }
+
+  if (options.build_meshlets) {
+    size_t num_meshlets = 0;
+    size_t num_tris = 0;
+    for (const Mesh& mesh : meshes) {
+      num_meshlets += mesh.meshlet_data.meshlets.size();
+      num_tris += mesh.indices.size() / 3;
+    }
+    if (num_meshlets > 0) {
+      std::cout << "Built " << num_meshlets << " meshlets (" 
+                << static_cast<double>(num_tris) / num_meshlets << " triangles per meshlet)." 
+                << std::endl;
+    }
+  }
+}
+
 } // namespace
 
 const Mesh& Model::GetMeshByIndex(int index) const {
   return meshes_[index];
 }
 
+Mesh* Model::GetMutableMeshByIndex(int index) {
+  return &meshes_[index];
+}
+
 const Mesh& Model::GetMeshByName(const std::string& name) const {
   return meshes_[name_to_idx_map_.at(name)];
 }
@@ -200,47 +431,96 @@ int Model::GetNumMeshes() const {
   return meshes_.size();
 }
 
+const Material& Model::GetMaterial(int id) const {
+  return material_table_.materials[id];
+}
+
 std::shared_ptr<Model> Model::LoadModelFromFile(const std::string& path, 
-                                                const std::string& material_dir) {
+                                                const std::string& material_dir,
+                                                const ModelLoadOptions& options,
+                                                const MeshLoadedCallback& on_mesh_loaded) {
   auto model = std::make_shared<Model>();
 
-  tinyobj::attrib_t attribs;
-  std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
-  std::string warn_str, err_str;
-
-  if (!tinyobj::LoadObj(&attribs, &shapes, &materials, &warn_str,
-      &err_str, path.c_str(), material_dir.c_str())) {
-    return nullptr;
-  }
+  // Hands finished meshes over to the model and the callback.
+  auto add_meshes = [&](std::vector<Mesh>* meshes) {
+    FinishMeshes(options, meshes);
+    for (Mesh& mesh : *meshes) {
+      int mesh_idx = static_cast<int>(model->meshes_.size());
+      model->name_to_idx_map_[mesh.name] = mesh_idx;
+      model->meshes_.push_back(std::move(mesh));
+      if (on_mesh_loaded) {
+        on_mesh_loaded(model->meshes_.back(), mesh_idx);
+      }
+    }
+  };
+
+  std::vector<Mesh> cached_meshes;
+  if (options.use_mesh_cache && 
+      ReadMeshCache(path, options, &cached_meshes, &model->material_table_)) {
+    add_meshes(&cached_meshes);
+  } else {
+    // The shapes are converted and handed over one window of the file at a time, so the parsed
+    // face data never has to be held for the whole file.
+    ObjData obj;
+    ObjLoadStats stats;
+    MaterialInterner interner(&model->material_table_);
+    std::vector<int> obj_to_model_mtl_ids;
+    bool meshes_ok = true;
+    bool parsed = StreamObjFile(path, material_dir, options.stream_memory_budget, &obj,
+                                [&](std::vector<ObjShape>* shapes) {
+      // Material libraries can show up anywhere in the file.
+      for (size_t i = obj_to_model_mtl_ids.size(); i < obj.materials.size(); ++i) {
+        obj_to_model_mtl_ids.push_back(interner.InternMaterial(obj.materials[i]));
+      }
 
-  // Only supports triangles for now.
-  for (const tinyobj::shape_t& shape : shapes) {
-    for (size_t num_verts : shape.mesh.num_face_vertices) {
-      if (num_verts != 3) return false;
+      std::vector<Mesh> meshes;
+      if (!LoadMeshesFromObjShapes(*shapes, obj, obj_to_model_mtl_ids, options, &meshes, 
+                                   &stats)) {
+        meshes_ok = false;
+        return false;
+      }
+      shapes->clear();
+      add_meshes(&meshes);
+      return true;
+    });
+    if (!parsed || !meshes_ok) {
+      return nullptr;
     }
-  }
 
-  model->meshes_.resize(shapes.size());
+    if (!obj.materials.empty()) {
+      std::cout << "Interned " << obj.materials.size() << " materials into " 
+                << model->material_table_.materials.size() << " unique materials with " 
+                << model->material_table_.texture_names.size() << " textures." << std::endl;
+    }
+    PrintObjLoadStats(options, stats, model->meshes_);
 
-  size_t mesh_idx = 0;
-  for (const tinyobj::shape_t& shape : shapes) {
-    Mesh& mesh = model->meshes_[mesh_idx];
+    if (options.use_mesh_cache && 
+        !WriteMeshCache(path, options, obj.material_files, model->meshes_, 
+                        model->material_table_)) {
+      std::cerr << "Could not write mesh cache: " << GetMeshCachePath(path) << std::endl;
+    }
+  }
 
-    mesh.name = shape.name;
-    model->name_to_idx_map_[mesh.name] = mesh_idx;
+  PrintFinishStats(options, model->meshes_);
 
-    if (!LoadVertexDataForMesh(shape, attribs, &mesh)) {
-      return false;
-    }
-    if (!LoadMaterialDataForMesh(shape, materials, &mesh)) {
-      return false;
+  // The model sphere is centered on the model box and reaches around every mesh sphere. It is
+  // not the tightest sphere, but it only needs the per-mesh bounds.
+  for (const Mesh& mesh : model->meshes_) {
+    model->aabb_.Merge(mesh.aabb);
+  }
+  if (!model->aabb_.IsEmpty()) {
+    glm::vec3 center = model->aabb_.GetCenter();
+    float radius = 0.f;
+    for (const Mesh& mesh : model->meshes_) {
+      if (!mesh.aabb.IsEmpty()) {
+        radius = std::max(radius, glm::length(glm::vec3(mesh.bounding_sphere) - center) + 
+                                  mesh.bounding_sphere.w);
+      }
     }
-
-    ++mesh_idx;
+    model->bounding_sphere_ = glm::vec4(center, radius);
   }
 
-  return std::move(model);
+  return model;
 }
 
 } // namespace utils
\ No newline at end of file
@@ -3,12 +3,17 @@
 
 #include <glm/glm.hpp>
 
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "utils/bounds.h"
+#include "utils/meshlet.h"
+
 namespace utils {
 
 enum class IllumModel {
@@ -28,9 +33,34 @@ struct Material {
 
   IllumModel illum;
 
-  std::string ambient_texname;
-  std::string diffuse_texname;
-  std::string specular_texname;
+  // Indices into MaterialTable::texture_names, or -1 if the material has no such texture.
+  int ambient_tex_id = -1;
+  int diffuse_tex_id = -1;
+  int specular_tex_id = -1;
+};
+
+// Materials shared by all the meshes of a model. Identical materials are stored once, and so is
+// every texture file name, so that materials and textures can be referred to by index.
+struct MaterialTable {
+  std::vector<Material> materials;
+  std::vector<std::string> texture_names;
+};
+
+enum class VertexFormat {
+  // Only the separate full-float vertex arrays.
+  kSeparate = 0,
+  // Interleaved float positions, octahedral-encoded normals and half-float texcoords.
+  kPacked,
+  // Same as kPacked, but the positions are quantized to 16 bits against the mesh bounds.
+  kPackedQuantized
+};
+
+struct MeshLod {
+  // Triangle list over the same vertices as Mesh::indices.
+  std::vector<uint32_t> indices;
+
+  // Object-space distance between this LOD and the full-detail mesh.
+  float error;
 };
 
 struct Mesh {
@@ -39,27 +69,104 @@ struct Mesh {
   std::vector<glm::vec3> positions;
   std::vector<glm::vec3> normals;
   std::vector<glm::vec2> texcoords;
+  // Position of every vertex in the lightmap atlas of the model (see utils/lightmap_uv.h). Empty
+  // unless ApplyLightmapUvs() was called on the mesh, and never stored in the mesh cache.
+  std::vector<glm::vec2> lightmap_uvs;
+  // Indices into MaterialTable::materials of the model, or -1 for vertices without a material.
   std::vector<int> material_ids;
   uint32_t num_verts;
 
-  std::vector<Material> materials;
+  // Triangle list that indexes into the vertex data above.
+  std::vector<uint32_t> indices;
+
+  // Simplified versions of |indices|, from the most to the least detailed (see
+  // utils/mesh_simplifier.h). Empty unless the model was loaded with ModelLoadOptions::build_lods.
+  std::vector<MeshLod> lods;
+
+  // Interleaved copy of the vertex data in |packed_format| (see utils/vertex_packing.h). Empty if
+  // the format is VertexFormat::kSeparate.
+  VertexFormat packed_format = VertexFormat::kSeparate;
+  std::vector<uint8_t> packed_vertices;
+
+  // Quantized positions decode to position_offset + position_scale * q, for q in [0, 1].
+  glm::vec3 position_offset = glm::vec3(0.f);
+  glm::vec3 position_scale = glm::vec3(1.f);
+
+  // Bounds of |positions|. The sphere is xyz center, w radius.
+  Aabb aabb;
+  glm::vec4 bounding_sphere = glm::vec4(0.f);
+
+  // Clusters of triangles for culling at a finer granularity than the whole mesh. Empty unless
+  // the model was loaded with ModelLoadOptions::build_meshlets.
+  MeshletData meshlet_data;
+
+  // Every material id in |material_ids| except -1, in the order of first use.
+  std::vector<int> used_material_ids;
 };
 
+struct ModelLoadOptions {
+  // Merges face corners with the same position, normal, texcoord and material into a single
+  // vertex. If false, every face corner gets its own vertex and the indices are sequential.
+  bool weld_vertices = true;
+
+  // Reorders the triangles and vertices of every mesh for vertex cache, overdraw and vertex fetch
+  // efficiency (see utils/mesh_optimizer.h).
+  bool optimize_meshes = true;
+
+  // Builds a chain of simplified LODs for every mesh.
+  bool build_lods = false;
+
+  // Reads the meshes from the binary cache next to the model file if it is up to date, and writes
+  // the cache after loading the model file otherwise.
+  bool use_mesh_cache = true;
+
+  // Builds an interleaved vertex stream in this format for each mesh, next to the full-float
+  // arrays.
+  VertexFormat vertex_format = VertexFormat::kSeparate;
+
+  // Splits every mesh into meshlets with bounding spheres and normal cones.
+  bool build_meshlets = false;
+
+  // Rough upper bound in bytes for the parsed but not yet converted data while loading a model
+  // file. The file is parsed in windows of this size and meshes are handed out as they complete.
+  // 0 parses the whole file at once.
+  size_t stream_memory_budget = 64 << 20;
+};
+
+// Called for each mesh as soon as it is ready, in order, on the thread that loads the model. The
+// reference is only valid for the duration of the call.
+using MeshLoadedCallback = std::function<void(const Mesh& mesh, int mesh_idx)>;
+
 class Model {
  public:
   const Mesh& GetMeshByIndex(int index) const;
+  // For changes that keep the bounds and LODs of the mesh in step, e.g. ApplyLightmapUvs(), so
+  // that a large mesh doesn't have to be copied to be changed.
+  Mesh* GetMutableMeshByIndex(int index);
   const Mesh& GetMeshByName(const std::string& name) const;
 
   const std::vector<Mesh>& GetMeshes() const { return meshes_; }
 
   int GetNumMeshes() const;
 
+  // Bounds of all the meshes. The sphere is xyz center, w radius.
+  const Aabb& GetAabb() const { return aabb_; }
+  const glm::vec4& GetBoundingSphere() const { return bounding_sphere_; }
+
+  const MaterialTable& GetMaterialTable() const { return material_table_; }
+  const Material& GetMaterial(int id) const;
+
   static std::shared_ptr<Model> LoadModelFromFile(const std::string& path, 
-                                                  const std::string& material_dir);
+                                                  const std::string& material_dir,
+                                                  const ModelLoadOptions& options = {},
+                                                  const MeshLoadedCallback& on_mesh_loaded = {});
 
  private:
   std::vector<Mesh> meshes_;
   std::unordered_map<std::string, int> name_to_idx_map_;
+  MaterialTable material_table_;
+  Aabb aabb_;
+  glm::vec4 bounding_sphere_ = glm::vec4(0.f);
 };
 
 
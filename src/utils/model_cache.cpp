@@ -0,0 +1,409 @@
+#include "utils/model_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "utils/cache_file.h"
+#include "utils/mapped_file.h"
+
+namespace utils {
+
+namespace {
+
+constexpr char kCacheMagic[8] = { 'R', 'O', 'B', 'I', 'N', 'M', 'S', 'H' };
+
+// Must be incremented whenever the layout of the cache changes.
+constexpr uint32_t kCacheVersion = 4;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t options_key;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint32_t num_meshes;
+  uint32_t num_materials;
+  uint32_t num_textures;
+  uint32_t num_material_files;
+};
+
+// Follows the path of every material file, right after the header. A missing file has a stamp of
+// zeros, so that the cache also goes stale when the file shows up.
+struct CacheFileStamp {
+  uint64_t size;
+  int64_t mtime;
+};
+
+struct CacheMeshHeader {
+  uint32_t num_verts;
+  uint32_t num_indices;
+  uint32_t has_texcoords;
+  uint32_t num_used_materials;
+  uint32_t num_lods;
+};
+
+struct CacheLodHeader {
+  uint32_t num_indices;
+  float error;
+};
+
+struct CacheMaterial {
+  float ambient_color[3];
+  float diffuse_color[3];
+  float specular_color[3];
+  float emission_color[3];
+  float shininess;
+  int32_t illum;
+  int32_t ambient_tex_id;
+  int32_t diffuse_tex_id;
+  int32_t specular_tex_id;
+};
+
+// Packs the load options that change the contents of the meshes.
+uint32_t GetOptionsKey(const ModelLoadOptions& options) {
+  uint32_t key = 0;
+  key |= options.weld_vertices ? 1u << 0 : 0u;
+  key |= options.optimize_meshes ? 1u << 1 : 0u;
+  key |= options.build_lods ? 1u << 2 : 0u;
+  return key;
+}
+
+class CacheWriter {
+ public:
+  template<typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    WriteBytes(&value, sizeof(T));
+  }
+
+  template<typename T>
+  void WriteArray(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    WriteBytes(values.data(), values.size() * sizeof(T));
+  }
+
+  void WriteString(const std::string& str) {
+    Write(static_cast<uint32_t>(str.size()));
+    WriteBytes(str.data(), str.size());
+  }
+
+  const std::vector<uint8_t>& GetBuffer() const { return buffer_; }
+
+ private:
+  // Every write is padded to 4 bytes so that all the arrays in the cache stay aligned.
+  void WriteBytes(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+    buffer_.resize((buffer_.size() + 3) & ~size_t(3), 0);
+  }
+
+  std::vector<uint8_t> buffer_;
+};
+
+class CacheReader {
+ public:
+  CacheReader(const uint8_t* data, size_t size) : cur_(data), end_(data + size) {}
+
+  template<typename T>
+  bool Read(T* value) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    return ReadBytes(value, sizeof(T));
+  }
+
+  template<typename T>
+  bool ReadArray(size_t count, std::vector<T>* values) {
+    static_assert(std::is_trivially_copyable<T>::value);
+    if (count > GetRemaining() / sizeof(T)) {
+      return false;
+    }
+    values->resize(count);
+    return ReadBytes(values->data(), count * sizeof(T));
+  }
+
+  bool ReadString(std::string* str) {
+    uint32_t len;
+    if (!Read(&len) || len > GetRemaining()) {
+      return false;
+    }
+    str->assign(reinterpret_cast<const char*>(cur_), len);
+    return Skip(len);
+  }
+
+ private:
+  size_t GetRemaining() const { return static_cast<size_t>(end_ - cur_); }
+
+  bool ReadBytes(void* data, size_t size) {
+    if (size > GetRemaining()) {
+      return false;
+    }
+    if (size > 0) {
+      std::memcpy(data, cur_, size);
+    }
+    return Skip(size);
+  }
+
+  bool Skip(size_t size) {
+    size_t padded_size = (size + 3) & ~size_t(3);
+    if (padded_size > GetRemaining()) {
+      padded_size = GetRemaining();
+    }
+    cur_ += padded_size;
+    return true;
+  }
+
+  const uint8_t* cur_;
+  const uint8_t* end_;
+};
+
+CacheMaterial ToCacheMaterial(const Material& mtl) {
+  CacheMaterial cache_mtl;
+  std::memcpy(cache_mtl.ambient_color, &mtl.ambient_color, sizeof(cache_mtl.ambient_color));
+  std::memcpy(cache_mtl.diffuse_color, &mtl.diffuse_color, sizeof(cache_mtl.diffuse_color));
+  std::memcpy(cache_mtl.specular_color, &mtl.specular_color, sizeof(cache_mtl.specular_color));
+  std::memcpy(cache_mtl.emission_color, &mtl.emission_color, sizeof(cache_mtl.emission_color));
+  cache_mtl.shininess = mtl.shininess;
+  cache_mtl.illum = static_cast<int32_t>(mtl.illum);
+  cache_mtl.ambient_tex_id = mtl.ambient_tex_id;
+  cache_mtl.diffuse_tex_id = mtl.diffuse_tex_id;
+  cache_mtl.specular_tex_id = mtl.specular_tex_id;
+  return cache_mtl;
+}
+
+Material FromCacheMaterial(const CacheMaterial& cache_mtl) {
+  Material mtl;
+  std::memcpy(&mtl.ambient_color, cache_mtl.ambient_color, sizeof(cache_mtl.ambient_color));
+  std::memcpy(&mtl.diffuse_color, cache_mtl.diffuse_color, sizeof(cache_mtl.diffuse_color));
+  std::memcpy(&mtl.specular_color, cache_mtl.specular_color, sizeof(cache_mtl.specular_color));
+  std::memcpy(&mtl.emission_color, cache_mtl.emission_color, sizeof(cache_mtl.emission_color));
+  mtl.shininess = cache_mtl.shininess;
+  mtl.illum = static_cast<IllumModel>(cache_mtl.illum);
+  mtl.ambient_tex_id = cache_mtl.ambient_tex_id;
+  mtl.diffuse_tex_id = cache_mtl.diffuse_tex_id;
+  mtl.specular_tex_id = cache_mtl.specular_tex_id;
+  return mtl;
+}
+
+bool ReadMesh(CacheReader* reader, Mesh* mesh) {
+  CacheMeshHeader mesh_header;
+  if (!reader->ReadString(&mesh->name) || !reader->Read(&mesh_header)) {
+    return false;
+  }
+  mesh->num_verts = mesh_header.num_verts;
+
+  if (!reader->ReadArray(mesh_header.num_verts, &mesh->positions) ||
+      !reader->ReadArray(mesh_header.num_verts, &mesh->normals) ||
+      !reader->ReadArray(mesh_header.has_texcoords ? mesh_header.num_verts : 0, 
+                         &mesh->texcoords) ||
+      !reader->ReadArray(mesh_header.num_verts, &mesh->material_ids) ||
+      !reader->ReadArray(mesh_header.num_indices, &mesh->indices) ||
+      !reader->ReadArray(mesh_header.num_used_materials, &mesh->used_material_ids)) {
+    return false;
+  }
+
+  mesh->lods.resize(mesh_header.num_lods);
+  for (MeshLod& lod : mesh->lods) {
+    CacheLodHeader lod_header;
+    if (!reader->Read(&lod_header) || 
+        !reader->ReadArray(lod_header.num_indices, &lod.indices)) {
+      return false;
+    }
+    lod.error = lod_header.error;
+  }
+
+  return true;
+}
+
+void WriteMesh(const Mesh& mesh, CacheWriter* writer) {
+  CacheMeshHeader mesh_header;
+  mesh_header.num_verts = mesh.num_verts;
+  mesh_header.num_indices = static_cast<uint32_t>(mesh.indices.size());
+  mesh_header.has_texcoords = mesh.texcoords.empty() ? 0 : 1;
+  mesh_header.num_used_materials = static_cast<uint32_t>(mesh.used_material_ids.size());
+  mesh_header.num_lods = static_cast<uint32_t>(mesh.lods.size());
+
+  writer->WriteString(mesh.name);
+  writer->Write(mesh_header);
+
+  writer->WriteArray(mesh.positions);
+  writer->WriteArray(mesh.normals);
+  writer->WriteArray(mesh.texcoords);
+  writer->WriteArray(mesh.material_ids);
+  writer->WriteArray(mesh.indices);
+  writer->WriteArray(mesh.used_material_ids);
+
+  for (const MeshLod& lod : mesh.lods) {
+    CacheLodHeader lod_header;
+    lod_header.num_indices = static_cast<uint32_t>(lod.indices.size());
+    lod_header.error = lod.error;
+    writer->Write(lod_header);
+    writer->WriteArray(lod.indices);
+  }
+}
+
+bool ReadMaterialTable(CacheReader* reader, uint32_t num_materials, uint32_t num_textures,
+                       MaterialTable* table) {
+  table->texture_names.resize(num_textures);
+  for (std::string& texture_name : table->texture_names) {
+    if (!reader->ReadString(&texture_name)) {
+      return false;
+    }
+  }
+
+  table->materials.resize(num_materials);
+  for (Material& mtl : table->materials) {
+    CacheMaterial cache_mtl;
+    if (!reader->Read(&cache_mtl)) {
+      return false;
+    }
+    mtl = FromCacheMaterial(cache_mtl);
+  }
+  return true;
+}
+
+CacheFileStamp GetMaterialFileStamp(const std::string& path) {
+  CacheFileStamp stamp = {};
+  if (!GetSourceStamp(path, &stamp.size, &stamp.mtime)) {
+    stamp = {};
+  }
+  return stamp;
+}
+
+// Checks that the indices of the mesh stay within its vertices, and its material ids within the
+// table, so that a damaged cache that still matches the stamps is never read out of bounds.
+bool IsMeshValid(const Mesh& mesh, const MaterialTable& table) {
+  auto is_index_valid = [&](uint32_t index) { return index < mesh.num_verts; };
+  if (!std::all_of(mesh.indices.begin(), mesh.indices.end(), is_index_valid)) {
+    return false;
+  }
+  for (const MeshLod& lod : mesh.lods) {
+    if (!std::all_of(lod.indices.begin(), lod.indices.end(), is_index_valid)) {
+      return false;
+    }
+  }
+
+  const int num_materials = static_cast<int>(table.materials.size());
+  return std::all_of(mesh.material_ids.begin(), mesh.material_ids.end(), 
+                     [&](int id) { return id >= -1 && id < num_materials; }) &&
+         std::all_of(mesh.used_material_ids.begin(), mesh.used_material_ids.end(), 
+                     [&](int id) { return id >= 0 && id < num_materials; });
+}
+
+bool IsMaterialTableValid(const MaterialTable& table) {
+  const int num_textures = static_cast<int>(table.texture_names.size());
+  auto is_tex_id_valid = [&](int id) { return id >= -1 && id < num_textures; };
+  return std::all_of(table.materials.begin(), table.materials.end(), [&](const Material& mtl) {
+    return is_tex_id_valid(mtl.ambient_tex_id) && is_tex_id_valid(mtl.diffuse_tex_id) &&
+           is_tex_id_valid(mtl.specular_tex_id);
+  });
+}
+
+void WriteMaterialTable(const MaterialTable& table, CacheWriter* writer) {
+  for (const std::string& texture_name : table.texture_names) {
+    writer->WriteString(texture_name);
+  }
+  for (const Material& mtl : table.materials) {
+    writer->Write(ToCacheMaterial(mtl));
+  }
+}
+
+} // namespace
+
+std::string GetMeshCachePath(const std::string& model_path) {
+  return model_path + ".robinmesh";
+}
+
+bool ReadMeshCache(const std::string& model_path, const ModelLoadOptions& options,
+                   std::vector<Mesh>* meshes, MaterialTable* material_table) {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!GetSourceStamp(model_path, &source_size, &source_mtime)) {
+    return false;
+  }
+
+  std::unique_ptr<MappedFile> file = MappedFile::Open(GetMeshCachePath(model_path));
+  if (file == nullptr) {
+    return false;
+  }
+
+  CacheReader reader(file->GetData(), file->GetSize());
+
+  CacheHeader header;
+  if (!reader.Read(&header)) {
+    return false;
+  }
+  if (std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      header.version != kCacheVersion || 
+      header.options_key != GetOptionsKey(options) ||
+      header.source_size != source_size || 
+      header.source_mtime != source_mtime) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header.num_material_files; ++i) {
+    std::string path;
+    CacheFileStamp stamp;
+    if (!reader.ReadString(&path) || !reader.Read(&stamp)) {
+      return false;
+    }
+    CacheFileStamp current_stamp = GetMaterialFileStamp(path);
+    if (stamp.size != current_stamp.size || stamp.mtime != current_stamp.mtime) {
+      return false;
+    }
+  }
+
+  MaterialTable cached_material_table;
+  if (!ReadMaterialTable(&reader, header.num_materials, header.num_textures, 
+                         &cached_material_table) ||
+      !IsMaterialTableValid(cached_material_table)) {
+    return false;
+  }
+
+  std::vector<Mesh> cached_meshes(header.num_meshes);
+  for (Mesh& mesh : cached_meshes) {
+    if (!ReadMesh(&reader, &mesh) || !IsMeshValid(mesh, cached_material_table)) {
+      return false;
+    }
+  }
+
+  *meshes = std::move(cached_meshes);
+  *material_table = std::move(cached_material_table);
+  return true;
+}
+
+bool WriteMeshCache(const std::string& model_path, const ModelLoadOptions& options,
+                    const std::vector<std::string>& material_files,
+                    const std::vector<Mesh>& meshes, const MaterialTable& material_table) {
+  CacheHeader header = {};
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.options_key = GetOptionsKey(options);
+  header.num_meshes = static_cast<uint32_t>(meshes.size());
+  header.num_materials = static_cast<uint32_t>(material_table.materials.size());
+  header.num_textures = static_cast<uint32_t>(material_table.texture_names.size());
+  header.num_material_files = static_cast<uint32_t>(material_files.size());
+  if (!GetSourceStamp(model_path, &header.source_size, &header.source_mtime)) {
+    return false;
+  }
+
+  CacheWriter writer;
+  writer.Write(header);
+  for (const std::string& path : material_files) {
+    writer.WriteString(path);
+    writer.Write(GetMaterialFileStamp(path));
+  }
+  WriteMaterialTable(material_table, &writer);
+  for (const Mesh& mesh : meshes) {
+    WriteMesh(mesh, &writer);
+  }
+
+  return WriteFileAtomically(GetMeshCachePath(model_path), writer.GetBuffer());
+}
+
+} // namespace utils
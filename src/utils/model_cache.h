@@ -0,0 +1,30 @@
+#ifndef UTILS_MODEL_CACHE_H_
+#define UTILS_MODEL_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include "utils/model.h"
+
+namespace utils {
+
+// Binary cache of the meshes loaded from a model file, stored next to the model file (e.g. 
+// sponza.obj.robinmesh). The cache records the size and modification time of the model file and
+// of the material files it references, and the load options it was built with. It is ignored if
+// any of them have changed, or if its indices or material ids are out of range.
+
+std::string GetMeshCachePath(const std::string& model_path);
+
+// Memory-maps the cache of |model_path| and reads the meshes and their material table from it.
+// Returns false if there is no valid cache for the model file and options.
+bool ReadMeshCache(const std::string& model_path, const ModelLoadOptions& options,
+                   std::vector<Mesh>* meshes, MaterialTable* material_table);
+
+// |material_files| are the paths of the material files, as in ObjData::material_files.
+bool WriteMeshCache(const std::string& model_path, const ModelLoadOptions& options,
+                    const std::vector<std::string>& material_files,
+                    const std::vector<Mesh>& meshes, const MaterialTable& material_table);
+
+} // namespace utils
+
+#endif // UTILS_MODEL_CACHE_H_
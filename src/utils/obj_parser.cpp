@@ -0,0 +1,901 @@
+#include "utils/obj_parser.h"
+
+#include <glm/glm.hpp>
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tinyobjloader/tiny_obj_loader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/mapped_file.h"
+#include "utils/parallel.h"
+
+namespace utils {
+
+namespace {
+
+// Chunks smaller than this aren't worth handing to another thread.
+constexpr size_t kMinChunkSize = 1 << 20;
+
+// Rough size of the parsed chunk data (attributes, corners, face starts) per byte of OBJ text. Used
+// to turn a memory budget into a window size.
+constexpr size_t kParsedBytesPerFileByte = 4;
+
+constexpr uint8_t kRelativeVertex = 1 << 0;
+constexpr uint8_t kRelativeNormal = 1 << 1;
+constexpr uint8_t kRelativeTexcoord = 1 << 2;
+
+// A face corner as it is written in the file. Negative (relative) indices can only be resolved
+// against the number of attributes in the chunk, so they are flagged in |relative_mask| and the
+// offset of the chunk is added after all the chunks have been parsed.
+struct Corner {
+  ObjIndex index;
+  uint8_t relative_mask;
+};
+
+// Statements other than vertex data and faces. They are replayed in file order after all the
+// chunks have been parsed.
+enum class EventType {
+  kUseMtl,
+  kMtlLib,
+  kGroup,
+  kObject,
+  kOtherPrim
+};
+
+struct Event {
+  EventType type;
+
+  // Number of faces in the chunk that come before the event.
+  size_t face_pos;
+
+  std::string arg;
+};
+
+struct Chunk {
+  std::vector<float> positions;
+  std::vector<float> normals;
+  std::vector<float> texcoords;
+
+  std::vector<Corner> corners;
+
+  // Start of each face in |corners|, followed by corners.size().
+  std::vector<size_t> face_starts;
+
+  std::vector<Event> events;
+
+  bool ok = true;
+};
+
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+inline bool IsDigit(char c) {
+  return static_cast<unsigned int>(c - '0') < 10u;
+}
+
+inline bool IsLineEnd(const char* p, const char* end) {
+  return p == end || *p == '\r' || *p == '\n';
+}
+
+const char* SkipChars(const char* p, const char* end, const char* chars) {
+  while (p < end && std::strchr(chars, *p) != nullptr) {
+    ++p;
+  }
+  return p;
+}
+
+const char* FindChars(const char* p, const char* end, const char* chars) {
+  while (p < end && std::strchr(chars, *p) == nullptr) {
+    ++p;
+  }
+  return p;
+}
+
+bool HasKeyword(const char* p, const char* end, const char* keyword) {
+  size_t len = std::strlen(keyword);
+  return static_cast<size_t>(end - p) > len && std::memcmp(p, keyword, len) == 0 &&
+         IsSpace(p[len]);
+}
+
+// Parses the next whitespace-separated token as a real number. Like tinyobjloader, the token is
+// consumed even if it isn't a valid number, in which case |default_value| is returned.
+float ParseReal(const char** p, const char* end, double default_value = 0.0) {
+  const char* token = SkipChars(*p, end, " \t");
+  const char* token_end = FindChars(token, end, " \t\r");
+  *p = token_end;
+
+  if (token < token_end && *token == '+') {
+    ++token;
+  }
+
+  double value = default_value;
+  if (token < token_end && (IsDigit(*token) || *token == '.' || *token == '-')) {
+    // |value| is left untouched if the token can't be parsed.
+    std::from_chars(token, token_end, value);
+  }
+  return static_cast<float>(value);
+}
+
+// Same as atoi(), but stops at |end|.
+int ParseInt(const char* p, const char* end) {
+  while (p < end && std::isspace(static_cast<unsigned char>(*p))) {
+    ++p;
+  }
+
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) {
+    negative = *p == '-';
+    ++p;
+  }
+
+  int64_t value = 0;
+  while (p < end && IsDigit(*p)) {
+    value = std::min<int64_t>(value * 10 + (*p - '0'), INT_MAX);
+    ++p;
+  }
+  return static_cast<int>(negative ? -value : value);
+}
+
+// Converts a one-based OBJ index to a zero-based index. Index 0 is invalid.
+bool FixIndex(int idx, size_t count, uint8_t relative_flag, int* ret, uint8_t* relative_mask) {
+  if (idx > 0) {
+    *ret = idx - 1;
+    return true;
+  }
+  if (idx == 0) {
+    return false;
+  }
+  *ret = static_cast<int>(count) + idx;
+  *relative_mask |= relative_flag;
+  return true;
+}
+
+// Parses a face corner in one of the forms: v, v/vt, v//vn, v/vt/vn.
+bool ParseCorner(const char** p, const char* end, const Chunk& chunk, Corner* corner) {
+  corner->index.vertex_index = -1;
+  corner->index.normal_index = -1;
+  corner->index.texcoord_index = -1;
+  corner->relative_mask = 0;
+
+  const size_t num_positions = chunk.positions.size() / 3;
+  const size_t num_normals = chunk.normals.size() / 3;
+  const size_t num_texcoords = chunk.texcoords.size() / 2;
+
+  const char* cur = *p;
+  if (!FixIndex(ParseInt(cur, end), num_positions, kRelativeVertex, &corner->index.vertex_index,
+                &corner->relative_mask)) {
+    return false;
+  }
+  cur = FindChars(cur, end, "/ \t\r");
+  if (cur == end || *cur != '/') {
+    *p = cur;
+    return true;
+  }
+  ++cur;
+
+  // v//vn
+  if (cur < end && *cur == '/') {
+    ++cur;
+    if (!FixIndex(ParseInt(cur, end), num_normals, kRelativeNormal, &corner->index.normal_index,
+                  &corner->relative_mask)) {
+      return false;
+    }
+    *p = FindChars(cur, end, "/ \t\r");
+    return true;
+  }
+
+  // v/vt/vn or v/vt
+  if (!FixIndex(ParseInt(cur, end), num_texcoords, kRelativeTexcoord,
+                &corner->index.texcoord_index, &corner->relative_mask)) {
+    return false;
+  }
+  cur = FindChars(cur, end, "/ \t\r");
+  if (cur == end || *cur != '/') {
+    *p = cur;
+    return true;
+  }
+  ++cur;
+
+  if (!FixIndex(ParseInt(cur, end), num_normals, kRelativeNormal, &corner->index.normal_index,
+                &corner->relative_mask)) {
+    return false;
+  }
+  *p = FindChars(cur, end, "/ \t\r");
+  return true;
+}
+
+// Parses the corners of a face, line or point statement. Appends them to |corners| if it isn't
+// null.
+bool ParseCorners(const char* p, const char* end, const Chunk& chunk,
+                  std::vector<Corner>* corners) {
+  while (!IsLineEnd(p, end)) {
+    Corner corner;
+    if (!ParseCorner(&p, end, chunk, &corner)) {
+      return false;
+    }
+    if (corners != nullptr) {
+      corners->push_back(corner);
+    }
+    p = SkipChars(p, end, " \t\r");
+  }
+  return true;
+}
+
+std::string ParseGroupName(const char* p, const char* end) {
+  std::vector<std::string> names;
+  while (!IsLineEnd(p, end)) {
+    const char* token = SkipChars(p, end, " \t");
+    const char* token_end = FindChars(token, end, " \t\r");
+    names.emplace_back(token, token_end);
+    p = SkipChars(token_end, end, " \t\r");
+  }
+
+  // names[0] is the "g" keyword. Multiple group names are joined into one.
+  std::string name;
+  for (size_t i = 1; i < names.size(); ++i) {
+    if (i > 1) {
+      name += ' ';
+    }
+    name += names[i];
+  }
+  return name;
+}
+
+void ParseLine(const char* p, const char* end, Chunk* chunk) {
+  p = SkipChars(p, end, " \t");
+  if (p == end || *p == '#') {
+    return;
+  }
+
+  if (HasKeyword(p, end, "v")) {
+    p += 2;
+    chunk->positions.push_back(ParseReal(&p, end));
+    chunk->positions.push_back(ParseReal(&p, end));
+    chunk->positions.push_back(ParseReal(&p, end));
+  } else if (HasKeyword(p, end, "vn")) {
+    p += 3;
+    chunk->normals.push_back(ParseReal(&p, end));
+    chunk->normals.push_back(ParseReal(&p, end));
+    chunk->normals.push_back(ParseReal(&p, end));
+  } else if (HasKeyword(p, end, "vt")) {
+    p += 3;
+    chunk->texcoords.push_back(ParseReal(&p, end));
+    chunk->texcoords.push_back(ParseReal(&p, end));
+  } else if (HasKeyword(p, end, "l") || HasKeyword(p, end, "p")) {
+    // Lines and points aren't loaded, but they still need to be valid and they affect which shapes
+    // are created.
+    if (!ParseCorners(p + 2, end, *chunk, nullptr)) {
+      chunk->ok = false;
+      return;
+    }
+    chunk->events.push_back({ EventType::kOtherPrim, chunk->face_starts.size(), "" });
+  } else if (HasKeyword(p, end, "f")) {
+    p = SkipChars(p + 2, end, " \t");
+    chunk->face_starts.push_back(chunk->corners.size());
+    if (!ParseCorners(p, end, *chunk, &chunk->corners)) {
+      chunk->ok = false;
+    }
+  } else if (HasKeyword(p, end, "usemtl")) {
+    chunk->events.push_back({ EventType::kUseMtl, chunk->face_starts.size(),
+                              std::string(p + 7, end) });
+  } else if (HasKeyword(p, end, "mtllib")) {
+    chunk->events.push_back({ EventType::kMtlLib, chunk->face_starts.size(),
+                              std::string(p + 7, end) });
+  } else if (HasKeyword(p, end, "g")) {
+    chunk->events.push_back({ EventType::kGroup, chunk->face_starts.size(),
+                              ParseGroupName(p, end) });
+  } else if (HasKeyword(p, end, "o")) {
+    chunk->events.push_back({ EventType::kObject, chunk->face_starts.size(),
+                              std::string(p + 2, end) });
+  }
+  // Other statements (smoothing groups, tags, etc.) don't affect the loaded data.
+}
+
+void ParseChunk(const char* begin, const char* end, Chunk* chunk) {
+  const char* line = begin;
+  while (line < end && chunk->ok) {
+    const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+
+    const char* content_end = line_end;
+    if (content_end > line && content_end[-1] == '\r') {
+      --content_end;
+    }
+    ParseLine(line, content_end, chunk);
+
+    line = line_end < end ? line_end + 1 : end;
+  }
+  chunk->face_starts.push_back(chunk->corners.size());
+}
+
+// Returns the end of the line that |pos| is on, including the line break.
+size_t FindLineEnd(const char* data, size_t size, size_t pos) {
+  if (pos >= size) {
+    return size;
+  }
+  const void* line_end = std::memchr(data + pos, '\n', size - pos);
+  return line_end != nullptr ? 
+      static_cast<size_t>(static_cast<const char*>(line_end) - data) + 1 : size;
+}
+
+// Splits the file into chunks that each end at a line break.
+std::vector<std::pair<size_t, size_t>> SplitIntoChunks(const char* data, size_t size) {
+  size_t num_chunks =
+      std::max<size_t>(1, std::min(GetNumWorkerThreads() * 4, size / kMinChunkSize));
+  size_t target_size = size / num_chunks;
+
+  std::vector<std::pair<size_t, size_t>> chunks;
+  size_t begin = 0;
+  while (begin < size) {
+    size_t end = FindLineEnd(data, size, begin + std::max<size_t>(target_size, 1));
+    chunks.emplace_back(begin, end);
+    begin = end;
+  }
+  return chunks;
+}
+
+// A run of consecutive faces in a chunk that share a material.
+struct FaceRange {
+  size_t chunk_idx;
+  size_t begin;
+  size_t end;
+  int material_id;
+};
+
+// Whether a shape is kept if triangulating its faces produced no triangles. This follows the rules
+// tinyobjloader uses when closing a shape.
+enum class KeepRule {
+  kIfNotEmpty,
+  kAlways
+};
+
+struct ShapePlan {
+  std::string name;
+  std::vector<FaceRange> faces;
+  KeepRule keep_rule;
+};
+
+// Replays the group, object and material statements of the file in order, mirroring the state
+// machine in tinyobj::LoadObj(), to work out which faces go into which shape.
+class ShapePlanner {
+ public:
+  ShapePlanner(const std::string& material_dir) : material_dir_(material_dir) {
+    if (!material_dir_.empty()) {
+#ifdef _WIN32
+      const char dir_sep = '\\';
+#else
+      const char dir_sep = '/';
+#endif
+      if (material_dir_.back() != dir_sep) {
+        material_dir_ += dir_sep;
+      }
+    }
+  }
+
+  void AddFaces(size_t chunk_idx, size_t begin, size_t end) {
+    if (begin == end) {
+      return;
+    }
+    if (!pending_faces_.empty() && pending_faces_.back().chunk_idx == chunk_idx &&
+        pending_faces_.back().end == begin) {
+      pending_faces_.back().end = end;
+    } else {
+      pending_faces_.push_back({ chunk_idx, begin, end, -1 });
+    }
+  }
+
+  void HandleEvent(const Event& event) {
+    switch (event.type) {
+      case EventType::kUseMtl: {
+        auto it = material_map_.find(event.arg);
+        int material_id = it != material_map_.end() ? it->second : -1;
+        if (material_id != material_id_) {
+          ExportPendingFaces();
+          pending_faces_.clear();
+          material_id_ = material_id;
+        }
+        break;
+      }
+      case EventType::kMtlLib:
+        LoadMaterialLibrary(event.arg);
+        break;
+      case EventType::kGroup:
+        ExportPendingFaces();
+        FinishShape(KeepRule::kIfNotEmpty);
+        name_ = event.arg;
+        break;
+      case EventType::kObject:
+        if (ExportPendingFaces()) {
+          FinishShape(KeepRule::kAlways);
+        } else {
+          shape_ = ShapePlan();
+          ClearPending();
+        }
+        name_ = event.arg;
+        break;
+      case EventType::kOtherPrim:
+        has_other_prims_ = true;
+        break;
+    }
+  }
+
+  void Finish() {
+    FinishShape(ExportPendingFaces() ? KeepRule::kAlways : KeepRule::kIfNotEmpty);
+  }
+
+  // Returns the shapes that were finished since the last call.
+  std::vector<ShapePlan> TakeFinishedPlans() { return std::exchange(plans_, {}); }
+
+  const std::vector<tinyobj::material_t>& GetMaterials() const { return materials_; }
+  const std::vector<std::string>& GetMaterialFiles() const { return material_files_; }
+
+  // Returns the first chunk that faces of the unfinished shape are in, or |num_chunks| if it has
+  // none. Earlier chunks are no longer needed.
+  size_t GetFirstOpenChunk(size_t num_chunks) const {
+    size_t first_chunk = num_chunks;
+    for (const FaceRange& range : shape_.faces) {
+      first_chunk = std::min(first_chunk, range.chunk_idx);
+    }
+    for (const FaceRange& range : pending_faces_) {
+      first_chunk = std::min(first_chunk, range.chunk_idx);
+    }
+    return first_chunk;
+  }
+
+ private:
+  // Mirrors exportGroupsToShape().
+  bool ExportPendingFaces() {
+    if (pending_faces_.empty() && !has_other_prims_) {
+      return false;
+    }
+    shape_.name = name_;
+    for (FaceRange range : pending_faces_) {
+      range.material_id = material_id_;
+      shape_.faces.push_back(range);
+    }
+    return true;
+  }
+
+  void FinishShape(KeepRule keep_rule) {
+    if (keep_rule == KeepRule::kAlways || !shape_.faces.empty()) {
+      shape_.keep_rule = keep_rule;
+      plans_.push_back(std::move(shape_));
+    }
+    shape_ = ShapePlan();
+    ClearPending();
+  }
+
+  void ClearPending() {
+    pending_faces_.clear();
+    has_other_prims_ = false;
+  }
+
+  void LoadMaterialLibrary(const std::string& arg) {
+    std::vector<std::string> filenames;
+    std::stringstream sstrm(arg);
+    std::string filename;
+    while (std::getline(sstrm, filename, ' ')) {
+      filenames.push_back(filename);
+    }
+
+    // Only the first material file that can be opened is loaded.
+    for (const std::string& filename : filenames) {
+      material_files_.push_back(material_dir_ + filename);
+      std::ifstream file(material_dir_ + filename);
+      if (!file) {
+        continue;
+      }
+      std::string warn_str, err_str;
+      tinyobj::LoadMtl(&material_map_, &materials_, &file, &warn_str, &err_str);
+      break;
+    }
+  }
+
+  std::string material_dir_;
+
+  std::map<std::string, int> material_map_;
+  std::vector<tinyobj::material_t> materials_;
+  std::vector<std::string> material_files_;
+
+  std::string name_;
+  int material_id_ = -1;
+  std::vector<FaceRange> pending_faces_;
+  bool has_other_prims_ = false;
+
+  ShapePlan shape_;
+  std::vector<ShapePlan> plans_;
+};
+
+// Same as pnpoly() in tinyobjloader.
+int PointInPolygon(int nvert, const float* vertx, const float* verty, float testx, float testy) {
+  int c = 0;
+  for (int i = 0, j = nvert - 1; i < nvert; j = i++) {
+    if (((verty[i] > testy) != (verty[j] > testy)) &&
+        (testx < (vertx[j] - vertx[i]) * (testy - verty[i]) / (verty[j] - verty[i]) + vertx[i])) {
+      c = !c;
+    }
+  }
+  return c;
+}
+
+void AddTriangle(const ObjIndex& i0, const ObjIndex& i1, const ObjIndex& i2, int material_id,
+                 ObjShape* shape) {
+  shape->indices.push_back(i0);
+  shape->indices.push_back(i1);
+  shape->indices.push_back(i2);
+  shape->material_ids.push_back(material_id);
+}
+
+// Triangulates a polygon with ear clipping. This is a port of the triangulation in
+// exportGroupsToShape() so that the triangles come out exactly the same.
+void TriangulatePolygon(const ObjIndex* face, size_t num_corners, const std::vector<float>& v,
+                        int material_id, ObjShape* shape) {
+  // Finds the two axes to work in.
+  size_t axes[2] = { 1, 2 };
+  for (size_t k = 0; k < num_corners; ++k) {
+    size_t vi0 = static_cast<size_t>(face[(k + 0) % num_corners].vertex_index);
+    size_t vi1 = static_cast<size_t>(face[(k + 1) % num_corners].vertex_index);
+    size_t vi2 = static_cast<size_t>(face[(k + 2) % num_corners].vertex_index);
+
+    if (((3 * vi0 + 2) >= v.size()) || ((3 * vi1 + 2) >= v.size()) ||
+        ((3 * vi2 + 2) >= v.size())) {
+      continue;
+    }
+    float e0x = v[vi1 * 3 + 0] - v[vi0 * 3 + 0];
+    float e0y = v[vi1 * 3 + 1] - v[vi0 * 3 + 1];
+    float e0z = v[vi1 * 3 + 2] - v[vi0 * 3 + 2];
+    float e1x = v[vi2 * 3 + 0] - v[vi1 * 3 + 0];
+    float e1y = v[vi2 * 3 + 1] - v[vi1 * 3 + 1];
+    float e1z = v[vi2 * 3 + 2] - v[vi1 * 3 + 2];
+    float cx = std::fabs(e0y * e1z - e0z * e1y);
+    float cy = std::fabs(e0z * e1x - e0x * e1z);
+    float cz = std::fabs(e0x * e1y - e0y * e1x);
+    const float epsilon = std::numeric_limits<float>::epsilon();
+    if (cx > epsilon || cy > epsilon || cz > epsilon) {
+      // Found a corner.
+      if (!(cx > cy && cx > cz)) {
+        axes[0] = 0;
+        if (cz > cx && cz > cy) {
+          axes[1] = 1;
+        }
+      }
+      break;
+    }
+  }
+
+  float area = 0.f;
+  for (size_t k = 0; k < num_corners; ++k) {
+    size_t vi0 = static_cast<size_t>(face[(k + 0) % num_corners].vertex_index);
+    size_t vi1 = static_cast<size_t>(face[(k + 1) % num_corners].vertex_index);
+    if (((vi0 * 3 + axes[0]) >= v.size()) || ((vi0 * 3 + axes[1]) >= v.size()) ||
+        ((vi1 * 3 + axes[0]) >= v.size()) || ((vi1 * 3 + axes[1]) >= v.size())) {
+      continue;
+    }
+    float v0x = v[vi0 * 3 + axes[0]];
+    float v0y = v[vi0 * 3 + axes[1]];
+    float v1x = v[vi1 * 3 + axes[0]];
+    float v1y = v[vi1 * 3 + axes[1]];
+    area += (v0x * v1y - v0y * v1x) * 0.5f;
+  }
+
+  std::vector<ObjIndex> remaining(face, face + num_corners);
+  size_t guess_vert = 0;
+  ObjIndex ind[3];
+  float vx[3];
+  float vy[3];
+
+  // How many iterations can be done without decreasing the number of remaining vertices.
+  size_t remaining_iterations = remaining.size();
+  size_t prev_num_remaining = remaining.size();
+
+  while (remaining.size() > 3 && remaining_iterations > 0) {
+    size_t npolys = remaining.size();
+    if (guess_vert >= npolys) {
+      guess_vert -= npolys;
+    }
+
+    if (prev_num_remaining != npolys) {
+      prev_num_remaining = npolys;
+      remaining_iterations = npolys;
+    } else {
+      --remaining_iterations;
+    }
+
+    for (size_t k = 0; k < 3; ++k) {
+      ind[k] = remaining[(guess_vert + k) % npolys];
+      size_t vi = static_cast<size_t>(ind[k].vertex_index);
+      if (((vi * 3 + axes[0]) >= v.size()) || ((vi * 3 + axes[1]) >= v.size())) {
+        vx[k] = 0.f;
+        vy[k] = 0.f;
+      } else {
+        vx[k] = v[vi * 3 + axes[0]];
+        vy[k] = v[vi * 3 + axes[1]];
+      }
+    }
+    float e0x = vx[1] - vx[0];
+    float e0y = vy[1] - vy[0];
+    float e1x = vx[2] - vx[1];
+    float e1y = vy[2] - vy[1];
+    float cross = e0x * e1y - e0y * e1x;
+
+    // Skips internal angles.
+    if (cross * area < 0.f) {
+      guess_vert += 1;
+      continue;
+    }
+
+    // Checks whether any of the other vertices are inside this triangle.
+    bool overlap = false;
+    for (size_t other_vert = 3; other_vert < npolys; ++other_vert) {
+      size_t idx = (guess_vert + other_vert) % npolys;
+      size_t ovi = static_cast<size_t>(remaining[idx].vertex_index);
+      if (((ovi * 3 + axes[0]) >= v.size()) || ((ovi * 3 + axes[1]) >= v.size())) {
+        continue;
+      }
+      float tx = v[ovi * 3 + axes[0]];
+      float ty = v[ovi * 3 + axes[1]];
+      if (PointInPolygon(3, vx, vy, tx, ty)) {
+        overlap = true;
+        break;
+      }
+    }
+
+    if (overlap) {
+      guess_vert += 1;
+      continue;
+    }
+
+    // This triangle is an ear.
+    AddTriangle(ind[0], ind[1], ind[2], material_id, shape);
+
+    remaining.erase(remaining.begin() + (guess_vert + 1) % npolys);
+  }
+
+  if (remaining.size() == 3) {
+    AddTriangle(remaining[0], remaining[1], remaining[2], material_id, shape);
+  }
+}
+
+void BuildShape(const ShapePlan& plan, const std::vector<Chunk>& chunks,
+                const std::vector<float>& positions, ObjShape* shape) {
+  shape->name = plan.name;
+
+  std::vector<ObjIndex> face;
+  for (const FaceRange& range : plan.faces) {
+    const Chunk& chunk = chunks[range.chunk_idx];
+    for (size_t i = range.begin; i < range.end; ++i) {
+      size_t num_corners = chunk.face_starts[i + 1] - chunk.face_starts[i];
+      if (num_corners < 3) {
+        continue;
+      }
+
+      face.clear();
+      for (size_t j = chunk.face_starts[i]; j < chunk.face_starts[i + 1]; ++j) {
+        face.push_back(chunk.corners[j].index);
+      }
+
+      if (num_corners == 3) {
+        AddTriangle(face[0], face[1], face[2], range.material_id, shape);
+      } else {
+        TriangulatePolygon(face.data(), num_corners, positions, range.material_id, shape);
+      }
+    }
+  }
+}
+
+ObjMaterial CreateMaterialFromLoaderData(const tinyobj::material_t& loader_mtl) {
+  ObjMaterial obj_mtl;
+  Material& mtl = obj_mtl.material;
+
+  mtl.ambient_color  = glm::vec3(loader_mtl.ambient[0],
+                                loader_mtl.ambient[1],
+                                loader_mtl.ambient[2]);
+  mtl.diffuse_color  = glm::vec3(loader_mtl.diffuse[0],
+                                loader_mtl.diffuse[1],
+                                loader_mtl.diffuse[2]);
+  mtl.specular_color = glm::vec3(loader_mtl.specular[0],
+                                loader_mtl.specular[1],
+                                loader_mtl.specular[2]);
+  mtl.emission_color = glm::vec3(loader_mtl.emission[0],
+                                loader_mtl.emission[1],
+                                loader_mtl.emission[2]);
+  mtl.shininess = loader_mtl.shininess;
+
+  switch (loader_mtl.illum) {
+    case 0:
+      mtl.illum = IllumModel::kColorOnly;
+      break;
+    case 1:
+      mtl.illum = IllumModel::kAmbientOnly;
+      break;
+    case 2:
+      mtl.illum = IllumModel::kHighlight;
+      break;
+    default:
+      mtl.illum = IllumModel::kInvalid;
+      break;
+  }
+
+  obj_mtl.ambient_texname = loader_mtl.ambient_texname;
+  obj_mtl.diffuse_texname = loader_mtl.diffuse_texname;
+  obj_mtl.specular_texname = loader_mtl.specular_texname;
+
+  return obj_mtl;
+}
+
+} // namespace
+
+bool StreamObjFile(const std::string& path, const std::string& material_dir,
+                   size_t memory_budget, ObjData* obj, const ObjShapesCallback& on_shapes) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+  if (file == nullptr) {
+    return false;
+  }
+  const char* data = reinterpret_cast<const char*>(file->GetData());
+  const size_t size = file->GetSize();
+
+  const size_t window_size = memory_budget == 0 ? 
+      size : std::max(kMinChunkSize, memory_budget / kParsedBytesPerFileByte);
+
+  *obj = ObjData();
+
+  // Chunk indices are global across windows. Chunks are emptied once no unfinished shape has faces
+  // in them.
+  std::vector<Chunk> chunks;
+  size_t num_released_chunks = 0;
+  ShapePlanner planner(material_dir);
+
+  size_t window_begin = 0;
+  bool last_window = false;
+  while (!last_window) {
+    size_t window_end = FindLineEnd(data, size, window_begin + window_size);
+    last_window = window_end == size;
+
+    std::vector<std::pair<size_t, size_t>> chunk_ranges = 
+        SplitIntoChunks(data + window_begin, window_end - window_begin);
+    const size_t first_chunk = chunks.size();
+    chunks.resize(first_chunk + chunk_ranges.size());
+
+    ParallelFor(chunk_ranges.size(), [&](size_t i) {
+      ParseChunk(data + window_begin + chunk_ranges[i].first, 
+                 data + window_begin + chunk_ranges[i].second, &chunks[first_chunk + i]);
+    });
+
+    for (size_t i = first_chunk; i < chunks.size(); ++i) {
+      if (!chunks[i].ok) {
+        std::cerr << "Invalid face index in OBJ file: " << path << std::endl;
+        return false;
+      }
+    }
+
+    // Works out where the attributes of each chunk go in the combined arrays.
+    std::vector<size_t> position_offsets(chunk_ranges.size());
+    std::vector<size_t> normal_offsets(chunk_ranges.size());
+    std::vector<size_t> texcoord_offsets(chunk_ranges.size());
+    size_t num_position_floats = obj->positions.size();
+    size_t num_normal_floats = obj->normals.size();
+    size_t num_texcoord_floats = obj->texcoords.size();
+    for (size_t i = 0; i < chunk_ranges.size(); ++i) {
+      const Chunk& chunk = chunks[first_chunk + i];
+      position_offsets[i] = num_position_floats;
+      normal_offsets[i] = num_normal_floats;
+      texcoord_offsets[i] = num_texcoord_floats;
+      num_position_floats += chunk.positions.size();
+      num_normal_floats += chunk.normals.size();
+      num_texcoord_floats += chunk.texcoords.size();
+    }
+
+    obj->positions.resize(num_position_floats);
+    obj->normals.resize(num_normal_floats);
+    obj->texcoords.resize(num_texcoord_floats);
+
+    ParallelFor(chunk_ranges.size(), [&](size_t i) {
+      Chunk& chunk = chunks[first_chunk + i];
+
+      std::copy(chunk.positions.begin(), chunk.positions.end(),
+                obj->positions.begin() + position_offsets[i]);
+      std::copy(chunk.normals.begin(), chunk.normals.end(),
+                obj->normals.begin() + normal_offsets[i]);
+      std::copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+                obj->texcoords.begin() + texcoord_offsets[i]);
+
+      chunk.positions = std::vector<float>();
+      chunk.normals = std::vector<float>();
+      chunk.texcoords = std::vector<float>();
+
+      int position_offset = static_cast<int>(position_offsets[i] / 3);
+      int normal_offset = static_cast<int>(normal_offsets[i] / 3);
+      int texcoord_offset = static_cast<int>(texcoord_offsets[i] / 2);
+      for (Corner& corner : chunk.corners) {
+        if (corner.relative_mask & kRelativeVertex) {
+          corner.index.vertex_index += position_offset;
+        }
+        if (corner.relative_mask & kRelativeNormal) {
+          corner.index.normal_index += normal_offset;
+        }
+        if (corner.relative_mask & kRelativeTexcoord) {
+          corner.index.texcoord_index += texcoord_offset;
+        }
+      }
+    });
+
+    for (size_t i = first_chunk; i < chunks.size(); ++i) {
+      size_t face_pos = 0;
+      for (const Event& event : chunks[i].events) {
+        planner.AddFaces(i, face_pos, event.face_pos);
+        face_pos = event.face_pos;
+        planner.HandleEvent(event);
+      }
+      planner.AddFaces(i, face_pos, chunks[i].face_starts.size() - 1);
+    }
+    if (last_window) {
+      planner.Finish();
+    }
+
+    const std::vector<tinyobj::material_t>& loader_mtls = planner.GetMaterials();
+    for (size_t i = obj->materials.size(); i < loader_mtls.size(); ++i) {
+      obj->materials.push_back(CreateMaterialFromLoaderData(loader_mtls[i]));
+    }
+    obj->material_files = planner.GetMaterialFiles();
+
+    std::vector<ShapePlan> plans = planner.TakeFinishedPlans();
+    std::vector<ObjShape> shapes(plans.size());
+    ParallelFor(plans.size(), [&](size_t i) {
+      BuildShape(plans[i], chunks, obj->positions, &shapes[i]);
+    });
+
+    std::vector<ObjShape> kept_shapes;
+    for (size_t i = 0; i < shapes.size(); ++i) {
+      if (plans[i].keep_rule == KeepRule::kAlways || !shapes[i].indices.empty()) {
+        kept_shapes.push_back(std::move(shapes[i]));
+      }
+    }
+    shapes.clear();
+
+    size_t first_open_chunk = planner.GetFirstOpenChunk(chunks.size());
+    for (; num_released_chunks < first_open_chunk; ++num_released_chunks) {
+      chunks[num_released_chunks] = Chunk();
+    }
+    file->DiscardPages(window_begin, window_end - window_begin);
+
+    if (!kept_shapes.empty() && !on_shapes(&kept_shapes)) {
+      return false;
+    }
+
+    window_begin = window_end;
+  }
+
+  return true;
+}
+
+bool ParseObjFile(const std::string& path, const std::string& material_dir, ObjData* obj) {
+  std::vector<ObjShape> shapes;
+  bool ok = StreamObjFile(path, material_dir, 0, obj, [&](std::vector<ObjShape>* new_shapes) {
+    std::move(new_shapes->begin(), new_shapes->end(), std::back_inserter(shapes));
+    return true;
+  });
+  obj->shapes = std::move(shapes);
+  return ok;
+}
+
+} // namespace utils
@@ -0,0 +1,78 @@
+#ifndef UTILS_OBJ_PARSER_H_
+#define UTILS_OBJ_PARSER_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "utils/model.h"
+
+namespace utils {
+
+// Zero-based indices into the attribute arrays of ObjData. An index is -1 if the face corner has
+// no data for that attribute.
+struct ObjIndex {
+  int vertex_index;
+  int normal_index;
+  int texcoord_index;
+};
+
+struct ObjShape {
+  std::string name;
+
+  // Triangle list; polygons are triangulated while parsing.
+  std::vector<ObjIndex> indices;
+
+  // One per triangle. Indexes into ObjData::materials, or -1 if the triangle has no material.
+  std::vector<int> material_ids;
+};
+
+// Material as read from the material library. The texture ids of |material| are left unset; the
+// texture names are interned by the model loader.
+struct ObjMaterial {
+  Material material;
+
+  std::string ambient_texname;
+  std::string diffuse_texname;
+  std::string specular_texname;
+};
+
+struct ObjData {
+  std::vector<float> positions; // xyz
+  std::vector<float> normals;   // xyz
+  std::vector<float> texcoords; // st
+
+  std::vector<ObjShape> shapes;
+  std::vector<ObjMaterial> materials;
+
+  // Paths of the material files that the model file asked for, up to and including the one that
+  // was loaded from each material library statement. Caches of the model check them on top of
+  // the model file, since editing a material doesn't touch the model file.
+  std::vector<std::string> material_files;
+};
+
+// Parses an OBJ file and the material files it references. The file is memory-mapped and split
+// into line-aligned chunks that are parsed on all the worker threads.
+//
+// The shapes, triangulation and material assignment match what tinyobjloader produces for the
+// same file.
+bool ParseObjFile(const std::string& path, const std::string& material_dir, ObjData* obj);
+
+// Receives the shapes that have been completed so far, in file order. Shapes can be moved out of
+// the vector. Returning false stops the parsing.
+using ObjShapesCallback = std::function<bool(std::vector<ObjShape>* shapes)>;
+
+// Same as ParseObjFile(), but goes through the file in windows and hands over every shape as soon
+// as all of its faces have been parsed, after which the parsed face data is freed. The window size
+// keeps the intermediate data under roughly |memory_budget| bytes (0 parses the whole file at
+// once). A single shape that doesn't fit in the budget still has all of its faces kept.
+//
+// The attribute arrays and materials in |obj| are kept for the whole file, since faces may
+// reference any earlier vertex; |obj->shapes| stays empty. Callbacks run on the calling thread.
+bool StreamObjFile(const std::string& path, const std::string& material_dir,
+                   size_t memory_budget, ObjData* obj, const ObjShapesCallback& on_shapes);
+
+} // namespace utils
+
+#endif // UTILS_OBJ_PARSER_H_
@@ -0,0 +1,125 @@
+#include "utils/parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+size_t GetNumWorkerThreads() {
+  return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(size_t count, const std::function<void(size_t)>& func) {
+  size_t num_threads = std::min(count, GetNumWorkerThreads());
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next_idx(0);
+  auto worker = [&]() {
+    for (size_t i = next_idx++; i < count; i = next_idx++) {
+      func(i);
+    }
+  };
+
+  // The calling thread does its share of the work too.
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 0; i < num_threads - 1; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  num_threads = std::max<size_t>(1, num_threads);
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::RunWorker, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_available_.notify_all();
+
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  task_available_.notify_one();
+}
+
+void ThreadPool::RunWorker() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_available_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      // The queue is drained before stopping, so no submitted task is dropped.
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void ParallelFor(ThreadPool& pool, size_t count, const std::function<void(size_t)>& func) {
+  size_t num_helpers = std::min(count, pool.GetNumThreads() + 1);
+  num_helpers = num_helpers > 0 ? num_helpers - 1 : 0;
+
+  std::atomic<size_t> next_idx(0);
+  auto worker = [&]() {
+    for (size_t i = next_idx++; i < count; i = next_idx++) {
+      func(i);
+    }
+  };
+
+  std::mutex mutex;
+  std::condition_variable helpers_done;
+  size_t num_running = num_helpers;
+  for (size_t i = 0; i < num_helpers; ++i) {
+    pool.Submit([&]() {
+      worker();
+
+      // Notifies under the lock, since the caller destroys |helpers_done| as soon as it sees the
+      // last helper finish.
+      std::lock_guard<std::mutex> lock(mutex);
+      --num_running;
+      helpers_done.notify_one();
+    });
+  }
+
+  // The calling thread does its share of the work too.
+  worker();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  helpers_done.wait(lock, [&]() { return num_running == 0; });
+}
+
+} // namespace utils
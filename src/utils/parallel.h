@@ -0,0 +1,144 @@
+#ifndef UTILS_PARALLEL_H_
+#define UTILS_PARALLEL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+// Returns the number of worker threads to use for parallel work. Always at least 1.
+size_t GetNumWorkerThreads();
+
+// Calls |func(i)| for every i in [0, count) across all the worker threads and blocks until all the
+// calls have returned. Indices are handed out one at a time, so |func| should do a reasonable
+// amount of work per call.
+void ParallelFor(size_t count, const std::function<void(size_t)>& func);
+
+// Fixed set of worker threads that run submitted tasks in submission order. Unlike ParallelFor(),
+// submitting doesn't block, so the calling thread can keep going while the tasks run. The
+// destructor waits for all the submitted tasks to finish.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads = GetNumWorkerThreads());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queues |task| to run on one of the worker threads.
+  void Submit(std::function<void()> task);
+
+  size_t GetNumThreads() const { return threads_.size(); }
+
+ private:
+  void RunWorker();
+
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+// Same as ParallelFor(), but runs on the threads of |pool| instead of starting new ones, which
+// makes it cheap enough to call every frame.
+void ParallelFor(ThreadPool& pool, size_t count, const std::function<void(size_t)>& func);
+
+// Runs tasks on its own pool of worker threads and hands out their results in the order they
+// finish, so the caller can use each result as soon as it is ready.
+template <typename T>
+class CompletionQueue {
+ public:
+  struct Result {
+    // Index of the task, in submission order.
+    size_t index;
+
+    T value;
+  };
+
+  explicit CompletionQueue(size_t num_threads = GetNumWorkerThreads()) : pool_(num_threads) {}
+
+  // Tasks that haven't started running yet are skipped.
+  ~CompletionQueue() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+  }
+
+  CompletionQueue(const CompletionQueue&) = delete;
+  CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+  void Submit(std::function<T()> task) {
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      index = num_submitted_++;
+      ++num_remaining_;
+    }
+    pool_.Submit([this, index, task = std::move(task)]() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_) {
+          return;
+        }
+      }
+      T value = task();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        results_.push_back({ index, std::move(value) });
+      }
+      result_ready_.notify_one();
+    });
+  }
+
+  // Blocks until the next task finishes. Returns std::nullopt once the results of all the tasks
+  // submitted so far have been returned.
+  std::optional<Result> WaitForNext() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (num_remaining_ == 0) {
+      return std::nullopt;
+    }
+    result_ready_.wait(lock, [this]() { return !results_.empty(); });
+
+    Result result = std::move(results_.front());
+    results_.pop_front();
+    --num_remaining_;
+    return result;
+  }
+
+  // Returns the result of a finished task without blocking, or std::nullopt if no unreturned task
+  // has finished yet.
+  std::optional<Result> TryGetNext() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (results_.empty()) {
+      return std::nullopt;
+    }
+
+    Result result = std::move(results_.front());
+    results_.pop_front();
+    --num_remaining_;
+    return result;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable result_ready_;
+  std::deque<Result> results_;
+  size_t num_submitted_ = 0;
+  size_t num_remaining_ = 0;
+  bool cancelled_ = false;
+
+  // Declared last so that the workers are joined before the state above is destroyed.
+  ThreadPool pool_;
+};
+
+} // namespace utils
+
+#endif // UTILS_PARALLEL_H_
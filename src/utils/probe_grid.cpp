@@ -0,0 +1,404 @@
+#include "utils/probe_grid.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils/cache_file.h"
+#include "utils/mapped_file.h"
+#include "utils/model.h"
+#include "utils/parallel.h"
+#include "utils/triangle_bvh.h"
+
+namespace utils {
+
+namespace {
+
+constexpr float kPi = 3.14159265358979f;
+
+// Distances seen from a probe are capped at this many times the diagonal of a cell, so that the
+// probes in the open don't have huge variances.
+constexpr float kMaxDistanceScale = 1.5f;
+
+// Points are moved this fraction of the smallest probe spacing along their normal before sampling,
+// so that the probes just behind the surface they are on don't pass the visibility test.
+constexpr float kNormalBias = 0.25f;
+
+// Lowest weight of a probe, so that the probes around a point never all get 0.
+constexpr float kMinProbeWeight = 1e-4f;
+
+constexpr char kFileMagic[8] = { 'R', 'O', 'B', 'I', 'N', 'P', 'R', 'B' };
+
+// Must be incremented whenever the layout of the file changes.
+constexpr uint32_t kFileVersion = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t options_key;
+  uint64_t source_size;
+  int64_t source_mtime;
+  float bounds_min[3];
+  float bounds_max[3];
+  int32_t dims[3];
+  uint32_t reserved;
+};
+
+// Hashes the bake options that change the contents of the grid.
+uint32_t GetOptionsKey(const ProbeBakeOptions& options) {
+  const float values[] = {
+      static_cast<float>(options.max_probes_per_axis), static_cast<float>(options.rays_per_probe),
+      static_cast<float>(options.num_bounces),
+      options.sun_dir.x, options.sun_dir.y, options.sun_dir.z,
+      options.sun_color.x, options.sun_color.y, options.sun_color.z,
+      options.sky_color.x, options.sky_color.y, options.sky_color.z };
+  uint32_t key = Fnv1a(values, sizeof(values));
+  return Fnv1a(options.material_albedos.data(),
+               options.material_albedos.size() * sizeof(glm::vec3), key);
+}
+
+// Returns |count| directions spread evenly over the unit sphere, on a spherical Fibonacci spiral.
+std::vector<glm::vec3> GetSphereDirections(int count) {
+  const float golden_angle = kPi * (3.f - std::sqrt(5.f));
+  std::vector<glm::vec3> dirs(count);
+  for (int i = 0; i < count; ++i) {
+    float z = 1.f - (2.f * i + 1.f) / count;
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float phi = golden_angle * i;
+    dirs[i] = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+  }
+  return dirs;
+}
+
+// Returns a random rotation, so that every probe sees the directions of GetSphereDirections() at
+// a different orientation, and the pattern doesn't show as banding.
+glm::mat3 GetRandomRotation(std::mt19937* rng) {
+  std::uniform_real_distribution<float> unit_dist(0.f, 1.f);
+  float z = 1.f - 2.f * unit_dist(*rng);
+  float r = std::sqrt(std::max(0.f, 1.f - z * z));
+  float phi = 2.f * kPi * unit_dist(*rng);
+  glm::vec3 n(r * std::cos(phi), r * std::sin(phi), z);
+
+  // Orthonormal basis around |n| (Duff et al.), twisted by a random angle around it.
+  float sign = n.z >= 0.f ? 1.f : -1.f;
+  float a = -1.f / (sign + n.z);
+  float b = n.x * n.y * a;
+  glm::vec3 t(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+  glm::vec3 s(b, sign + n.y * n.y * a, -n.y);
+  float twist = 2.f * kPi * unit_dist(*rng);
+  glm::vec3 x = std::cos(twist) * t + std::sin(twist) * s;
+  return glm::mat3(x, glm::cross(n, x), n);
+}
+
+// Returns the distance moments of |distances| in the unit direction |dir|, blended from the three
+// axes that |dir| leans towards.
+glm::vec2 GetDistanceMoments(const ProbeDistances& distances, const glm::vec3& dir) {
+  glm::vec2 moments(0.f);
+  for (int axis = 0; axis < 3; ++axis) {
+    moments += dir[axis] * dir[axis] * distances.moments[2 * axis + (dir[axis] < 0.f ? 1 : 0)];
+  }
+  return moments;
+}
+
+// Albedo of the material of the first vertex of triangle |triangle_idx| of |mesh|.
+glm::vec3 GetAlbedo(const Mesh& mesh, uint32_t triangle_idx, const ProbeBakeOptions& options) {
+  int mtl_id = mesh.material_ids[mesh.indices[3 * triangle_idx]];
+  if (mtl_id < 0 || static_cast<size_t>(mtl_id) >= options.material_albedos.size()) {
+    return glm::vec3(0.5f);
+  }
+  return options.material_albedos[mtl_id];
+}
+
+} // namespace
+
+void EvalShBasis(const glm::vec3& dir, float basis[kNumShCoeffs]) {
+  basis[0] = 0.282095f;
+  basis[1] = 0.488603f * dir.y;
+  basis[2] = 0.488603f * dir.z;
+  basis[3] = 0.488603f * dir.x;
+  basis[4] = 1.092548f * dir.x * dir.y;
+  basis[5] = 1.092548f * dir.y * dir.z;
+  basis[6] = 0.315392f * (3.f * dir.z * dir.z - 1.f);
+  basis[7] = 1.092548f * dir.x * dir.z;
+  basis[8] = 0.546274f * (dir.x * dir.x - dir.y * dir.y);
+}
+
+glm::vec3 EvalShIrradiance(const ShIrradiance& sh, const glm::vec3& normal) {
+  float basis[kNumShCoeffs];
+  EvalShBasis(normal, basis);
+  glm::vec3 irradiance(0.f);
+  for (int i = 0; i < kNumShCoeffs; ++i) {
+    irradiance += sh.coeffs[i] * basis[i];
+  }
+  // Ringing can take the irradiance below 0 in the darkest directions.
+  return glm::max(irradiance, glm::vec3(0.f));
+}
+
+glm::vec3 ProbeGrid::SampleIrradiance(const glm::vec3& pos, const glm::vec3& normal) const {
+  if (irradiance.empty()) {
+    return glm::vec3(0.f);
+  }
+  const glm::vec3 spacing = GetSpacing();
+  const glm::vec3 biased_pos =
+      pos + normal * (kNormalBias * std::min(spacing.x, std::min(spacing.y, spacing.z)));
+
+  // Cell of the grid around the point. Points outside the grid use the probes on its border.
+  glm::vec3 grid_pos = glm::clamp((biased_pos - bounds.min) / spacing, glm::vec3(0.f),
+                                  glm::vec3(dims - 1));
+  glm::ivec3 base = glm::min(glm::ivec3(grid_pos), dims - 2);
+  glm::vec3 alpha = grid_pos - glm::vec3(base);
+
+  glm::vec3 sum(0.f);
+  float weight_sum = 0.f;
+  for (int i = 0; i < 8; ++i) {
+    glm::ivec3 offset(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+    glm::ivec3 coords = base + offset;
+    size_t probe_idx = GetProbeIndex(coords);
+
+    glm::vec3 to_probe = GetProbePos(coords) - biased_pos;
+    float distance = glm::length(to_probe);
+    glm::vec3 dir = distance > 0.f ? to_probe / distance : normal;
+
+    // Probes behind the surface get less weight, but never none, so that thin walls with probes on
+    // one side only still get light.
+    float backface = (glm::dot(dir, normal) + 1.f) * 0.5f;
+    float weight = backface * backface + 0.2f;
+
+    // Chebyshev's inequality bounds the chance that the point is visible from the probe, given the
+    // distances that the probe sees in that direction.
+    glm::vec2 moments = GetDistanceMoments(distances[probe_idx], -dir);
+    if (distance > moments.x) {
+      float variance = std::abs(moments.y - moments.x * moments.x);
+      float delta = distance - moments.x;
+      float visibility = variance / (variance + delta * delta);
+      weight *= visibility * visibility * visibility;
+    }
+    weight = std::max(weight, kMinProbeWeight);
+
+    glm::vec3 trilinear = glm::mix(glm::vec3(1.f) - alpha, alpha, glm::vec3(offset));
+    weight *= trilinear.x * trilinear.y * trilinear.z;
+
+    sum += weight * EvalShIrradiance(irradiance[probe_idx], normal);
+    weight_sum += weight;
+  }
+  return weight_sum > 0.f ? sum / weight_sum : glm::vec3(0.f);
+}
+
+ProbeGrid BakeProbeGrid(const Model& model, const TriangleBvh& bvh,
+                        const ProbeBakeOptions& options, ProbeBakeStats* stats) {
+  auto start = std::chrono::steady_clock::now();
+
+  ProbeGrid grid;
+  const Aabb& model_aabb = model.GetAabb();
+  glm::vec3 size = model_aabb.GetSize();
+  float longest = std::max(size.x, std::max(size.y, size.z));
+  if (model_aabb.IsEmpty() || !(longest > 0.f)) {
+    return grid;
+  }
+
+  // The grid covers the model bounds with cubic cells, and ends up slightly larger on the shorter
+  // axes.
+  float spacing = longest / (std::max(options.max_probes_per_axis, 2) - 1);
+  grid.bounds.min = model_aabb.min;
+  for (int axis = 0; axis < 3; ++axis) {
+    grid.dims[axis] = std::max(2, static_cast<int>(std::ceil(size[axis] / spacing - 1e-3f)) + 1);
+    grid.bounds.max[axis] = grid.bounds.min[axis] + spacing * (grid.dims[axis] - 1);
+  }
+  const size_t num_probes = grid.GetNumProbes();
+  grid.irradiance.resize(num_probes);
+  grid.distances.resize(num_probes);
+
+  const std::vector<glm::vec3> ray_dirs = GetSphereDirections(std::max(options.rays_per_probe, 1));
+  const float max_distance = kMaxDistanceScale * spacing * std::sqrt(3.f);
+  const glm::vec3 sun_dir = glm::normalize(options.sun_dir);
+
+  // Shadow rays start this far off the surface, so that they don't hit it again.
+  const float surface_offset = 1e-3f * spacing;
+
+  std::atomic<size_t> num_rays(0);
+  ProbeGrid last_pass;
+  for (int pass = 0; pass < std::max(options.num_bounces, 1); ++pass) {
+    ParallelFor(num_probes, [&](size_t probe_idx) {
+      glm::ivec3 coords(static_cast<int>(probe_idx % grid.dims.x),
+                        static_cast<int>(probe_idx / grid.dims.x % grid.dims.y),
+                        static_cast<int>(probe_idx / (static_cast<size_t>(grid.dims.x) *
+                                                      grid.dims.y)));
+      const glm::vec3 probe_pos = grid.GetProbePos(coords);
+
+      // Every pass traces the same rays, so that the distances only need to be gathered once.
+      std::mt19937 rng(static_cast<uint32_t>(probe_idx));
+      const glm::mat3 rotation = GetRandomRotation(&rng);
+
+      ShIrradiance sh;
+      glm::vec2 moments[6] = {};
+      float moment_weights[6] = {};
+      size_t probe_rays = 0;
+      for (const glm::vec3& ray_dir : ray_dirs) {
+        glm::vec3 dir = rotation * ray_dir;
+        std::optional<RayHit> hit = bvh.Intersect({ probe_pos, dir });
+        ++probe_rays;
+
+        glm::vec3 radiance = options.sky_color;
+        float distance = max_distance;
+        if (hit.has_value()) {
+          distance = std::min(hit->t, max_distance);
+
+          // Surfaces are lit from both sides, which suits the single-sided cloth of Sponza. The
+          // probes inside walls that this lights up are weighted down by the distances.
+          const Mesh& mesh = model.GetMeshByIndex(hit->mesh_idx);
+          const uint32_t* tri = &mesh.indices[3 * hit->triangle_idx];
+          const glm::vec3& p0 = mesh.positions[tri[0]];
+          glm::vec3 normal = glm::normalize(glm::cross(mesh.positions[tri[1]] - p0,
+                                                       mesh.positions[tri[2]] - p0));
+          if (glm::dot(normal, dir) > 0.f) {
+            normal = -normal;
+          }
+          glm::vec3 hit_pos = probe_pos + dir * hit->t;
+
+          glm::vec3 hit_irradiance(0.f);
+          float n_dot_l = glm::dot(normal, sun_dir);
+          if (n_dot_l > 0.f) {
+            ++probe_rays;
+            if (!bvh.IsOccluded({ hit_pos + normal * surface_offset, sun_dir })) {
+              hit_irradiance += options.sun_color * n_dot_l;
+            }
+          }
+          if (pass > 0) {
+            hit_irradiance += last_pass.SampleIrradiance(hit_pos, normal);
+          }
+          radiance = GetAlbedo(mesh, hit->triangle_idx, options) / kPi * hit_irradiance;
+        }
+
+        float basis[kNumShCoeffs];
+        EvalShBasis(dir, basis);
+        for (int i = 0; i < kNumShCoeffs; ++i) {
+          sh.coeffs[i] += radiance * basis[i];
+        }
+
+        if (pass == 0) {
+          for (int axis = 0; axis < 3; ++axis) {
+            int face = 2 * axis + (dir[axis] < 0.f ? 1 : 0);
+            float weight = dir[axis] * dir[axis];
+            moments[face] += weight * glm::vec2(distance, distance * distance);
+            moment_weights[face] += weight;
+          }
+        }
+      }
+
+      // Monte Carlo projection of the radiance, convolved with the clamped cosine lobe, whose
+      // bands scale by pi, 2 pi / 3 and pi / 4.
+      const float band_scales[3] = { kPi, 2.f * kPi / 3.f, kPi / 4.f };
+      const float sample_weight = 4.f * kPi / ray_dirs.size();
+      for (int i = 0; i < kNumShCoeffs; ++i) {
+        int band = i == 0 ? 0 : (i < 4 ? 1 : 2);
+        sh.coeffs[i] *= sample_weight * band_scales[band];
+      }
+      grid.irradiance[probe_idx] = sh;
+
+      if (pass == 0) {
+        for (int face = 0; face < 6; ++face) {
+          grid.distances[probe_idx].moments[face] = moment_weights[face] > 0.f ?
+              moments[face] / moment_weights[face] :
+              glm::vec2(max_distance, max_distance * max_distance);
+        }
+      }
+      num_rays += probe_rays;
+    });
+    last_pass = grid;
+  }
+
+  if (stats != nullptr) {
+    stats->num_probes = num_probes;
+    stats->num_rays = num_rays;
+    stats->num_threads = GetNumWorkerThreads();
+    stats->bake_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+  }
+  return grid;
+}
+
+std::string GetProbeGridPath(const std::string& model_path) {
+  return model_path + ".robinprobes";
+}
+
+bool ReadProbeGrid(const std::string& model_path, const ProbeBakeOptions& options,
+                   ProbeGrid* grid) {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!GetSourceStamp(model_path, &source_size, &source_mtime)) {
+    return false;
+  }
+
+  std::unique_ptr<MappedFile> file = MappedFile::Open(GetProbeGridPath(model_path));
+  if (file == nullptr || file->GetSize() < sizeof(FileHeader)) {
+    return false;
+  }
+
+  FileHeader header;
+  std::memcpy(&header, file->GetData(), sizeof(header));
+  if (std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+      header.version != kFileVersion ||
+      header.options_key != GetOptionsKey(options) ||
+      header.source_size != source_size ||
+      header.source_mtime != source_mtime ||
+      header.dims[0] < 2 || header.dims[1] < 2 || header.dims[2] < 2) {
+    return false;
+  }
+
+  ProbeGrid file_grid;
+  std::memcpy(&file_grid.bounds.min, header.bounds_min, sizeof(header.bounds_min));
+  std::memcpy(&file_grid.bounds.max, header.bounds_max, sizeof(header.bounds_max));
+  file_grid.dims = glm::ivec3(header.dims[0], header.dims[1], header.dims[2]);
+
+  const size_t num_probes = file_grid.GetNumProbes();
+  const size_t irradiance_size = num_probes * sizeof(ShIrradiance);
+  const size_t distances_size = num_probes * sizeof(ProbeDistances);
+  if (file->GetSize() != sizeof(FileHeader) + irradiance_size + distances_size) {
+    return false;
+  }
+  file_grid.irradiance.resize(num_probes);
+  file_grid.distances.resize(num_probes);
+  std::memcpy(file_grid.irradiance.data(), file->GetData() + sizeof(FileHeader), irradiance_size);
+  std::memcpy(file_grid.distances.data(), file->GetData() + sizeof(FileHeader) + irradiance_size,
+              distances_size);
+
+  *grid = std::move(file_grid);
+  return true;
+}
+
+bool WriteProbeGrid(const std::string& model_path, const ProbeBakeOptions& options,
+                    const ProbeGrid& grid) {
+  FileHeader header = {};
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kFileVersion;
+  header.options_key = GetOptionsKey(options);
+  std::memcpy(header.bounds_min, &grid.bounds.min, sizeof(header.bounds_min));
+  std::memcpy(header.bounds_max, &grid.bounds.max, sizeof(header.bounds_max));
+  header.dims[0] = grid.dims.x;
+  header.dims[1] = grid.dims.y;
+  header.dims[2] = grid.dims.z;
+  if (!GetSourceStamp(model_path, &header.source_size, &header.source_mtime)) {
+    return false;
+  }
+
+  const size_t irradiance_size = grid.irradiance.size() * sizeof(ShIrradiance);
+  const size_t distances_size = grid.distances.size() * sizeof(ProbeDistances);
+  std::vector<uint8_t> bytes(sizeof(header) + irradiance_size + distances_size);
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  std::memcpy(bytes.data() + sizeof(header), grid.irradiance.data(), irradiance_size);
+  std::memcpy(bytes.data() + sizeof(header) + irradiance_size, grid.distances.data(),
+              distances_size);
+  return WriteFileAtomically(GetProbeGridPath(model_path), bytes);
+}
+
+} // namespace utils
@@ -0,0 +1,124 @@
+#ifndef UTILS_PROBE_GRID_H_
+#define UTILS_PROBE_GRID_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "utils/bounds.h"
+
+namespace utils {
+
+class Model;
+class TriangleBvh;
+
+// Number of coefficients of an L2 spherical harmonic: 1 for band 0, 3 for band 1 and 5 for band 2.
+constexpr int kNumShCoeffs = 9;
+
+// RGB irradiance as an L2 spherical harmonic. The radiance around the probe has already been
+// convolved with the clamped cosine lobe, so evaluating it at a normal gives the irradiance of a
+// surface facing that way.
+struct ShIrradiance {
+  glm::vec3 coeffs[kNumShCoeffs] = {};
+};
+
+// Mean and mean square of the distance from a probe to the surfaces around it, for the directions
+// around each axis, in the order +x, -x, +y, -y, +z, -z. The distances are capped at a multiple of
+// the probe spacing.
+struct ProbeDistances {
+  glm::vec2 moments[6] = {};
+};
+
+// Fills |basis| with the 9 real SH basis functions at the unit direction |dir|.
+void EvalShBasis(const glm::vec3& dir, float basis[kNumShCoeffs]);
+
+// Returns the irradiance of |sh| for a surface with the unit normal |normal|.
+glm::vec3 EvalShIrradiance(const ShIrradiance& sh, const glm::vec3& normal);
+
+// Regular 3D grid of irradiance probes. The probes sit on the corners of the cells, from
+// bounds.min to bounds.max, and are stored with x varying fastest, then y, then z.
+struct ProbeGrid {
+  Aabb bounds;
+  glm::ivec3 dims = glm::ivec3(0);
+
+  std::vector<ShIrradiance> irradiance;
+  std::vector<ProbeDistances> distances;
+
+  size_t GetNumProbes() const { return static_cast<size_t>(dims.x) * dims.y * dims.z; }
+  glm::vec3 GetSpacing() const { return bounds.GetSize() / glm::vec3(dims - 1); }
+
+  size_t GetProbeIndex(const glm::ivec3& coords) const {
+    return (static_cast<size_t>(coords.z) * dims.y + coords.y) * dims.x + coords.x;
+  }
+  glm::vec3 GetProbePos(const glm::ivec3& coords) const {
+    return bounds.min + GetSpacing() * glm::vec3(coords);
+  }
+
+  // Returns the irradiance at |pos| of a surface with the unit normal |normal|, blended from the 8
+  // probes around it. Besides the trilinear weights, the probes are weighted down when they are
+  // behind the surface, or when the distances seen from them say that a surface is in the way.
+  // The light pass of global_illum does the same on the GPU. Returns 0 for an empty grid.
+  glm::vec3 SampleIrradiance(const glm::vec3& pos, const glm::vec3& normal) const;
+};
+
+struct ProbeBakeOptions {
+  // Number of probes along the longest axis of the model bounds. The cells are cubes, so the other
+  // axes get fewer.
+  int max_probes_per_axis = 32;
+
+  int rays_per_probe = 256;
+
+  // Number of passes over all the probes. The first pass lights the surfaces that the rays hit with
+  // the sun alone, and every later pass adds the irradiance of the previous pass at the hit point,
+  // i.e. one more bounce.
+  int num_bounces = 2;
+
+  // Direction towards the sun, and the irradiance of a surface that faces it. The sun only reaches
+  // the probes through the surfaces it lights.
+  glm::vec3 sun_dir = glm::vec3(0.2f, 1.f, 0.3f);
+  glm::vec3 sun_color = glm::vec3(4.f);
+
+  // Radiance of the rays that leave the model.
+  glm::vec3 sky_color = glm::vec3(0.4f, 0.5f, 0.7f);
+
+  // Diffuse albedo of every material of the model, indexed like MaterialTable::materials.
+  // Surfaces without a material, or with one past the end, are 50% grey. The albedos come from the
+  // material files and textures rather than the model file, so they are part of the key of the
+  // probe file.
+  std::vector<glm::vec3> material_albedos;
+};
+
+struct ProbeBakeStats {
+  size_t num_probes = 0;
+
+  // Probe rays and shadow rays.
+  size_t num_rays = 0;
+
+  size_t num_threads = 0;
+  double bake_ms = 0.0;
+};
+
+// Places a grid of probes over the bounds of |model| and bakes the light from the sun and the sky
+// into them, by ray tracing |bvh|, which must have been built from |model|. The probes are spread
+// over all the worker threads.
+ProbeGrid BakeProbeGrid(const Model& model, const TriangleBvh& bvh,
+                        const ProbeBakeOptions& options, ProbeBakeStats* stats = nullptr);
+
+// Probe grid file of a model, stored next to the model file (e.g. sponza.obj.robinprobes). Like
+// the mesh cache, the file records the size and modification time of the model file and the bake
+// options, and it is ignored if any of them have changed.
+
+std::string GetProbeGridPath(const std::string& model_path);
+
+// Returns false if there is no valid probe grid file for the model file and options.
+bool ReadProbeGrid(const std::string& model_path, const ProbeBakeOptions& options,
+                   ProbeGrid* grid);
+
+bool WriteProbeGrid(const std::string& model_path, const ProbeBakeOptions& options,
+                    const ProbeGrid& grid);
+
+} // namespace utils
+
+#endif // UTILS_PROBE_GRID_H_
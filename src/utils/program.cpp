@@ -1,10 +1,35 @@
 #include "utils/program.h"
 
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "utils/shader.h"
+
 namespace utils {
 
+namespace {
+
+std::string GetResourceName(GLuint program, GLenum interface, GLuint index, GLint name_len) {
+  std::vector<GLchar> name(std::max(name_len, 1));
+  glGetProgramResourceName(program, interface, index, name.size(), nullptr, name.data());
+  return std::string(name.data());
+}
+
+} // namespace
+
 bool CheckProgramLinkStatus(GLuint program) {
   GLint result = GL_FALSE;
   glGetProgramiv(program, GL_LINK_STATUS, &result);
@@ -23,4 +48,171 @@ bool CheckProgramLinkStatus(GLuint program) {
   return true;
 }
 
-} // namespace utils
\ No newline at end of file
+Program::Program(GLuint gl_program) : gl_program_(gl_program) {}
+
+Program::~Program() {
+  glDeleteProgram(gl_program_);
+}
+
+int Program::FindUniform(const std::string& name) const {
+  auto it = uniform_ids_.find(name);
+  return it != uniform_ids_.end() ? it->second : -1;
+}
+
+int Program::FindBlock(const std::string& name) const {
+  auto it = block_ids_.find(name);
+  return it != block_ids_.end() ? it->second : -1;
+}
+
+void Program::SetUniform(int id, int32_t value) const {
+  if (id != -1) {
+    glProgramUniform1i(gl_program_, uniforms_[id].location, value);
+  }
+}
+
+void Program::SetUniform(int id, uint32_t value) const {
+  if (id != -1) {
+    glProgramUniform1ui(gl_program_, uniforms_[id].location, value);
+  }
+}
+
+void Program::SetUniform(int id, float value) const {
+  if (id != -1) {
+    glProgramUniform1f(gl_program_, uniforms_[id].location, value);
+  }
+}
+
+void Program::SetUniform(int id, const glm::vec3& value) const {
+  if (id != -1) {
+    glProgramUniform3fv(gl_program_, uniforms_[id].location, 1, glm::value_ptr(value));
+  }
+}
+
+void Program::SetUniform(int id, const glm::ivec3& value) const {
+  if (id != -1) {
+    glProgramUniform3iv(gl_program_, uniforms_[id].location, 1, glm::value_ptr(value));
+  }
+}
+
+void Program::SetUniform(int id, const glm::mat3& value) const {
+  if (id != -1) {
+    glProgramUniformMatrix3fv(gl_program_, uniforms_[id].location, 1, GL_FALSE,
+                              glm::value_ptr(value));
+  }
+}
+
+void Program::SetUniform(int id, const glm::mat4& value) const {
+  if (id != -1) {
+    glProgramUniformMatrix4fv(gl_program_, uniforms_[id].location, 1, GL_FALSE,
+                              glm::value_ptr(value));
+  }
+}
+
+void Program::SetUniformArray(int id, const int32_t* values, size_t count) const {
+  if (id != -1) {
+    glProgramUniform1iv(gl_program_, uniforms_[id].location, count, values);
+  }
+}
+
+void Program::Reflect() {
+  GLint num_uniforms = 0;
+  glGetProgramInterfaceiv(gl_program_, GL_UNIFORM, GL_ACTIVE_RESOURCES, &num_uniforms);
+  const GLenum uniform_props[] = {
+    GL_NAME_LENGTH, GL_TYPE, GL_ARRAY_SIZE, GL_LOCATION, GL_BLOCK_INDEX, GL_OFFSET
+  };
+  for (GLint i = 0; i < num_uniforms; ++i) {
+    GLint values[6];
+    glGetProgramResourceiv(gl_program_, GL_UNIFORM, i, 6, uniform_props, 6, nullptr, values);
+
+    ProgramUniform uniform;
+    uniform.name = GetResourceName(gl_program_, GL_UNIFORM, i, values[0]);
+    uniform.type = static_cast<GLenum>(values[1]);
+    uniform.array_size = values[2];
+    uniform.location = values[3];
+    uniform.block_index = values[4];
+    uniform.offset = values[5];
+
+    constexpr char kArraySuffix[] = "[0]";
+    constexpr size_t kArraySuffixLen = sizeof(kArraySuffix) - 1;
+    if (uniform.name.size() > kArraySuffixLen &&
+        uniform.name.compare(uniform.name.size() - kArraySuffixLen, kArraySuffixLen,
+                             kArraySuffix) == 0) {
+      uniform.name.resize(uniform.name.size() - kArraySuffixLen);
+    }
+
+    uniform_ids_[uniform.name] = static_cast<int>(uniforms_.size());
+    uniforms_.push_back(std::move(uniform));
+  }
+
+  const GLenum block_props[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+  for (GLenum interface : { GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK }) {
+    GLint num_blocks = 0;
+    glGetProgramInterfaceiv(gl_program_, interface, GL_ACTIVE_RESOURCES, &num_blocks);
+    for (GLint i = 0; i < num_blocks; ++i) {
+      GLint values[3];
+      glGetProgramResourceiv(gl_program_, interface, i, 3, block_props, 3, nullptr, values);
+
+      ProgramBlock block;
+      block.name = GetResourceName(gl_program_, interface, i, values[0]);
+      block.interface = interface;
+      block.binding = values[1];
+      block.data_size = values[2];
+
+      block_ids_[block.name] = static_cast<int>(blocks_.size());
+      blocks_.push_back(std::move(block));
+    }
+  }
+}
+
+std::unique_ptr<Program> Program::Create(
+    const std::vector<std::pair<GLenum, std::string>>& shader_srcs) {
+  GLuint gl_program = glCreateProgram();
+  if (!gl_program) {
+    std::cerr << "Could not create program." << std::endl;
+    return nullptr;
+  }
+  std::unique_ptr<Program> program(new Program(gl_program));
+
+  std::vector<GLuint> shaders;
+  bool compiled = true;
+  for (const auto& [type, src] : shader_srcs) {
+    GLuint shader = glCreateShader(type);
+    shaders.push_back(shader);
+    if (!CompileShader(shader, src)) {
+      compiled = false;
+      break;
+    }
+    glAttachShader(gl_program, shader);
+  }
+
+  bool linked = false;
+  if (compiled) {
+    glLinkProgram(gl_program);
+    linked = CheckProgramLinkStatus(gl_program);
+  }
+  for (GLuint shader : shaders) {
+    glDeleteShader(shader);
+  }
+  if (!linked) {
+    return nullptr;
+  }
+
+  program->Reflect();
+  return program;
+}
+
+std::unique_ptr<Program> Program::LoadFromFiles(
+    const std::vector<std::pair<GLenum, std::string>>& shader_paths) {
+  std::vector<std::pair<GLenum, std::string>> shader_srcs;
+  for (const auto& [type, path] : shader_paths) {
+    std::optional<std::string> src = LoadShaderSource(path);
+    if (!src) {
+      std::cerr << "Could not load shader from file: " << path << std::endl;
+      return nullptr;
+    }
+    shader_srcs.emplace_back(type, std::move(*src));
+  }
+  return Create(shader_srcs);
+}
+
+} // namespace utils
@@ -4,11 +4,154 @@
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GL/gl.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace utils {
 
 bool CheckProgramLinkStatus(GLuint program);
 
+// Active uniform of a program, as reflected at link time.
+struct ProgramUniform {
+  // Arrays are listed once, under their name without the "[0]".
+  std::string name;
+  GLenum type;
+  GLint array_size;
+
+  // -1 for uniforms in a block, which have an offset into the block instead.
+  GLint location;
+  GLint block_index;
+  GLint offset;
+};
+
+// Active uniform block or shader storage block of a program.
+struct ProgramBlock {
+  std::string name;
+
+  // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK.
+  GLenum interface;
+  GLint binding;
+
+  // Minimum size of the buffer bound to the block, in bytes.
+  GLint data_size;
+};
+
+// A linked program with a table of its active uniforms and blocks.
+//
+// Uniforms are looked up by name once, e.g. at startup, and are then set through the integer ids
+// of the table, so that drawing doesn't go through glGetUniformLocation(). The values are set with
+// glProgramUniform*(), which doesn't need the program to be in use. Data that changes per frame or
+// per draw is best kept in uniform blocks, see UniformBuffer.
+class Program {
+ public:
+  ~Program();
+
+  Program(const Program&) = delete;
+  Program& operator=(const Program&) = delete;
+
+  GLuint GetId() const { return gl_program_; }
+  void Use() const { glUseProgram(gl_program_); }
+
+  // Returns the id of the uniform or block called |name|, or -1 if the program has no such active
+  // uniform or block.
+  int FindUniform(const std::string& name) const;
+  int FindBlock(const std::string& name) const;
+
+  size_t GetNumUniforms() const { return uniforms_.size(); }
+  const ProgramUniform& GetUniform(int id) const { return uniforms_[id]; }
+
+  size_t GetNumBlocks() const { return blocks_.size(); }
+  const ProgramBlock& GetBlock(int id) const { return blocks_[id]; }
+
+  // Setting an id of -1 does nothing, like a location of -1 in GL.
+  void SetUniform(int id, int32_t value) const;
+  void SetUniform(int id, uint32_t value) const;
+  void SetUniform(int id, float value) const;
+  void SetUniform(int id, const glm::vec3& value) const;
+  void SetUniform(int id, const glm::ivec3& value) const;
+  void SetUniform(int id, const glm::mat3& value) const;
+  void SetUniform(int id, const glm::mat4& value) const;
+  void SetUniformArray(int id, const int32_t* values, size_t count) const;
+
+  // Compiles |shader_srcs|, given as (shader type, source) pairs, and links them. Prints the
+  // errors and returns nullptr if any step fails.
+  static std::unique_ptr<Program> Create(
+      const std::vector<std::pair<GLenum, std::string>>& shader_srcs);
+
+  // Same as Create(), with the sources read from the files at |shader_paths|.
+  static std::unique_ptr<Program> LoadFromFiles(
+      const std::vector<std::pair<GLenum, std::string>>& shader_paths);
+
+ private:
+  explicit Program(GLuint gl_program);
+
+  void Reflect();
+
+  GLuint gl_program_;
+  std::vector<ProgramUniform> uniforms_;
+  std::vector<ProgramBlock> blocks_;
+  std::unordered_map<std::string, int> uniform_ids_;
+  std::unordered_map<std::string, int> block_ids_;
+};
+
+// A uniform buffer that holds |num_elements| std140 blocks of type T, each at an offset that can
+// be bound on its own. Per-draw data is written for all the draws of a frame, uploaded with a
+// single call, and every draw then binds its element with BindElement().
+//
+// T must match the std140 layout of the block, with the padding spelled out.
+template<typename T>
+class UniformBuffer {
+ public:
+  explicit UniformBuffer(size_t num_elements = 1) : num_elements_(num_elements) {
+    GLint alignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride_ = (sizeof(T) + alignment - 1) / alignment * alignment;
+    data_.resize(stride_ * num_elements_);
+
+    glGenBuffers(1, &gl_buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, gl_buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, data_.size(), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  ~UniformBuffer() { glDeleteBuffers(1, &gl_buffer_); }
+
+  UniformBuffer(const UniformBuffer&) = delete;
+  UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+  size_t GetNumElements() const { return num_elements_; }
+
+  // Only changes the CPU copy; Upload() sends it to the GPU.
+  void Set(size_t idx, const T& value) { std::memcpy(&data_[idx * stride_], &value, sizeof(T)); }
+
+  // Replaces the whole buffer. The old storage is orphaned first, so that the draws of the
+  // previous frame that still read it don't stall the upload.
+  void Upload() {
+    glBindBuffer(GL_UNIFORM_BUFFER, gl_buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, data_.size(), nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, data_.size(), data_.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  void BindElement(GLuint binding, size_t idx) const {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, gl_buffer_, idx * stride_, sizeof(T));
+  }
+
+ private:
+  size_t num_elements_;
+  size_t stride_;
+  std::vector<uint8_t> data_;
+  GLuint gl_buffer_ = 0;
+};
+
 } // namespace utils
 
-#endif // UTILS_PROGRAM_H_
\ No newline at end of file
+#endif // UTILS_PROGRAM_H_
@@ -0,0 +1,279 @@
+#include "utils/scene_buffers.h"
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "utils/model.h"
+#include "utils/vertex_packing.h"
+
+namespace utils {
+
+namespace {
+
+// Smallest size of a vertex or index buffer, so that the first meshes don't copy the buffers
+// over and over.
+constexpr size_t kMinBufferCapacity = size_t(1) << 20;
+
+template<typename T>
+GLuint CreateBuffer(GLenum target, const std::vector<T>& data) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(target, buffer);
+  glBufferData(target, data.size() * sizeof(T), data.data(), GL_STATIC_DRAW);
+  return buffer;
+}
+
+template<typename T>
+void FreeVector(std::vector<T>* v) {
+  std::vector<T>().swap(*v);
+}
+
+} // namespace
+
+SceneBuffers::SceneBuffers(VertexFormat format) : format_(format) {}
+
+SceneBuffers::~SceneBuffers() {
+  glDeleteBuffers(1, &gl_draw_command_buffer_);
+  glDeleteBuffers(1, &gl_mesh_info_buffer_);
+  glDeleteBuffers(1, &gl_mesh_idx_buffer_);
+  for (GrowingBuffer* buffer : { &positions_, &normals_, &texcoords_, &material_ids_, 
+                                 &packed_vertices_, &lightmap_uvs_, &indices_ }) {
+    glDeleteBuffers(1, &buffer->gl_buffer);
+  }
+  glDeleteVertexArrays(1, &gl_vao_);
+}
+
+void SceneBuffers::ResizeBuffer(GrowingBuffer* buffer, size_t capacity) {
+  GLuint gl_buffer;
+  glGenBuffers(1, &gl_buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, gl_buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+  if (buffer->size > 0) {
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer->gl_buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, buffer->size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &buffer->gl_buffer);
+  buffer->gl_buffer = gl_buffer;
+  buffer->capacity = capacity;
+}
+
+void SceneBuffers::AppendToBuffer(GrowingBuffer* buffer, const void* data, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  if (buffer->size + size > buffer->capacity) {
+    ResizeBuffer(buffer, std::max({ buffer->size + size, 2 * buffer->capacity, 
+                                    kMinBufferCapacity }));
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer->gl_buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, buffer->size, size, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  buffer->size += size;
+}
+
+template<typename T>
+void SceneBuffers::AppendVertices(GrowingBuffer* buffer, const std::vector<T>& values,
+                                  size_t num_verts, const T& fill) {
+  size_t num_values = std::min(values.size(), num_verts);
+  AppendToBuffer(buffer, values.data(), num_values * sizeof(T));
+  if (num_values < num_verts) {
+    std::vector<T> fills(num_verts - num_values, fill);
+    AppendToBuffer(buffer, fills.data(), fills.size() * sizeof(T));
+  }
+}
+
+void SceneBuffers::AddMesh(const Mesh& mesh) {
+  MeshRange range;
+  range.base_vertex = static_cast<int32_t>(num_vertices_);
+
+  // The indices of every LOD stay relative to the mesh, and the draws add the base vertex.
+  std::vector<const std::vector<uint32_t>*> lod_indices = { &mesh.indices };
+  for (const MeshLod& lod : mesh.lods) {
+    lod_indices.push_back(&lod.indices);
+  }
+  for (const std::vector<uint32_t>* indices : lod_indices) {
+    range.lods.push_back({ static_cast<uint32_t>(indices_.size / sizeof(uint32_t)),
+                           static_cast<uint32_t>(indices->size()) });
+    AppendToBuffer(&indices_, indices->data(), indices->size() * sizeof(uint32_t));
+  }
+  meshes_.push_back(std::move(range));
+
+  // Meshes without some of the attributes get zeros, so that the buffers stay in step.
+  size_t num_verts = mesh.positions.size();
+  if (format_ == VertexFormat::kSeparate) {
+    AppendVertices(&positions_, mesh.positions, num_verts, glm::vec3(0.f));
+    AppendVertices(&normals_, mesh.normals, num_verts, glm::vec3(0.f));
+    AppendVertices(&texcoords_, mesh.texcoords, num_verts, glm::vec2(0.f));
+    AppendVertices<int32_t>(&material_ids_, mesh.material_ids, num_verts, -1);
+  } else {
+    AppendToBuffer(&packed_vertices_, mesh.packed_vertices.data(), mesh.packed_vertices.size());
+    num_verts = mesh.packed_vertices.size() / GetPackedVertexSize(format_);
+  }
+
+  // The vertices added before the first mesh with lightmap texcoords get zeros once it comes.
+  if (!has_lightmap_uvs_ && !mesh.lightmap_uvs.empty()) {
+    has_lightmap_uvs_ = true;
+    std::vector<uint16_t> zeros(2 * static_cast<size_t>(num_vertices_), 0);
+    AppendToBuffer(&lightmap_uvs_, zeros.data(), zeros.size() * sizeof(uint16_t));
+  }
+  if (has_lightmap_uvs_) {
+    std::vector<uint16_t> uvs(2 * num_verts, 0);
+    for (size_t i = 0; i < std::min(mesh.lightmap_uvs.size(), num_verts); ++i) {
+      glm::vec2 unorm = glm::round(glm::clamp(mesh.lightmap_uvs[i], 0.f, 1.f) * 65535.f);
+      uvs[2 * i] = static_cast<uint16_t>(unorm.x);
+      uvs[2 * i + 1] = static_cast<uint16_t>(unorm.y);
+    }
+    AppendToBuffer(&lightmap_uvs_, uvs.data(), uvs.size() * sizeof(uint16_t));
+  }
+  num_vertices_ += static_cast<uint32_t>(num_verts);
+
+  GpuMeshInfo info;
+  info.pos_offset = glm::vec4(mesh.position_offset, 0.f);
+  info.pos_scale = glm::vec4(mesh.position_scale, 0.f);
+  info.aabb_min = glm::vec4(mesh.aabb.min, 0.f);
+  info.aabb_max = glm::vec4(mesh.aabb.max, 0.f);
+  info.bounding_sphere = mesh.bounding_sphere;
+  mesh_infos_.push_back(info);
+}
+
+void SceneBuffers::Upload() {
+  // Drops the room left for more meshes. A buffer that nothing was added to is created empty, so
+  // that the vertex array can still point at it.
+  for (GrowingBuffer* buffer : { &positions_, &normals_, &texcoords_, &material_ids_, 
+                                 &packed_vertices_, &lightmap_uvs_, &indices_ }) {
+    if (buffer->capacity != buffer->size || buffer->gl_buffer == 0) {
+      ResizeBuffer(buffer, buffer->size);
+    }
+  }
+
+  glGenVertexArrays(1, &gl_vao_);
+  glBindVertexArray(gl_vao_);
+
+  glEnableVertexAttribArray(kScenePositionAttrib);
+  glEnableVertexAttribArray(kSceneNormalAttrib);
+  glEnableVertexAttribArray(kSceneTexcoordAttrib);
+  glEnableVertexAttribArray(kSceneMaterialIdAttrib);
+
+  if (format_ == VertexFormat::kSeparate) {
+    glBindBuffer(GL_ARRAY_BUFFER, positions_.gl_buffer);
+    glVertexAttribPointer(kScenePositionAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, normals_.gl_buffer);
+    glVertexAttribPointer(kSceneNormalAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, texcoords_.gl_buffer);
+    glVertexAttribPointer(kSceneTexcoordAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, material_ids_.gl_buffer);
+    glVertexAttribIPointer(kSceneMaterialIdAttrib, 1, GL_INT, 0, 0);
+  } else if (format_ == VertexFormat::kPacked) {
+    constexpr GLsizei stride = sizeof(PackedVertex);
+
+    glBindBuffer(GL_ARRAY_BUFFER, packed_vertices_.gl_buffer);
+    glVertexAttribPointer(kScenePositionAttrib, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(PackedVertex, position));
+    glVertexAttribPointer(kSceneNormalAttrib, 2, GL_SHORT, GL_TRUE, stride,
+                          (void*)offsetof(PackedVertex, normal));
+    glVertexAttribPointer(kSceneTexcoordAttrib, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(PackedVertex, texcoord));
+    glVertexAttribIPointer(kSceneMaterialIdAttrib, 1, GL_SHORT, stride,
+                           (void*)offsetof(PackedVertex, material_id));
+  } else {
+    constexpr GLsizei stride = sizeof(QuantizedVertex);
+
+    glBindBuffer(GL_ARRAY_BUFFER, packed_vertices_.gl_buffer);
+    glVertexAttribPointer(kScenePositionAttrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                          (void*)offsetof(QuantizedVertex, position));
+    glVertexAttribPointer(kSceneNormalAttrib, 2, GL_SHORT, GL_TRUE, stride,
+                          (void*)offsetof(QuantizedVertex, normal));
+    glVertexAttribPointer(kSceneTexcoordAttrib, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(QuantizedVertex, texcoord));
+    glVertexAttribIPointer(kSceneMaterialIdAttrib, 1, GL_SHORT, stride,
+                           (void*)offsetof(QuantizedVertex, material_id));
+  }
+
+  if (has_lightmap_uvs_) {
+    glBindBuffer(GL_ARRAY_BUFFER, lightmap_uvs_.gl_buffer);
+    glEnableVertexAttribArray(kSceneLightmapUvAttrib);
+    glVertexAttribPointer(kSceneLightmapUvAttrib, 2, GL_UNSIGNED_SHORT, GL_TRUE, 0, 0);
+  }
+
+  // Instance i of a draw reads element base_instance + i of this buffer.
+  std::vector<uint32_t> mesh_indices(meshes_.size());
+  std::iota(mesh_indices.begin(), mesh_indices.end(), 0);
+  gl_mesh_idx_buffer_ = CreateBuffer(GL_ARRAY_BUFFER, mesh_indices);
+  glEnableVertexAttribArray(kSceneMeshIdxAttrib);
+  glVertexAttribIPointer(kSceneMeshIdxAttrib, 1, GL_UNSIGNED_INT, 0, 0);
+  glVertexAttribDivisor(kSceneMeshIdxAttrib, 1);
+
+  // The element buffer binding is part of the vertex array.
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_.gl_buffer);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  gl_mesh_info_buffer_ = CreateBuffer(GL_SHADER_STORAGE_BUFFER, mesh_infos_);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glGenBuffers(1, &gl_draw_command_buffer_);
+
+  FreeVector(&mesh_infos_);
+}
+
+DrawElementsIndirectCommand SceneBuffers::GetDrawCommand(size_t mesh_idx, size_t lod) const {
+  const MeshRange& mesh = meshes_[mesh_idx];
+  DrawElementsIndirectCommand command;
+  command.count = mesh.lods[lod].count;
+  command.instance_count = 1;
+  command.first_index = mesh.lods[lod].first_index;
+  command.base_vertex = mesh.base_vertex;
+  command.base_instance = static_cast<uint32_t>(mesh_idx);
+  return command;
+}
+
+void SceneBuffers::SetDrawCommands(const std::vector<DrawElementsIndirectCommand>& commands) {
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gl_draw_command_buffer_);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+               commands.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void SceneBuffers::Draw(size_t first, size_t count) const {
+  glBindVertexArray(gl_vao_);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gl_draw_command_buffer_);
+  glMultiDrawElementsIndirect(
+      GL_TRIANGLES, GL_UNSIGNED_INT,
+      reinterpret_cast<const void*>(first * sizeof(DrawElementsIndirectCommand)),
+      static_cast<GLsizei>(count), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+void SceneBuffers::DrawIndirect(GLuint command_buffer, GLuint count_buffer,
+                                size_t max_count) const {
+  glBindVertexArray(gl_vao_);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+  if (GLEW_ARB_indirect_parameters) {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, count_buffer);
+    glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0,
+                                        static_cast<GLsizei>(max_count), 0);
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  } else {
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                static_cast<GLsizei>(max_count), 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+} // namespace utils
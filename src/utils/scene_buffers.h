@@ -0,0 +1,156 @@
+#ifndef UTILS_SCENE_BUFFERS_H_
+#define UTILS_SCENE_BUFFERS_H_
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils/model.h"
+
+namespace utils {
+
+// Vertex attribute locations of the vertex array of SceneBuffers.
+constexpr GLuint kScenePositionAttrib = 0;
+constexpr GLuint kSceneNormalAttrib = 1;
+constexpr GLuint kSceneTexcoordAttrib = 2;
+constexpr GLuint kSceneMaterialIdAttrib = 3;
+
+// Index of the mesh a vertex belongs to. It is an instanced attribute read at the base instance of
+// the draw, which is the mesh index in every command of SceneBuffers.
+constexpr GLuint kSceneMeshIdxAttrib = 4;
+
+// Lightmap texcoords, as two unorm16s in their own buffer whatever the vertex format. Only enabled
+// if some mesh has Mesh::lightmap_uvs.
+constexpr GLuint kSceneLightmapUvAttrib = 5;
+
+// Layout of the commands of glMultiDrawElementsIndirect().
+struct DrawElementsIndirectCommand {
+  uint32_t count;
+  uint32_t instance_count;
+  uint32_t first_index;
+  int32_t base_vertex;
+  uint32_t base_instance;
+};
+
+// Per-mesh data for the shaders. Only uses vec4s, so that an array of it can be read as a std430
+// array.
+struct GpuMeshInfo {
+  // Quantized positions decode to pos_offset + pos_scale * q. w is unused.
+  glm::vec4 pos_offset;
+  glm::vec4 pos_scale;
+
+  // Bounds of the mesh. w is unused for the box, and the radius for the sphere.
+  glm::vec4 aabb_min;
+  glm::vec4 aabb_max;
+  glm::vec4 bounding_sphere;
+};
+
+// All the meshes of a scene in a single vertex buffer (one per attribute for
+// VertexFormat::kSeparate) and a single index buffer, with the indices of all their LODs. Any
+// set of meshes is drawn with one glMultiDrawElementsIndirect(), so the cost of submitting a
+// pass doesn't grow with the number of meshes.
+//
+// The meshes are written to the GL buffers as they are added, e.g. from a MeshLoadedCallback
+// while the rest of the model is still being parsed, and only their ranges and bounds are kept on
+// the CPU.
+class SceneBuffers {
+ public:
+  explicit SceneBuffers(VertexFormat format);
+  ~SceneBuffers();
+
+  SceneBuffers(const SceneBuffers&) = delete;
+  SceneBuffers& operator=(const SceneBuffers&) = delete;
+
+  // Writes the vertices and indices of |mesh| to the end of the GL buffers. The mesh must have been
+  // loaded with the format of the buffers. Needs a current GL context.
+  void AddMesh(const Mesh& mesh);
+
+  // Shrinks the GL buffers to the meshes added so far, uploads their bounds and creates the vertex
+  // array. Must be called once, after the last AddMesh() and before drawing.
+  void Upload();
+
+  size_t GetNumMeshes() const { return meshes_.size(); }
+  size_t GetNumLods(size_t mesh_idx) const { return meshes_[mesh_idx].lods.size(); }
+
+  // Command that draws LOD |lod| of mesh |mesh_idx|, where LOD 0 is the full-detail mesh.
+  DrawElementsIndirectCommand GetDrawCommand(size_t mesh_idx, size_t lod) const;
+
+  // Shader storage buffer holding a GpuMeshInfo per mesh.
+  GLuint GetMeshInfoBuffer() const { return gl_mesh_info_buffer_; }
+
+  GLuint GetVertexArray() const { return gl_vao_; }
+
+  // Replaces the commands in the draw command buffer. The old storage is orphaned first, so the
+  // commands can be replaced several times per frame.
+  void SetDrawCommands(const std::vector<DrawElementsIndirectCommand>& commands);
+
+  // Buffer of the commands of SetDrawCommands(), e.g. for a compute shader that filters them.
+  GLuint GetDrawCommandBuffer() const { return gl_draw_command_buffer_; }
+
+  // Draws |count| commands of the draw command buffer, starting at |first|, with the vertex array
+  // of the buffers.
+  void Draw(size_t first, size_t count) const;
+
+  // Draws the commands of |command_buffer|, which were written on the GPU. With
+  // GL_ARB_indirect_parameters, the number of commands is the uint at the start of |count_buffer|,
+  // up to |max_count|. Without it, all |max_count| commands are drawn, so the unused ones must have
+  // a count of 0.
+  void DrawIndirect(GLuint command_buffer, GLuint count_buffer, size_t max_count) const;
+
+ private:
+  struct LodRange {
+    uint32_t first_index;
+    uint32_t count;
+  };
+
+  struct MeshRange {
+    int32_t base_vertex;
+    std::vector<LodRange> lods;
+  };
+
+  // GL buffer that data is appended to. When it runs out of room, its contents are copied on the
+  // GPU into a buffer twice as large.
+  struct GrowingBuffer {
+    GLuint gl_buffer = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+  };
+
+  static void ResizeBuffer(GrowingBuffer* buffer, size_t capacity);
+  static void AppendToBuffer(GrowingBuffer* buffer, const void* data, size_t size);
+
+  // Appends the first |num_verts| elements of |values|, and |fill| for the vertices past its end.
+  template<typename T>
+  static void AppendVertices(GrowingBuffer* buffer, const std::vector<T>& values, size_t num_verts,
+                             const T& fill);
+
+  VertexFormat format_;
+  std::vector<MeshRange> meshes_;
+  std::vector<GpuMeshInfo> mesh_infos_;
+  uint32_t num_vertices_ = 0;
+
+  // The separate attributes are only used with VertexFormat::kSeparate, and |packed_vertices_|
+  // with the other formats. The lightmap texcoords are only created once some mesh has them.
+  GrowingBuffer positions_;
+  GrowingBuffer normals_;
+  GrowingBuffer texcoords_;
+  GrowingBuffer material_ids_;
+  GrowingBuffer packed_vertices_;
+  GrowingBuffer lightmap_uvs_;
+  bool has_lightmap_uvs_ = false;
+  GrowingBuffer indices_;
+
+  GLuint gl_vao_ = 0;
+  GLuint gl_mesh_idx_buffer_ = 0;
+  GLuint gl_mesh_info_buffer_ = 0;
+  GLuint gl_draw_command_buffer_ = 0;
+};
+
+} // namespace utils
+
+#endif // UTILS_SCENE_BUFFERS_H_
@@ -0,0 +1,119 @@
+#include "utils/texture_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/cache_file.h"
+#include "utils/image.h"
+#include "utils/parallel.h"
+#include "utils/texture_compression.h"
+#include "utils/texture_file.h"
+
+namespace utils {
+
+namespace {
+
+// Packs the options that change the contents of the texture.
+uint32_t GetOptionsKey(const TextureLoadOptions& options) {
+  uint32_t key = 0;
+  key |= static_cast<uint32_t>(options.rgb_format);
+  key |= static_cast<uint32_t>(options.rgba_format) << 4;
+  key |= options.flip ? 1u << 8 : 0u;
+  key |= options.compress ? 1u << 9 : 0u;
+  return key;
+}
+
+std::unique_ptr<TextureFile> ReadTextureCache(const std::string& image_path,
+                                              const TextureLoadOptions& options) {
+  uint64_t source_size;
+  int64_t source_mtime;
+  if (!GetSourceStamp(image_path, &source_size, &source_mtime)) {
+    return nullptr;
+  }
+
+  std::unique_ptr<TextureFile> file = TextureFile::Open(GetTextureCachePath(image_path));
+  if (file == nullptr) {
+    return nullptr;
+  }
+  const TextureFileInfo& info = file->GetInfo();
+  if (info.options_key != GetOptionsKey(options) ||
+      info.source_size != source_size ||
+      info.source_mtime != source_mtime ||
+      file->GetNumLevels() == 0) {
+    return nullptr;
+  }
+  return file;
+}
+
+std::shared_ptr<TextureFile> LoadTextureImpl(const std::string& image_path,
+                                             const TextureLoadOptions& options,
+                                             bool parallel_compression) {
+  if (options.use_cache) {
+    if (std::unique_ptr<TextureFile> file = ReadTextureCache(image_path, options)) {
+      return file;
+    }
+  }
+
+  std::shared_ptr<Image> img = LoadImageFromFile(image_path, options.flip);
+  if (img == nullptr) {
+    return nullptr;
+  }
+  GenerateMips(img.get());
+
+  TextureFileInfo info;
+  info.options_key = GetOptionsKey(options);
+  bool write_cache = options.use_cache &&
+                     GetSourceStamp(image_path, &info.source_size, &info.source_mtime);
+
+  std::vector<uint8_t> buffer;
+  if (options.compress) {
+    BlockFormat format = img->format == ImageFormat::kRGBA ? options.rgba_format :
+                                                             options.rgb_format;
+    CompressedImage compressed;
+    CompressImage(*img, format, &compressed, parallel_compression);
+    info.format = ToTextureFormat(format);
+    info.psnr = compressed.psnr;
+    buffer = SerializeTextureFile(info, GetTextureLevels(compressed));
+  } else {
+    info.format = img->format == ImageFormat::kRGBA ? TextureFormat::kRGBA8 :
+                                                      TextureFormat::kRGB8;
+    buffer = SerializeTextureFile(info, GetTextureLevels(*img));
+  }
+  img.reset();
+
+  if (write_cache && !WriteTextureFile(GetTextureCachePath(image_path), buffer)) {
+    std::cerr << "Could not write texture cache: " << GetTextureCachePath(image_path) <<
+        std::endl;
+  }
+  return TextureFile::FromBuffer(std::move(buffer));
+}
+
+} // namespace
+
+std::string GetTextureCachePath(const std::string& image_path) {
+  return image_path + ".robintex";
+}
+
+std::shared_ptr<TextureFile> LoadTexture(const std::string& image_path,
+                                         const TextureLoadOptions& options) {
+  return LoadTextureImpl(image_path, options, true);
+}
+
+std::unique_ptr<TextureLoadQueue> LoadTexturesAsync(const std::vector<std::string>& image_paths,
+                                                    const TextureLoadOptions& options) {
+  // Each texture is compressed on the pool thread that decoded it. Spreading the blocks over more
+  // threads on top of that would only oversubscribe the cores.
+  auto queue = std::make_unique<TextureLoadQueue>(
+      std::min(image_paths.size(), GetNumWorkerThreads()));
+  for (const std::string& path : image_paths) {
+    queue->Submit([path, options]() { return LoadTextureImpl(path, options, false); });
+  }
+  return queue;
+}
+
+} // namespace utils
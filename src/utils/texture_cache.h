@@ -0,0 +1,54 @@
+#ifndef UTILS_TEXTURE_CACHE_H_
+#define UTILS_TEXTURE_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/parallel.h"
+#include "utils/texture_compression.h"
+#include "utils/texture_file.h"
+
+namespace utils {
+
+// Textures are cached next to the source images (e.g. wall.png.robintex) as texture files with
+// their whole mip chain, so that later runs only map the file instead of decoding the image. The
+// cache records the size and modification time of the image file and the options it was built
+// with. It is ignored if any of them have changed.
+
+struct TextureLoadOptions {
+  // Block-compresses the texture. Otherwise the levels are stored as RGB8 or RGBA8.
+  bool compress = true;
+
+  // Format for images without and with an alpha channel.
+  BlockFormat rgb_format = BlockFormat::kBC1;
+  BlockFormat rgba_format = BlockFormat::kBC3;
+
+  // Flips the images vertically, as for LoadImageFromFile().
+  bool flip = true;
+
+  bool use_cache = true;
+};
+
+std::string GetTextureCachePath(const std::string& image_path);
+
+// Returns the texture for the image at |image_path|, with mips down to 1x1. If there is a valid
+// cache, the texture is memory-mapped from it and its levels can be uploaded without any copy.
+// Otherwise the image is loaded, its mips are generated and compressed, and the result is written
+// to the cache. Returns nullptr if the image couldn't be loaded.
+std::shared_ptr<TextureFile> LoadTexture(const std::string& image_path,
+                                         const TextureLoadOptions& options);
+
+// Textures loaded by LoadTexturesAsync(). The index of a result is the index of its path, and the
+// texture is nullptr if it couldn't be loaded.
+using TextureLoadQueue = CompletionQueue<std::shared_ptr<TextureFile>>;
+
+// Starts loading the textures at |image_paths| on a pool of worker threads and returns right
+// away. Each texture is decoded, mipped and compressed on one thread, so several textures are
+// processed at once.
+std::unique_ptr<TextureLoadQueue> LoadTexturesAsync(const std::vector<std::string>& image_paths,
+                                                    const TextureLoadOptions& options);
+
+} // namespace utils
+
+#endif // UTILS_TEXTURE_CACHE_H_
@@ -0,0 +1,690 @@
+#include "utils/texture_compression.h"
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILS_TEXTURE_COMPRESSION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "utils/image.h"
+#include "utils/parallel.h"
+
+namespace utils {
+
+namespace {
+
+constexpr uint32_t kBlockDim = 4;
+constexpr int kBlockPixels = 16;
+
+// Weights of the second endpoint for the BC1 palette entries, in the order of the indices.
+constexpr float kBc1Weights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+
+// Weights of the second endpoint for the 4-bit BC7 indices, out of 64.
+constexpr int kBc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// The pixels of one block, stored per channel so that four pixels fit in an SSE register.
+struct BlockPixels {
+  alignas(16) float channels[4][kBlockPixels];
+
+  glm::vec4 GetPixel(int i) const {
+    return glm::vec4(channels[0][i], channels[1][i], channels[2][i], channels[3][i]);
+  }
+};
+
+// Writes bit fields from the least significant bit of the block up. The block must be zeroed.
+class BitWriter {
+ public:
+  explicit BitWriter(uint8_t* data) : data_(data) {}
+
+  void Write(uint32_t value, int num_bits) {
+    for (int i = 0; i < num_bits; ++i, ++pos_) {
+      if ((value >> i) & 1) {
+        data_[pos_ / 8] |= static_cast<uint8_t>(1 << (pos_ % 8));
+      }
+    }
+  }
+
+ private:
+  uint8_t* data_;
+  int pos_ = 0;
+};
+
+class BitReader {
+ public:
+  explicit BitReader(const uint8_t* data) : data_(data) {}
+
+  uint32_t Read(int num_bits) {
+    uint32_t value = 0;
+    for (int i = 0; i < num_bits; ++i, ++pos_) {
+      value |= static_cast<uint32_t>((data_[pos_ / 8] >> (pos_ % 8)) & 1) << i;
+    }
+    return value;
+  }
+
+ private:
+  const uint8_t* data_;
+  int pos_ = 0;
+};
+
+// Reads a block of pixels, repeating the last row and column past the edges of the image. Images
+// without alpha get an alpha of 255.
+void LoadBlock(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t num_channels,
+               uint32_t block_x, uint32_t block_y, BlockPixels* block) {
+  for (int i = 0; i < kBlockPixels; ++i) {
+    uint32_t x = std::min(block_x * kBlockDim + i % kBlockDim, width - 1);
+    uint32_t y = std::min(block_y * kBlockDim + i / kBlockDim, height - 1);
+    const uint8_t* pixel = pixels + (static_cast<size_t>(y) * width + x) * num_channels;
+    for (int c = 0; c < 3; ++c) {
+      block->channels[c][i] = pixel[c];
+    }
+    block->channels[3][i] = num_channels == 4 ? pixel[3] : 255.f;
+  }
+}
+
+// Picks the nearest palette entry for every pixel, measured over the first |num_channels|
+// channels, and returns the summed squared error.
+float FindNearestIndices(const BlockPixels& block, int num_channels, const glm::vec4* palette,
+                         int palette_size, uint8_t* indices) {
+#ifdef UTILS_TEXTURE_COMPRESSION_USE_SSE
+  __m128 total_err = _mm_setzero_ps();
+  for (int group = 0; group < kBlockPixels / 4; ++group) {
+    __m128 pixels[4];
+    for (int c = 0; c < num_channels; ++c) {
+      pixels[c] = _mm_load_ps(&block.channels[c][group * 4]);
+    }
+
+    __m128 best_err = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128 best_idx = _mm_setzero_ps();
+    for (int p = 0; p < palette_size; ++p) {
+      __m128 err = _mm_setzero_ps();
+      for (int c = 0; c < num_channels; ++c) {
+        __m128 d = _mm_sub_ps(pixels[c], _mm_set1_ps(palette[p][c]));
+        err = _mm_add_ps(err, _mm_mul_ps(d, d));
+      }
+      __m128 closer = _mm_cmplt_ps(err, best_err);
+      best_err = _mm_min_ps(err, best_err);
+      best_idx = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(static_cast<float>(p))),
+                           _mm_andnot_ps(closer, best_idx));
+    }
+    total_err = _mm_add_ps(total_err, best_err);
+
+    alignas(16) int32_t group_indices[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(group_indices), _mm_cvttps_epi32(best_idx));
+    for (int i = 0; i < 4; ++i) {
+      indices[group * 4 + i] = static_cast<uint8_t>(group_indices[i]);
+    }
+  }
+  alignas(16) float lane_errs[4];
+  _mm_store_ps(lane_errs, total_err);
+  return lane_errs[0] + lane_errs[1] + lane_errs[2] + lane_errs[3];
+#else
+  float total_err = 0.f;
+  for (int i = 0; i < kBlockPixels; ++i) {
+    float best_err = std::numeric_limits<float>::max();
+    for (int p = 0; p < palette_size; ++p) {
+      float err = 0.f;
+      for (int c = 0; c < num_channels; ++c) {
+        float d = block.channels[c][i] - palette[p][c];
+        err += d * d;
+      }
+      if (err < best_err) {
+        best_err = err;
+        indices[i] = static_cast<uint8_t>(p);
+      }
+    }
+    total_err += best_err;
+  }
+  return total_err;
+#endif
+}
+
+// Fits a line through the pixels over the first |num_channels| channels and returns the two
+// points on it that bound the projections of all the pixels.
+void ComputeLineEndpoints(const BlockPixels& block, int num_channels, glm::vec4* e0,
+                          glm::vec4* e1) {
+  glm::vec4 mean(0.f);
+  glm::vec4 min_pixel(255.f);
+  glm::vec4 max_pixel(0.f);
+  for (int i = 0; i < kBlockPixels; ++i) {
+    glm::vec4 pixel = block.GetPixel(i);
+    mean += pixel;
+    min_pixel = glm::min(min_pixel, pixel);
+    max_pixel = glm::max(max_pixel, pixel);
+  }
+  mean /= static_cast<float>(kBlockPixels);
+
+  float cov[4][4] = {};
+  for (int i = 0; i < kBlockPixels; ++i) {
+    glm::vec4 d = block.GetPixel(i) - mean;
+    for (int r = 0; r < num_channels; ++r) {
+      for (int c = 0; c < num_channels; ++c) {
+        cov[r][c] += d[r] * d[c];
+      }
+    }
+  }
+
+  // Power iteration, starting from the diagonal of the bounding box, which is usually close.
+  glm::vec4 axis(0.f);
+  for (int c = 0; c < num_channels; ++c) {
+    axis[c] = max_pixel[c] - min_pixel[c];
+  }
+  for (int iter = 0; iter < 8; ++iter) {
+    glm::vec4 next(0.f);
+    for (int r = 0; r < num_channels; ++r) {
+      for (int c = 0; c < num_channels; ++c) {
+        next[r] += cov[r][c] * axis[c];
+      }
+    }
+    float len = glm::length(next);
+    if (len < 1e-6f) {
+      break;
+    }
+    axis = next / len;
+  }
+
+  float min_t = 0.f;
+  float max_t = 0.f;
+  for (int i = 0; i < kBlockPixels; ++i) {
+    float t = 0.f;
+    for (int c = 0; c < num_channels; ++c) {
+      t += (block.channels[c][i] - mean[c]) * axis[c];
+    }
+    min_t = std::min(min_t, t);
+    max_t = std::max(max_t, t);
+  }
+  *e0 = glm::clamp(mean + axis * min_t, 0.f, 255.f);
+  *e1 = glm::clamp(mean + axis * max_t, 0.f, 255.f);
+}
+
+// Solves for the endpoints that minimize the squared error when every pixel is reconstructed as
+// mix(e0, e1, weights[indices[i]]). Returns false if all the pixels use the same weight.
+bool FitEndpoints(const BlockPixels& block, const uint8_t* indices, const float* weights,
+                  glm::vec4* e0, glm::vec4* e1) {
+  float aa = 0.f;
+  float ab = 0.f;
+  float bb = 0.f;
+  glm::vec4 ax(0.f);
+  glm::vec4 bx(0.f);
+  for (int i = 0; i < kBlockPixels; ++i) {
+    float b = weights[indices[i]];
+    float a = 1.f - b;
+    glm::vec4 pixel = block.GetPixel(i);
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    ax += a * pixel;
+    bx += b * pixel;
+  }
+
+  float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f) {
+    return false;
+  }
+  *e0 = glm::clamp((ax * bb - bx * ab) / det, 0.f, 255.f);
+  *e1 = glm::clamp((bx * aa - ax * ab) / det, 0.f, 255.f);
+  return true;
+}
+
+uint16_t PackRgb565(const glm::vec4& color) {
+  uint32_t r = static_cast<uint32_t>(std::lround(color.r * 31.f / 255.f));
+  uint32_t g = static_cast<uint32_t>(std::lround(color.g * 63.f / 255.f));
+  uint32_t b = static_cast<uint32_t>(std::lround(color.b * 31.f / 255.f));
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void UnpackRgb565(uint16_t packed, int rgb[3]) {
+  int r = (packed >> 11) & 31;
+  int g = (packed >> 5) & 63;
+  int b = packed & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Builds the four colors of a BC1 block in 4-color mode, with the same rounding as the decoder.
+void BuildBc1Palette(uint16_t c0, uint16_t c1, glm::vec4 palette[4]) {
+  int rgb0[3];
+  int rgb1[3];
+  UnpackRgb565(c0, rgb0);
+  UnpackRgb565(c1, rgb1);
+  for (int c = 0; c < 3; ++c) {
+    palette[0][c] = static_cast<float>(rgb0[c]);
+    palette[1][c] = static_cast<float>(rgb1[c]);
+    palette[2][c] = static_cast<float>((2 * rgb0[c] + rgb1[c]) / 3);
+    palette[3][c] = static_cast<float>((rgb0[c] + 2 * rgb1[c]) / 3);
+  }
+  for (int p = 0; p < 4; ++p) {
+    palette[p][3] = 255.f;
+  }
+}
+
+// Writes the 8-byte BC1 color block. The endpoints are always ordered for 4-color mode, so the
+// block decodes the same way as the color part of a BC3 block.
+void EncodeBc1Colors(const BlockPixels& block, uint8_t* out) {
+  glm::vec4 e0;
+  glm::vec4 e1;
+  ComputeLineEndpoints(block, 3, &e0, &e1);
+
+  uint16_t best_c0 = 0;
+  uint16_t best_c1 = 0;
+  uint8_t best_indices[kBlockPixels] = {};
+  float best_err = std::numeric_limits<float>::max();
+
+  // The second pass refits the endpoints to the indices of the first.
+  for (int pass = 0; pass < 2; ++pass) {
+    uint16_t c0 = PackRgb565(e0);
+    uint16_t c1 = PackRgb565(e1);
+    if (c0 < c1) {
+      std::swap(c0, c1);
+    }
+
+    glm::vec4 palette[4];
+    BuildBc1Palette(c0, c1, palette);
+
+    uint8_t indices[kBlockPixels];
+    float err;
+    if (c0 == c1) {
+      // Equal endpoints select 3-color mode, where only the first entry is safe to use.
+      std::fill(indices, indices + kBlockPixels, 0);
+      err = FindNearestIndices(block, 3, palette, 1, indices);
+    } else {
+      err = FindNearestIndices(block, 3, palette, 4, indices);
+    }
+
+    if (err < best_err) {
+      best_err = err;
+      best_c0 = c0;
+      best_c1 = c1;
+      std::copy(indices, indices + kBlockPixels, best_indices);
+    }
+
+    if (!FitEndpoints(block, best_indices, kBc1Weights, &e0, &e1)) {
+      break;
+    }
+  }
+
+  uint32_t index_bits = 0;
+  for (int i = 0; i < kBlockPixels; ++i) {
+    index_bits |= static_cast<uint32_t>(best_indices[i]) << (2 * i);
+  }
+  out[0] = static_cast<uint8_t>(best_c0);
+  out[1] = static_cast<uint8_t>(best_c0 >> 8);
+  out[2] = static_cast<uint8_t>(best_c1);
+  out[3] = static_cast<uint8_t>(best_c1 >> 8);
+  std::memcpy(out + 4, &index_bits, sizeof(index_bits));
+}
+
+void BuildBc3AlphaPalette(int a0, int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  for (int i = 2; i < 8; ++i) {
+    palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+  }
+}
+
+// Writes the 8-byte BC3 alpha block, with the alpha range of the block as the endpoints.
+void EncodeBc3Alpha(const BlockPixels& block, uint8_t* out) {
+  const float* alpha = block.channels[3];
+  int a0 = static_cast<int>(*std::max_element(alpha, alpha + kBlockPixels));
+  int a1 = static_cast<int>(*std::min_element(alpha, alpha + kBlockPixels));
+
+  uint64_t index_bits = 0;
+  if (a0 != a1) {
+    int palette[8];
+    BuildBc3AlphaPalette(a0, a1, palette);
+    for (int i = 0; i < kBlockPixels; ++i) {
+      int best_idx = 0;
+      int best_err = std::numeric_limits<int>::max();
+      for (int p = 0; p < 8; ++p) {
+        int err = std::abs(palette[p] - static_cast<int>(alpha[i]));
+        if (err < best_err) {
+          best_err = err;
+          best_idx = p;
+        }
+      }
+      index_bits |= static_cast<uint64_t>(best_idx) << (3 * i);
+    }
+  }
+
+  out[0] = static_cast<uint8_t>(a0);
+  out[1] = static_cast<uint8_t>(a1);
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = static_cast<uint8_t>(index_bits >> (8 * i));
+  }
+}
+
+// BC7 mode 6 endpoint: 7 bits per channel plus a shared lowest bit.
+struct Bc7Endpoint {
+  int values[4];
+  int p_bit;
+
+  int Get(int c) const { return (values[c] << 1) | p_bit; }
+};
+
+Bc7Endpoint QuantizeBc7Endpoint(const glm::vec4& color) {
+  Bc7Endpoint best = {};
+  float best_err = std::numeric_limits<float>::max();
+  for (int p_bit = 0; p_bit < 2; ++p_bit) {
+    Bc7Endpoint endpoint;
+    endpoint.p_bit = p_bit;
+    float err = 0.f;
+    for (int c = 0; c < 4; ++c) {
+      endpoint.values[c] = std::clamp(static_cast<int>(std::lround((color[c] - p_bit) * 0.5f)),
+                                      0, 127);
+      float d = static_cast<float>(endpoint.Get(c)) - color[c];
+      err += d * d;
+    }
+    if (err < best_err) {
+      best_err = err;
+      best = endpoint;
+    }
+  }
+  return best;
+}
+
+void BuildBc7Palette(const Bc7Endpoint& e0, const Bc7Endpoint& e1, glm::vec4 palette[16]) {
+  for (int p = 0; p < 16; ++p) {
+    for (int c = 0; c < 4; ++c) {
+      int w = kBc7Weights[p];
+      palette[p][c] = static_cast<float>(((64 - w) * e0.Get(c) + w * e1.Get(c) + 32) >> 6);
+    }
+  }
+}
+
+void EncodeBc7Mode6(const BlockPixels& block, uint8_t* out) {
+  float weights[16];
+  for (int p = 0; p < 16; ++p) {
+    weights[p] = kBc7Weights[p] / 64.f;
+  }
+
+  glm::vec4 e0;
+  glm::vec4 e1;
+  ComputeLineEndpoints(block, 4, &e0, &e1);
+
+  Bc7Endpoint best_e0 = {};
+  Bc7Endpoint best_e1 = {};
+  uint8_t best_indices[kBlockPixels] = {};
+  float best_err = std::numeric_limits<float>::max();
+
+  // The second pass refits the endpoints to the indices of the first.
+  for (int pass = 0; pass < 2; ++pass) {
+    Bc7Endpoint q0 = QuantizeBc7Endpoint(e0);
+    Bc7Endpoint q1 = QuantizeBc7Endpoint(e1);
+
+    glm::vec4 palette[16];
+    BuildBc7Palette(q0, q1, palette);
+
+    uint8_t indices[kBlockPixels];
+    float err = FindNearestIndices(block, 4, palette, 16, indices);
+    if (err < best_err) {
+      best_err = err;
+      best_e0 = q0;
+      best_e1 = q1;
+      std::copy(indices, indices + kBlockPixels, best_indices);
+    }
+
+    if (!FitEndpoints(block, best_indices, weights, &e0, &e1)) {
+      break;
+    }
+  }
+
+  // The highest bit of the first index is implicitly 0, which is ensured by swapping the
+  // endpoints.
+  if (best_indices[0] & 8) {
+    std::swap(best_e0, best_e1);
+    for (uint8_t& index : best_indices) {
+      index = static_cast<uint8_t>(15 - index);
+    }
+  }
+
+  std::memset(out, 0, 16);
+  BitWriter writer(out);
+  writer.Write(1 << 6, 7); // mode 6
+  for (int c = 0; c < 4; ++c) {
+    writer.Write(best_e0.values[c], 7);
+    writer.Write(best_e1.values[c], 7);
+  }
+  writer.Write(best_e0.p_bit, 1);
+  writer.Write(best_e1.p_bit, 1);
+  writer.Write(best_indices[0], 3);
+  for (int i = 1; i < kBlockPixels; ++i) {
+    writer.Write(best_indices[i], 4);
+  }
+}
+
+void EncodeBlock(BlockFormat format, const BlockPixels& block, uint8_t* out) {
+  switch (format) {
+    case BlockFormat::kBC1:
+      EncodeBc1Colors(block, out);
+      break;
+    case BlockFormat::kBC3:
+      EncodeBc3Alpha(block, out);
+      EncodeBc1Colors(block, out + 8);
+      break;
+    case BlockFormat::kBC7:
+      EncodeBc7Mode6(block, out);
+      break;
+  }
+}
+
+// Decodes a block into 16 RGBA pixels.
+void DecodeBc1Colors(const uint8_t* in, uint8_t rgba[kBlockPixels * 4]) {
+  uint16_t c0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+  uint16_t c1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+  uint32_t index_bits;
+  std::memcpy(&index_bits, in + 4, sizeof(index_bits));
+
+  int palette[4][4];
+  UnpackRgb565(c0, palette[0]);
+  UnpackRgb565(c1, palette[1]);
+  for (int c = 0; c < 3; ++c) {
+    if (c0 > c1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  for (int p = 0; p < 4; ++p) {
+    palette[p][3] = c0 <= c1 && p == 3 ? 0 : 255;
+  }
+
+  for (int i = 0; i < kBlockPixels; ++i) {
+    int idx = (index_bits >> (2 * i)) & 3;
+    for (int c = 0; c < 4; ++c) {
+      rgba[i * 4 + c] = static_cast<uint8_t>(palette[idx][c]);
+    }
+  }
+}
+
+void DecodeBc3Alpha(const uint8_t* in, uint8_t rgba[kBlockPixels * 4]) {
+  int palette[8];
+  if (in[0] > in[1]) {
+    BuildBc3AlphaPalette(in[0], in[1], palette);
+  } else {
+    // 6-value mode, which the encoder only produces with equal endpoints.
+    palette[0] = in[0];
+    palette[1] = in[1];
+    for (int i = 2; i < 6; ++i) {
+      palette[i] = ((6 - i) * in[0] + (i - 1) * in[1]) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+
+  uint64_t index_bits = 0;
+  for (int i = 0; i < 6; ++i) {
+    index_bits |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+  }
+  for (int i = 0; i < kBlockPixels; ++i) {
+    rgba[i * 4 + 3] = static_cast<uint8_t>(palette[(index_bits >> (3 * i)) & 7]);
+  }
+}
+
+void DecodeBc7Mode6(const uint8_t* in, uint8_t rgba[kBlockPixels * 4]) {
+  BitReader reader(in);
+  if (reader.Read(7) != (1 << 6)) {
+    // Not mode 6. Decodes as black so that foreign blocks show up in the PSNR.
+    std::fill(rgba, rgba + kBlockPixels * 4, 0);
+    return;
+  }
+
+  Bc7Endpoint e0;
+  Bc7Endpoint e1;
+  for (int c = 0; c < 4; ++c) {
+    e0.values[c] = reader.Read(7);
+    e1.values[c] = reader.Read(7);
+  }
+  e0.p_bit = reader.Read(1);
+  e1.p_bit = reader.Read(1);
+
+  glm::vec4 palette[16];
+  BuildBc7Palette(e0, e1, palette);
+  for (int i = 0; i < kBlockPixels; ++i) {
+    int idx = reader.Read(i == 0 ? 3 : 4);
+    for (int c = 0; c < 4; ++c) {
+      rgba[i * 4 + c] = static_cast<uint8_t>(palette[idx][c]);
+    }
+  }
+}
+
+void DecodeBlock(BlockFormat format, const uint8_t* in, uint8_t rgba[kBlockPixels * 4]) {
+  switch (format) {
+    case BlockFormat::kBC1:
+      DecodeBc1Colors(in, rgba);
+      break;
+    case BlockFormat::kBC3:
+      DecodeBc1Colors(in + 8, rgba);
+      DecodeBc3Alpha(in, rgba);
+      break;
+    case BlockFormat::kBC7:
+      DecodeBc7Mode6(in, rgba);
+      break;
+  }
+}
+
+void CompressLevel(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t num_channels,
+                   BlockFormat format, bool parallel, CompressedLevel* level) {
+  uint32_t num_blocks_x = (width + kBlockDim - 1) / kBlockDim;
+  uint32_t num_blocks_y = (height + kBlockDim - 1) / kBlockDim;
+  size_t block_size = GetBlockSize(format);
+
+  level->width = width;
+  level->height = height;
+  level->data.resize(num_blocks_x * num_blocks_y * block_size);
+
+  auto compress_row = [&](size_t block_y) {
+    BlockPixels block;
+    for (uint32_t block_x = 0; block_x < num_blocks_x; ++block_x) {
+      LoadBlock(pixels, width, height, num_channels, block_x, block_y, &block);
+      uint8_t* out = level->data.data() + (block_y * num_blocks_x + block_x) * block_size;
+      EncodeBlock(format, block, out);
+    }
+  };
+  if (parallel) {
+    // Rows of blocks are handed out to the threads, which keeps the per-call overhead small.
+    ParallelFor(num_blocks_y, compress_row);
+  } else {
+    for (uint32_t block_y = 0; block_y < num_blocks_y; ++block_y) {
+      compress_row(block_y);
+    }
+  }
+}
+
+double ComputePsnr(const Image& img, const CompressedImage& compressed) {
+  // BC1 has no alpha, so only the color channels are compared.
+  uint32_t num_channels = GetNumChannels(img.format);
+  uint32_t num_compared_channels = compressed.format == BlockFormat::kBC1 ? 3 : num_channels;
+
+  std::vector<uint8_t> decoded;
+  DecompressLevel(compressed.format, compressed.levels[0], num_channels, &decoded);
+
+  double sum_sq_err = 0.0;
+  size_t num_pixels = static_cast<size_t>(img.width) * img.height;
+  for (size_t i = 0; i < num_pixels; ++i) {
+    for (uint32_t c = 0; c < num_compared_channels; ++c) {
+      double d = static_cast<double>(img.data[i * num_channels + c]) -
+                 decoded[i * num_channels + c];
+      sum_sq_err += d * d;
+    }
+  }
+  if (sum_sq_err == 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  double mse = sum_sq_err / (num_pixels * num_compared_channels);
+  return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+} // namespace
+
+size_t GetBlockSize(BlockFormat format) {
+  return format == BlockFormat::kBC1 ? 8 : 16;
+}
+
+const char* GetBlockFormatName(BlockFormat format) {
+  switch (format) {
+    case BlockFormat::kBC1:
+      return "BC1";
+    case BlockFormat::kBC3:
+      return "BC3";
+    case BlockFormat::kBC7:
+      return "BC7";
+  }
+  return "";
+}
+
+void CompressImage(const Image& img, BlockFormat format, CompressedImage* compressed,
+                   bool parallel) {
+  uint32_t num_channels = GetNumChannels(img.format);
+
+  compressed->format = format;
+  compressed->levels.resize(img.mips.size() + 1);
+  CompressLevel(img.data.data(), img.width, img.height, num_channels, format, parallel,
+                &compressed->levels[0]);
+  for (size_t i = 0; i < img.mips.size(); ++i) {
+    const ImageMipLevel& mip = img.mips[i];
+    CompressLevel(mip.data.data(), mip.width, mip.height, num_channels, format, parallel,
+                  &compressed->levels[i + 1]);
+  }
+
+  compressed->psnr = ComputePsnr(img, *compressed);
+}
+
+void DecompressLevel(BlockFormat format, const CompressedLevel& level, uint32_t num_channels,
+                     std::vector<uint8_t>* pixels) {
+  uint32_t num_blocks_x = (level.width + kBlockDim - 1) / kBlockDim;
+  uint32_t num_blocks_y = (level.height + kBlockDim - 1) / kBlockDim;
+  size_t block_size = GetBlockSize(format);
+
+  pixels->resize(static_cast<size_t>(level.width) * level.height * num_channels);
+  for (uint32_t block_y = 0; block_y < num_blocks_y; ++block_y) {
+    for (uint32_t block_x = 0; block_x < num_blocks_x; ++block_x) {
+      uint8_t rgba[kBlockPixels * 4];
+      DecodeBlock(format, level.data.data() + (block_y * num_blocks_x + block_x) * block_size,
+                  rgba);
+
+      for (int i = 0; i < kBlockPixels; ++i) {
+        uint32_t x = block_x * kBlockDim + i % kBlockDim;
+        uint32_t y = block_y * kBlockDim + i / kBlockDim;
+        if (x >= level.width || y >= level.height) {
+          continue;
+        }
+        uint8_t* pixel = pixels->data() + (static_cast<size_t>(y) * level.width + x) *
+                         num_channels;
+        std::memcpy(pixel, rgba + i * 4, num_channels);
+      }
+    }
+  }
+}
+
+} // namespace utils
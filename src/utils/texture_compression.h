@@ -0,0 +1,60 @@
+#ifndef UTILS_TEXTURE_COMPRESSION_H_
+#define UTILS_TEXTURE_COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utils/image.h"
+
+namespace utils {
+
+// GPU block compression formats. Each one stores 4x4 pixel blocks in a fixed number of bytes.
+enum class BlockFormat {
+  kBC1 = 0, // RGB, 8 bytes per block
+  kBC3,     // RGBA with interpolated alpha, 16 bytes per block
+  kBC7      // RGBA, 16 bytes per block, higher quality than BC1 and BC3
+};
+
+size_t GetBlockSize(BlockFormat format);
+
+// E.g. "BC1".
+const char* GetBlockFormatName(BlockFormat format);
+
+struct CompressedLevel {
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  // Rows of blocks; the last row and column of blocks are padded with edge pixels.
+  std::vector<uint8_t> data;
+};
+
+struct CompressedImage {
+  BlockFormat format = BlockFormat::kBC1;
+
+  // Level 0 first, then the mips of the source image.
+  std::vector<CompressedLevel> levels;
+
+  // Peak signal-to-noise ratio of level 0 against the source image, in dB, over the channels the
+  // source image has. Infinite if the compression was lossless.
+  double psnr = 0.0;
+};
+
+// Compresses |img| and its mips into |compressed| and computes the PSNR. BC1 drops the alpha
+// channel of RGBA images. If |parallel| is true, the blocks are spread over the worker threads;
+// callers that already compress several images at once pass false.
+//
+// The endpoints of every block are fit along the principal axis of its colors and then refined
+// with a least-squares pass. BC7 only uses mode 6 (one subset, 4-bit indices), which handles
+// smooth gradients and alpha well enough for surface textures.
+void CompressImage(const Image& img, BlockFormat format, CompressedImage* compressed,
+                   bool parallel = true);
+
+// Decodes one level into tightly packed pixels with |num_channels| (3 or 4) channels. Only the
+// block modes that CompressImage() writes are supported.
+void DecompressLevel(BlockFormat format, const CompressedLevel& level, uint32_t num_channels,
+                     std::vector<uint8_t>* pixels);
+
+} // namespace utils
+
+#endif // UTILS_TEXTURE_COMPRESSION_H_
@@ -0,0 +1,211 @@
+#include "utils/texture_file.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/cache_file.h"
+#include "utils/image.h"
+#include "utils/mapped_file.h"
+#include "utils/texture_compression.h"
+
+namespace utils {
+
+namespace {
+
+constexpr char kFileMagic[8] = { 'R', 'O', 'B', 'I', 'N', 'T', 'E', 'X' };
+
+// Must be incremented whenever the layout of the file changes.
+constexpr uint32_t kFileVersion = 2;
+
+constexpr size_t kLevelAlignment = 16;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  uint32_t num_levels;
+  uint32_t options_key;
+  uint64_t source_size;
+  int64_t source_mtime;
+  double psnr;
+};
+
+struct FileLevelIndex {
+  uint32_t width;
+  uint32_t height;
+
+  // From the start of the file.
+  uint64_t offset;
+  uint64_t size;
+};
+
+size_t AlignLevelOffset(size_t offset) {
+  return (offset + kLevelAlignment - 1) & ~(kLevelAlignment - 1);
+}
+
+size_t GetLevelSize(TextureFormat format, uint32_t width, uint32_t height) {
+  switch (format) {
+    case TextureFormat::kRGB8:
+      return static_cast<size_t>(width) * height * 3;
+    case TextureFormat::kRGBA8:
+      return static_cast<size_t>(width) * height * 4;
+    case TextureFormat::kBC1:
+    case TextureFormat::kBC3:
+    case TextureFormat::kBC7: {
+      size_t block_size = format == TextureFormat::kBC1 ? 8 : 16;
+      return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+TextureFormat ToTextureFormat(BlockFormat format) {
+  switch (format) {
+    case BlockFormat::kBC1:
+      return TextureFormat::kBC1;
+    case BlockFormat::kBC3:
+      return TextureFormat::kBC3;
+    case BlockFormat::kBC7:
+      return TextureFormat::kBC7;
+  }
+  return TextureFormat::kBC1;
+}
+
+BlockFormat ToBlockFormat(TextureFormat format) {
+  switch (format) {
+    case TextureFormat::kBC3:
+      return BlockFormat::kBC3;
+    case TextureFormat::kBC7:
+      return BlockFormat::kBC7;
+    default:
+      return BlockFormat::kBC1;
+  }
+}
+
+bool IsBlockCompressed(TextureFormat format) {
+  return format != TextureFormat::kRGB8 && format != TextureFormat::kRGBA8;
+}
+
+std::vector<TextureLevel> GetTextureLevels(const Image& img) {
+  std::vector<TextureLevel> levels;
+  levels.push_back({ img.width, img.height, img.data.data(), img.data.size() });
+  for (const ImageMipLevel& mip : img.mips) {
+    levels.push_back({ mip.width, mip.height, mip.data.data(), mip.data.size() });
+  }
+  return levels;
+}
+
+std::vector<TextureLevel> GetTextureLevels(const CompressedImage& img) {
+  std::vector<TextureLevel> levels;
+  for (const CompressedLevel& level : img.levels) {
+    levels.push_back({ level.width, level.height, level.data.data(), level.data.size() });
+  }
+  return levels;
+}
+
+std::unique_ptr<TextureFile> TextureFile::Open(const std::string& path) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+  if (file == nullptr) {
+    return nullptr;
+  }
+
+  std::unique_ptr<TextureFile> texture_file(new TextureFile());
+  if (!texture_file->Parse(file->GetData(), file->GetSize())) {
+    return nullptr;
+  }
+  texture_file->file_ = std::move(file);
+  return texture_file;
+}
+
+std::unique_ptr<TextureFile> TextureFile::FromBuffer(std::vector<uint8_t> buffer) {
+  std::unique_ptr<TextureFile> texture_file(new TextureFile());
+  // Moving the vector keeps its data pointer, so the levels parsed here stay valid.
+  texture_file->buffer_ = std::move(buffer);
+  if (!texture_file->Parse(texture_file->buffer_.data(), texture_file->buffer_.size())) {
+    return nullptr;
+  }
+  return texture_file;
+}
+
+void TextureFile::DiscardLevel(size_t level) const {
+  if (file_ != nullptr) {
+    file_->DiscardPages(levels_[level].data - file_->GetData(), levels_[level].size);
+  }
+}
+
+bool TextureFile::Parse(const uint8_t* data, size_t size) {
+  FileHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+      header.version != kFileVersion ||
+      header.format > static_cast<uint32_t>(TextureFormat::kBC7) ||
+      header.num_levels > (size - sizeof(header)) / sizeof(FileLevelIndex)) {
+    return false;
+  }
+
+  info_.format = static_cast<TextureFormat>(header.format);
+  info_.options_key = header.options_key;
+  info_.source_size = header.source_size;
+  info_.source_mtime = header.source_mtime;
+  info_.psnr = header.psnr;
+
+  levels_.resize(header.num_levels);
+  for (uint32_t i = 0; i < header.num_levels; ++i) {
+    FileLevelIndex index;
+    std::memcpy(&index, data + sizeof(header) + i * sizeof(index), sizeof(index));
+    if (index.offset > size || index.size > size - index.offset ||
+        index.offset % kLevelAlignment != 0 ||
+        index.size != GetLevelSize(info_.format, index.width, index.height)) {
+      return false;
+    }
+    levels_[i] = { index.width, index.height, data + index.offset, index.size };
+  }
+  return true;
+}
+
+std::vector<uint8_t> SerializeTextureFile(const TextureFileInfo& info,
+                                          const std::vector<TextureLevel>& levels) {
+  FileHeader header = {};
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kFileVersion;
+  header.format = static_cast<uint32_t>(info.format);
+  header.num_levels = static_cast<uint32_t>(levels.size());
+  header.options_key = info.options_key;
+  header.source_size = info.source_size;
+  header.source_mtime = info.source_mtime;
+  header.psnr = info.psnr;
+
+  // The data of the smallest level comes first.
+  std::vector<FileLevelIndex> indices(levels.size());
+  size_t offset = AlignLevelOffset(sizeof(header) + levels.size() * sizeof(FileLevelIndex));
+  for (size_t i = levels.size(); i-- > 0;) {
+    indices[i] = { levels[i].width, levels[i].height, offset, levels[i].size };
+    offset = AlignLevelOffset(offset + levels[i].size);
+  }
+
+  std::vector<uint8_t> buffer(offset, 0);
+  std::memcpy(buffer.data(), &header, sizeof(header));
+  std::memcpy(buffer.data() + sizeof(header), indices.data(),
+              indices.size() * sizeof(FileLevelIndex));
+  for (size_t i = 0; i < levels.size(); ++i) {
+    if (levels[i].size > 0) {
+      std::memcpy(buffer.data() + indices[i].offset, levels[i].data, levels[i].size);
+    }
+  }
+  return buffer;
+}
+
+bool WriteTextureFile(const std::string& path, const std::vector<uint8_t>& buffer) {
+  return WriteFileAtomically(path, buffer);
+}
+
+} // namespace utils
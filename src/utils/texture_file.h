@@ -0,0 +1,113 @@
+#ifndef UTILS_TEXTURE_FILE_H_
+#define UTILS_TEXTURE_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/mapped_file.h"
+#include "utils/texture_compression.h"
+
+namespace utils {
+
+// Native texture container (.robintex), in the spirit of KTX2: a fixed header, an index with one
+// entry per mip level, and the data of all the levels stored back to back. The levels are stored
+// smallest first so that a coarse version of the texture is at the start of the file, and every
+// level starts on a 16-byte boundary so that it can be handed to GL straight from the mapping.
+
+enum class TextureFormat {
+  kRGB8 = 0,
+  kRGBA8,
+  kBC1,
+  kBC3,
+  kBC7
+};
+
+TextureFormat ToTextureFormat(BlockFormat format);
+
+// Only for the block-compressed formats.
+BlockFormat ToBlockFormat(TextureFormat format);
+
+bool IsBlockCompressed(TextureFormat format);
+
+// Describes a whole texture file.
+struct TextureFileInfo {
+  TextureFormat format = TextureFormat::kRGB8;
+
+  // Not interpreted by the reader. Lets the producer of the file tell if it is stale, e.g. when
+  // the file is a cache of another file.
+  uint32_t options_key = 0;
+  uint64_t source_size = 0;
+  int64_t source_mtime = 0;
+
+  // PSNR of the block-compressed data against the source image, 0 for uncompressed textures.
+  double psnr = 0.0;
+};
+
+// One mip level, pointing into memory owned by someone else.
+struct TextureLevel {
+  uint32_t width = 0;
+  uint32_t height = 0;
+
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Levels of an uncompressed image, level 0 first. The levels point into |img|.
+std::vector<TextureLevel> GetTextureLevels(const Image& img);
+
+// Levels of a block-compressed image, level 0 first. The levels point into |img|.
+std::vector<TextureLevel> GetTextureLevels(const CompressedImage& img);
+
+// A texture file whose levels are read in place, without copies.
+class TextureFile {
+ public:
+  TextureFile(const TextureFile&) = delete;
+  TextureFile& operator=(const TextureFile&) = delete;
+
+  const TextureFileInfo& GetInfo() const { return info_; }
+
+  // Level 0 is the full-size image.
+  size_t GetNumLevels() const { return levels_.size(); }
+  const TextureLevel& GetLevel(size_t level) const { return levels_[level]; }
+
+  // True if the levels point into a memory-mapped file, false if they point into a buffer.
+  bool IsMapped() const { return file_ != nullptr; }
+
+  // Lets the OS drop the pages of a level of a mapped file from memory, e.g. once it has been
+  // uploaded. The level stays valid and is read back from the file if it is accessed again.
+  void DiscardLevel(size_t level) const;
+
+  // Memory-maps a texture file. Returns nullptr if the file can't be opened or isn't a valid
+  // texture file.
+  static std::unique_ptr<TextureFile> Open(const std::string& path);
+
+  // Takes over a buffer produced by SerializeTextureFile(). Returns nullptr if it isn't valid.
+  static std::unique_ptr<TextureFile> FromBuffer(std::vector<uint8_t> buffer);
+
+ private:
+  TextureFile() = default;
+
+  bool Parse(const uint8_t* data, size_t size);
+
+  TextureFileInfo info_;
+  std::vector<TextureLevel> levels_;
+
+  // Only one of them holds the data.
+  std::unique_ptr<MappedFile> file_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Lays out a texture file in memory. |levels| are given level 0 first.
+std::vector<uint8_t> SerializeTextureFile(const TextureFileInfo& info,
+                                          const std::vector<TextureLevel>& levels);
+
+// Writes a buffer produced by SerializeTextureFile(). The file is written under a temporary name
+// and then renamed, so readers never see a partially written file.
+bool WriteTextureFile(const std::string& path, const std::vector<uint8_t>& buffer);
+
+} // namespace utils
+
+#endif // UTILS_TEXTURE_FILE_H_
@@ -0,0 +1,474 @@
+#include "utils/texture_streamer.h"
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/parallel.h"
+#include "utils/texture_cache.h"
+#include "utils/texture_file.h"
+
+namespace utils {
+
+namespace {
+
+// The feedback of a frame is read back this many frames later at the earliest, by which time the
+// GPU is usually done with it.
+constexpr size_t kNumFeedbackBuffers = 3;
+
+constexpr uint32_t kNotSampled = 0xffffffff;
+
+// A level that was asked for stays wanted for this many frames after the last time it was asked
+// for. The shaders only write feedback for some of the pixels every frame, so a texture that covers
+// few pixels isn't seen in every frame.
+constexpr uint32_t kWantedLevelLifetime = 60;
+
+// Uploads |num_layers| consecutive layers of a level of the bound texture array, stored back to
+// back in |data|. |level| gives the size of one layer.
+void UploadLayers(TextureFormat format, GLint gl_level, const TextureLevel& level,
+                  uint32_t first_layer, uint32_t num_layers, const uint8_t* data) {
+  if (IsBlockCompressed(format)) {
+    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, gl_level, 0, 0, first_layer, level.width,
+                              level.height, num_layers, GetGlInternalFormat(format),
+                              level.size * num_layers, data);
+  } else {
+    GLenum gl_format = format == TextureFormat::kRGBA8 ? GL_RGBA : GL_RGB;
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, gl_level, 0, 0, first_layer, level.width, level.height,
+                    num_layers, gl_format, GL_UNSIGNED_BYTE, data);
+  }
+}
+
+} // namespace
+
+GLenum GetGlInternalFormat(TextureFormat format) {
+  switch (format) {
+    case TextureFormat::kRGB8:
+      return GL_SRGB8;
+    case TextureFormat::kRGBA8:
+      return GL_SRGB8_ALPHA8;
+    case TextureFormat::kBC1:
+      return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    case TextureFormat::kBC3:
+      return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+    case TextureFormat::kBC7:
+      return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+  }
+  return GL_SRGB8;
+}
+
+TextureStreamer::TextureStreamer(const std::vector<std::string>& image_paths,
+                                 const TextureStreamerOptions& options)
+    : options_(options), textures_(image_paths.size()), load_queue_(1) {
+  std::unique_ptr<TextureLoadQueue> queue = LoadTexturesAsync(image_paths, options.load_options);
+  while (std::optional<TextureLoadQueue::Result> result = queue->WaitForNext()) {
+    if (result->value != nullptr && result->value->GetNumLevels() > 0) {
+      textures_[result->index].file = std::move(result->value);
+    }
+  }
+  PackTextures(image_paths);
+
+  for (TextureArray& array : arrays_) {
+    // Nothing is resident yet, so all the levels from the first small enough one are uploaded.
+    uint32_t base_level = array.num_levels - 1;
+    while (base_level > 0) {
+      const TextureLevel& finer_level = GetLayerLevel(array, 0, base_level - 1);
+      if (std::max(finer_level.width, finer_level.height) > options_.resident_size) {
+        break;
+      }
+      --base_level;
+    }
+    array.base_level = array.num_levels;
+    array.min_base_level = base_level;
+    array.wanted_level = base_level;
+    for (size_t tex_idx : array.layers) {
+      textures_[tex_idx].wanted_level = base_level + textures_[tex_idx].level_offset;
+    }
+    SetBaseLevel(&array, base_level, nullptr);
+  }
+
+  feedback_.resize(textures_.size());
+  feedback_buffers_.resize(kNumFeedbackBuffers);
+  for (FeedbackBuffer& buffer : feedback_buffers_) {
+    glGenBuffers(1, &buffer.gl_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.gl_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(1, textures_.size()) * sizeof(uint32_t),
+                 nullptr, GL_DYNAMIC_READ);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+TextureStreamer::~TextureStreamer() {
+  for (FeedbackBuffer& buffer : feedback_buffers_) {
+    if (buffer.fence != nullptr) {
+      glDeleteSync(buffer.fence);
+    }
+    glDeleteBuffers(1, &buffer.gl_buffer);
+  }
+  for (TextureArray& array : arrays_) {
+    if (array.gl_texture != 0) {
+      glDeleteTextures(1, &array.gl_texture);
+    }
+  }
+}
+
+void TextureStreamer::BeginFrame(GLuint binding) {
+  FeedbackBuffer& buffer = feedback_buffers_[frame_index_ % kNumFeedbackBuffers];
+  if (buffer.fence != nullptr) {
+    // The GPU is still behind; the feedback of that frame is dropped.
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.gl_buffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                    &kNotSampled);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer.gl_buffer);
+}
+
+void TextureStreamer::EndFrame() {
+  FeedbackBuffer& buffer = feedback_buffers_[frame_index_ % kNumFeedbackBuffers];
+  buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  buffer.frame_index = frame_index_;
+
+  ReadFeedback();
+  UploadLoadedLevels();
+  StartLoads();
+
+  ++frame_index_;
+}
+
+void TextureStreamer::PackTextures(const std::vector<std::string>& image_paths) {
+  // Textures that are too large are resized by using one of their mips as level 0.
+  std::vector<size_t> loaded;
+  for (size_t tex_idx = 0; tex_idx < textures_.size(); ++tex_idx) {
+    StreamedTexture& tex = textures_[tex_idx];
+    if (tex.file == nullptr) {
+      continue;
+    }
+    uint32_t num_levels = static_cast<uint32_t>(tex.file->GetNumLevels());
+    while (tex.level_offset + 1 < num_levels) {
+      const TextureLevel& level = tex.file->GetLevel(tex.level_offset);
+      if (std::max(level.width, level.height) <= options_.max_size) {
+        break;
+      }
+      ++tex.level_offset;
+    }
+    loaded.push_back(tex_idx);
+  }
+
+  // Textures with the same format and size share an array.
+  auto get_format = [this](size_t tex_idx) { return textures_[tex_idx].file->GetInfo().format; };
+  auto get_level = [this](size_t tex_idx, uint32_t level) -> const TextureLevel& {
+    const StreamedTexture& tex = textures_[tex_idx];
+    return tex.file->GetLevel(tex.level_offset + level);
+  };
+  std::vector<std::vector<size_t>> groups;
+  for (size_t tex_idx : loaded) {
+    const TextureLevel& level = get_level(tex_idx, 0);
+    auto it = std::find_if(groups.begin(), groups.end(), [&](const std::vector<size_t>& group) {
+      const TextureLevel& group_level = get_level(group[0], 0);
+      return get_format(group[0]) == get_format(tex_idx) &&
+             group_level.width == level.width && group_level.height == level.height;
+    });
+    if (it != groups.end()) {
+      it->push_back(tex_idx);
+    } else {
+      groups.push_back({ tex_idx });
+    }
+  }
+
+  // Returns the number of levels a group has to drop to fit into |target|, or 0 if it can't.
+  auto get_fold_levels = [&](const std::vector<size_t>& group, const std::vector<size_t>& target) {
+    if (get_format(group[0]) != get_format(target[0])) {
+      return uint32_t(0);
+    }
+    const TextureLevel& target_level = get_level(target[0], 0);
+    const StreamedTexture& tex = textures_[group[0]];
+    for (uint32_t level = tex.level_offset + 1; level < tex.file->GetNumLevels(); ++level) {
+      const TextureLevel& level_data = tex.file->GetLevel(level);
+      if (level_data.width == target_level.width && level_data.height == target_level.height) {
+        return level - tex.level_offset;
+      }
+    }
+    return uint32_t(0);
+  };
+
+  // Past the limit, the smallest groups are resized into the largest group they fit in, and
+  // dropped if there is none.
+  while (groups.size() > options_.max_arrays) {
+    auto smallest = std::min_element(groups.begin(), groups.end(),
+                                     [](const std::vector<size_t>& a,
+                                        const std::vector<size_t>& b) {
+                                       return a.size() < b.size();
+                                     });
+    std::vector<size_t> group = std::move(*smallest);
+    groups.erase(smallest);
+
+    std::vector<size_t>* target = nullptr;
+    uint32_t target_fold_levels = 0;
+    for (std::vector<size_t>& candidate : groups) {
+      uint32_t fold_levels = get_fold_levels(group, candidate);
+      if (fold_levels != 0 && (target == nullptr || fold_levels < target_fold_levels)) {
+        target = &candidate;
+        target_fold_levels = fold_levels;
+      }
+    }
+
+    for (size_t tex_idx : group) {
+      if (target != nullptr) {
+        textures_[tex_idx].level_offset += target_fold_levels;
+        target->push_back(tex_idx);
+      } else {
+        std::cerr << "Too many texture sizes, could not fit texture: " << image_paths[tex_idx] <<
+            std::endl;
+        textures_[tex_idx].file.reset();
+      }
+    }
+  }
+
+  for (std::vector<size_t>& group : groups) {
+    TextureArray array;
+    array.format = get_format(group[0]);
+    array.num_levels = std::numeric_limits<uint32_t>::max();
+    for (size_t tex_idx : group) {
+      StreamedTexture& tex = textures_[tex_idx];
+      tex.array_idx = arrays_.size();
+      tex.layer = static_cast<uint32_t>(array.layers.size());
+      array.layers.push_back(tex_idx);
+      array.num_levels = std::min(array.num_levels,
+                                  static_cast<uint32_t>(tex.file->GetNumLevels()) -
+                                  tex.level_offset);
+    }
+    arrays_.push_back(std::move(array));
+  }
+}
+
+const TextureLevel& TextureStreamer::GetLayerLevel(const TextureArray& array, size_t layer,
+                                                   uint32_t level) const {
+  const StreamedTexture& tex = textures_[array.layers[layer]];
+  return tex.file->GetLevel(tex.level_offset + level);
+}
+
+size_t TextureStreamer::GetLevelSize(const TextureArray& array, uint32_t level) const {
+  return GetLayerLevel(array, 0, level).size * array.layers.size();
+}
+
+void TextureStreamer::SetBaseLevel(TextureArray* array, uint32_t base_level,
+                                   const uint8_t* new_level_data) {
+  uint32_t num_layers = static_cast<uint32_t>(array->layers.size());
+  const TextureLevel& base = GetLayerLevel(*array, 0, base_level);
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, array->num_levels - base_level,
+                 GetGlInternalFormat(array->format), base.width, base.height, num_layers);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  // Levels that are resident in both textures are copied on the GPU, all layers at once.
+  uint32_t first_shared_level = std::max(base_level, array->base_level);
+  for (uint32_t level = first_shared_level; level < array->num_levels; ++level) {
+    const TextureLevel& level_data = GetLayerLevel(*array, 0, level);
+    glCopyImageSubData(array->gl_texture, GL_TEXTURE_2D_ARRAY, level - array->base_level, 0, 0, 0,
+                       texture, GL_TEXTURE_2D_ARRAY, level - base_level, 0, 0, 0,
+                       level_data.width, level_data.height, num_layers);
+  }
+
+  // The rows of uncompressed RGB levels aren't 4-byte aligned.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (uint32_t level = base_level; level < first_shared_level; ++level) {
+    if (level == base_level && new_level_data != nullptr) {
+      UploadLayers(array->format, level - base_level, GetLayerLevel(*array, 0, level), 0,
+                   num_layers, new_level_data);
+      continue;
+    }
+    // Every layer comes from a different file.
+    for (uint32_t layer = 0; layer < num_layers; ++layer) {
+      const TextureLevel& level_data = GetLayerLevel(*array, layer, level);
+      UploadLayers(array->format, level - base_level, level_data, layer, 1, level_data.data);
+      const StreamedTexture& tex = textures_[array->layers[layer]];
+      tex.file->DiscardLevel(tex.level_offset + level);
+    }
+  }
+
+  for (uint32_t level = base_level; level < array->base_level && level < array->num_levels;
+       ++level) {
+    vram_usage_ += GetLevelSize(*array, level);
+  }
+  for (uint32_t level = array->base_level; level < base_level; ++level) {
+    vram_usage_ -= GetLevelSize(*array, level);
+  }
+
+  if (array->gl_texture != 0) {
+    glDeleteTextures(1, &array->gl_texture);
+  }
+  array->gl_texture = texture;
+  array->base_level = base_level;
+}
+
+void TextureStreamer::ReadFeedback() {
+  bool has_feedback = false;
+
+  // Goes from the oldest frame to the newest, so that the newest feedback wins.
+  for (size_t i = 1; i <= kNumFeedbackBuffers; ++i) {
+    FeedbackBuffer& buffer = feedback_buffers_[(frame_index_ + i) % kNumFeedbackBuffers];
+    if (buffer.fence == nullptr) {
+      continue;
+    }
+    GLenum status = glClientWaitSync(buffer.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      continue;
+    }
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+    has_feedback = true;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.gl_buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, feedback_.size() * sizeof(uint32_t),
+                       feedback_.data());
+
+    for (size_t tex_idx = 0; tex_idx < textures_.size(); ++tex_idx) {
+      StreamedTexture& tex = textures_[tex_idx];
+      if (tex.file == nullptr) {
+        continue;
+      }
+      uint32_t min_level = arrays_[tex.array_idx].min_base_level + tex.level_offset;
+      bool expired = buffer.frame_index - tex.wanted_frame > kWantedLevelLifetime;
+      if (feedback_[tex_idx] == kNotSampled) {
+        if (expired) {
+          tex.wanted_level = min_level;
+        }
+        continue;
+      }
+      uint32_t level = std::min(feedback_[tex_idx], min_level);
+      if (level <= tex.wanted_level || expired) {
+        tex.wanted_level = level;
+        tex.wanted_frame = buffer.frame_index;
+      }
+    }
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  if (!has_feedback) {
+    return;
+  }
+  // An array needs the finest level that any of its layers needs. Levels past the size of a
+  // resized texture can't be streamed in.
+  for (TextureArray& array : arrays_) {
+    array.wanted_level = array.min_base_level;
+    array.wanted_frame = 0;
+    for (size_t tex_idx : array.layers) {
+      const StreamedTexture& tex = textures_[tex_idx];
+      uint32_t level = tex.wanted_level > tex.level_offset ? tex.wanted_level - tex.level_offset :
+                                                             0;
+      array.wanted_level = std::min(array.wanted_level, level);
+      array.wanted_frame = std::max(array.wanted_frame, tex.wanted_frame);
+    }
+  }
+}
+
+void TextureStreamer::UploadLoadedLevels() {
+  while (std::optional<CompletionQueue<LoadedLevel>::Result> result = load_queue_.TryGetNext()) {
+    LoadedLevel& loaded = result->value;
+    TextureArray& array = arrays_[loaded.array_idx];
+    size_t size = GetLevelSize(array, loaded.level);
+    array.load_pending = false;
+    pending_load_size_ -= size;
+    --num_pending_loads_;
+
+    // The array may have lost levels while the load was in flight.
+    if (loaded.level + 1 != array.base_level || !MakeRoom(size)) {
+      continue;
+    }
+    SetBaseLevel(&array, loaded.level, loaded.data.data());
+  }
+}
+
+bool TextureStreamer::MakeRoom(size_t size) {
+  while (vram_usage_ + size > options_.vram_budget) {
+    // Evicts from the array with the most detail beyond what it needs, and among those, from the
+    // one that was needed longest ago.
+    TextureArray* victim = nullptr;
+    for (TextureArray& array : arrays_) {
+      if (array.base_level >= array.wanted_level) {
+        continue;
+      }
+      if (victim == nullptr ||
+          array.wanted_level - array.base_level > victim->wanted_level - victim->base_level ||
+          (array.wanted_level - array.base_level == victim->wanted_level - victim->base_level &&
+           array.wanted_frame < victim->wanted_frame)) {
+        victim = &array;
+      }
+    }
+    if (victim == nullptr) {
+      return false;
+    }
+    SetBaseLevel(victim, victim->base_level + 1, nullptr);
+  }
+  return true;
+}
+
+void TextureStreamer::StartLoads() {
+  // The arrays that are missing the most levels go first.
+  std::vector<size_t> candidates;
+  for (size_t array_idx = 0; array_idx < arrays_.size(); ++array_idx) {
+    const TextureArray& array = arrays_[array_idx];
+    if (!array.load_pending && array.base_level > array.wanted_level) {
+      candidates.push_back(array_idx);
+    }
+  }
+  std::stable_sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) {
+    return arrays_[a].base_level - arrays_[a].wanted_level >
+           arrays_[b].base_level - arrays_[b].wanted_level;
+  });
+
+  for (size_t array_idx : candidates) {
+    if (num_pending_loads_ >= options_.max_pending_loads) {
+      break;
+    }
+    TextureArray& array = arrays_[array_idx];
+    uint32_t level = array.base_level - 1;
+    size_t size = GetLevelSize(array, level);
+    if (!MakeRoom(pending_load_size_ + size)) {
+      continue;
+    }
+
+    std::vector<std::pair<std::shared_ptr<TextureFile>, uint32_t>> layer_levels;
+    for (size_t tex_idx : array.layers) {
+      const StreamedTexture& tex = textures_[tex_idx];
+      layer_levels.emplace_back(tex.file, tex.level_offset + level);
+    }
+
+    array.load_pending = true;
+    pending_load_size_ += size;
+    ++num_pending_loads_;
+    load_queue_.Submit([layer_levels = std::move(layer_levels), array_idx, level, size]() {
+      // Copying the level out of the mappings reads it from the disk on the loader thread. The
+      // layers are laid out back to back so that they can be uploaded in a single call.
+      LoadedLevel loaded;
+      loaded.array_idx = array_idx;
+      loaded.level = level;
+      loaded.data.reserve(size);
+      for (const auto& [file, file_level] : layer_levels) {
+        const TextureLevel& level_data = file->GetLevel(file_level);
+        loaded.data.insert(loaded.data.end(), level_data.data, level_data.data + level_data.size);
+        file->DiscardLevel(file_level);
+      }
+      return loaded;
+    });
+  }
+}
+
+} // namespace utils
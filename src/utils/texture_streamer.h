@@ -0,0 +1,203 @@
+#ifndef UTILS_TEXTURE_STREAMER_H_
+#define UTILS_TEXTURE_STREAMER_H_
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/parallel.h"
+#include "utils/texture_cache.h"
+#include "utils/texture_file.h"
+
+namespace utils {
+
+// The sRGB internal format for |format|. The textures hold sRGB colors, so the sampler decodes
+// them to linear, before filtering.
+GLenum GetGlInternalFormat(TextureFormat format);
+
+struct TextureStreamerOptions {
+  TextureLoadOptions load_options;
+
+  // Textures larger than this (the larger of width and height) use one of their mips as their
+  // full-size level.
+  uint32_t max_size = 2048;
+
+  // Upper bound on the number of texture arrays, e.g. the number of sampler units a shader can
+  // use for them. Groups past it are folded into arrays of the same format with a smaller size.
+  size_t max_arrays = 16;
+
+  // Levels up to this size (the larger of width and height) are uploaded at startup and stay
+  // resident. Finer levels are streamed in when the feedback asks for them.
+  uint32_t resident_size = 64;
+
+  // Upper bound on the GPU memory of the streamed levels, in bytes. The levels that are always
+  // resident count towards it but are never evicted.
+  size_t vram_budget = size_t(256) << 20;
+
+  // Number of levels that can be loading in the background at the same time.
+  size_t max_pending_loads = 8;
+};
+
+// Keeps the textures of a scene on the GPU with only the mip levels that are actually needed.
+//
+// Textures with the same format and size are packed into the layers of a GL_TEXTURE_2D_ARRAY, so
+// that a shader can reach all of them through a few samplers, without per-draw binds. Textures
+// that are larger than the other textures of their format can be resized into a smaller array by
+// dropping their finest levels.
+//
+// Every frame, the shaders that sample the textures write the finest mip level they need into a
+// feedback buffer (see BeginFrame()). The feedback is read back a couple of frames later, without
+// stalling. Finer levels are then read from the texture files on a background thread and
+// uploaded, and levels that are finer than needed are evicted when the budget runs out. The
+// levels of an array are shared by all its layers, so an array streams in the finest level that
+// any of its textures needs.
+//
+// Changing the resident levels of an array recreates its GL texture, so GetGlArray() has to be
+// called again after every EndFrame().
+class TextureStreamer {
+ public:
+  // Loads the textures at |image_paths| through the texture cache, packs them into arrays and
+  // uploads their coarse levels. Requires a current GL context.
+  TextureStreamer(const std::vector<std::string>& image_paths,
+                  const TextureStreamerOptions& options);
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  size_t GetNumTextures() const { return textures_.size(); }
+
+  // False if the image couldn't be loaded or didn't fit in any array.
+  bool IsLoaded(size_t tex_idx) const { return textures_[tex_idx].file != nullptr; }
+
+  // Array and layer of a loaded texture.
+  size_t GetArrayIndex(size_t tex_idx) const { return textures_[tex_idx].array_idx; }
+  uint32_t GetLayer(size_t tex_idx) const { return textures_[tex_idx].layer; }
+
+  // Size of the full texture, before any resizing. The feedback is in terms of its levels.
+  uint32_t GetWidth(size_t tex_idx) const { return textures_[tex_idx].file->GetLevel(0).width; }
+  uint32_t GetHeight(size_t tex_idx) const {
+    return textures_[tex_idx].file->GetLevel(0).height;
+  }
+
+  // File of a loaded texture, with all of its levels.
+  const TextureFile& GetFile(size_t tex_idx) const { return *textures_[tex_idx].file; }
+
+  size_t GetNumArrays() const { return arrays_.size(); }
+  GLuint GetGlArray(size_t array_idx) const { return arrays_[array_idx].gl_texture; }
+
+  // GPU memory taken by all the resident levels, in bytes.
+  size_t GetVramUsage() const { return vram_usage_; }
+
+  // Increases by one every frame. Shaders can use it to spread the feedback writes over frames.
+  uint32_t GetFrameIndex() const { return frame_index_; }
+
+  // Clears the feedback buffer of this frame and binds it to the shader storage buffer binding
+  // point |binding|. The shaders write the finest level they need of texture i with
+  // atomicMin(levels[i], level) into a uint array. Untouched entries stay at 0xffffffff.
+  void BeginFrame(GLuint binding);
+
+  // Must be called after the draws that write the feedback. Reads the feedback of an earlier
+  // frame if the GPU is done with it, uploads the levels that have finished loading, and starts
+  // new loads and evictions.
+  void EndFrame();
+
+ private:
+  struct StreamedTexture {
+    std::shared_ptr<TextureFile> file;
+    size_t array_idx = 0;
+    uint32_t layer = 0;
+
+    // Level of the file held by level 0 of the array. Non-zero for resized textures.
+    uint32_t level_offset = 0;
+
+    // Finest level of the file asked for by the recent feedback, and the frame it was last asked
+    // for.
+    uint32_t wanted_level = 0;
+    uint32_t wanted_frame = 0;
+  };
+
+  struct TextureArray {
+    GLuint gl_texture = 0;
+    TextureFormat format = TextureFormat::kRGB8;
+    uint32_t num_levels = 0;
+
+    // Indices of the textures in the layers.
+    std::vector<size_t> layers;
+
+    // Level of the array held by level 0 of the GL texture. Coarser levels are all resident.
+    uint32_t base_level = 0;
+
+    // Never evicted below this level.
+    uint32_t min_base_level = 0;
+
+    // Finest level wanted by any of the layers.
+    uint32_t wanted_level = 0;
+    uint32_t wanted_frame = 0;
+
+    bool load_pending = false;
+  };
+
+  // Level of all the layers of an array read from the files in the background, layer after
+  // layer.
+  struct LoadedLevel {
+    size_t array_idx;
+    uint32_t level;
+    std::vector<uint8_t> data;
+  };
+
+  struct FeedbackBuffer {
+    GLuint gl_buffer = 0;
+    GLsync fence = nullptr;
+    uint32_t frame_index = 0;
+  };
+
+  // Groups the loaded textures into arrays. Textures that fit in none are unloaded.
+  void PackTextures(const std::vector<std::string>& image_paths);
+
+  // Level |level| of the array in layer |layer|.
+  const TextureLevel& GetLayerLevel(const TextureArray& array, size_t layer,
+                                    uint32_t level) const;
+
+  // Size of a level of an array, over all of its layers.
+  size_t GetLevelSize(const TextureArray& array, uint32_t level) const;
+
+  // Recreates the GL texture of |array| with |base_level| as its level 0. Levels shared with the
+  // old texture are copied on the GPU. If the new texture has one more level, its data is taken
+  // from |new_level_data|, otherwise from the texture files.
+  void SetBaseLevel(TextureArray* array, uint32_t base_level, const uint8_t* new_level_data);
+
+  void ReadFeedback();
+  void UploadLoadedLevels();
+
+  // Evicts levels that are finer than needed until at least |size| more bytes fit in the budget.
+  // Returns false if that isn't possible.
+  bool MakeRoom(size_t size);
+
+  void StartLoads();
+
+  TextureStreamerOptions options_;
+  std::vector<StreamedTexture> textures_;
+  std::vector<TextureArray> arrays_;
+  size_t vram_usage_ = 0;
+  size_t pending_load_size_ = 0;
+  size_t num_pending_loads_ = 0;
+  uint32_t frame_index_ = 0;
+
+  std::vector<FeedbackBuffer> feedback_buffers_;
+  std::vector<uint32_t> feedback_;
+
+  // Reads the levels out of the texture files. This is bound by the disk, so it runs on a single
+  // thread. Declared last so that the loads in flight finish before the rest is destroyed.
+  CompletionQueue<LoadedLevel> load_queue_;
+};
+
+} // namespace utils
+
+#endif // UTILS_TEXTURE_STREAMER_H_
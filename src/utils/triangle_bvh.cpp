@@ -0,0 +1,275 @@
+#include "utils/triangle_bvh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "utils/bounds.h"
+#include "utils/model.h"
+
+namespace utils {
+
+namespace {
+
+// Nodes with this many triangles or fewer become leaves.
+constexpr uint32_t kMaxLeafTriangles = 4;
+
+// Number of buckets along the split axis in which the split positions are evaluated.
+constexpr int kNumSahBins = 16;
+
+// Nodes this deep become leaves whatever their size, which bounds the traversal stack.
+constexpr int kMaxDepth = 64;
+
+constexpr float kNoHit = std::numeric_limits<float>::infinity();
+
+float GetSurfaceArea(const Aabb& aabb) {
+  if (aabb.IsEmpty()) {
+    return 0.f;
+  }
+  glm::vec3 size = aabb.GetSize();
+  return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// Returns the distance at which a ray enters |aabb|, or kNoHit if it misses it within
+// [t_min, t_max]. |inv_dir| is 1 / the direction of the ray.
+float IntersectAabb(const Aabb& aabb, const glm::vec3& origin, const glm::vec3& inv_dir,
+                    float t_min, float t_max) {
+  glm::vec3 t0 = (aabb.min - origin) * inv_dir;
+  glm::vec3 t1 = (aabb.max - origin) * inv_dir;
+  glm::vec3 t_near = glm::min(t0, t1);
+  glm::vec3 t_far = glm::max(t0, t1);
+  float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, t_min));
+  float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+  return enter <= exit ? enter : kNoHit;
+}
+
+} // namespace
+
+TriangleBvh::TriangleBvh(const Model& model) {
+  std::vector<Aabb> triangle_bounds;
+  std::vector<Triangle> triangles;
+  for (int mesh_idx = 0; mesh_idx < model.GetNumMeshes(); ++mesh_idx) {
+    const Mesh& mesh = model.GetMeshByIndex(mesh_idx);
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+      const glm::vec3& p0 = mesh.positions[mesh.indices[i]];
+      const glm::vec3& p1 = mesh.positions[mesh.indices[i + 1]];
+      const glm::vec3& p2 = mesh.positions[mesh.indices[i + 2]];
+
+      // Triangles without any area can't be hit.
+      glm::vec3 edge1 = p1 - p0;
+      glm::vec3 edge2 = p2 - p0;
+      if (glm::dot(glm::cross(edge1, edge2), glm::cross(edge1, edge2)) == 0.f) {
+        continue;
+      }
+      triangles.push_back({ p0, edge1, edge2, static_cast<uint32_t>(mesh_idx),
+                            static_cast<uint32_t>(i / 3) });
+      triangle_bounds.push_back({ glm::min(p0, glm::min(p1, p2)),
+                                  glm::max(p0, glm::max(p1, p2)) });
+    }
+  }
+  if (triangles.empty()) {
+    return;
+  }
+
+  std::vector<uint32_t> order(triangles.size());
+  for (uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  nodes_.reserve(2 * triangles.size() / kMaxLeafTriangles);
+  BuildNode(triangle_bounds, &order, 0, static_cast<uint32_t>(order.size()), 0);
+
+  triangles_.reserve(triangles.size());
+  for (uint32_t triangle_idx : order) {
+    triangles_.push_back(triangles[triangle_idx]);
+  }
+}
+
+uint32_t TriangleBvh::BuildNode(const std::vector<Aabb>& triangle_bounds,
+                                std::vector<uint32_t>* order, uint32_t first, uint32_t count,
+                                int depth) {
+  uint32_t node_idx = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back({ Aabb(), first, count, 0 });
+
+  Aabb bounds;
+  Aabb centroid_bounds;
+  for (uint32_t i = first; i < first + count; ++i) {
+    const Aabb& triangle_aabb = triangle_bounds[(*order)[i]];
+    bounds.Merge(triangle_aabb);
+    glm::vec3 center = triangle_aabb.GetCenter();
+    centroid_bounds.Merge({ center, center });
+  }
+  nodes_[node_idx].bounds = bounds;
+  if (count <= kMaxLeafTriangles || depth + 1 >= kMaxDepth) {
+    return node_idx;
+  }
+
+  // Splits along the longest axis of the triangle centers.
+  glm::vec3 extent = centroid_bounds.GetSize();
+  int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+  if (!(extent[axis] > 0.f)) {
+    return node_idx;
+  }
+  auto get_bin = [&](uint32_t triangle_idx) {
+    float t = (triangle_bounds[triangle_idx].GetCenter()[axis] - centroid_bounds.min[axis]) /
+              extent[axis];
+    return std::min(static_cast<int>(t * kNumSahBins), kNumSahBins - 1);
+  };
+
+  Aabb bin_bounds[kNumSahBins];
+  uint32_t bin_counts[kNumSahBins] = {};
+  for (uint32_t i = first; i < first + count; ++i) {
+    int bin = get_bin((*order)[i]);
+    bin_bounds[bin].Merge(triangle_bounds[(*order)[i]]);
+    ++bin_counts[bin];
+  }
+
+  // Cost of splitting after each bin, as the area-weighted number of triangles on both sides.
+  float left_costs[kNumSahBins - 1];
+  Aabb left_bounds;
+  uint32_t left_count = 0;
+  for (int bin = 0; bin < kNumSahBins - 1; ++bin) {
+    left_bounds.Merge(bin_bounds[bin]);
+    left_count += bin_counts[bin];
+    left_costs[bin] = GetSurfaceArea(left_bounds) * left_count;
+  }
+  int best_split = -1;
+  float best_cost = GetSurfaceArea(bounds) * count;
+  Aabb right_bounds;
+  uint32_t right_count = 0;
+  for (int bin = kNumSahBins - 1; bin > 0; --bin) {
+    right_bounds.Merge(bin_bounds[bin]);
+    right_count += bin_counts[bin];
+    float cost = left_costs[bin - 1] + GetSurfaceArea(right_bounds) * right_count;
+    if (right_count < count && cost < best_cost) {
+      best_cost = cost;
+      best_split = bin;
+    }
+  }
+
+  // Falls back to halving the triangles along the axis when no split beats a single leaf.
+  uint32_t* begin = order->data() + first;
+  uint32_t* end = begin + count;
+  uint32_t* middle;
+  if (best_split != -1) {
+    middle = std::partition(begin, end, [&](uint32_t triangle_idx) {
+      return get_bin(triangle_idx) < best_split;
+    });
+  } else {
+    middle = begin + count / 2;
+    std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+      return triangle_bounds[a].GetCenter()[axis] < triangle_bounds[b].GetCenter()[axis];
+    });
+  }
+  uint32_t left_size = static_cast<uint32_t>(middle - begin);
+  if (left_size == 0 || left_size == count) {
+    return node_idx;
+  }
+
+  BuildNode(triangle_bounds, order, first, left_size, depth + 1);
+  uint32_t right_child =
+      BuildNode(triangle_bounds, order, first + left_size, count - left_size, depth + 1);
+  nodes_[node_idx].right_child = right_child;
+  return node_idx;
+}
+
+template<bool kAnyHit>
+std::optional<RayHit> TriangleBvh::Traverse(const Ray& ray) const {
+  if (nodes_.empty()) {
+    return std::nullopt;
+  }
+  // Zero components give infinities, which the slab test handles.
+  const glm::vec3 inv_dir = 1.f / ray.dir;
+  float t_max = ray.t_max;
+  if (IntersectAabb(nodes_[0].bounds, ray.origin, inv_dir, ray.t_min, t_max) == kNoHit) {
+    return std::nullopt;
+  }
+
+  // Far children waiting to be visited, with the distance at which the ray enters them, so that
+  // they can be skipped once a closer hit has been found.
+  struct StackEntry {
+    uint32_t node_idx;
+    float t;
+  };
+  StackEntry stack[kMaxDepth];
+  int stack_size = 0;
+
+  std::optional<RayHit> closest;
+  uint32_t node_idx = 0;
+  while (true) {
+    const Node& node = nodes_[node_idx];
+    if (node.right_child == 0) {
+      // Moller-Trumbore.
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        const Triangle& tri = triangles_[i];
+        glm::vec3 p = glm::cross(ray.dir, tri.edge2);
+        float det = glm::dot(tri.edge1, p);
+        if (det == 0.f) {
+          continue;
+        }
+        float inv_det = 1.f / det;
+        glm::vec3 s = ray.origin - tri.v0;
+        float u = glm::dot(s, p) * inv_det;
+        if (u < 0.f || u > 1.f) {
+          continue;
+        }
+        glm::vec3 q = glm::cross(s, tri.edge1);
+        float v = glm::dot(ray.dir, q) * inv_det;
+        if (v < 0.f || u + v > 1.f) {
+          continue;
+        }
+        float t = glm::dot(tri.edge2, q) * inv_det;
+        if (t < ray.t_min || t > t_max) {
+          continue;
+        }
+        closest = RayHit{ t, tri.mesh_idx, tri.triangle_idx, u, v };
+        if (kAnyHit) {
+          return closest;
+        }
+        t_max = t;
+      }
+    } else {
+      // Visits the closer child first, so that its hits let the other one be skipped.
+      uint32_t near_idx = node_idx + 1;
+      uint32_t far_idx = node.right_child;
+      float t_near = IntersectAabb(nodes_[near_idx].bounds, ray.origin, inv_dir, ray.t_min, t_max);
+      float t_far = IntersectAabb(nodes_[far_idx].bounds, ray.origin, inv_dir, ray.t_min, t_max);
+      if (t_far < t_near) {
+        std::swap(near_idx, far_idx);
+        std::swap(t_near, t_far);
+      }
+      if (t_near != kNoHit) {
+        if (t_far != kNoHit) {
+          stack[stack_size++] = { far_idx, t_far };
+        }
+        node_idx = near_idx;
+        continue;
+      }
+    }
+
+    // Pops the next child that the ray can still reach before the closest hit.
+    do {
+      if (stack_size == 0) {
+        return closest;
+      }
+      --stack_size;
+    } while (stack[stack_size].t > t_max);
+    node_idx = stack[stack_size].node_idx;
+  }
+}
+
+std::optional<RayHit> TriangleBvh::Intersect(const Ray& ray) const {
+  return Traverse<false>(ray);
+}
+
+bool TriangleBvh::IsOccluded(const Ray& ray) const {
+  return Traverse<true>(ray).has_value();
+}
+
+} // namespace utils
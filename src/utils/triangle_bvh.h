@@ -0,0 +1,96 @@
+#ifndef UTILS_TRIANGLE_BVH_H_
+#define UTILS_TRIANGLE_BVH_H_
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "utils/bounds.h"
+
+namespace utils {
+
+class Model;
+
+struct Ray {
+  glm::vec3 origin;
+
+  // Doesn't need to be normalized. Hit distances are in units of its length.
+  glm::vec3 dir;
+
+  float t_min = 0.f;
+  float t_max = std::numeric_limits<float>::max();
+};
+
+struct RayHit {
+  float t;
+
+  // Mesh of the model, and triangle of the index list of the mesh.
+  uint32_t mesh_idx;
+  uint32_t triangle_idx;
+
+  // Barycentric coordinates of the hit point on the second and third vertex of the triangle.
+  float u;
+  float v;
+};
+
+// Bounding volume hierarchy over the triangles of all the meshes of a model, for ray tracing on
+// the CPU, e.g. to bake lighting.
+//
+// The tree is built once with the surface area heuristic, from the full-detail triangles. Queries
+// only read the tree, so any number of threads can trace rays at the same time.
+class TriangleBvh {
+ public:
+  explicit TriangleBvh(const Model& model);
+
+  TriangleBvh(const TriangleBvh&) = delete;
+  TriangleBvh& operator=(const TriangleBvh&) = delete;
+
+  size_t GetNumTriangles() const { return triangles_.size(); }
+  size_t GetNumNodes() const { return nodes_.size(); }
+
+  // Returns the closest hit of |ray| within [t_min, t_max], or std::nullopt if it hits nothing.
+  // Triangles are hit from both sides.
+  std::optional<RayHit> Intersect(const Ray& ray) const;
+
+  // Returns true if |ray| hits anything within [t_min, t_max]. Cheaper than Intersect(), since it
+  // stops at the first hit found.
+  bool IsOccluded(const Ray& ray) const;
+
+ private:
+  // Same layout as the nodes of MeshBvh: interior nodes have their left child right after them,
+  // and cover the same range of |triangles_| as their two children together.
+  struct Node {
+    Aabb bounds;
+    uint32_t first;
+    uint32_t count;
+    uint32_t right_child; // 0 for leaves
+  };
+
+  // Triangle in the form that the intersection test reads: one vertex and the two edges from it.
+  struct Triangle {
+    glm::vec3 v0;
+    glm::vec3 edge1;
+    glm::vec3 edge2;
+    uint32_t mesh_idx;
+    uint32_t triangle_idx;
+  };
+
+  uint32_t BuildNode(const std::vector<Aabb>& triangle_bounds, std::vector<uint32_t>* order,
+                     uint32_t first, uint32_t count, int depth);
+
+  template<bool kAnyHit>
+  std::optional<RayHit> Traverse(const Ray& ray) const;
+
+  std::vector<Node> nodes_;
+
+  // In the order of the leaves of the tree.
+  std::vector<Triangle> triangles_;
+};
+
+} // namespace utils
+
+#endif // UTILS_TRIANGLE_BVH_H_
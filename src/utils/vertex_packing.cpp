@@ -0,0 +1,211 @@
+#include "utils/vertex_packing.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace utils {
+
+namespace {
+
+int16_t FloatToSnorm16(float value) {
+  return static_cast<int16_t>(std::round(std::clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+uint16_t FloatToUnorm16(float value) {
+  return static_cast<uint16_t>(std::round(std::clamp(value, 0.f, 1.f) * 65535.f));
+}
+
+// Picks the snorm16 encoding of |normal| that decodes closest to it, out of the four neighbouring
+// grid points around the rounded-down encoding.
+void EncodeNormal(const glm::vec3& normal, int16_t out[2]) {
+  glm::vec2 encoded = EncodeOctahedral(normal);
+
+  glm::vec2 base = glm::floor(glm::clamp(encoded, -1.f, 1.f) * 32767.f);
+  float best_error = std::numeric_limits<float>::max();
+  for (int i = 0; i < 4; ++i) {
+    glm::vec2 candidate = 
+        glm::clamp(base + glm::vec2(i & 1, i >> 1), -32767.f, 32767.f);
+    glm::vec3 decoded = DecodeOctahedral(candidate / 32767.f);
+    float error = glm::dot(decoded - normal, decoded - normal);
+    if (error < best_error) {
+      best_error = error;
+      out[0] = static_cast<int16_t>(candidate.x);
+      out[1] = static_cast<int16_t>(candidate.y);
+    }
+  }
+}
+
+template <typename Vertex>
+void FillCommonAttribs(const Mesh& mesh, size_t i, Vertex* vert) {
+  EncodeNormal(mesh.normals[i], vert->normal);
+
+  glm::vec2 texcoord = mesh.texcoords.empty() ? glm::vec2(0.f) : mesh.texcoords[i];
+  vert->texcoord[0] = FloatToHalf(texcoord.s);
+  vert->texcoord[1] = FloatToHalf(texcoord.t);
+
+  vert->material_id = static_cast<int16_t>(mesh.material_ids[i]);
+  vert->padding = 0;
+}
+
+} // namespace
+
+size_t GetPackedVertexSize(VertexFormat format) {
+  switch (format) {
+    case VertexFormat::kPacked:
+      return sizeof(PackedVertex);
+    case VertexFormat::kPackedQuantized:
+      return sizeof(QuantizedVertex);
+    default:
+      return 0;
+  }
+}
+
+void PackVertices(VertexFormat format, Mesh* mesh) {
+  mesh->packed_format = format;
+  mesh->packed_vertices.assign(GetPackedVertexSize(format) * mesh->num_verts, 0);
+  mesh->position_offset = glm::vec3(0.f);
+  mesh->position_scale = glm::vec3(1.f);
+
+  if (format == VertexFormat::kPacked) {
+    for (size_t i = 0; i < mesh->num_verts; ++i) {
+      PackedVertex vert;
+      const glm::vec3& pos = mesh->positions[i];
+      vert.position[0] = pos.x;
+      vert.position[1] = pos.y;
+      vert.position[2] = pos.z;
+      FillCommonAttribs(*mesh, i, &vert);
+      std::memcpy(&mesh->packed_vertices[i * sizeof(vert)], &vert, sizeof(vert));
+    }
+  } else if (format == VertexFormat::kPackedQuantized) {
+    glm::vec3 min_pos(std::numeric_limits<float>::max());
+    glm::vec3 max_pos(std::numeric_limits<float>::lowest());
+    for (const glm::vec3& pos : mesh->positions) {
+      min_pos = glm::min(min_pos, pos);
+      max_pos = glm::max(max_pos, pos);
+    }
+    if (mesh->positions.empty()) {
+      min_pos = max_pos = glm::vec3(0.f);
+    }
+
+    // Flat axes still get a non-zero scale so that decoding doesn't need a special case.
+    glm::vec3 extent = max_pos - min_pos;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (extent[axis] <= 0.f) {
+        extent[axis] = 1.f;
+      }
+    }
+    mesh->position_offset = min_pos;
+    mesh->position_scale = extent;
+
+    for (size_t i = 0; i < mesh->num_verts; ++i) {
+      QuantizedVertex vert;
+      glm::vec3 normalized = (mesh->positions[i] - min_pos) / extent;
+      vert.position[0] = FloatToUnorm16(normalized.x);
+      vert.position[1] = FloatToUnorm16(normalized.y);
+      vert.position[2] = FloatToUnorm16(normalized.z);
+      vert.position[3] = 0;
+      FillCommonAttribs(*mesh, i, &vert);
+      std::memcpy(&mesh->packed_vertices[i * sizeof(vert)], &vert, sizeof(vert));
+    }
+  }
+}
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs_bits = bits & 0x7fffffff;
+
+  // NaN stays a (quiet) NaN, anything too large for a half becomes infinity.
+  if (abs_bits > 0x7f800000) {
+    return static_cast<uint16_t>(sign | 0x7e00);
+  }
+  if (abs_bits >= 0x477ff000) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+
+  // Denormal halves. Shifts the implicit leading one into the mantissa and rounds to nearest even.
+  if (abs_bits < 0x38800000) {
+    if (abs_bits < 0x33000000) {
+      return static_cast<uint16_t>(sign);
+    }
+    uint32_t exponent = abs_bits >> 23;
+    uint32_t mantissa = (abs_bits & 0x007fffff) | 0x00800000;
+    uint32_t shift = 126 - exponent;
+    uint32_t half_mantissa = mantissa >> shift;
+    uint32_t remainder = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half_mantissa & 1))) {
+      ++half_mantissa;
+    }
+    return static_cast<uint16_t>(sign | half_mantissa);
+  }
+
+  // Normal halves. Rebiases the exponent, then rounds to nearest even; a carry out of the mantissa
+  // correctly bumps the exponent.
+  uint32_t half = (abs_bits - 0x38000000) >> 13;
+  uint32_t remainder = abs_bits & 0x1fff;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return static_cast<uint16_t>(sign | half);
+}
+
+float HalfToFloat(uint16_t value) {
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+
+  uint32_t bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa != 0) {
+    // Normalizes the denormal half.
+    exponent = 113;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  } else {
+    bits = sign;
+  }
+
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+glm::vec2 EncodeOctahedral(const glm::vec3& normal) {
+  float l1_norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (l1_norm == 0.f) {
+    return glm::vec2(0.f);
+  }
+
+  glm::vec2 encoded = glm::vec2(normal.x, normal.y) / l1_norm;
+  if (normal.z < 0.f) {
+    // Folds the lower hemisphere over the diagonals.
+    glm::vec2 folded = 1.f - glm::abs(glm::vec2(encoded.y, encoded.x));
+    encoded.x = encoded.x >= 0.f ? folded.x : -folded.x;
+    encoded.y = encoded.y >= 0.f ? folded.y : -folded.y;
+  }
+  return encoded;
+}
+
+glm::vec3 DecodeOctahedral(const glm::vec2& encoded) {
+  glm::vec3 normal(encoded.x, encoded.y, 1.f - std::abs(encoded.x) - std::abs(encoded.y));
+  float t = std::max(-normal.z, 0.f);
+  normal.x += normal.x >= 0.f ? -t : t;
+  normal.y += normal.y >= 0.f ? -t : t;
+  return glm::normalize(normal);
+}
+
+} // namespace utils
@@ -0,0 +1,47 @@
+#ifndef UTILS_VERTEX_PACKING_H_
+#define UTILS_VERTEX_PACKING_H_
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+#include "utils/model.h"
+
+namespace utils {
+
+// Vertex layout of VertexFormat::kPacked (24 bytes).
+struct PackedVertex {
+  float position[3];
+  int16_t normal[2];    // octahedral, snorm16
+  uint16_t texcoord[2]; // half float
+  int16_t material_id;
+  uint16_t padding;
+};
+
+// Vertex layout of VertexFormat::kPackedQuantized (20 bytes).
+struct QuantizedVertex {
+  uint16_t position[4]; // unorm16 relative to the mesh bounds, w is unused
+  int16_t normal[2];    // octahedral, snorm16
+  uint16_t texcoord[2]; // half float
+  int16_t material_id;
+  uint16_t padding;
+};
+
+static_assert(sizeof(PackedVertex) == 24, "PackedVertex must be tightly packed.");
+static_assert(sizeof(QuantizedVertex) == 20, "QuantizedVertex must be tightly packed.");
+
+size_t GetPackedVertexSize(VertexFormat format);
+
+// Fills in the packed vertex stream of |mesh| from its full-float vertex arrays.
+void PackVertices(VertexFormat format, Mesh* mesh);
+
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+// Maps a unit vector onto the [-1, 1]^2 square.
+glm::vec2 EncodeOctahedral(const glm::vec3& normal);
+glm::vec3 DecodeOctahedral(const glm::vec2& encoded);
+
+} // namespace utils
+
+#endif // UTILS_VERTEX_PACKING_H_
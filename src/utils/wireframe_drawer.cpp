@@ -6,7 +6,6 @@
 #include <string>
 
 #include "utils/program.h"
-#include "utils/shader.h"
 
 namespace utils {
 
@@ -30,31 +29,13 @@ const char kFragShaderSource[] =
 }  // namespace
 
 WireframeDrawer::WireframeDrawer() {
-  gl_program_ = glCreateProgram();
-
-  GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
-  // TODO: Use string view.
-  if (!utils::CompileShader(vert_shader, std::string(kVertShaderSource))) {
+  program_ = Program::Create({ { GL_VERTEX_SHADER, kVertShaderSource },
+                               { GL_FRAGMENT_SHADER, kFragShaderSource } });
+  if (program_ == nullptr) {
     // TODO: Do something better.
     throw;
   }
-
-  GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    // TODO: Use string view.
-  if (!utils::CompileShader(frag_shader, std::string(kFragShaderSource))) {
-    throw;
-  }
-
-  glAttachShader(gl_program_, vert_shader);
-  glAttachShader(gl_program_, frag_shader);
-
-  glLinkProgram(gl_program_);
-  if (!utils::CheckProgramLinkStatus(gl_program_)) {
-    throw;
-  }
-
-  glDeleteShader(frag_shader);
-  glDeleteShader(vert_shader);
+  vp_mat_id_ = program_->FindUniform("vp_mat");
 
   glGenVertexArrays(1, &gl_vao_);
 }
@@ -66,14 +47,11 @@ WireframeDrawer::~WireframeDrawer() {
   meshes_.clear();
 
   glDeleteVertexArrays(1, &gl_vao_);
-  glDeleteProgram(gl_program_);
 }
 
 void WireframeDrawer::Draw(glm::mat4 vp_mat) {
-  glUseProgram(gl_program_);
-
-  GLint vp_mat_loc = glGetUniformLocation(gl_program_, "vp_mat");
-  glUniformMatrix4fv(vp_mat_loc, 1, GL_FALSE, glm::value_ptr(vp_mat));
+  program_->Use();
+  program_->SetUniform(vp_mat_id_, vp_mat);
 
   glBindVertexArray(gl_vao_);
 
@@ -6,8 +6,11 @@
 #include <GL/gl.h>
 #include <glm/glm.hpp>
 
+#include <memory>
 #include <vector>
 
+#include "utils/program.h"
+
 namespace utils {
 
 namespace {
@@ -29,7 +32,8 @@ private:
     int num_triangles;
   };
 
-  GLuint gl_program_;
+  std::unique_ptr<Program> program_;
+  int vp_mat_id_;
   GLuint gl_vao_;
   std::vector<WireframeMesh> meshes_;
 };